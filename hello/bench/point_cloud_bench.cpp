@@ -0,0 +1,311 @@
+/**
+ * Copyright (C) 2021 Parrot Drones SAS
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ULOG_TAG ms_point_cloud_bench
+#include <ulog.h>
+ULOG_DECLARE_TAG(ULOG_TAG);
+
+#include "cloud_shm.h"
+#include "drone_state.h"
+#include "point_cloud.h"
+
+#define DEFAULT_FRAME_COUNT 300
+#define SYNTHETIC_FRAME_COUNT 16
+#define FRAME_PERIOD_US 33333.
+#define SHM_NAME "/hello-point-cloud-bench"
+#define SHM_SLOT_COUNT 4
+#define WALL_DEPTH 5.f
+
+struct resolution {
+	unsigned int width;
+	unsigned int height;
+};
+
+static const struct resolution s_resolutions[] = {
+	{176, 90},
+	{320, 180},
+	{640, 360},
+};
+
+static const unsigned int s_steps[] = {1, 2, 4};
+
+static uint64_t time_now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Tilted plane from 1 m to 6 m with some noise and a few invalid pixels,
+ * the kind of depth seen when looking at the ground ahead */
+static void fill_frame(float *depth,
+		       unsigned int width,
+		       unsigned int height,
+		       unsigned int seed)
+{
+	srand(seed);
+	for (unsigned int i = 0; i < height; i++) {
+		for (unsigned int j = 0; j < width; j++) {
+			float noise = (rand() % 1000) / 10000.f;
+			depth[i * width + j] =
+				1.f + (4.f + seed % 3) * (height - i) / height
+				+ noise;
+			if (rand() % 50 == 0)
+				depth[i * width + j] = NAN;
+		}
+	}
+}
+
+/* Fronto-parallel wall: with a level drone at the origin, every point of
+ * the cloud is at x = WALL_DEPTH. Returns the largest distance to the wall
+ * plane, or a negative errno */
+static float check_wall(const struct point_cloud_config *cfg,
+			unsigned int width,
+			unsigned int height)
+{
+	int res = 0;
+	struct point_cloud *cloud = NULL;
+	struct drone_state state;
+	const struct point3f *points;
+	unsigned int count;
+	float *depth;
+	float error_max = 0.f;
+
+	depth = (float *)malloc(width * height * sizeof(float));
+	if (depth == NULL)
+		return -ENOMEM;
+	for (unsigned int i = 0; i < width * height; i++)
+		depth[i] = WALL_DEPTH;
+	memset(&state, 0, sizeof(state));
+
+	res = point_cloud_new(cfg, &cloud);
+	if (res < 0)
+		goto out;
+	res = point_cloud_compute(
+		cloud, depth, width * sizeof(float), width, height, &state);
+	if (res < 0)
+		goto out;
+	points = point_cloud_get(cloud, &count, NULL);
+	if (count == 0) {
+		res = -ENODATA;
+		goto out;
+	}
+	for (unsigned int i = 0; i < count; i++) {
+		float error = fabsf(points[i].x - WALL_DEPTH);
+		if (error > error_max)
+			error_max = error;
+	}
+
+out:
+	point_cloud_destroy(cloud);
+	free(depth);
+	return res < 0 ? res : error_max;
+}
+
+static int run(const struct point_cloud_config *base_cfg,
+	       unsigned int width,
+	       unsigned int height,
+	       unsigned int step,
+	       unsigned int frame_count)
+{
+	int res = 0;
+	struct point_cloud_config cfg = *base_cfg;
+	struct point_cloud *cloud = NULL;
+	struct cloud_shm *writer = NULL;
+	struct cloud_shm *reader = NULL;
+	struct point3f *read_points = NULL;
+	struct drone_state state;
+	const struct point3f *points;
+	unsigned int count, dropped;
+	unsigned int read_count;
+	uint64_t read_ts;
+	uint64_t points_sum = 0;
+	uint64_t start, compute_us = 0, publish_us = 0, read_us = 0;
+	size_t frame_size = width * height;
+	float *depth;
+	float wall_error;
+	double frame_us;
+
+	cfg.step = step;
+	depth = (float *)malloc(SYNTHETIC_FRAME_COUNT * frame_size
+				* sizeof(float));
+	read_points =
+		(struct point3f *)calloc(cfg.max_points, sizeof(*read_points));
+	if (depth == NULL || read_points == NULL) {
+		res = -ENOMEM;
+		goto out;
+	}
+	for (unsigned int i = 0; i < SYNTHETIC_FRAME_COUNT; i++)
+		fill_frame(depth + i * frame_size, width, height, i);
+
+	res = point_cloud_new(&cfg, &cloud);
+	if (res < 0) {
+		ULOG_ERRNO("point_cloud_new", -res);
+		goto out;
+	}
+	res = cloud_shm_writer_new(
+		SHM_NAME, SHM_SLOT_COUNT, cfg.max_points, &writer);
+	if (res < 0) {
+		ULOG_ERRNO("cloud_shm_writer_new", -res);
+		goto out;
+	}
+	res = cloud_shm_reader_new(SHM_NAME, &reader);
+	if (res < 0) {
+		ULOG_ERRNO("cloud_shm_reader_new", -res);
+		goto out;
+	}
+
+	/* Drone slowly moving forward and turning */
+	memset(&state, 0, sizeof(state));
+	state.position_global.z = -2.f;
+	for (unsigned int i = 0; i < frame_count; i++) {
+		const float *frame =
+			depth + (i % SYNTHETIC_FRAME_COUNT) * frame_size;
+		state.position_global.x = 0.1f * i;
+		state.attitude.yaw = 0.01f * i;
+
+		start = time_now_us();
+		res = point_cloud_compute(cloud,
+					  frame,
+					  width * sizeof(float),
+					  width,
+					  height,
+					  &state);
+		if (res < 0) {
+			ULOG_ERRNO("point_cloud_compute", -res);
+			goto out;
+		}
+		points = point_cloud_get(cloud, &count, &dropped);
+		compute_us += time_now_us() - start;
+		points_sum += count;
+
+		start = time_now_us();
+		res = cloud_shm_publish(writer, i, points, count);
+		publish_us += time_now_us() - start;
+		if (res < 0) {
+			ULOG_ERRNO("cloud_shm_publish", -res);
+			goto out;
+		}
+
+		start = time_now_us();
+		res = cloud_shm_read_latest(
+			reader, read_points, &read_count, &read_ts);
+		read_us += time_now_us() - start;
+		if (res < 0) {
+			ULOG_ERRNO("cloud_shm_read_latest", -res);
+			goto out;
+		}
+		if (read_ts != i || read_count != count
+		    || memcmp(read_points, points, count * sizeof(*points))
+			       != 0) {
+			ULOGE("cloud %u read back from shared memory differs",
+			      i);
+			res = -EIO;
+			goto out;
+		}
+	}
+
+	wall_error = check_wall(&cfg, width, height);
+	if (wall_error < 0.f) {
+		res = (int)wall_error;
+		ULOG_ERRNO("check_wall", -res);
+		goto out;
+	}
+
+	frame_us = (double)compute_us / frame_count;
+	printf("%ux%u step %u: %.1f us/frame (%.1f%% of a 30 fps frame), "
+	       "%.1f Mpixels/s, %.0f voxels/frame, dropped %u, "
+	       "shm publish %.1f us, read %.1f us, wall error %.3f m\n",
+	       width,
+	       height,
+	       step,
+	       frame_us,
+	       100. * frame_us / FRAME_PERIOD_US,
+	       frame_size / (step * step) / frame_us,
+	       (double)points_sum / frame_count,
+	       dropped,
+	       (double)publish_us / frame_count,
+	       (double)read_us / frame_count,
+	       wall_error);
+	res = 0;
+
+out:
+	cloud_shm_destroy(reader);
+	cloud_shm_destroy(writer);
+	point_cloud_destroy(cloud);
+	free(read_points);
+	free(depth);
+	return res;
+}
+
+static void usage(const char *progname)
+{
+	fprintf(stderr,
+		"usage: %s [-n frames] [-v voxel_size] [-m max_points]\n",
+		progname);
+}
+
+int main(int argc, char *argv[])
+{
+	int res = 0;
+	int opt;
+	unsigned int frame_count = DEFAULT_FRAME_COUNT;
+	struct point_cloud_config cfg;
+
+	/* Same defaults as assets/etc/services/cv_service.cfg */
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.fx = 0.5f;
+	cfg.fy = 0.978f;
+	cfg.cx = 0.5f;
+	cfg.cy = 0.5f;
+	cfg.voxel_size = 0.2f;
+	cfg.max_depth = 15.f;
+	cfg.max_points = 4096;
+
+	while ((opt = getopt(argc, argv, "n:v:m:")) != -1) {
+		switch (opt) {
+		case 'n':
+			frame_count = atoi(optarg);
+			break;
+		case 'v':
+			cfg.voxel_size = atof(optarg);
+			break;
+		case 'm':
+			cfg.max_points = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (frame_count == 0 || cfg.voxel_size <= 0.f || cfg.max_points == 0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	for (size_t i = 0; i < sizeof(s_resolutions) / sizeof(s_resolutions[0]);
+	     i++) {
+		for (size_t j = 0; j < sizeof(s_steps) / sizeof(s_steps[0]);
+		     j++) {
+			res = run(&cfg,
+				  s_resolutions[i].width,
+				  s_resolutions[i].height,
+				  s_steps[j],
+				  frame_count);
+			if (res < 0)
+				return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
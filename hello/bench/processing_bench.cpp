@@ -0,0 +1,926 @@
+/**
+ * Copyright (C) 2021 Parrot Drones SAS
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ULOG_TAG ms_processing_bench
+#include <ulog.h>
+ULOG_DECLARE_TAG(ULOG_TAG);
+
+#include <libpomp.h>
+#include <video-ipc/vipc_client.h>
+
+#include "depth_stats.h"
+#include "processing.h"
+
+#define DEFAULT_WIDTH 176
+#define DEFAULT_HEIGHT 90
+#define DEFAULT_FRAME_COUNT 500
+#define SYNTHETIC_FRAME_COUNT 16
+#define FRAME_PERIOD_NS 33333333ULL
+#define OUTPUT_TIMEOUT_MS 1000
+
+/* Largest accepted mean error of a sampled depth_mean, a bin of the
+ * histogram: the dominant bin of the flat histograms of the synthetic
+ * gradient and noise frames is arbitrary, only the mean over the frames
+ * tells whether sampling still finds the same depth range */
+#define DEFAULT_MAX_MEAN_ERROR (HIST_RANGE / HIST_SIZE) // [m]
+
+/* Largest accepted difference between the depth mean of the processing
+ * object and the scalar reference, relative to the depth. Float and double
+ * accumulations differ by a few ulps */
+#define REFERENCE_TOLERANCE 1e-5f
+
+/* Quantiles given by the processing object */
+#define QUANTILE_COUNT 3
+static const float s_quantiles[QUANTILE_COUNT] = {0.5f, 0.1f, 0.9f};
+static const char *const s_quantile_names[QUANTILE_COUNT] = {
+	"depth_median",
+	"depth_p10",
+	"depth_p90",
+};
+
+/* Results of the scalar reference for a frame */
+struct reference {
+	float depth_mean;
+	/* Exact quantiles of the sampled pixels */
+	float quantiles[QUANTILE_COUNT];
+};
+
+struct bench {
+	struct pomp_loop *loop;
+	struct pomp_evt *evt;
+	struct processing *processing;
+
+	/* Processing configuration, thread and pipeline counts excepted */
+	struct processing_config cfg;
+
+	/* Frames given to the processing object, synthetic or recorded. Each
+	 * frame in flight has its own copy of the `frame` descriptor */
+	struct vipc_frame frame;
+	struct vipc_frame in_flight[PROCESSING_MAX_PIPELINE_COUNT];
+	uint64_t step_us[PROCESSING_MAX_PIPELINE_COUNT];
+	float *depth;
+	unsigned int depth_count;
+
+	/* Results of the scalar reference for each distinct frame */
+	bool synthetic;
+	struct reference *reference;
+
+	/* Largest accepted mean error of check_accuracy [m] */
+	float max_mean_error;
+
+	/* Latency of each frame of a run [us] */
+	uint32_t *latency_us;
+
+	/* Outputs received since the processing object was created, the
+	 * ones out of frame order and the ones differing from the reference.
+	 * Latency and reference are only checked during a run */
+	struct processing_output output;
+	unsigned int output_count;
+	unsigned int unordered_count;
+	unsigned int mismatch_count;
+	bool in_run;
+	unsigned int released_frames;
+};
+
+static uint64_t time_now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Frames are heap buffers owned by the bench, nothing to give back to
+ * video-ipc */
+static void release_frame_cb(const struct vipc_frame *frame, void *userdata)
+{
+	struct bench *bench = (struct bench *)userdata;
+	bench->released_frames++;
+}
+
+/* Kinds of synthetic frames, cycled over the distinct frames */
+enum frame_pattern {
+	/* Wall facing the camera, with some noise */
+	PATTERN_WALL,
+	/* Tilted plane from 1 m to 6 m, the ground ahead */
+	PATTERN_GROUND,
+	/* Depth increasing from left to right across the whole range */
+	PATTERN_GRADIENT,
+	/* Uniform noise over the range of the histogram */
+	PATTERN_NOISE,
+	/* Wall with NaN, infinite, negative and too far pixels */
+	PATTERN_INVALID,
+	/* Pixels on and around the bin edges */
+	PATTERN_EDGES,
+	PATTERN_COUNT,
+};
+
+static const char *const s_pattern_names[PATTERN_COUNT] = {
+	"wall",
+	"ground",
+	"gradient",
+	"noise",
+	"invalid",
+	"edges",
+};
+
+/* Same arithmetic as the bin bounds of the histogram */
+static inline float bin_edge(int i)
+{
+	return HIST_RANGE_LOW + i * (HIST_RANGE / HIST_SIZE);
+}
+
+static inline float random_ratio(void)
+{
+	return (float)rand() / RAND_MAX;
+}
+
+static float invalid_depth(void)
+{
+	switch (rand() % 5) {
+	case 0:
+		return NAN;
+	case 1:
+		return INFINITY;
+	case 2:
+		return -INFINITY;
+	case 3:
+		return -1.f - random_ratio();
+	default:
+		return HIST_RANGE_HIGH + 1.f + random_ratio();
+	}
+}
+
+static void fill_frame(float *depth,
+		       unsigned int width,
+		       unsigned int height,
+		       unsigned int seed)
+{
+	enum frame_pattern pattern = (enum frame_pattern)(seed % PATTERN_COUNT);
+	float wall = 1.25f + seed * 7 % 12;
+
+	srand(seed);
+	for (unsigned int i = 0; i < height; i++) {
+		for (unsigned int j = 0; j < width; j++) {
+			float noise = (rand() % 1000) / 10000.f;
+			float *pixel = &depth[i * width + j];
+
+			switch (pattern) {
+			case PATTERN_WALL:
+				*pixel = wall + noise;
+				break;
+			case PATTERN_GROUND:
+				*pixel = 1.f
+					 + (4.f + seed % 3) * (height - i)
+						   / height
+					 + noise;
+				break;
+			case PATTERN_GRADIENT:
+				*pixel = HIST_RANGE_LOW
+					 + HIST_RANGE * (j + 0.5f) / width;
+				break;
+			case PATTERN_NOISE:
+				*pixel = HIST_RANGE_LOW
+					 + HIST_RANGE * random_ratio();
+				break;
+			case PATTERN_INVALID:
+				*pixel = rand() % 5 == 0 ? invalid_depth()
+							 : wall + noise;
+				break;
+			case PATTERN_EDGES:
+			default:
+				*pixel = bin_edge(rand() % (HIST_SIZE + 1));
+				if (rand() % 3 == 0)
+					*pixel = nextafterf(*pixel, 0.f);
+				break;
+			}
+		}
+	}
+}
+
+/* Recorded frames: raw RAW32 frames of the given dimensions one after the
+ * other, as dumped from the depth stream */
+static int load_frames(struct bench *bench, const char *path)
+{
+	int res = 0;
+	size_t frame_size = bench->frame.width * bench->frame.height;
+	long size;
+	FILE *file = fopen(path, "rb");
+
+	if (file == NULL) {
+		res = -errno;
+		ULOG_ERRNO("fopen('%s')", -res, path);
+		return res;
+	}
+
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	bench->depth_count = size / (frame_size * sizeof(float));
+	if (bench->depth_count == 0) {
+		ULOGE("'%s' holds no complete frame", path);
+		res = -EINVAL;
+		goto out;
+	}
+
+	bench->depth = (float *)malloc(
+		bench->depth_count * frame_size * sizeof(float));
+	if (bench->depth == NULL) {
+		res = -ENOMEM;
+		goto out;
+	}
+	if (fread(bench->depth, frame_size * sizeof(float),
+		  bench->depth_count, file) != bench->depth_count) {
+		res = -EIO;
+		ULOG_ERRNO("fread('%s')", -res, path);
+	}
+
+out:
+	fclose(file);
+	return res;
+}
+
+static int create_frames(struct bench *bench)
+{
+	size_t frame_size = bench->frame.width * bench->frame.height;
+
+	bench->synthetic = true;
+	bench->depth_count = SYNTHETIC_FRAME_COUNT;
+	bench->depth = (float *)malloc(
+		bench->depth_count * frame_size * sizeof(float));
+	if (bench->depth == NULL)
+		return -ENOMEM;
+
+	for (unsigned int i = 0; i < bench->depth_count; i++) {
+		fill_frame(bench->depth + i * frame_size,
+			   bench->frame.width,
+			   bench->frame.height,
+			   i);
+	}
+
+	return 0;
+}
+
+/* Region of interest in pixels, as computed by the processing object */
+static void get_roi(const struct bench *bench,
+		    unsigned int *x,
+		    unsigned int *y,
+		    unsigned int *width,
+		    unsigned int *height)
+{
+	const struct processing_config *cfg = &bench->cfg;
+	unsigned int frame_width = bench->frame.width;
+	unsigned int frame_height = bench->frame.height;
+
+	if (cfg->roi.width <= 0.f || cfg->roi.height <= 0.f) {
+		*x = 0;
+		*y = 0;
+		*width = frame_width;
+		*height = frame_height;
+		return;
+	}
+
+	*x = cfg->roi.x * frame_width;
+	*y = cfg->roi.y * frame_height;
+	*width = cfg->roi.width * frame_width;
+	*height = cfg->roi.height * frame_height;
+	if (*x + *width > frame_width)
+		*width = frame_width - *x;
+	if (*y + *height > frame_height)
+		*height = frame_height - *y;
+}
+
+/* Straightforward scalar version of the depth mean: histogram of the sampled
+ * pixels of the region of interest, mean of the first most populated bin
+ * with the pixels on its upper edge, optionally refined with every pixel of
+ * the region of interest lying in the bin */
+static float reference_depth_mean(const struct bench *bench,
+				  const float *depth)
+{
+	unsigned int step = bench->cfg.sample_stride;
+	unsigned int x, y, width, height;
+	uint32_t count[HIST_SIZE] = {};
+	uint32_t edge_count[HIST_SIZE] = {};
+	double sum[HIST_SIZE] = {};
+	double refined_sum = 0.;
+	uint32_t n, refined_count = 0;
+	int bin = 0;
+
+	if (step == 0)
+		step = 1;
+	get_roi(bench, &x, &y, &width, &height);
+
+	for (unsigned int i = y; i < y + height; i += step) {
+		for (unsigned int j = x; j < x + width; j += step) {
+			float d = depth[i * bench->frame.width + j];
+
+			for (int k = 0; k < HIST_SIZE; k++) {
+				if (d >= bin_edge(k) && d < bin_edge(k + 1)) {
+					count[k]++;
+					sum[k] += d;
+				}
+				if (d == bin_edge(k + 1))
+					edge_count[k]++;
+			}
+		}
+	}
+
+	for (int k = 1; k < HIST_SIZE; k++) {
+		if (count[k] > count[bin])
+			bin = k;
+	}
+	n = count[bin] + edge_count[bin];
+	if (n == 0)
+		return 0.f;
+
+	if (!bench->cfg.refine_dominant_bin || step == 1 || count[bin] == 0)
+		return (sum[bin] + edge_count[bin] * bin_edge(bin + 1)) / n;
+
+	for (unsigned int i = y; i < y + height; i++) {
+		for (unsigned int j = x; j < x + width; j++) {
+			float d = depth[i * bench->frame.width + j];
+			if (d >= bin_edge(bin) && d <= bin_edge(bin + 1)) {
+				refined_count++;
+				refined_sum += d;
+			}
+		}
+	}
+
+	return refined_sum / refined_count;
+}
+
+static int compare_float(const void *a, const void *b)
+{
+	float x = *(const float *)a;
+	float y = *(const float *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* Exact quantiles of the valid sampled pixels of the region of interest,
+ * the value of rank ceil(q * n) for a quantile q of n pixels */
+static void reference_quantiles(const struct bench *bench,
+				const float *depth,
+				float *pixels,
+				float *values)
+{
+	unsigned int step = bench->cfg.sample_stride;
+	unsigned int x, y, width, height;
+	unsigned int n = 0;
+
+	if (step == 0)
+		step = 1;
+	get_roi(bench, &x, &y, &width, &height);
+
+	for (unsigned int i = y; i < y + height; i += step) {
+		for (unsigned int j = x; j < x + width; j += step) {
+			float d = depth[i * bench->frame.width + j];
+			if (d >= HIST_RANGE_LOW && d < HIST_RANGE_HIGH)
+				pixels[n++] = d;
+		}
+	}
+	qsort(pixels, n, sizeof(*pixels), &compare_float);
+
+	for (int k = 0; k < QUANTILE_COUNT; k++) {
+		unsigned int rank = ceilf(s_quantiles[k] * n);
+		values[k] = n == 0 ? 0.f : pixels[rank > 0 ? rank - 1 : 0];
+	}
+}
+
+static int compute_references(struct bench *bench)
+{
+	size_t frame_size = bench->frame.width * bench->frame.height;
+	float *pixels;
+
+	bench->reference = (struct reference *)calloc(
+		bench->depth_count, sizeof(*bench->reference));
+	pixels = (float *)malloc(frame_size * sizeof(float));
+	if (bench->reference == NULL || pixels == NULL) {
+		free(pixels);
+		return -ENOMEM;
+	}
+
+	for (unsigned int i = 0; i < bench->depth_count; i++) {
+		const float *depth = bench->depth + i * frame_size;
+		struct reference *reference = &bench->reference[i];
+
+		reference_quantiles(bench, depth, pixels, reference->quantiles);
+		if (bench->cfg.estimator == PROCESSING_ESTIMATOR_MEDIAN) {
+			reference->depth_mean = reference->quantiles[0];
+		} else {
+			reference->depth_mean =
+				reference_depth_mean(bench, depth);
+		}
+	}
+
+	free(pixels);
+	return 0;
+}
+
+/* The quantiles of the sketch lie in the sketch bin of the exact value,
+ * 1/32 of an octave wide or DEPTH_SKETCH_LOW for the first bin */
+static inline bool quantile_matches(float value, float reference)
+{
+	float width = fmaxf(DEPTH_SKETCH_LOW,
+			    reference / DEPTH_SKETCH_BINS_PER_OCTAVE);
+	return fabsf(value - reference) <= width * (1.f + REFERENCE_TOLERANCE);
+}
+
+static bool check_value(const struct bench *bench,
+			unsigned int i,
+			const char *name,
+			float value,
+			float reference,
+			bool matches)
+{
+	if (matches)
+		return true;
+
+	fprintf(stderr,
+		"frame %u (%s): %s %.6f, reference %.6f\n",
+		i,
+		bench->synthetic ? s_pattern_names[i % PATTERN_COUNT]
+				 : "recorded",
+		name,
+		value,
+		reference);
+	return false;
+}
+
+/* Check the depth mean and quantiles of a frame against the scalar
+ * reference */
+static bool check_reference(const struct bench *bench, unsigned int index)
+{
+	unsigned int i = index % bench->depth_count;
+	const struct reference *reference = &bench->reference[i];
+	const struct processing_output *output = &bench->output;
+	const float quantiles[QUANTILE_COUNT] = {
+		output->depth_median,
+		output->depth_p10,
+		output->depth_p90,
+	};
+	bool matches;
+	bool res = true;
+
+	if (bench->cfg.estimator == PROCESSING_ESTIMATOR_MEDIAN) {
+		matches = quantile_matches(output->depth_mean,
+					   reference->depth_mean);
+	} else {
+		matches = fabsf(output->depth_mean - reference->depth_mean)
+			  <= REFERENCE_TOLERANCE
+				     * fmaxf(1.f, reference->depth_mean);
+	}
+	res &= check_value(bench,
+			   i,
+			   "depth_mean",
+			   output->depth_mean,
+			   reference->depth_mean,
+			   matches);
+
+	/* Quantiles are only computed by the median estimator */
+	if (bench->cfg.estimator != PROCESSING_ESTIMATOR_MEDIAN)
+		return res;
+
+	for (int k = 0; k < QUANTILE_COUNT; k++) {
+		matches = quantile_matches(quantiles[k],
+					   reference->quantiles[k]);
+		res &= check_value(bench,
+				   i,
+				   s_quantile_names[k],
+				   quantiles[k],
+				   reference->quantiles[k],
+				   matches);
+	}
+
+	return res;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* Nearest rank percentile of sorted values */
+static uint32_t percentile(const uint32_t *values,
+			   unsigned int count,
+			   unsigned int p)
+{
+	return values[(count - 1) * p / 100];
+}
+
+/* Frames are given in order from index 0 and never dropped by the bench, the
+ * n-th output must be the one of frame n. The index of a frame is given by
+ * its timestamp */
+static void handle_output(struct bench *bench)
+{
+	const struct timespec *ts = &bench->output.ts;
+	uint64_t ts_ns = (uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+	unsigned int index = ts_ns / FRAME_PERIOD_NS - 1;
+	unsigned int n = bench->output_count++;
+	unsigned int slot = n % PROCESSING_MAX_PIPELINE_COUNT;
+
+	if (index != n) {
+		ULOGE("output %u is the one of frame %u", n, index);
+		bench->unordered_count++;
+		return;
+	}
+	if (!bench->in_run)
+		return;
+	bench->latency_us[n] = time_now_us() - bench->step_us[slot];
+	if (!check_reference(bench, index))
+		bench->mismatch_count++;
+}
+
+static void processing_evt_cb(struct pomp_evt *evt, void *userdata)
+{
+	struct bench *bench = (struct bench *)userdata;
+
+	while (processing_get_output(bench->processing, &bench->output) == 0)
+		handle_output(bench);
+}
+
+/* Give a frame to the processing object without waiting for its output.
+ * At most PROCESSING_MAX_PIPELINE_COUNT frames can be in flight */
+static int step_frame(struct bench *bench, unsigned int index)
+{
+	int res = 0;
+	struct vipc_frame *frame =
+		&bench->in_flight[index % PROCESSING_MAX_PIPELINE_COUNT];
+	size_t frame_size = bench->frame.width * bench->frame.height;
+	float *depth = bench->depth + (index % bench->depth_count) * frame_size;
+	struct processing_input input;
+
+	*frame = bench->frame;
+	frame->index = index;
+	frame->ts_sof_ns = (index + 1) * FRAME_PERIOD_NS;
+	frame->planes[0].virt_addr = (uintptr_t)depth;
+
+	memset(&input, 0, sizeof(input));
+	input.frame = frame;
+	bench->step_us[index % PROCESSING_MAX_PIPELINE_COUNT] = time_now_us();
+	res = processing_step(bench->processing, &input);
+	if (res < 0)
+		ULOG_ERRNO("processing_step", -res);
+	return res;
+}
+
+/* Wait for the outputs of the frames given so far, up to `count` outputs */
+static int wait_outputs(struct bench *bench, unsigned int count)
+{
+	int res = 0;
+
+	while (bench->output_count < count) {
+		res = pomp_loop_wait_and_process(bench->loop,
+						 OUTPUT_TIMEOUT_MS);
+		if (res == -ETIMEDOUT) {
+			ULOGE("no output for frame %u", bench->output_count);
+			return res;
+		}
+	}
+
+	return 0;
+}
+
+/* Process a frame and wait for its output */
+static int process_frame(struct bench *bench, unsigned int index)
+{
+	int res = 0;
+
+	res = step_frame(bench, index);
+	if (res < 0)
+		return res;
+	return wait_outputs(bench, bench->output_count + 1);
+}
+
+static int create_processing(struct bench *bench,
+			     const struct processing_config *cfg)
+{
+	int res = 0;
+
+	res = processing_new(cfg, bench->evt, &bench->processing);
+	if (res < 0) {
+		ULOG_ERRNO("processing_new", -res);
+		return res;
+	}
+	res = processing_start(bench->processing);
+	if (res < 0) {
+		ULOG_ERRNO("processing_start", -res);
+		processing_destroy(bench->processing);
+		bench->processing = NULL;
+	}
+	bench->output_count = 0;
+	bench->unordered_count = 0;
+	bench->mismatch_count = 0;
+
+	return res;
+}
+
+/* Error of depth_mean against full resolution processing of the same region
+ * of interest */
+static int check_accuracy(struct bench *bench)
+{
+	int res = 0;
+	struct processing_config full_cfg = bench->cfg;
+	float *reference;
+	double error, error_sum = 0.;
+	double error_max = 0.;
+
+	reference = (float *)calloc(bench->depth_count, sizeof(float));
+	if (reference == NULL)
+		return -ENOMEM;
+
+	full_cfg.sample_stride = 1;
+	full_cfg.refine_dominant_bin = false;
+	res = create_processing(bench, &full_cfg);
+	if (res < 0)
+		goto out;
+	for (unsigned int i = 0; i < bench->depth_count && res == 0; i++) {
+		res = process_frame(bench, i);
+		reference[i] = bench->output.depth_mean;
+	}
+	processing_destroy(bench->processing);
+	bench->processing = NULL;
+	if (res < 0)
+		goto out;
+
+	res = create_processing(bench, &bench->cfg);
+	if (res < 0)
+		goto out;
+	for (unsigned int i = 0; i < bench->depth_count && res == 0; i++) {
+		res = process_frame(bench, i);
+		error = fabs(bench->output.depth_mean - reference[i]);
+		error_sum += error;
+		if (error > error_max)
+			error_max = error;
+	}
+	processing_destroy(bench->processing);
+	bench->processing = NULL;
+	if (res < 0)
+		goto out;
+
+	printf("stride %u%s: depth_mean error against full resolution over "
+	       "%u frames: mean %.4f m, max %.4f m\n",
+	       bench->cfg.sample_stride,
+	       bench->cfg.refine_dominant_bin ? " refined" : "",
+	       bench->depth_count,
+	       error_sum / bench->depth_count,
+	       error_max);
+	if (error_sum / bench->depth_count > bench->max_mean_error) {
+		fprintf(stderr,
+			"stride %u: mean depth_mean error above %.4f m\n",
+			bench->cfg.sample_stride,
+			bench->max_mean_error);
+		res = -EDOM;
+	}
+
+out:
+	free(reference);
+	return res;
+}
+
+static int run(struct bench *bench,
+	       unsigned int pipeline_count,
+	       unsigned int thread_count,
+	       unsigned int frame_count)
+{
+	int res = 0;
+	struct processing_config cfg = bench->cfg;
+	struct processing_stats stats;
+	uint64_t start, duration;
+	unsigned int stepped = 0;
+	uint32_t *latency = bench->latency_us;
+
+	cfg.pipeline_count = pipeline_count;
+	cfg.thread_count = thread_count;
+	res = create_processing(bench, &cfg);
+	if (res < 0)
+		return res;
+
+	/* One frame in flight per pipeline: the next frame is given as soon as
+	 * an output has been received, so that the round-robin never gives a
+	 * frame to a busy pipeline. With a single pipeline, frames are
+	 * processed one at a time. The latency of a frame is the time from
+	 * processing_step to the output */
+	bench->in_run = true;
+	start = time_now_us();
+	while (bench->output_count < frame_count) {
+		while (stepped < frame_count
+		       && stepped - bench->output_count < pipeline_count) {
+			res = step_frame(bench, stepped++);
+			if (res < 0)
+				goto out;
+		}
+		res = wait_outputs(bench, bench->output_count + 1);
+		if (res < 0)
+			goto out;
+	}
+	duration = time_now_us() - start;
+
+	qsort(latency, frame_count, sizeof(*latency), &compare_u32);
+	printf("pipelines %u threads %u: %u frames in %.1f ms, "
+	       "%.1f frames/s, latency p50 %u us, p90 %u us, p99 %u us, "
+	       "max %u us\n",
+	       pipeline_count,
+	       thread_count,
+	       frame_count,
+	       duration / 1000.,
+	       frame_count * 1000000. / duration,
+	       percentile(latency, frame_count, 50),
+	       percentile(latency, frame_count, 90),
+	       percentile(latency, frame_count, 99),
+	       latency[frame_count - 1]);
+
+	/* Every optimisation of the depth kernel must keep the result of the
+	 * scalar reference, and outputs must come in frame order whatever the
+	 * number of pipelines */
+	processing_get_stats(bench->processing, &stats);
+	if (bench->mismatch_count > 0 || bench->unordered_count > 0
+	    || stats.dropped_inputs > 0) {
+		fprintf(stderr,
+			"pipelines %u threads %u: %u frames differ from the "
+			"reference, %u outputs out of order, %u frames "
+			"dropped\n",
+			pipeline_count,
+			thread_count,
+			bench->mismatch_count,
+			bench->unordered_count,
+			stats.dropped_inputs);
+		res = -EDOM;
+		goto out;
+	}
+	res = 0;
+
+out:
+	bench->in_run = false;
+	processing_destroy(bench->processing);
+	bench->processing = NULL;
+	return res;
+}
+
+static void usage(const char *progname)
+{
+	fprintf(stderr,
+		"usage: %s [-w width] [-h height] [-n frames] "
+		"[-t max_threads] [-p max_pipelines] [-s stride] [-r] "
+		"[-R x,y,width,height] [-e dominant|median] "
+		"[-f frames_file] [-E max_mean_error]\n",
+		progname);
+}
+
+int main(int argc, char *argv[])
+{
+	int res = 0;
+	int opt;
+	struct bench bench;
+	unsigned int width = DEFAULT_WIDTH;
+	unsigned int height = DEFAULT_HEIGHT;
+	unsigned int frame_count = DEFAULT_FRAME_COUNT;
+	unsigned int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int max_pipelines = max_threads;
+	const char *frames_path = NULL;
+
+	memset(&bench, 0, sizeof(bench));
+	bench.cfg.release_frame = &release_frame_cb;
+	bench.cfg.release_userdata = &bench;
+	bench.max_mean_error = DEFAULT_MAX_MEAN_ERROR;
+
+	while ((opt = getopt(argc, argv, "w:h:n:t:p:s:rR:e:f:E:")) != -1) {
+		switch (opt) {
+		case 'w':
+			width = atoi(optarg);
+			break;
+		case 'h':
+			height = atoi(optarg);
+			break;
+		case 'n':
+			frame_count = atoi(optarg);
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'p':
+			max_pipelines = atoi(optarg);
+			break;
+		case 's':
+			bench.cfg.sample_stride = atoi(optarg);
+			break;
+		case 'r':
+			bench.cfg.refine_dominant_bin = true;
+			break;
+		case 'R':
+			if (sscanf(optarg,
+				   "%f,%f,%f,%f",
+				   &bench.cfg.roi.x,
+				   &bench.cfg.roi.y,
+				   &bench.cfg.roi.width,
+				   &bench.cfg.roi.height)
+			    != 4) {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'e':
+			if (strcmp(optarg, "median") == 0) {
+				bench.cfg.estimator =
+					PROCESSING_ESTIMATOR_MEDIAN;
+			} else if (strcmp(optarg, "dominant") == 0) {
+				bench.cfg.estimator =
+					PROCESSING_ESTIMATOR_DOMINANT_BIN;
+			} else {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'f':
+			frames_path = optarg;
+			break;
+		case 'E':
+			bench.max_mean_error = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (width == 0 || height == 0 || frame_count == 0
+	    || max_threads == 0 || max_pipelines == 0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (max_threads > PROCESSING_MAX_THREAD_COUNT)
+		max_threads = PROCESSING_MAX_THREAD_COUNT;
+	if (max_pipelines > PROCESSING_MAX_PIPELINE_COUNT)
+		max_pipelines = PROCESSING_MAX_PIPELINE_COUNT;
+
+	bench.frame.width = width;
+	bench.frame.height = height;
+	bench.frame.num_planes = 1;
+	bench.frame.format = VACQ_PIX_FORMAT_RAW32;
+	bench.frame.planes[0].stride = width * sizeof(float);
+	if (frames_path != NULL)
+		res = load_frames(&bench, frames_path);
+	else
+		res = create_frames(&bench);
+	if (res < 0)
+		goto out;
+	res = compute_references(&bench);
+	if (res < 0)
+		goto out;
+	bench.latency_us =
+		(uint32_t *)calloc(frame_count, sizeof(*bench.latency_us));
+	if (bench.latency_us == NULL) {
+		res = -ENOMEM;
+		goto out;
+	}
+
+	bench.loop = pomp_loop_new();
+	bench.evt = pomp_evt_new();
+	if (bench.loop == NULL || bench.evt == NULL) {
+		res = -ENOMEM;
+		goto out;
+	}
+	res = pomp_evt_attach_to_loop(
+		bench.evt, bench.loop, &processing_evt_cb, &bench);
+	if (res < 0) {
+		ULOG_ERRNO("pomp_evt_attach_to_loop", -res);
+		goto out;
+	}
+
+	printf("%ux%u RAW32 frames, %u distinct\n",
+	       width,
+	       height,
+	       bench.depth_count);
+	/* Threads sharing the rows of a frame, then frames processed
+	 * concurrently by single threaded pipelines */
+	for (unsigned int n = 1; n <= max_threads && res == 0; n++)
+		res = run(&bench, 1, n, frame_count);
+	for (unsigned int n = 2; n <= max_pipelines && res == 0; n++)
+		res = run(&bench, n, 1, frame_count);
+
+	/* Sampling trades accuracy for time */
+	bench.cfg.thread_count = 1;
+	if (res == 0 && bench.cfg.sample_stride > 1)
+		res = check_accuracy(&bench);
+
+	pomp_evt_detach_from_loop(bench.evt, bench.loop);
+
+out:
+	if (bench.evt != NULL)
+		pomp_evt_destroy(bench.evt);
+	if (bench.loop != NULL)
+		pomp_loop_destroy(bench.loop);
+	free(bench.latency_us);
+	free(bench.reference);
+	free(bench.depth);
+	return res == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
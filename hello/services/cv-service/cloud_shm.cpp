@@ -0,0 +1,285 @@
+/**
+ * Copyright (C) 2021 Parrot Drones SAS
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ULOG_TAG ms_cloud_shm
+#include <ulog.h>
+ULOG_DECLARE_TAG(ULOG_TAG);
+
+#include "cloud_shm.h"
+
+/* Attempts of a reader racing with the writer */
+#define CLOUD_SHM_READ_RETRIES 4
+
+struct cloud_shm {
+	char *name;
+	bool writer;
+	void *map;
+	size_t map_size;
+	struct cloud_shm_header *header;
+};
+
+static inline struct cloud_shm_slot *get_slot(const struct cloud_shm *self,
+					      uint64_t index)
+{
+	uint8_t *base = (uint8_t *)(self->header + 1);
+	return (struct cloud_shm_slot *)(base
+					 + (index % self->header->slot_count)
+						   * self->header->slot_size);
+}
+
+static inline struct point3f *slot_points(struct cloud_shm_slot *slot)
+{
+	return (struct point3f *)(slot + 1);
+}
+
+static int cloud_shm_map(struct cloud_shm *self, int fd, size_t size)
+{
+	int prot = self->writer ? PROT_READ | PROT_WRITE : PROT_READ;
+
+	self->map = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+	if (self->map == MAP_FAILED) {
+		self->map = NULL;
+		return -errno;
+	}
+	self->map_size = size;
+	self->header = (struct cloud_shm_header *)self->map;
+	return 0;
+}
+
+int cloud_shm_writer_new(const char *name,
+			 unsigned int slot_count,
+			 unsigned int max_points,
+			 struct cloud_shm **ret_obj)
+{
+	int res = 0;
+	int fd = -1;
+	struct cloud_shm *self = NULL;
+	size_t slot_size;
+	size_t size;
+
+	ULOG_ERRNO_RETURN_ERR_IF(name == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(slot_count == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(max_points == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	/* Slots are 8 bytes aligned for the 64 bits fields */
+	slot_size = sizeof(struct cloud_shm_slot)
+		    + max_points * sizeof(struct point3f);
+	slot_size = (slot_size + 7) & ~(size_t)7;
+	size = sizeof(struct cloud_shm_header) + slot_count * slot_size;
+
+	self = (struct cloud_shm *)calloc(1, sizeof(*self));
+	if (self == NULL)
+		return -ENOMEM;
+	self->writer = true;
+	self->name = strdup(name);
+	if (self->name == NULL) {
+		res = -ENOMEM;
+		goto error;
+	}
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		res = -errno;
+		ULOG_ERRNO("shm_open('%s')", -res, name);
+		goto error;
+	}
+	if (ftruncate(fd, size) < 0) {
+		res = -errno;
+		ULOG_ERRNO("ftruncate", -res);
+		goto error;
+	}
+	res = cloud_shm_map(self, fd, size);
+	if (res < 0) {
+		ULOG_ERRNO("mmap", -res);
+		goto error;
+	}
+	close(fd);
+	fd = -1;
+
+	/* Readers check the magic last */
+	self->header->version = CLOUD_SHM_VERSION;
+	self->header->slot_count = slot_count;
+	self->header->slot_size = slot_size;
+	self->header->max_points = max_points;
+	self->header->write_count = 0;
+	__atomic_store_n(
+		&self->header->magic, CLOUD_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	*ret_obj = self;
+	return 0;
+
+error:
+	if (fd >= 0)
+		close(fd);
+	cloud_shm_destroy(self);
+	return res;
+}
+
+int cloud_shm_reader_new(const char *name, struct cloud_shm **ret_obj)
+{
+	int res = 0;
+	int fd = -1;
+	struct cloud_shm *self = NULL;
+	struct stat st;
+
+	ULOG_ERRNO_RETURN_ERR_IF(name == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	self = (struct cloud_shm *)calloc(1, sizeof(*self));
+	if (self == NULL)
+		return -ENOMEM;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		res = -errno;
+		goto error;
+	}
+	if (fstat(fd, &st) < 0) {
+		res = -errno;
+		ULOG_ERRNO("fstat", -res);
+		goto error;
+	}
+	if ((size_t)st.st_size < sizeof(struct cloud_shm_header)) {
+		res = -EAGAIN;
+		goto error;
+	}
+	res = cloud_shm_map(self, fd, st.st_size);
+	if (res < 0) {
+		ULOG_ERRNO("mmap", -res);
+		goto error;
+	}
+	close(fd);
+	fd = -1;
+
+	if (__atomic_load_n(&self->header->magic, __ATOMIC_ACQUIRE)
+	    != CLOUD_SHM_MAGIC) {
+		res = -EAGAIN;
+		goto error;
+	}
+	if (self->header->version != CLOUD_SHM_VERSION
+	    || sizeof(struct cloud_shm_header)
+			       + (size_t)self->header->slot_count
+					 * self->header->slot_size
+		       > self->map_size) {
+		res = -EPROTO;
+		ULOGE("unsupported cloud shared memory '%s'", name);
+		goto error;
+	}
+
+	*ret_obj = self;
+	return 0;
+
+error:
+	if (fd >= 0)
+		close(fd);
+	cloud_shm_destroy(self);
+	return res;
+}
+
+void cloud_shm_destroy(struct cloud_shm *self)
+{
+	if (self == NULL)
+		return;
+
+	if (self->map != NULL)
+		munmap(self->map, self->map_size);
+	if (self->writer && self->name != NULL)
+		shm_unlink(self->name);
+	free(self->name);
+	free(self);
+}
+
+int cloud_shm_publish(struct cloud_shm *self,
+		      uint64_t ts_ns,
+		      const struct point3f *points,
+		      unsigned int count)
+{
+	struct cloud_shm_slot *slot;
+	uint64_t index;
+	uint64_t seq;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(!self->writer, EPERM);
+	ULOG_ERRNO_RETURN_ERR_IF(points == NULL && count > 0, EINVAL);
+
+	if (count > self->header->max_points)
+		count = self->header->max_points;
+
+	index = self->header->write_count;
+	slot = get_slot(self, index);
+	seq = slot->seq;
+
+	/* Mark the slot as being written before touching its content */
+	__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	slot->ts_ns = ts_ns;
+	slot->count = count;
+	memcpy(slot_points(slot), points, count * sizeof(*points));
+
+	__atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(
+		&self->header->write_count, index + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+int cloud_shm_read_latest(struct cloud_shm *self,
+			  struct point3f *points,
+			  unsigned int *ret_count,
+			  uint64_t *ret_ts_ns)
+{
+	struct cloud_shm_slot *slot;
+	uint64_t write_count;
+	uint64_t seq_begin, seq_end;
+	unsigned int count;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(points == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_count == NULL, EINVAL);
+
+	for (int i = 0; i < CLOUD_SHM_READ_RETRIES; i++) {
+		write_count = __atomic_load_n(&self->header->write_count,
+					      __ATOMIC_ACQUIRE);
+		if (write_count == 0)
+			return -ENOENT;
+
+		slot = get_slot(self, write_count - 1);
+		seq_begin = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq_begin & 1)
+			continue;
+
+		count = slot->count;
+		if (count > self->header->max_points)
+			continue;
+		memcpy(points, slot_points(slot), count * sizeof(*points));
+		if (ret_ts_ns != NULL)
+			*ret_ts_ns = slot->ts_ns;
+
+		/* Content is valid if the slot was not written meanwhile */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		seq_end = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+		if (seq_begin == seq_end) {
+			*ret_count = count;
+			return 0;
+		}
+	}
+
+	return -EAGAIN;
+}
+
+unsigned int cloud_shm_get_max_points(const struct cloud_shm *self)
+{
+	return self->header->max_points;
+}
@@ -0,0 +1,112 @@
+/**
+ * Copyright (C) 2021 Parrot Drones SAS
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "point_cloud.h"
+
+/**
+ * Shared memory ring of point clouds.
+ *
+ * The shared memory object starts with a `struct cloud_shm_header` followed
+ * by `slot_count` slots of `slot_size` bytes. Each slot starts with a
+ * `struct cloud_shm_slot` followed by `max_points` `struct point3f`.
+ *
+ * The writer publishes cloud number n in slot n % slot_count, then sets
+ * `write_count` to n + 1. The `seq` of a slot is odd while the slot is being
+ * written. A reader loads `write_count`, reads the `seq` of the last written
+ * slot, copies the slot and reads `seq` again: the copy is valid if both
+ * values are equal and even.
+ */
+
+#define CLOUD_SHM_MAGIC 0x434c4f44 /* "CLOD" */
+#define CLOUD_SHM_VERSION 1
+
+struct cloud_shm_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slot_count;
+	uint32_t slot_size;
+	uint32_t max_points;
+	uint32_t reserved;
+	/* Number of clouds published */
+	uint64_t write_count;
+};
+
+struct cloud_shm_slot {
+	/* Odd while the slot is being written */
+	uint64_t seq;
+	/* Timestamp of the depth frame [ns] */
+	uint64_t ts_ns;
+	/* Number of points following */
+	uint32_t count;
+	uint32_t reserved;
+};
+
+struct cloud_shm;
+
+/**
+ * Create a shared memory ring of point clouds and its writer.
+ * @param name name of the POSIX shared memory object.
+ * @param slot_count number of clouds in the ring.
+ * @param max_points maximum number of points of a cloud.
+ * @param ret_obj pointer to return created object.
+ * @return 0 in case of success, negative errno in case of error.
+ */
+int cloud_shm_writer_new(const char *name,
+			 unsigned int slot_count,
+			 unsigned int max_points,
+			 struct cloud_shm **ret_obj);
+
+/**
+ * Open an existing shared memory ring of point clouds for reading.
+ * @param name name of the POSIX shared memory object.
+ * @param ret_obj pointer to return created object.
+ * @return 0 in case of success, negative errno in case of error.
+ */
+int cloud_shm_reader_new(const char *name, struct cloud_shm **ret_obj);
+
+/**
+ * Unmap a shared memory ring of point clouds. The shared memory object is
+ * also removed for a writer.
+ * @param self shared memory ring.
+ */
+void cloud_shm_destroy(struct cloud_shm *self);
+
+/**
+ * Publish a point cloud, points beyond the capacity of a slot are dropped.
+ * @param self shared memory ring, opened as writer.
+ * @param ts_ns timestamp of the depth frame [ns].
+ * @param points points of the cloud.
+ * @param count number of points.
+ * @return 0 in case of success, negative errno in case of error.
+ */
+int cloud_shm_publish(struct cloud_shm *self,
+		      uint64_t ts_ns,
+		      const struct point3f *points,
+		      unsigned int count);
+
+/**
+ * Copy the latest point cloud of the ring.
+ * @param self shared memory ring.
+ * @param points buffer of at least `max_points` points.
+ * @param ret_count pointer to return the number of points.
+ * @param ret_ts_ns pointer to return the timestamp of the cloud [ns].
+ * @return 0 in case of success, -ENOENT if no cloud has been published,
+ *         -EAGAIN if the writer kept overwriting the slot, negative errno in
+ *         case of error.
+ */
+int cloud_shm_read_latest(struct cloud_shm *self,
+			  struct point3f *points,
+			  unsigned int *ret_count,
+			  uint64_t *ret_ts_ns);
+
+/**
+ * Get the maximum number of points of a cloud of the ring.
+ * @param self shared memory ring.
+ * @return maximum number of points.
+ */
+unsigned int cloud_shm_get_max_points(const struct cloud_shm *self);
@@ -0,0 +1,466 @@
+/**
+ * Copyright (C) 2021 Parrot Drones SAS
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "depth_stats.h"
+
+/* 4 lanes vectors, mapped on NEON/SSE registers by the compiler */
+typedef float vec_f32 __attribute__((vector_size(16)));
+typedef int32_t vec_s32 __attribute__((vector_size(16)));
+typedef int64_t vec_s64 __attribute__((vector_size(16)));
+#define VEC_LANES 4
+
+static_assert(DEPTH_SKETCH_LANES == VEC_LANES,
+	      "each lane of the vectors has its own sketch histogram");
+
+#define BIN_SIZE (HIST_RANGE / HIST_SIZE) // [m]
+
+/* Bits of a positive float giving its sketch bin */
+#define SKETCH_SHIFT (23 - DEPTH_SKETCH_MANTISSA_BITS)
+
+/* Last sketch bin ends at 16 m */
+static_assert(HIST_RANGE_LOW >= 0.f && HIST_RANGE_HIGH <= 16.f,
+	      "depth sketch does not cover the histogram range");
+
+/* Bin edges of the histogram (multiples of 1.5 m up to 15 m) have their
+ * lowest 19 mantissa bits cleared, which allows to find pixels that may lie
+ * on an edge with a single test */
+static_assert(HIST_RANGE_LOW == 0.f && HIST_RANGE_HIGH == 15.f
+		      && HIST_SIZE == 10,
+	      "bin edges may use more mantissa bits");
+#define EDGE_MANTISSA_MASK ((1 << 19) - 1)
+
+static inline float bin_edge(int i)
+{
+	/* Same arithmetic as the bin bounds used by the histogram */
+	return HIST_RANGE_LOW + i * BIN_SIZE;
+}
+
+static inline int32_t float_bits(float x)
+{
+	int32_t bits;
+	memcpy(&bits, &x, sizeof(bits));
+	return bits;
+}
+
+static inline float bits_float(int32_t bits)
+{
+	float x;
+	memcpy(&x, &bits, sizeof(x));
+	return x;
+}
+
+/* Index of a sketch bin minus the shifted bits of its depth, bin 1 starts at
+ * DEPTH_SKETCH_LOW */
+static inline int32_t sketch_base(void)
+{
+	return (float_bits(DEPTH_SKETCH_LOW) >> SKETCH_SHIFT) - 1;
+}
+
+/* Lower bound of a sketch bin */
+static inline float sketch_bin_low(int bin)
+{
+	if (bin == 0)
+		return HIST_RANGE_LOW;
+	return bits_float((bin + sketch_base()) << SKETCH_SHIFT);
+}
+
+static inline vec_f32 vec_load(const float *ptr)
+{
+	vec_f32 v;
+	memcpy(&v, ptr, sizeof(v));
+	return v;
+}
+
+static inline vec_f32 vec_setall(float x)
+{
+	vec_f32 v = {x, x, x, x};
+	return v;
+}
+
+static inline vec_s32 vec_setall(int32_t x)
+{
+	vec_s32 v = {x, x, x, x};
+	return v;
+}
+
+static inline int32_t vec_reduce_sum(vec_s32 v)
+{
+	return v[0] + v[1] + v[2] + v[3];
+}
+
+static inline double vec_reduce_sum(vec_f32 v)
+{
+	return (double)v[0] + (double)v[1] + (double)v[2] + (double)v[3];
+}
+
+/* Vector accumulators of a block of pixels */
+struct vec_stats {
+	vec_s32 count[HIST_SIZE];
+	vec_f32 sum[HIST_SIZE];
+	vec_s32 edge_count[HIST_SIZE];
+	vec_f32 min;
+	unsigned int pending;
+};
+
+/* Number of vectors accumulated before flushing float sums into double,
+ * keeps the precision of a per pixel double accumulation */
+#define VEC_FLUSH_PERIOD 64
+
+/* Number of sampled pixels gathered before being accumulated */
+#define GATHER_SIZE 64
+
+static inline void vec_stats_reset(struct vec_stats *acc)
+{
+	memset(acc, 0, sizeof(*acc));
+	acc->min = vec_setall(INFINITY);
+}
+
+static inline void vec_stats_flush(struct vec_stats *acc,
+				   struct depth_stats *stats)
+{
+	for (int i = 0; i < HIST_SIZE; i++) {
+		stats->count[i] += vec_reduce_sum(acc->count[i]);
+		stats->sum[i] += vec_reduce_sum(acc->sum[i]);
+		stats->edge_count[i] += vec_reduce_sum(acc->edge_count[i]);
+		acc->count[i] = vec_s32{};
+		acc->sum[i] = vec_f32{};
+		acc->edge_count[i] = vec_s32{};
+	}
+	acc->pending = 0;
+}
+
+static inline bool vec_any(vec_s32 mask)
+{
+	vec_s64 v = (vec_s64)mask;
+	return (v[0] | v[1]) != 0;
+}
+
+static inline float vec_reduce_min(vec_f32 v)
+{
+	return fminf(fminf(v[0], v[1]), fminf(v[2], v[3]));
+}
+
+void depth_stats_reset(struct depth_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	stats->min = INFINITY;
+}
+
+void depth_sketch_reset(struct depth_sketch *sketch)
+{
+	memset(sketch, 0, sizeof(*sketch));
+}
+
+/* Count a vector of pixels in the sketch. Bin indices are computed with
+ * vectors, then each lane increments its own histogram */
+static inline void sketch_add(struct depth_sketch *sketch,
+			      vec_f32 depth,
+			      vec_s32 valid)
+{
+	vec_s32 below = depth < vec_setall(DEPTH_SKETCH_LOW);
+	vec_s32 index = ((vec_s32)depth >> SKETCH_SHIFT) - sketch_base();
+
+	index &= ~below;
+	index = (index & valid) | (vec_setall(DEPTH_SKETCH_SIZE) & ~valid);
+
+	for (int l = 0; l < DEPTH_SKETCH_LANES; l++)
+		sketch->count[l][index[l]]++;
+}
+
+static inline void sketch_add(struct depth_sketch *sketch, float depth)
+{
+	int32_t index = 0;
+
+	if (!(depth >= bin_edge(0) && depth < bin_edge(HIST_SIZE)))
+		index = DEPTH_SKETCH_SIZE;
+	else if (depth >= DEPTH_SKETCH_LOW)
+		index = (float_bits(depth) >> SKETCH_SHIFT) - sketch_base();
+
+	sketch->count[0][index]++;
+}
+
+/* Pixels on the upper edge of a bin, the last edge included */
+static inline void add_edge(struct depth_stats *stats, float depth)
+{
+	for (int i = 0; i < HIST_SIZE; i++) {
+		if (depth == bin_edge(i + 1))
+			stats->edge_count[i]++;
+	}
+}
+
+/* Accumulate contiguous depth pixels */
+static inline void accumulate(struct vec_stats *acc,
+			      struct depth_stats *stats,
+			      struct depth_sketch *sketch,
+			      const vec_f32 *edges,
+			      const float *pixels,
+			      unsigned int count)
+{
+	unsigned int j = 0;
+
+	/* Each vector of pixels is compared against every bin edge: a pixel
+	 * belongs to bin i if it is >= edge i and < edge i+1. Comparisons
+	 * with NaN are false so NaN pixels never land in a bin, neither do
+	 * negative ones (< edge 0) nor infinite ones (>= edge HIST_SIZE) */
+	for (; j + VEC_LANES <= count; j += VEC_LANES) {
+		vec_f32 depth = vec_load(pixels + j);
+		vec_s32 above_low = depth >= edges[0];
+		vec_s32 below_high = depth < edges[HIST_SIZE];
+		vec_s32 valid = above_low & below_high;
+		vec_s32 lower = valid & (depth < acc->min);
+		vec_s32 maybe_edge =
+			(((vec_s32)depth & EDGE_MANTISSA_MASK) == 0)
+			& (depth >= edges[1]) & (depth <= edges[HIST_SIZE]);
+
+		if (sketch != NULL)
+			sketch_add(sketch, depth, valid);
+
+		/* Pixels exactly on an edge are rare, they are only looked
+		 * for in vectors where some pixel may lie on one */
+		if (vec_any(maybe_edge)) {
+			for (int i = 0; i < HIST_SIZE; i++)
+				acc->edge_count[i] -= depth == edges[i + 1];
+		}
+
+#pragma GCC unroll 16
+		for (int i = 0; i < HIST_SIZE; i++) {
+			vec_s32 above_high = depth >= edges[i + 1];
+			vec_s32 in_bin = above_low & ~above_high;
+
+			/* Comparison masks are -1 for true lanes */
+			acc->count[i] -= in_bin;
+			acc->sum[i] += (vec_f32)((vec_s32)depth & in_bin);
+			above_low = above_high;
+		}
+
+		acc->min = (vec_f32)(((vec_s32)depth & lower)
+				     | ((vec_s32)acc->min & ~lower));
+
+		if (++acc->pending == VEC_FLUSH_PERIOD)
+			vec_stats_flush(acc, stats);
+	}
+
+	/* Remaining pixels */
+	for (; j < count; j++) {
+		float depth = pixels[j];
+		bool above_low = depth >= bin_edge(0);
+
+		if (sketch != NULL)
+			sketch_add(sketch, depth);
+
+		if (above_low && depth < bin_edge(HIST_SIZE)
+		    && depth < stats->min)
+			stats->min = depth;
+
+		for (int i = 0; i < HIST_SIZE; i++) {
+			bool above_high = depth >= bin_edge(i + 1);
+
+			if (above_low && !above_high) {
+				stats->count[i]++;
+				stats->sum[i] += depth;
+			}
+			above_low = above_high;
+		}
+		add_edge(stats, depth);
+	}
+}
+
+void depth_stats_add_block(struct depth_stats *stats,
+			   struct depth_sketch *sketch,
+			   const void *data,
+			   size_t stride,
+			   unsigned int x,
+			   unsigned int y,
+			   unsigned int width,
+			   unsigned int height,
+			   unsigned int step)
+{
+	vec_f32 edges[HIST_SIZE + 1];
+	struct vec_stats acc;
+	float samples[GATHER_SIZE];
+
+	if (width == 0 || height == 0)
+		return;
+	if (step == 0)
+		step = 1;
+
+	for (int i = 0; i <= HIST_SIZE; i++)
+		edges[i] = vec_setall(bin_edge(i));
+	vec_stats_reset(&acc);
+
+	for (unsigned int r = y; r < y + height; r += step) {
+		const float *row =
+			(const float *)((const uint8_t *)data + r * stride) + x;
+
+		if (step == 1) {
+			accumulate(&acc, stats, sketch, edges, row, width);
+			continue;
+		}
+
+		/* Gather sampled pixels so that they can be handled by
+		 * vectors */
+		for (unsigned int j = 0; j < width;) {
+			unsigned int n = 0;
+			for (; n < GATHER_SIZE && j < width; n++, j += step)
+				samples[n] = row[j];
+			accumulate(&acc, stats, sketch, edges, samples, n);
+		}
+	}
+
+	vec_stats_flush(&acc, stats);
+	stats->min = fminf(stats->min, vec_reduce_min(acc.min));
+	stats->pixel_count +=
+		((width + step - 1) / step) * ((height + step - 1) / step);
+}
+
+void depth_stats_add_bin_block(struct depth_bin_sum *bin_sum,
+			       const void *data,
+			       size_t stride,
+			       unsigned int x,
+			       unsigned int y,
+			       unsigned int width,
+			       unsigned int height,
+			       int bin)
+{
+	const float low_edge = bin_edge(bin);
+	const float high_edge = bin_edge(bin + 1);
+	vec_f32 low = vec_setall(low_edge);
+	vec_f32 high = vec_setall(high_edge);
+	vec_s32 count = {};
+	vec_f32 sum = {};
+	unsigned int pending = 0;
+
+	for (unsigned int r = y; r < y + height; r++) {
+		const float *row =
+			(const float *)((const uint8_t *)data + r * stride) + x;
+		unsigned int j = 0;
+
+		/* Bin bounds are both included, as in the dominant mean */
+		for (; j + VEC_LANES <= width; j += VEC_LANES) {
+			vec_f32 depth = vec_load(row + j);
+			vec_s32 in_bin = (depth >= low) & (depth <= high);
+
+			count -= in_bin;
+			sum += (vec_f32)((vec_s32)depth & in_bin);
+			if (++pending == VEC_FLUSH_PERIOD) {
+				bin_sum->count += vec_reduce_sum(count);
+				bin_sum->sum += vec_reduce_sum(sum);
+				count = vec_s32{};
+				sum = vec_f32{};
+				pending = 0;
+			}
+		}
+
+		for (; j < width; j++) {
+			float depth = row[j];
+			if (depth >= low_edge && depth <= high_edge) {
+				bin_sum->count++;
+				bin_sum->sum += depth;
+			}
+		}
+	}
+
+	bin_sum->count += vec_reduce_sum(count);
+	bin_sum->sum += vec_reduce_sum(sum);
+}
+
+void depth_stats_merge(struct depth_stats *stats,
+		       const struct depth_stats *other)
+{
+	for (int i = 0; i < HIST_SIZE; i++) {
+		stats->count[i] += other->count[i];
+		stats->sum[i] += other->sum[i];
+		stats->edge_count[i] += other->edge_count[i];
+	}
+	stats->min = fminf(stats->min, other->min);
+	stats->pixel_count += other->pixel_count;
+}
+
+float depth_stats_dominant_mean(const struct depth_stats *stats, int *ret_bin)
+{
+	int bin = 0;
+	uint32_t n;
+
+	/* First bin with highest count */
+	for (int i = 1; i < HIST_SIZE; i++) {
+		if (stats->count[i] > stats->count[bin])
+			bin = i;
+	}
+
+	if (ret_bin != NULL)
+		*ret_bin = bin;
+
+	/* Pixels of the bin, plus the ones on its upper edge */
+	n = stats->count[bin] + stats->edge_count[bin];
+	if (n == 0)
+		return 0.f;
+
+	return (stats->sum[bin] + stats->edge_count[bin] * bin_edge(bin + 1))
+	       / n;
+}
+
+float depth_stats_valid_ratio(const struct depth_stats *stats)
+{
+	uint32_t n = 0;
+
+	if (stats->pixel_count == 0)
+		return 0.f;
+
+	for (int i = 0; i < HIST_SIZE; i++)
+		n += stats->count[i];
+
+	return (float)n / stats->pixel_count;
+}
+
+void depth_sketch_merge(struct depth_sketch *sketch,
+			const struct depth_sketch *other)
+{
+	for (int l = 0; l < DEPTH_SKETCH_LANES; l++) {
+		for (int i = 0; i < DEPTH_SKETCH_SIZE; i++)
+			sketch->count[l][i] += other->count[l][i];
+	}
+}
+
+void depth_sketch_quantiles(const struct depth_sketch *sketch,
+			    const float *q,
+			    float *values,
+			    unsigned int count)
+{
+	uint32_t bins[DEPTH_SKETCH_SIZE];
+	uint32_t total = 0;
+
+	for (int i = 0; i < DEPTH_SKETCH_SIZE; i++) {
+		bins[i] = 0;
+		for (int l = 0; l < DEPTH_SKETCH_LANES; l++)
+			bins[i] += sketch->count[l][i];
+		total += bins[i];
+	}
+
+	for (unsigned int k = 0; k < count; k++) {
+		/* Rank of the quantile among the pixels */
+		float rank = q[k] * total;
+		uint32_t below = 0;
+		int i = 0;
+
+		values[k] = 0.f;
+		if (total == 0)
+			continue;
+
+		while (i < DEPTH_SKETCH_SIZE - 1
+		       && (bins[i] == 0 || below + bins[i] < rank)) {
+			below += bins[i];
+			i++;
+		}
+
+		/* Pixels are assumed evenly spread in their bin */
+		float low = sketch_bin_low(i);
+		float high = fminf(sketch_bin_low(i + 1), HIST_RANGE_HIGH);
+		float ratio = bins[i] > 0 ? (rank - below) / bins[i] : 0.f;
+		values[k] = low + fminf(fmaxf(ratio, 0.f), 1.f) * (high - low);
+	}
+}
@@ -0,0 +1,170 @@
+/**
+ * Copyright (C) 2021 Parrot Drones SAS
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// HIST_RANGE_LOW < HIST_RANGE_HIGH
+#define HIST_RANGE_LOW 0.f                            // [m]
+#define HIST_RANGE_HIGH 15.f                          // [m]
+#define HIST_RANGE (HIST_RANGE_HIGH - HIST_RANGE_LOW) // [m]
+#define HIST_SIZE 10
+
+/* Quantile sketch: log spaced histogram with DEPTH_SKETCH_BINS_PER_OCTAVE bins
+ * per octave from DEPTH_SKETCH_LOW to 16 m, after a first bin holding
+ * [HIST_RANGE_LOW, DEPTH_SKETCH_LOW). The bin of a depth is read from the
+ * exponent and the upper mantissa bits of its float representation */
+#define DEPTH_SKETCH_MANTISSA_BITS 5
+#define DEPTH_SKETCH_BINS_PER_OCTAVE (1 << DEPTH_SKETCH_MANTISSA_BITS)
+#define DEPTH_SKETCH_LOW 0.125f // [m]
+#define DEPTH_SKETCH_OCTAVES 7
+#define DEPTH_SKETCH_SIZE                                                      \
+	(1 + DEPTH_SKETCH_BINS_PER_OCTAVE * DEPTH_SKETCH_OCTAVES)
+#define DEPTH_SKETCH_LANES 4
+
+/**
+ * Depth statistics accumulated over a set of RAW32 depth pixels.
+ *
+ * Bin `i` holds the pixels whose depth lies in [low(i), high(i)) with
+ * low(i) = HIST_RANGE_LOW + i * HIST_RANGE / HIST_SIZE and
+ * high(i) = low(i) + HIST_RANGE / HIST_SIZE. Negative, infinite and NaN
+ * pixels are never counted.
+ */
+struct depth_stats {
+	/* Number of pixels in each bin */
+	uint32_t count[HIST_SIZE];
+	/* Sum of the depth of the pixels in each bin [m] */
+	double sum[HIST_SIZE];
+	/* Number of pixels lying exactly on the upper edge of each bin */
+	uint32_t edge_count[HIST_SIZE];
+	/* Minimum depth of the pixels in the bins, INFINITY if none [m] */
+	float min;
+	/* Number of pixels visited, counted in a bin or not */
+	uint32_t pixel_count;
+};
+
+/**
+ * Fixed memory sketch of the depth distribution, giving any quantile with a
+ * resolution of 1/32 of an octave (about 2%) in a single pass.
+ *
+ * Pixels are counted in the same range as `struct depth_stats`. Counts are
+ * split in DEPTH_SKETCH_LANES interleaved histograms so that consecutive
+ * pixels falling in the same bin do not wait on each other's increment, the
+ * last column of each histogram collects the invalid pixels.
+ */
+struct depth_sketch {
+	uint32_t count[DEPTH_SKETCH_LANES][DEPTH_SKETCH_SIZE + 1];
+};
+
+/* Sum of the depth pixels lying in a bin, upper edge included */
+struct depth_bin_sum {
+	uint32_t count;
+	/* [m] */
+	double sum;
+};
+
+/**
+ * Reset depth statistics.
+ * @param stats depth statistics.
+ */
+void depth_stats_reset(struct depth_stats *stats);
+
+/**
+ * Reset a depth sketch.
+ * @param sketch depth sketch.
+ */
+void depth_sketch_reset(struct depth_sketch *sketch);
+
+/**
+ * Accumulate a rectangular block of depth pixels in a single pass, sampling
+ * one pixel every `step` columns and rows starting from the first pixel of
+ * the block.
+ * @param stats depth statistics.
+ * @param sketch depth sketch to update in the same pass (optional).
+ * @param data RAW32 depth image [m].
+ * @param stride distance in bytes between two rows of the image.
+ * @param x first column of the block.
+ * @param y first row of the block.
+ * @param width number of columns of the block.
+ * @param height number of rows of the block.
+ * @param step sampling step in pixels, 1 to use every pixel.
+ */
+void depth_stats_add_block(struct depth_stats *stats,
+			   struct depth_sketch *sketch,
+			   const void *data,
+			   size_t stride,
+			   unsigned int x,
+			   unsigned int y,
+			   unsigned int width,
+			   unsigned int height,
+			   unsigned int step);
+
+/**
+ * Accumulate the depth pixels of a rectangular block lying in a bin, lower
+ * and upper edges included, at full resolution.
+ * @param bin_sum sum to update.
+ * @param data RAW32 depth image [m].
+ * @param stride distance in bytes between two rows of the image.
+ * @param x first column of the block.
+ * @param y first row of the block.
+ * @param width number of columns of the block.
+ * @param height number of rows of the block.
+ * @param bin index of the bin.
+ */
+void depth_stats_add_bin_block(struct depth_bin_sum *bin_sum,
+			       const void *data,
+			       size_t stride,
+			       unsigned int x,
+			       unsigned int y,
+			       unsigned int width,
+			       unsigned int height,
+			       int bin);
+
+/**
+ * Merge depth statistics into another one.
+ * @param stats depth statistics to update.
+ * @param other depth statistics to add.
+ */
+void depth_stats_merge(struct depth_stats *stats,
+		       const struct depth_stats *other);
+
+/**
+ * Get the mean depth of the pixels of the most populated bin, including the
+ * pixels lying on its upper edge.
+ * @param stats depth statistics.
+ * @param ret_bin pointer to return index of the most populated bin (optional).
+ * @return mean depth [m], 0 if no pixel has been accumulated.
+ */
+float depth_stats_dominant_mean(const struct depth_stats *stats, int *ret_bin);
+
+/**
+ * Get the ratio of visited pixels counted in a bin.
+ * @param stats depth statistics.
+ * @return ratio between 0 and 1, 0 if no pixel has been visited.
+ */
+float depth_stats_valid_ratio(const struct depth_stats *stats);
+
+/**
+ * Merge a depth sketch into another one.
+ * @param sketch depth sketch to update.
+ * @param other depth sketch to add.
+ */
+void depth_sketch_merge(struct depth_sketch *sketch,
+			const struct depth_sketch *other);
+
+/**
+ * Get quantiles of the depth pixels of a sketch, linearly interpolated
+ * within their bin.
+ * @param sketch depth sketch.
+ * @param q quantiles to compute, between 0 and 1.
+ * @param values array to return the depth of each quantile [m], 0 if no
+ *               pixel has been accumulated.
+ * @param count number of quantiles.
+ */
+void depth_sketch_quantiles(const struct depth_sketch *sketch,
+			    const float *q,
+			    float *values,
+			    unsigned int count);
@@ -0,0 +1,184 @@
+/**
+ * Copyright (C) 2021 Parrot Drones SAS
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#define ULOG_TAG ms_drone_state
+#include <ulog.h>
+ULOG_DECLARE_TAG(ULOG_TAG);
+
+#include <libtelemetry.h>
+
+#include "drone_state.h"
+
+struct drone_state_reader {
+	/* Consumer to get drone telemetry */
+	struct tlm_consumer *consumer;
+
+	/* Structure where the consumer saves telemetry data */
+	struct drone_state data;
+};
+
+// clang-format off
+static const struct tlm_reg_field s_drone_state_fields[] = {
+	TLM_REG_FIELD_SCALAR_EX(struct drone_state, velocity.x,
+			"linear_velocity_global.x", TLM_TYPE_FLOAT32),
+	TLM_REG_FIELD_SCALAR_EX(struct drone_state, velocity.y,
+			"linear_velocity_global.y", TLM_TYPE_FLOAT32),
+	TLM_REG_FIELD_SCALAR_EX(struct drone_state, velocity.z,
+			"linear_velocity_global.z", TLM_TYPE_FLOAT32),
+
+	TLM_REG_FIELD_SCALAR_EX(struct drone_state, position_global.x,
+			"position_global.x", TLM_TYPE_FLOAT32),
+	TLM_REG_FIELD_SCALAR_EX(struct drone_state, position_global.y,
+			"position_global.y", TLM_TYPE_FLOAT32),
+	TLM_REG_FIELD_SCALAR_EX(struct drone_state, position_global.z,
+			"position_global.z", TLM_TYPE_FLOAT32),
+
+	TLM_REG_FIELD_SCALAR_EX(struct drone_state, attitude.yaw,
+			"attitude_euler_angles.yaw", TLM_TYPE_FLOAT32),
+	TLM_REG_FIELD_SCALAR_EX(struct drone_state, attitude.pitch,
+			"attitude_euler_angles.pitch", TLM_TYPE_FLOAT32),
+	TLM_REG_FIELD_SCALAR_EX(struct drone_state, attitude.roll,
+			"attitude_euler_angles.roll", TLM_TYPE_FLOAT32),
+};
+// clang-format on
+
+static const struct tlm_reg_struct s_drone_state_struct =
+	TLM_REG_STRUCT("drone_state", s_drone_state_fields);
+
+static inline int64_t timespec_diff_ns(const struct timespec *t1,
+				       const struct timespec *t2)
+{
+	return (int64_t)(t1->tv_sec - t2->tv_sec) * 1000000000LL
+	       + (t1->tv_nsec - t2->tv_nsec);
+}
+
+static inline float lerp(float a, float b, float k)
+{
+	return a + (b - a) * k;
+}
+
+int drone_state_reader_new(const char *section,
+			   struct drone_state_reader **ret_obj)
+{
+	int res = 0;
+	struct drone_state_reader *self = NULL;
+	ULOG_ERRNO_RETURN_ERR_IF(section == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	self = (struct drone_state_reader *)calloc(1, sizeof(*self));
+	if (self == NULL)
+		return -ENOMEM;
+
+	self->consumer = tlm_consumer_new();
+	if (self->consumer == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("tlm_consumer_new", -res);
+		goto error;
+	}
+	res = tlm_consumer_reg_struct_ptr(
+		self->consumer, &self->data, section, &s_drone_state_struct);
+	if (res < 0) {
+		ULOG_ERRNO("tlm_consumer_reg_struct_ptr", -res);
+		goto error;
+	}
+	res = tlm_consumer_reg_complete(self->consumer);
+	if (res < 0) {
+		ULOG_ERRNO("tlm_consumer_reg_complete", -res);
+		goto error;
+	}
+
+	*ret_obj = self;
+	return 0;
+
+error:
+	drone_state_reader_destroy(self);
+	return res;
+}
+
+void drone_state_reader_destroy(struct drone_state_reader *self)
+{
+	int res = 0;
+
+	if (self == NULL)
+		return;
+
+	if (self->consumer != NULL) {
+		res = tlm_consumer_destroy(self->consumer);
+		if (res < 0)
+			ULOG_ERRNO("tlm_consumer_destroy", -res);
+	}
+
+	free(self);
+}
+
+int drone_state_reader_get(struct drone_state_reader *self,
+			   const struct timespec *ts,
+			   struct drone_state *state)
+{
+	int res = 0;
+	struct drone_state before;
+	const struct drone_state *after = &self->data;
+	struct timespec ts_before, ts_after;
+	int64_t span_ns, elapsed_ns;
+	float k;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ts == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(state == NULL, EINVAL);
+
+	/* Latest sample at or before the given time */
+	res = tlm_consumer_get_sample_with_timestamp(
+		self->consumer, ts, TLM_FIRST_BEFORE, &ts_before);
+	if (res == -ENOENT) {
+		/* Frame older than any sample, use the oldest one */
+		res = tlm_consumer_get_sample_with_timestamp(
+			self->consumer, ts, TLM_FIRST_AFTER, &ts_before);
+	}
+	if (res < 0) {
+		if (res != -ENOENT)
+			ULOG_ERRNO("tlm_consumer_get_sample_with_timestamp",
+				   -res);
+		return res;
+	}
+	before = self->data;
+	*state = before;
+
+	/* First sample after the given time, not yet produced if the frame
+	 * is more recent than the telemetry */
+	res = tlm_consumer_get_sample_with_timestamp(
+		self->consumer, ts, TLM_FIRST_AFTER, &ts_after);
+	if (res < 0) {
+		if (res != -ENOENT)
+			ULOG_ERRNO("tlm_consumer_get_sample_with_timestamp",
+				   -res);
+		return 0;
+	}
+
+	span_ns = timespec_diff_ns(&ts_after, &ts_before);
+	elapsed_ns = timespec_diff_ns(ts, &ts_before);
+	if (span_ns <= 0 || elapsed_ns <= 0)
+		return 0;
+	k = (float)elapsed_ns / span_ns;
+
+	state->position_global.x =
+		lerp(before.position_global.x, after->position_global.x, k);
+	state->position_global.y =
+		lerp(before.position_global.y, after->position_global.y, k);
+	state->position_global.z =
+		lerp(before.position_global.z, after->position_global.z, k);
+	state->velocity.x = lerp(before.velocity.x, after->velocity.x, k);
+	state->velocity.y = lerp(before.velocity.y, after->velocity.y, k);
+	state->velocity.z = lerp(before.velocity.z, after->velocity.z, k);
+
+	/* Angles wrap around, take the closest sample */
+	if (k > 0.5f)
+		state->attitude = after->attitude;
+
+	return 0;
+}
@@ -0,0 +1,64 @@
+/**
+ * Copyright (C) 2021 Parrot Drones SAS
+ */
+
+#pragma once
+
+#include <time.h>
+
+/* State of the drone at a given time */
+struct drone_state {
+	/* Position in global frame [m] */
+	struct {
+		float x;
+		float y;
+		float z;
+	} position_global;
+
+	/* Velocity in global frame [m/s] */
+	struct {
+		float x;
+		float y;
+		float z;
+	} velocity;
+
+	/* Attitude [rad] */
+	struct {
+		float yaw;
+		float pitch;
+		float roll;
+	} attitude;
+};
+
+struct drone_state_reader;
+
+/**
+ * Create a reader of the drone state from telemetry. It owns a telemetry
+ * consumer and shall only be used from a single thread.
+ * @param section name of the telemetry section to read.
+ * @param ret_obj pointer to return created object.
+ * @return 0 in case of success, negative errno in case of error.
+ */
+int drone_state_reader_new(const char *section,
+			   struct drone_state_reader **ret_obj);
+
+/**
+ * Delete a drone state reader.
+ * @param self drone state reader.
+ */
+void drone_state_reader_destroy(struct drone_state_reader *self);
+
+/**
+ * Get the drone state at a given time. Position and velocity are linearly
+ * interpolated between the telemetry samples before and after the given
+ * time, attitude is taken from the closest one. If there is no sample after
+ * the given time, the latest sample is used as is.
+ * @param self drone state reader.
+ * @param ts time of the state.
+ * @param state pointer to return the state.
+ * @return 0 in case of success, -ENOENT if no sample is available, negative
+ *         errno in case of error.
+ */
+int drone_state_reader_get(struct drone_state_reader *self,
+			   const struct timespec *ts,
+			   struct drone_state *state);
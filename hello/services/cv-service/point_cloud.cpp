@@ -0,0 +1,297 @@
+/**
+ * Copyright (C) 2021 Parrot Drones SAS
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#define ULOG_TAG ms_point_cloud
+#include <ulog.h>
+ULOG_DECLARE_TAG(ULOG_TAG);
+
+#include "drone_state.h"
+#include "point_cloud.h"
+
+/* Voxel coordinates are packed on 21 bits each in hash keys */
+#define VOXEL_COORD_BITS 21
+#define VOXEL_COORD_MAX ((1 << (VOXEL_COORD_BITS - 1)) - 1)
+#define VOXEL_COORD_MASK ((1ULL << VOXEL_COORD_BITS) - 1)
+
+/* Slot of the open addressing voxel table */
+struct voxel {
+	uint64_t key;
+	/* Slot is used if generation matches the one of the table */
+	uint32_t generation;
+	uint32_t count;
+	float sum_x;
+	float sum_y;
+	float sum_z;
+};
+
+struct point_cloud {
+	struct point_cloud_config config;
+
+	/* Voxel table, twice as large as the maximum number of points so that
+	 * probe sequences stay short. Slots are not cleared between frames,
+	 * the generation is incremented instead */
+	struct voxel *voxels;
+	unsigned int voxel_mask;
+	unsigned int voxel_shift;
+	uint32_t generation;
+
+	/* Used slots in insertion order */
+	unsigned int *used;
+	unsigned int used_count;
+	unsigned int dropped;
+
+	/* Output cloud */
+	struct point3f *points;
+
+	/* Horizontal ray factor of each column */
+	float *col_factors;
+	unsigned int col_factors_size;
+};
+
+static inline uint64_t voxel_key(int32_t ix, int32_t iy, int32_t iz)
+{
+	return ((uint64_t)(ix & VOXEL_COORD_MASK) << (2 * VOXEL_COORD_BITS))
+	       | ((uint64_t)(iy & VOXEL_COORD_MASK) << VOXEL_COORD_BITS)
+	       | (uint64_t)(iz & VOXEL_COORD_MASK);
+}
+
+static inline unsigned int voxel_hash(const struct point_cloud *self,
+				      uint64_t key)
+{
+	/* Fibonacci hashing, keeps the upper bits of the product */
+	return (key * 0x9E3779B97F4A7C15ULL) >> self->voxel_shift;
+}
+
+/* Add a point given by its offset from the drone position, offsets are
+ * accumulated rather than global coordinates to keep float precision */
+static inline void voxel_add(struct point_cloud *self,
+			     const struct drone_state *state,
+			     float x,
+			     float y,
+			     float z,
+			     float inv_voxel_size)
+{
+	float fx = floorf((state->position_global.x + x) * inv_voxel_size);
+	float fy = floorf((state->position_global.y + y) * inv_voxel_size);
+	float fz = floorf((state->position_global.z + z) * inv_voxel_size);
+	uint64_t key;
+	unsigned int index;
+	struct voxel *voxel;
+
+	if (fabsf(fx) > VOXEL_COORD_MAX || fabsf(fy) > VOXEL_COORD_MAX
+	    || fabsf(fz) > VOXEL_COORD_MAX)
+		return;
+
+	key = voxel_key((int32_t)fx, (int32_t)fy, (int32_t)fz);
+	index = voxel_hash(self, key);
+	while (true) {
+		voxel = &self->voxels[index];
+		if (voxel->generation != self->generation) {
+			/* Free slot: new voxel */
+			if (self->used_count == self->config.max_points) {
+				self->dropped++;
+				return;
+			}
+			voxel->key = key;
+			voxel->generation = self->generation;
+			voxel->count = 1;
+			voxel->sum_x = x;
+			voxel->sum_y = y;
+			voxel->sum_z = z;
+			self->used[self->used_count++] = index;
+			return;
+		}
+		if (voxel->key == key) {
+			voxel->count++;
+			voxel->sum_x += x;
+			voxel->sum_y += y;
+			voxel->sum_z += z;
+			return;
+		}
+		index = (index + 1) & self->voxel_mask;
+	}
+}
+
+/* Rotation from camera (x right, y down, z forward) to global NED frame,
+ * columns are the camera axes */
+static void camera_rotation(const struct drone_state *state, float m[3][3])
+{
+	float cy = cosf(state->attitude.yaw), sy = sinf(state->attitude.yaw);
+	float cp = cosf(state->attitude.pitch);
+	float sp = sinf(state->attitude.pitch);
+	float cr = cosf(state->attitude.roll), sr = sinf(state->attitude.roll);
+
+	/* Body to global: Rz(yaw) * Ry(pitch) * Rx(roll) */
+	float r[3][3] = {
+		{cy * cp, cy * sp * sr - sy * cr, cy * sp * cr + sy * sr},
+		{sy * cp, sy * sp * sr + cy * cr, sy * sp * cr - cy * sr},
+		{-sp, cp * sr, cp * cr},
+	};
+
+	/* Camera x, y, z are body y, z, x */
+	for (int i = 0; i < 3; i++) {
+		m[i][0] = r[i][1];
+		m[i][1] = r[i][2];
+		m[i][2] = r[i][0];
+	}
+}
+
+int point_cloud_new(const struct point_cloud_config *config,
+		    struct point_cloud **ret_obj)
+{
+	struct point_cloud *self = NULL;
+	unsigned int voxel_count = 1;
+	unsigned int bits = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(config == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config->fx <= 0.f || config->fy <= 0.f,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config->voxel_size <= 0.f, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config->max_points == 0, EINVAL);
+
+	self = (struct point_cloud *)calloc(1, sizeof(*self));
+	if (self == NULL)
+		return -ENOMEM;
+	self->config = *config;
+	if (self->config.step == 0)
+		self->config.step = 1;
+
+	while (voxel_count < 2 * config->max_points) {
+		voxel_count <<= 1;
+		bits++;
+	}
+	self->voxel_mask = voxel_count - 1;
+	self->voxel_shift = 64 - bits;
+	/* A zero generation marks never used slots */
+	self->generation = 1;
+
+	self->voxels =
+		(struct voxel *)calloc(voxel_count, sizeof(*self->voxels));
+	self->used = (unsigned int *)calloc(config->max_points,
+					    sizeof(*self->used));
+	self->points = (struct point3f *)calloc(config->max_points,
+						sizeof(*self->points));
+	if (self->voxels == NULL || self->used == NULL
+	    || self->points == NULL) {
+		point_cloud_destroy(self);
+		return -ENOMEM;
+	}
+
+	*ret_obj = self;
+	return 0;
+}
+
+void point_cloud_destroy(struct point_cloud *self)
+{
+	if (self == NULL)
+		return;
+
+	free(self->voxels);
+	free(self->used);
+	free(self->points);
+	free(self->col_factors);
+	free(self);
+}
+
+int point_cloud_compute(struct point_cloud *self,
+			const void *data,
+			size_t stride,
+			unsigned int width,
+			unsigned int height,
+			const struct drone_state *state)
+{
+	const unsigned int step = self->config.step;
+	const float max_depth = self->config.max_depth;
+	const float inv_voxel_size = 1.f / self->config.voxel_size;
+	float fx = self->config.fx * width;
+	float fy = self->config.fy * height;
+	float cx = self->config.cx * width;
+	float cy = self->config.cy * height;
+	float m[3][3];
+
+	ULOG_ERRNO_RETURN_ERR_IF(data == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(state == NULL, EINVAL);
+
+	if (self->col_factors_size != width) {
+		float *factors = (float *)realloc(self->col_factors,
+						  width * sizeof(*factors));
+		if (factors == NULL)
+			return -ENOMEM;
+		self->col_factors = factors;
+		self->col_factors_size = width;
+	}
+	for (unsigned int u = 0; u < width; u++)
+		self->col_factors[u] = (u - cx) / fx;
+
+	/* Start a new frame: every slot becomes free */
+	self->generation++;
+	if (self->generation == 0) {
+		memset(self->voxels,
+		       0,
+		       (self->voxel_mask + 1) * sizeof(*self->voxels));
+		self->generation = 1;
+	}
+	self->used_count = 0;
+	self->dropped = 0;
+
+	camera_rotation(state, m);
+
+	/* A pixel (u, v) of depth d is at d * (a(u), b(v), 1) in the camera
+	 * frame, so in the global frame it is at
+	 * position + d * (a(u) * m0 + b(v) * m1 + m2), mi being the columns of
+	 * the rotation. The part depending on the row is computed once per
+	 * row */
+	for (unsigned int v = 0; v < height; v += step) {
+		const float *row =
+			(const float *)((const uint8_t *)data + v * stride);
+		float b = (v - cy) / fy;
+		float rx = b * m[0][1] + m[0][2];
+		float ry = b * m[1][1] + m[1][2];
+		float rz = b * m[2][1] + m[2][2];
+
+		for (unsigned int u = 0; u < width; u += step) {
+			float d = row[u];
+			float a = self->col_factors[u];
+
+			/* Also rejects NaN */
+			if (!(d > 0.f && d <= max_depth))
+				continue;
+
+			voxel_add(self,
+				  state,
+				  d * (a * m[0][0] + rx),
+				  d * (a * m[1][0] + ry),
+				  d * (a * m[2][0] + rz),
+				  inv_voxel_size);
+		}
+	}
+
+	/* Centroid of each voxel */
+	for (unsigned int i = 0; i < self->used_count; i++) {
+		const struct voxel *voxel = &self->voxels[self->used[i]];
+		float k = 1.f / voxel->count;
+		self->points[i].x = state->position_global.x + voxel->sum_x * k;
+		self->points[i].y = state->position_global.y + voxel->sum_y * k;
+		self->points[i].z = state->position_global.z + voxel->sum_z * k;
+	}
+
+	return 0;
+}
+
+const struct point3f *point_cloud_get(const struct point_cloud *self,
+				      unsigned int *ret_count,
+				      unsigned int *ret_dropped)
+{
+	*ret_count = self->used_count;
+	if (ret_dropped != NULL)
+		*ret_dropped = self->dropped;
+	return self->points;
+}
@@ -0,0 +1,90 @@
+/**
+ * Copyright (C) 2021 Parrot Drones SAS
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct drone_state;
+
+struct point_cloud_config {
+	/* Pinhole intrinsics of the depth stream: focal lengths and principal
+	 * point as ratios of the frame width (fx, cx) and height (fy, cy) */
+	float fx;
+	float fy;
+	float cx;
+	float cy;
+
+	/* Edge of the voxels used to downsample the cloud [m] */
+	float voxel_size;
+
+	/* Depth pixels above this are ignored [m] */
+	float max_depth;
+
+	/* One pixel every `step` columns and rows is projected */
+	unsigned int step;
+
+	/* Maximum number of points of the cloud, voxels are dropped beyond */
+	unsigned int max_points;
+};
+
+struct point3f {
+	float x;
+	float y;
+	float z;
+};
+
+struct point_cloud;
+
+/**
+ * Create a point cloud stage. All buffers are allocated here, except the
+ * per column ray factors which are resized when the frame width changes.
+ * @param config point cloud configuration.
+ * @param ret_obj pointer to return created object.
+ * @return 0 in case of success, negative errno in case of error.
+ */
+int point_cloud_new(const struct point_cloud_config *config,
+		    struct point_cloud **ret_obj);
+
+/**
+ * Delete a point cloud stage.
+ * @param self point cloud stage.
+ */
+void point_cloud_destroy(struct point_cloud *self);
+
+/**
+ * Back-project the valid pixels of a depth frame in the global frame and
+ * downsample them on a voxel grid, in a single pass. Each voxel of the
+ * resulting cloud is the centroid of the points falling in it.
+ *
+ * The stereo camera is assumed to look along the drone x axis, with its x
+ * axis on the drone y axis. The drone state gives the position and attitude
+ * (NED, yaw pitch roll) of the drone at the time of the frame.
+ * @param self point cloud stage.
+ * @param data RAW32 depth image [m].
+ * @param stride distance in bytes between two rows of the image.
+ * @param width number of columns of the image.
+ * @param height number of rows of the image.
+ * @param state drone state at the time of the frame.
+ * @return 0 in case of success, negative errno in case of error.
+ */
+int point_cloud_compute(struct point_cloud *self,
+			const void *data,
+			size_t stride,
+			unsigned int width,
+			unsigned int height,
+			const struct drone_state *state);
+
+/**
+ * Get the cloud computed by the last call to `point_cloud_compute`.
+ * @param self point cloud stage.
+ * @param ret_count pointer to return the number of points.
+ * @param ret_dropped pointer to return the number of points dropped because
+ *                    the cloud was full (optional).
+ * @return points of the cloud, valid until the next computation.
+ */
+const struct point3f *point_cloud_get(const struct point_cloud *self,
+				      unsigned int *ret_count,
+				      unsigned int *ret_dropped);
@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <errno.h>
+#include <math.h>
 #include <pthread.h>
 
 #define ULOG_TAG ms_processing
@@ -16,147 +17,744 @@ ULOG_DECLARE_TAG(ULOG_TAG);
 #include <libpomp.h>
 #include <video-ipc/vipc_client.h>
 
-#include <opencv2/opencv.hpp>
-
+#include "depth_stats.h"
+#include "cloud_shm.h"
+#include "drone_state.h"
 #include "processing.h"
+#include "ttc.h"
+
+/* Rectangle of pixels */
+struct rect {
+	unsigned int x;
+	unsigned int y;
+	unsigned int width;
+	unsigned int height;
+};
+
+/* Size of a cache line, workers are aligned on it */
+#define PROCESSING_CACHE_LINE 64
+
+/* Aligned and padded to a cache line, so that the partial statistics of
+ * neighbour workers in the pipeline array never share one */
+struct __attribute__((aligned(PROCESSING_CACHE_LINE))) processing_worker {
+	struct processing_pipeline *pipeline;
+	unsigned int index;
+	pthread_t thread;
+
+	/* Partial depth statistics of each grid cell for the rows handled by
+	 * the worker, only written by the worker itself */
+	struct depth_stats cells[PROCESSING_GRID_SIZE];
+
+	/* Partial depth sketch of the rows handled by the worker */
+	struct depth_sketch sketch;
+
+	/* Partial sum of the refined bin for the rows handled by the worker */
+	struct depth_bin_sum refine;
 
-// HIST_RANGE_LOW < HIST_RANGE_HIGH
-#define HIST_RANGE_LOW 0.f                            // [m]
-#define HIST_RANGE_HIGH 15.f                          // [m]
-#define HIST_RANGE (HIST_RANGE_HIGH - HIST_RANGE_LOW) // [m]
-#define HIST_SIZE 10
+	/* Last pool generation handled by the worker */
+	unsigned int generation;
+};
+
+/* Pipeline processing whole frames. Each pipeline has its own background
+ * thread, pool of workers and buffers so that several frames can be
+ * processed concurrently */
+struct processing_pipeline {
+	struct processing *processing;
+	pthread_t thread;
+	bool started;
+
+	/* Fields protected by the mutex of the processing object */
+	struct processing_input input;
+	bool input_available;
+	/* Timestamp of the frame being processed, if busy */
+	uint64_t frame_ts_ns;
+	bool busy;
+	/* Output of the last frame, waiting for the frames given before it to
+	 * be delivered. The pipeline does not take a new frame meanwhile */
+	struct processing_output output;
+	uint64_t output_ts_ns;
+	bool output_ready;
+
+	/* Depth sketch of the current frame */
+	struct depth_sketch sketch;
+
+	/* Point cloud stage, its points are published when the output is
+	 * delivered */
+	struct point_cloud *point_cloud;
+	bool cloud_ready;
+
+	/* Drone state telemetry */
+	struct drone_state_reader *drone_state_reader;
+
+	/* Pool of workers sharing the rows of a frame. Worker 0 is the
+	 * pipeline thread itself, the other ones have their own thread */
+	struct processing_worker *workers;
+	unsigned int started_workers;
+	pthread_mutex_t pool_mutex;
+	pthread_cond_t pool_cond;
+	pthread_cond_t pool_done_cond;
+	const struct vipc_frame *pool_frame;
+	struct rect pool_roi;
+	/* Bin to refine at full resolution, -1 to compute statistics */
+	int pool_refine_bin;
+	unsigned int pool_generation;
+	unsigned int pool_remaining;
+	bool pool_stop_requested;
+};
+
+/* Single producer single consumer queue of outputs: the processing thread
+ * pushes, the main loop pops. Indices are free running, the slot of an index
+ * is the index modulo the queue size */
+struct output_queue {
+	/* Next index to pop, only written by the consumer */
+	unsigned int head;
+	struct processing_output items[PROCESSING_OUTPUT_QUEUE_SIZE];
+	/* Next index to push, only written by the producer */
+	unsigned int tail;
+};
 
 struct processing {
 	struct pomp_evt *evt;
+	processing_release_frame_t release_frame;
+	void *release_userdata;
 	bool started;
 	bool stop_requested;
-	pthread_t thread;
+	/* Protects the inputs and outputs of the pipelines and the ordered
+	 * stage, the condition is broadcast when any of them changes */
 	pthread_mutex_t mutex;
 	pthread_cond_t cond;
 
-	struct processing_input input;
-	bool input_available;
+	/* Pipelines, frames are given to them round-robin */
+	unsigned int pipeline_count;
+	struct processing_pipeline *pipelines;
+	unsigned int next_pipeline;
 
-	struct processing_output output;
-	bool output_available;
+	struct output_queue output_queue;
+
+	/* Backpressure counters, read with atomic loads and written under the
+	 * mutex */
+	struct processing_stats stats;
+
+	/* Region of interest as ratios of the frame dimensions */
+	struct {
+		float x;
+		float y;
+		float width;
+		float height;
+	} roi;
+	unsigned int sample_stride;
+	bool refine_dominant_bin;
+	enum processing_estimator estimator;
+	/* Number of workers of each pipeline */
+	unsigned int thread_count;
+
+	/* Outputs are delivered by the ordered stage, under the mutex and in
+	 * frame order: point clouds are published in the shared memory and the
+	 * depth history gives the closing speed */
+	struct cloud_shm *cloud_shm;
+	struct ttc_estimator ttc;
 };
 
-static void do_step(struct processing *self,
+static inline void counter_store(unsigned int *counter, unsigned int value)
+{
+	__atomic_store_n(counter, value, __ATOMIC_RELAXED);
+}
+
+static inline unsigned int counter_load(const unsigned int *counter)
+{
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static int output_queue_push(struct output_queue *queue,
+			     const struct processing_output *output,
+			     unsigned int *ret_count)
+{
+	unsigned int tail = queue->tail;
+	unsigned int head;
+
+	head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+
+	if (tail - head == PROCESSING_OUTPUT_QUEUE_SIZE)
+		return -ENOBUFS;
+
+	queue->items[tail % PROCESSING_OUTPUT_QUEUE_SIZE] = *output;
+
+	/* Publish the item after it has been written */
+	__atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+	*ret_count = tail + 1 - head;
+	return 0;
+}
+
+static int output_queue_pop(struct output_queue *queue,
+			    struct processing_output *output)
+{
+	unsigned int head = queue->head;
+	unsigned int tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+
+	if (head == tail)
+		return -ENOENT;
+
+	*output = queue->items[head % PROCESSING_OUTPUT_QUEUE_SIZE];
+
+	/* Give the slot back after it has been read */
+	__atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static void release_frame(struct processing *self,
+			  const struct vipc_frame *frame)
+{
+	if (self->release_frame != NULL)
+		(*self->release_frame)(frame, self->release_userdata);
+	else
+		vipcc_release_safe(frame);
+}
+
+/* Index of the first sample at or after a position */
+static inline unsigned int sample_index(unsigned int pos, unsigned int step)
+{
+	return (pos + step - 1) / step;
+}
+
+static void worker_compute_stats(struct processing_worker *worker)
+{
+	const struct processing_pipeline *pipeline = worker->pipeline;
+	const struct processing *self = pipeline->processing;
+	const struct vipc_frame *frame = pipeline->pool_frame;
+	const struct rect *roi = &pipeline->pool_roi;
+	const void *data = (const void *)frame->planes[0].virt_addr;
+	const size_t stride = frame->planes[0].stride;
+	const unsigned int step = self->sample_stride;
+	/* The sketch costs a scattered increment per pixel, it is only filled
+	 * for the estimator using it */
+	struct depth_sketch *sketch =
+		self->estimator == PROCESSING_ESTIMATOR_MEDIAN ? &worker->sketch
+							       : NULL;
+
+	/* Sampled rows of the region of interest are shared between the
+	 * workers. Samples are aligned on the region of interest so that
+	 * they do not depend on the number of workers */
+	unsigned int sampled_rows = sample_index(roi->height, step);
+	unsigned int row_begin =
+		sampled_rows * worker->index / self->thread_count;
+	unsigned int row_end =
+		sampled_rows * (worker->index + 1) / self->thread_count;
+
+	for (unsigned int i = 0; i < PROCESSING_GRID_SIZE; i++)
+		depth_stats_reset(&worker->cells[i]);
+	if (sketch != NULL)
+		depth_sketch_reset(sketch);
+
+	/* Visit the part of each grid cell lying in the rows of the worker,
+	 * every sampled pixel is read once */
+	for (unsigned int r = 0; r < PROCESSING_GRID_ROWS; r++) {
+		unsigned int k = sample_index(
+			roi->height * r / PROCESSING_GRID_ROWS, step);
+		unsigned int k_end = sample_index(
+			roi->height * (r + 1) / PROCESSING_GRID_ROWS, step);
+		if (k < row_begin)
+			k = row_begin;
+		if (k_end > row_end)
+			k_end = row_end;
+		if (k >= k_end)
+			continue;
+
+		for (unsigned int c = 0; c < PROCESSING_GRID_COLS; c++) {
+			unsigned int x = roi->width * c / PROCESSING_GRID_COLS;
+			unsigned int x_end =
+				roi->width * (c + 1) / PROCESSING_GRID_COLS;
+
+			/* First sampled column of the cell */
+			x = sample_index(x, step) * step;
+			if (x >= x_end)
+				continue;
+			depth_stats_add_block(
+				&worker->cells[r * PROCESSING_GRID_COLS + c],
+				sketch,
+				data,
+				stride,
+				roi->x + x,
+				roi->y + k * step,
+				x_end - x,
+				(k_end - k - 1) * step + 1,
+				step);
+		}
+	}
+}
+
+static void worker_compute_refine(struct processing_worker *worker)
+{
+	const struct processing_pipeline *pipeline = worker->pipeline;
+	const struct processing *self = pipeline->processing;
+	const struct vipc_frame *frame = pipeline->pool_frame;
+	const struct rect *roi = &pipeline->pool_roi;
+	unsigned int row_begin =
+		roi->height * worker->index / self->thread_count;
+	unsigned int row_end =
+		roi->height * (worker->index + 1) / self->thread_count;
+
+	memset(&worker->refine, 0, sizeof(worker->refine));
+	depth_stats_add_bin_block(&worker->refine,
+				  (const void *)frame->planes[0].virt_addr,
+				  frame->planes[0].stride,
+				  roi->x,
+				  roi->y + row_begin,
+				  roi->width,
+				  row_end - row_begin,
+				  pipeline->pool_refine_bin);
+}
+
+static void worker_compute(struct processing_worker *worker)
+{
+	if (worker->pipeline->pool_refine_bin < 0)
+		worker_compute_stats(worker);
+	else
+		worker_compute_refine(worker);
+}
+
+static void *worker_entry(void *userdata)
+{
+	struct processing_worker *worker =
+		(struct processing_worker *)userdata;
+	struct processing_pipeline *self = worker->pipeline;
+
+	pthread_mutex_lock(&self->pool_mutex);
+
+	while (true) {
+		/* Wait for a new frame to share */
+		while (!self->pool_stop_requested
+		       && worker->generation == self->pool_generation)
+			pthread_cond_wait(&self->pool_cond, &self->pool_mutex);
+		if (self->pool_stop_requested)
+			break;
+		worker->generation = self->pool_generation;
+
+		/* Do the heavy computation outside lock */
+		pthread_mutex_unlock(&self->pool_mutex);
+		worker_compute(worker);
+		pthread_mutex_lock(&self->pool_mutex);
+
+		if (--self->pool_remaining == 0)
+			pthread_cond_signal(&self->pool_done_cond);
+	}
+
+	pthread_mutex_unlock(&self->pool_mutex);
+
+	return NULL;
+}
+
+/* Run a task on all workers, `refine_bin` selects the task as
+ * `pool_refine_bin` */
+static void pool_run(struct processing_pipeline *self,
+		     const struct vipc_frame *frame,
+		     const struct rect *roi,
+		     int refine_bin)
+{
+	/* Share the frame with the other workers */
+	pthread_mutex_lock(&self->pool_mutex);
+	self->pool_frame = frame;
+	self->pool_roi = *roi;
+	self->pool_refine_bin = refine_bin;
+	self->pool_remaining = self->started_workers;
+	self->pool_generation++;
+	pthread_cond_broadcast(&self->pool_cond);
+	pthread_mutex_unlock(&self->pool_mutex);
+
+	/* Pipeline thread handles the first rows */
+	worker_compute(&self->workers[0]);
+
+	pthread_mutex_lock(&self->pool_mutex);
+	while (self->pool_remaining > 0)
+		pthread_cond_wait(&self->pool_done_cond, &self->pool_mutex);
+	self->pool_frame = NULL;
+	pthread_mutex_unlock(&self->pool_mutex);
+}
+
+static void pool_compute(struct processing_pipeline *self,
+			 const struct vipc_frame *frame,
+			 const struct rect *roi,
+			 struct depth_stats *cells,
+			 struct depth_sketch *sketch)
+{
+	const unsigned int thread_count = self->processing->thread_count;
+
+	pool_run(self, frame, roi, -1);
+
+	/* Each worker only wrote its own partial statistics */
+	for (unsigned int i = 0; i < PROCESSING_GRID_SIZE; i++) {
+		depth_stats_reset(&cells[i]);
+		for (unsigned int j = 0; j < thread_count; j++) {
+			depth_stats_merge(&cells[i],
+					  &self->workers[j].cells[i]);
+		}
+	}
+	if (sketch == NULL)
+		return;
+	*sketch = self->workers[0].sketch;
+	for (unsigned int j = 1; j < thread_count; j++)
+		depth_sketch_merge(sketch, &self->workers[j].sketch);
+}
+
+static void pool_refine(struct processing_pipeline *self,
+			const struct vipc_frame *frame,
+			const struct rect *roi,
+			int bin,
+			struct depth_bin_sum *bin_sum)
+{
+	pool_run(self, frame, roi, bin);
+
+	memset(bin_sum, 0, sizeof(*bin_sum));
+	for (unsigned int j = 0; j < self->processing->thread_count; j++) {
+		bin_sum->count += self->workers[j].refine.count;
+		bin_sum->sum += self->workers[j].refine.sum;
+	}
+}
+
+static void pool_stop(struct processing_pipeline *self)
+{
+	pthread_mutex_lock(&self->pool_mutex);
+	self->pool_stop_requested = true;
+	pthread_cond_broadcast(&self->pool_cond);
+	pthread_mutex_unlock(&self->pool_mutex);
+
+	for (unsigned int i = 1; i <= self->started_workers; i++)
+		pthread_join(self->workers[i].thread, NULL);
+	self->started_workers = 0;
+}
+
+static int pool_start(struct processing_pipeline *self)
+{
+	int res = 0;
+
+	self->pool_stop_requested = false;
+	self->pool_generation = 0;
+	for (unsigned int i = 1; i < self->processing->thread_count; i++) {
+		self->workers[i].generation = 0;
+		res = pthread_create(&self->workers[i].thread,
+				     NULL,
+				     &worker_entry,
+				     &self->workers[i]);
+		if (res != 0) {
+			ULOG_ERRNO("pthread_create", res);
+			pool_stop(self);
+			return -res;
+		}
+		self->started_workers++;
+	}
+
+	return 0;
+}
+
+/* Projection of the drone velocity on the viewing axis of the stereo camera,
+ * assumed to be the drone x axis */
+static float velocity_closing_speed(const struct drone_state *state)
+{
+	float cos_pitch = cosf(state->attitude.pitch);
+	float fx = cos_pitch * cosf(state->attitude.yaw);
+	float fy = cos_pitch * sinf(state->attitude.yaw);
+	float fz = -sinf(state->attitude.pitch);
+
+	return state->velocity.x * fx + state->velocity.y * fy
+	       + state->velocity.z * fz;
+}
+
+/* Point cloud of the whole frame, published when the output is delivered.
+ * Returns true if the cloud was computed */
+static bool compute_cloud(struct processing_pipeline *pipeline,
+			  const struct vipc_frame *frame,
+			  const struct drone_state *state,
+			  struct processing_output *output)
+{
+	int res = 0;
+
+	res = point_cloud_compute(pipeline->point_cloud,
+				  (const void *)frame->planes[0].virt_addr,
+				  frame->planes[0].stride,
+				  frame->width,
+				  frame->height,
+				  state);
+	if (res < 0) {
+		ULOG_ERRNO("point_cloud_compute", -res);
+		return false;
+	}
+
+	point_cloud_get(pipeline->point_cloud,
+			&output->cloud_size,
+			&output->cloud_dropped);
+	return true;
+}
+
+/* Region of interest in pixels of a frame */
+static void get_roi(const struct processing *self,
+		    const struct vipc_frame *frame,
+		    struct rect *roi)
+{
+	if (self->roi.width <= 0.f || self->roi.height <= 0.f) {
+		roi->x = 0;
+		roi->y = 0;
+		roi->width = frame->width;
+		roi->height = frame->height;
+		return;
+	}
+
+	roi->x = self->roi.x * frame->width;
+	roi->y = self->roi.y * frame->height;
+	roi->width = self->roi.width * frame->width;
+	roi->height = self->roi.height * frame->height;
+	if (roi->x + roi->width > frame->width)
+		roi->width = frame->width - roi->x;
+	if (roi->y + roi->height > frame->height)
+		roi->height = frame->height - roi->y;
+}
+
+/* Drone state at the time of the frame, zero if unknown */
+static void get_drone_state(struct processing_pipeline *pipeline,
+			    const struct timespec *ts,
+			    struct drone_state *state)
+{
+	int res = 0;
+
+	memset(state, 0, sizeof(*state));
+	if (pipeline->drone_state_reader == NULL)
+		return;
+
+	res = drone_state_reader_get(pipeline->drone_state_reader, ts, state);
+	if (res < 0)
+		memset(state, 0, sizeof(*state));
+}
+
+/* Per frame part of the processing, run by the pipeline thread without lock.
+ * The closing speed is only the one of the drone velocity, the depth history
+ * is used by the ordered stage */
+static void do_step(struct processing_pipeline *pipeline,
 		    const struct processing_input *input,
 		    struct processing_output *output)
 {
-	const int hist_size = HIST_SIZE;
-	const float range_tuple[] = {HIST_RANGE_LOW, HIST_RANGE_HIGH};
-	const float *ranges = {range_tuple};
-	const float bin_size = HIST_RANGE / HIST_SIZE;
-	const cv::Mat depth_frame(input->frame->height,
-				  input->frame->width,
-				  CV_32F,
-				  (void *)input->frame->planes[0].virt_addr,
-				  input->frame->planes[0].stride);
-	cv::Mat mask_frame(
-		input->frame->height, input->frame->width, CV_8UC1, 1);
-	cv::Mat hist;
-	int hist_max_index;
+	struct processing *self = pipeline->processing;
+	struct depth_stats cells[PROCESSING_GRID_SIZE];
+	struct depth_stats stats;
+	struct depth_bin_sum bin_sum;
+	struct drone_state state;
+	struct rect roi;
+	struct timespec ts;
+	int bin;
 	float depth_mean;
+	/* Median, 10th and 90th percentiles */
+	static const float quantiles[3] = {0.5f, 0.1f, 0.9f};
+	float depths[3] = {0.f, 0.f, 0.f};
+	bool median = self->estimator == PROCESSING_ESTIMATOR_MEDIAN;
 
-	/* Initialize mask: reject negative and infinity depth pixels */
-	for (int i = 0; i < depth_frame.rows; ++i) {
-		for (int j = 0; j < depth_frame.cols; ++j) {
-			float depth = depth_frame.at<float>(i, j);
-			if (depth < 0.f || depth == INFINITY)
-				mask_frame.at<uint8_t>(i, j) = 0;
-		}
+	/* Timestamp of the frame */
+	ts.tv_sec = input->frame->ts_sof_ns / 1000000000UL;
+	ts.tv_nsec = input->frame->ts_sof_ns % 1000000000UL;
+
+	/* Telemetry is looked up here rather than in the main loop */
+	get_drone_state(pipeline, &ts, &state);
+
+	/* Compute histogram and per bin depth sums of each grid cell, and the
+	 * depth sketch of the region of interest for the median estimator, in
+	 * a single pass. Negative, infinity and NaN depth pixels are
+	 * rejected */
+	get_roi(self, input->frame, &roi);
+	pool_compute(pipeline,
+		     input->frame,
+		     &roi,
+		     cells,
+		     median ? &pipeline->sketch : NULL);
+	if (median)
+		depth_sketch_quantiles(&pipeline->sketch, quantiles, depths, 3);
+
+	/* The whole frame is the union of the grid cells */
+	depth_stats_reset(&stats);
+	for (unsigned int i = 0; i < PROCESSING_GRID_SIZE; i++) {
+		depth_stats_merge(&stats, &cells[i]);
+		output->grid.min[i] = cells[i].min;
+		output->grid.mean[i] =
+			depth_stats_dominant_mean(&cells[i], NULL);
+		output->grid.valid_ratio[i] =
+			depth_stats_valid_ratio(&cells[i]);
 	}
 
-	/* Compute histogram */
-	cv::calcHist(&depth_frame,
-		     1 /* image count */,
-		     nullptr /* channels */,
-		     mask_frame,
-		     hist,
-		     1, /* dimensions */
-		     &hist_size,
-		     &ranges);
-
-	/* Find histogram index with highest count */
-	cv::minMaxIdx(hist, nullptr, nullptr, nullptr, &hist_max_index);
-
-	float low = HIST_RANGE_LOW + hist_max_index * bin_size;
-	float high = low + bin_size;
-
-	/* Reject depth pixels not in the bin with most frequent depth range */
-	for (int i = 0; i < depth_frame.rows; ++i)
-		for (int j = 0; j < depth_frame.cols; ++j) {
-			float depth = depth_frame.at<float>(i, j);
-			if (depth < low || depth > high)
-				mask_frame.at<uint8_t>(i, j) = 0;
-		}
+	/* Compute mean of depth pixels in the bin with most frequent depth
+	 * range */
+	depth_mean = depth_stats_dominant_mean(&stats, &bin);
 
-	/* Compute mean of remaining depth pixels */
-	depth_mean = cv::mean(depth_frame, mask_frame).val[0];
+	/* The median replaces it if configured. Otherwise the dominant range
+	 * found on sampled pixels is accurate enough, its mean is refined with
+	 * every pixel */
+	if (median) {
+		depth_mean = depths[0];
+	} else if (self->refine_dominant_bin && self->sample_stride > 1
+		   && stats.count[bin] > 0) {
+		pool_refine(pipeline, input->frame, &roi, bin, &bin_sum);
+		if (bin_sum.count > 0)
+			depth_mean = bin_sum.sum / bin_sum.count;
+	}
 
-	ULOGD("depth_mean: %f", depth_mean);
+	pipeline->cloud_ready =
+		pipeline->point_cloud != NULL
+		&& compute_cloud(pipeline, input->frame, &state, output);
 
 	/* Fill output */
-	output->x = input->position_global.x;
-	output->y = input->position_global.y;
-	output->z = input->position_global.z;
+	output->x = state.position_global.x;
+	output->y = state.position_global.y;
+	output->z = state.position_global.z;
 	output->depth_mean = depth_mean;
 	output->confidence = 1.0f;
+	output->depth_median = depths[0];
+	output->depth_p10 = depths[1];
+	output->depth_p90 = depths[2];
+	output->closing_speed = velocity_closing_speed(&state);
 
 	/* Save timestamp of the frame */
-	output->ts.tv_sec = input->frame->ts_sof_ns / 1000000000UL;
-	output->ts.tv_nsec = input->frame->ts_sof_ns % 1000000000UL;
+	output->ts = ts;
 }
 
-static void *thread_entry(void *userdata)
+/* Ordered stage of the output of a pipeline, called under the mutex in the
+ * order of the frames */
+static void deliver_output(struct processing *self,
+			   struct processing_pipeline *pipeline)
 {
 	int res = 0;
-	struct processing *self = (struct processing *)userdata;
+	struct processing_output *output = &pipeline->output;
+	const struct point3f *points;
+	unsigned int count;
+
+	/* The drone velocity gives the closing speed as soon as the drone
+	 * moves, the depth history also catches obstacles moving towards a
+	 * still drone. Frames without any valid depth are left out of the
+	 * history */
+	if (output->depth_mean > 0.f) {
+		ttc_estimator_add(
+			&self->ttc, pipeline->output_ts_ns, output->depth_mean);
+		output->closing_speed =
+			fmaxf(output->closing_speed,
+			      ttc_estimator_depth_rate(&self->ttc));
+	}
+	output->ttc = output->depth_mean > 0.f
+			      ? ttc_compute(output->depth_mean,
+					    output->closing_speed)
+			      : INFINITY;
+
+	ULOGD("depth_mean: %f closing_speed: %f",
+	      output->depth_mean,
+	      output->closing_speed);
+
+	/* Clouds are published in the shared memory in frame order too */
+	if (pipeline->cloud_ready) {
+		points = point_cloud_get(pipeline->point_cloud, &count, NULL);
+		res = cloud_shm_publish(
+			self->cloud_shm, pipeline->output_ts_ns, points, count);
+		if (res < 0)
+			ULOG_ERRNO("cloud_shm_publish", -res);
+	}
+
+	/* Queue output data, the main loop is late if the queue is full: drop
+	 * the newest output rather than block */
+	res = output_queue_push(&self->output_queue, output, &count);
+	if (res < 0) {
+		counter_store(&self->stats.dropped_outputs,
+			      self->stats.dropped_outputs + 1);
+	} else if (count > self->stats.output_queue_high_water) {
+		counter_store(&self->stats.output_queue_high_water, count);
+	}
+	pipeline->output_ready = false;
+
+	/* Notify main loop that result is available */
+	res = pomp_evt_signal(self->evt);
+	if (res < 0)
+		ULOG_ERRNO("pomp_evt_signal", -res);
+}
+
+/* Deliver the outputs of the pipelines in frame order, called under the
+ * mutex. An output waits as long as an older frame is pending or being
+ * processed by another pipeline */
+static void deliver_ready_outputs(struct processing *self)
+{
+	struct processing_pipeline *pipeline;
+	struct processing_pipeline *next;
+	uint64_t oldest_ts_ns;
+	bool delivered = false;
+
+	while (true) {
+		next = NULL;
+		oldest_ts_ns = UINT64_MAX;
+		for (unsigned int i = 0; i < self->pipeline_count; i++) {
+			pipeline = &self->pipelines[i];
+			if (pipeline->output_ready
+			    && (next == NULL
+				|| pipeline->output_ts_ns
+					   < next->output_ts_ns))
+				next = pipeline;
+			if (pipeline->busy
+			    && pipeline->frame_ts_ns < oldest_ts_ns)
+				oldest_ts_ns = pipeline->frame_ts_ns;
+			if (pipeline->input_available
+			    && pipeline->input.frame->ts_sof_ns < oldest_ts_ns)
+				oldest_ts_ns = pipeline->input.frame->ts_sof_ns;
+		}
+		if (next == NULL || next->output_ts_ns > oldest_ts_ns)
+			break;
+
+		deliver_output(self, next);
+		delivered = true;
+	}
+
+	/* The pipelines of the delivered outputs can take a new frame */
+	if (delivered)
+		pthread_cond_broadcast(&self->cond);
+}
+
+static void *pipeline_entry(void *userdata)
+{
+	int res = 0;
+	struct processing_pipeline *pipeline =
+		(struct processing_pipeline *)userdata;
+	struct processing *self = pipeline->processing;
 	struct processing_input local_input;
-	struct processing_output local_output;
 
 	pthread_mutex_lock(&self->mutex);
 
-	while (!self->stop_requested) {
-		/* Atomically unlock the mutex, wait for condition and then
-		  re-lock the mutex when condition is signaled */
-		res = pthread_cond_wait(&self->cond, &self->mutex);
-		if (res != 0) {
-			ULOG_ERRNO("pthread_cond_wait", res);
-			continue;
-		}
+	while (true) {
+		/* Outputs of other pipelines may have been waiting for the last
+		 * frame of this one, or for a dropped input */
+		deliver_ready_outputs(self);
 
-		/* Check booleans in case of spurious wakeup */
 		if (self->stop_requested)
 			break;
-		if (!self->input_available)
+
+		/* Atomically unlock the mutex, wait for condition and then
+		  re-lock the mutex when condition is signaled. Do not wait if
+		  an input was given before the thread got there. A new frame
+		  is only taken once the previous output has been delivered */
+		if (!pipeline->input_available || pipeline->output_ready) {
+			res = pthread_cond_wait(&self->cond, &self->mutex);
+			if (res != 0)
+				ULOG_ERRNO("pthread_cond_wait", res);
 			continue;
+		}
 
 		/* Copy locally input data */
-		local_input = self->input;
-		memset(&self->input, 0, sizeof(self->input));
-		self->input_available = false;
+		local_input = pipeline->input;
+		memset(&pipeline->input, 0, sizeof(pipeline->input));
+		pipeline->input_available = false;
+		pipeline->frame_ts_ns = local_input.frame->ts_sof_ns;
+		pipeline->busy = true;
 
-		/* Do the heavy computation outside lock */
+		/* Do the heavy computation outside lock, the output is not read
+		 * by other threads until it is ready */
 		pthread_mutex_unlock(&self->mutex);
-		memset(&local_output, 0, sizeof(local_output));
-		do_step(self, &local_input, &local_output);
+		memset(&pipeline->output, 0, sizeof(pipeline->output));
+		do_step(pipeline, &local_input, &pipeline->output);
 		pthread_mutex_lock(&self->mutex);
 
 		/* Done with the input frame */
-		vipcc_release_safe(local_input.frame);
+		release_frame(self, local_input.frame);
 		memset(&local_input, 0, sizeof(local_input));
 
-		/* Copy output data */
-		self->output = local_output;
-		self->output_available = true;
-
-		/* Notify main loop that result is available */
-		res = pomp_evt_signal(self->evt);
-		if (res < 0)
-			ULOG_ERRNO("pomp_evt_signal", -res);
+		pipeline->output_ts_ns = pipeline->frame_ts_ns;
+		pipeline->output_ready = true;
+		pipeline->busy = false;
 	}
 
 	pthread_mutex_unlock(&self->mutex);
@@ -164,23 +762,183 @@ static void *thread_entry(void *userdata)
 	return NULL;
 }
 
-int processing_new(struct pomp_evt *evt, struct processing **ret_obj)
+static void pipeline_clear(struct processing_pipeline *pipeline)
+{
+	pthread_mutex_destroy(&pipeline->pool_mutex);
+	pthread_cond_destroy(&pipeline->pool_cond);
+	pthread_cond_destroy(&pipeline->pool_done_cond);
+
+	point_cloud_destroy(pipeline->point_cloud);
+	drone_state_reader_destroy(pipeline->drone_state_reader);
+	free(pipeline->workers);
+	memset(pipeline, 0, sizeof(*pipeline));
+}
+
+static int pipeline_init(struct processing *self,
+			 struct processing_pipeline *pipeline,
+			 const struct processing_config *config)
 {
+	int res = 0;
+
+	pipeline->processing = self;
+	pthread_mutex_init(&pipeline->pool_mutex, NULL);
+	pthread_cond_init(&pipeline->pool_cond, NULL);
+	pthread_cond_init(&pipeline->pool_done_cond, NULL);
+
+	/* The array honours the alignment of the workers */
+	res = posix_memalign((void **)&pipeline->workers,
+			     PROCESSING_CACHE_LINE,
+			     config->thread_count * sizeof(*pipeline->workers));
+	if (res != 0) {
+		pipeline->workers = NULL;
+		res = -res;
+		goto error;
+	}
+	memset(pipeline->workers,
+	       0,
+	       config->thread_count * sizeof(*pipeline->workers));
+	for (unsigned int i = 0; i < config->thread_count; i++) {
+		pipeline->workers[i].pipeline = pipeline;
+		pipeline->workers[i].index = i;
+	}
+
+	/* Each pipeline has its own telemetry consumer */
+	if (config->tlm_section != NULL) {
+		res = drone_state_reader_new(config->tlm_section,
+					     &pipeline->drone_state_reader);
+		if (res < 0) {
+			ULOG_ERRNO("drone_state_reader_new", -res);
+			goto error;
+		}
+	}
+
+	if (config->cloud.shm_name != NULL) {
+		res = point_cloud_new(&config->cloud.params,
+				      &pipeline->point_cloud);
+		if (res < 0) {
+			ULOG_ERRNO("point_cloud_new", -res);
+			goto error;
+		}
+	}
+
+	return 0;
+
+error:
+	pipeline_clear(pipeline);
+	return res;
+}
+
+/* Stop the threads of the pipelines, including partially started ones */
+static void pipelines_stop(struct processing *self)
+{
+	struct processing_pipeline *pipeline;
+
+	/* Ask threads to stop */
+	pthread_mutex_lock(&self->mutex);
+	self->stop_requested = true;
+	pthread_cond_broadcast(&self->cond);
+	pthread_mutex_unlock(&self->mutex);
+
+	/* Wait for threads, the frame being processed is completed first */
+	for (unsigned int i = 0; i < self->pipeline_count; i++) {
+		pipeline = &self->pipelines[i];
+		if (pipeline->started) {
+			pthread_join(pipeline->thread, NULL);
+			pipeline->started = false;
+		}
+		pool_stop(pipeline);
+	}
+}
+
+static inline bool ratio_is_valid(float ratio)
+{
+	return ratio >= 0.f && ratio <= 1.f;
+}
+
+int processing_new(const struct processing_config *config,
+		   struct pomp_evt *evt,
+		   struct processing **ret_obj)
+{
+	int res = 0;
 	struct processing *self = NULL;
+	unsigned int pipeline_count;
 	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
 	*ret_obj = NULL;
+	ULOG_ERRNO_RETURN_ERR_IF(config == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(evt == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config->thread_count == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		config->thread_count > PROCESSING_MAX_THREAD_COUNT, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		config->pipeline_count > PROCESSING_MAX_PIPELINE_COUNT, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		config->sample_stride > PROCESSING_MAX_SAMPLE_STRIDE, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(!ratio_is_valid(config->roi.x), EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(!ratio_is_valid(config->roi.y), EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(!ratio_is_valid(config->roi.width), EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(!ratio_is_valid(config->roi.height), EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		config->estimator != PROCESSING_ESTIMATOR_DOMINANT_BIN
+			&& config->estimator != PROCESSING_ESTIMATOR_MEDIAN,
+		EINVAL);
 
 	self = (struct processing *)calloc(1, sizeof(*self));
 	if (self == NULL)
 		return -ENOMEM;
 
+	self->thread_count = config->thread_count;
+	pipeline_count = config->pipeline_count > 1 ? config->pipeline_count
+						    : 1;
+	self->pipelines = (struct processing_pipeline *)calloc(
+		pipeline_count, sizeof(*self->pipelines));
+	if (self->pipelines == NULL) {
+		res = -ENOMEM;
+		goto error;
+	}
+	/* Only initialized pipelines are counted */
+	for (unsigned int i = 0; i < pipeline_count; i++) {
+		res = pipeline_init(self, &self->pipelines[i], config);
+		if (res < 0)
+			goto error;
+		self->pipeline_count++;
+	}
+
+	if (config->cloud.shm_name != NULL) {
+		res = cloud_shm_writer_new(config->cloud.shm_name,
+					   config->cloud.shm_slot_count,
+					   config->cloud.params.max_points,
+					   &self->cloud_shm);
+		if (res < 0) {
+			ULOG_ERRNO("cloud_shm_writer_new", -res);
+			goto error;
+		}
+	}
+
+	self->roi.x = config->roi.x;
+	self->roi.y = config->roi.y;
+	self->roi.width = config->roi.width;
+	self->roi.height = config->roi.height;
+	self->sample_stride =
+		config->sample_stride > 1 ? config->sample_stride : 1;
+	self->refine_dominant_bin = config->refine_dominant_bin;
+	self->estimator = config->estimator;
+
 	self->evt = evt;
+	self->release_frame = config->release_frame;
+	self->release_userdata = config->release_userdata;
 	pthread_mutex_init(&self->mutex, NULL);
 	pthread_cond_init(&self->cond, NULL);
 
 	*ret_obj = self;
 	return 0;
+
+error:
+	cloud_shm_destroy(self->cloud_shm);
+	for (unsigned int i = 0; i < self->pipeline_count; i++)
+		pipeline_clear(&self->pipelines[i]);
+	free(self->pipelines);
+	free(self);
+	return res;
 }
 
 void processing_destroy(struct processing *self)
@@ -193,49 +951,74 @@ void processing_destroy(struct processing *self)
 	pthread_mutex_destroy(&self->mutex);
 	pthread_cond_destroy(&self->cond);
 
+	cloud_shm_destroy(self->cloud_shm);
+	for (unsigned int i = 0; i < self->pipeline_count; i++)
+		pipeline_clear(&self->pipelines[i]);
+	free(self->pipelines);
 	free(self);
 }
 
 int processing_start(struct processing *self)
 {
 	int res = 0;
+	struct processing_pipeline *pipeline;
 	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(self->started, EBUSY);
 
-	/* Create background thread */
+	/* Previous results are not related to the new frames */
+	ttc_estimator_reset(&self->ttc);
+	self->next_pipeline = 0;
 	self->stop_requested = false;
-	res = pthread_create(&self->thread, NULL, &thread_entry, self);
-	if (res != 0) {
-		ULOG_ERRNO("pthread_create", res);
-		return -res;
+
+	for (unsigned int i = 0; i < self->pipeline_count; i++) {
+		pipeline = &self->pipelines[i];
+
+		/* Create workers sharing the rows of frames */
+		res = pool_start(pipeline);
+		if (res < 0)
+			goto error;
+
+		/* Create background thread of the pipeline */
+		res = pthread_create(
+			&pipeline->thread, NULL, &pipeline_entry, pipeline);
+		if (res != 0) {
+			ULOG_ERRNO("pthread_create", res);
+			res = -res;
+			goto error;
+		}
+		pipeline->started = true;
 	}
 	self->started = true;
 
 	return 0;
+
+error:
+	pipelines_stop(self);
+	return res;
 }
 
 void processing_stop(struct processing *self)
 {
+	struct processing_pipeline *pipeline;
+
 	if (self == NULL || !self->started)
 		return;
 
-	/* Ask thread to stop */
-	pthread_mutex_lock(&self->mutex);
-	self->stop_requested = true;
-	pthread_cond_signal(&self->cond);
-	pthread_mutex_unlock(&self->mutex);
-
-	/* Wait for thread and release resources */
-	pthread_join(self->thread, NULL);
+	pipelines_stop(self);
 	self->started = false;
 
-	/* Cleanup remaining input data if any */
+	/* Cleanup remaining input data if any, outputs which were waiting
+	 * for them can be delivered */
 	pthread_mutex_lock(&self->mutex);
-	if (self->input_available) {
-		vipcc_release_safe(self->input.frame);
-		memset(&self->input, 0, sizeof(self->input));
-		self->input_available = false;
+	for (unsigned int i = 0; i < self->pipeline_count; i++) {
+		pipeline = &self->pipelines[i];
+		if (pipeline->input_available) {
+			release_frame(self, pipeline->input.frame);
+			memset(&pipeline->input, 0, sizeof(pipeline->input));
+			pipeline->input_available = false;
+		}
 	}
+	deliver_ready_outputs(self);
 	pthread_mutex_unlock(&self->mutex);
 }
 
@@ -243,32 +1026,40 @@ int processing_step(struct processing *self,
 		    const struct processing_input *input)
 {
 	int res = 0;
+	struct processing_pipeline *pipeline;
 	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(!self->started, EPERM);
 
 	pthread_mutex_lock(&self->mutex);
 
+	/* Frames are given to the pipelines round-robin */
+	pipeline = &self->pipelines[self->next_pipeline];
+	self->next_pipeline = (self->next_pipeline + 1) % self->pipeline_count;
+
 	/* If an input is already pending, release it before overwrite */
-	if (self->input_available) {
-		vipcc_release_safe(self->input.frame);
-		memset(&self->input, 0, sizeof(self->input));
-		self->input_available = false;
+	if (pipeline->input_available) {
+		release_frame(self, pipeline->input.frame);
+		memset(&pipeline->input, 0, sizeof(pipeline->input));
+		pipeline->input_available = false;
+		counter_store(&self->stats.dropped_inputs,
+			      self->stats.dropped_inputs + 1);
 	}
 
 	/* Copy input data and take ownership of frame */
-	self->input = *input;
-	self->input_available = true;
+	pipeline->input = *input;
+	pipeline->input_available = true;
 
-	/* Wakeup background thread */
-	res = pthread_cond_signal(&self->cond);
+	/* Wakeup background threads, the pipeline of the frame and the ones
+	 * whose output was waiting for a dropped input */
+	res = pthread_cond_broadcast(&self->cond);
 	if (res != 0) {
 		/* pthread return a positive errno value */
-		ULOG_ERRNO("pthread_cond_signal", res);
+		ULOG_ERRNO("pthread_cond_broadcast", res);
 		res = -res;
 
 		/* Do not take frame and give it back to caller */
-		memset(&self->input, 0, sizeof(self->input));
-		self->input_available = false;
+		memset(&pipeline->input, 0, sizeof(pipeline->input));
+		pipeline->input_available = false;
 	}
 
 	pthread_mutex_unlock(&self->mutex);
@@ -279,20 +1070,23 @@ int processing_step(struct processing *self,
 int processing_get_output(struct processing *self,
 			  struct processing_output *output)
 {
-	int res = 0;
 	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(!self->started, EPERM);
+	ULOG_ERRNO_RETURN_ERR_IF(output == NULL, EINVAL);
 
-	pthread_mutex_lock(&self->mutex);
+	/* Outputs queued before a stop can still be retrieved */
+	return output_queue_pop(&self->output_queue, output);
+}
 
-	if (!self->output_available) {
-		res = -ENOENT;
-	} else {
-		*output = self->output;
-		self->output_available = false;
-	}
+int processing_get_stats(struct processing *self,
+			 struct processing_stats *stats)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
 
-	pthread_mutex_unlock(&self->mutex);
+	stats->dropped_inputs = counter_load(&self->stats.dropped_inputs);
+	stats->dropped_outputs = counter_load(&self->stats.dropped_outputs);
+	stats->output_queue_high_water =
+		counter_load(&self->stats.output_queue_high_water);
 
-	return res;
+	return 0;
 }
@@ -4,33 +4,153 @@
 
 #pragma once
 
+#include "point_cloud.h"
+
+/* Maximum number of threads computing depth statistics of a frame */
+#define PROCESSING_MAX_THREAD_COUNT 8
+
+/* Maximum number of frames processed concurrently */
+#define PROCESSING_MAX_PIPELINE_COUNT 4
+
+/* Maximum sampling stride of depth frames */
+#define PROCESSING_MAX_SAMPLE_STRIDE 16
+
+/* Maximum number of results waiting to be retrieved by the main loop */
+#define PROCESSING_OUTPUT_QUEUE_SIZE 8
+
+/* Grid of regions of the depth frame with their own statistics */
+#define PROCESSING_GRID_COLS 8
+#define PROCESSING_GRID_ROWS 6
+#define PROCESSING_GRID_SIZE (PROCESSING_GRID_COLS * PROCESSING_GRID_ROWS)
+
 struct processing;
 
-struct processing_input {
-	const struct vipc_frame *frame;
+/* Depth estimate of a frame, used for the time-to-collision */
+enum processing_estimator {
+	/* Mean depth of the most frequent depth range of the histogram */
+	PROCESSING_ESTIMATOR_DOMINANT_BIN = 0,
+	/* Median depth of the quantile sketch, does not jump when an obstacle
+	 * straddles two depth ranges. The sketch is only filled with this
+	 * estimator */
+	PROCESSING_ESTIMATOR_MEDIAN,
+};
 
+typedef void (*processing_release_frame_t)(const struct vipc_frame *frame,
+					   void *userdata);
+
+struct processing_config {
+	/* Number of threads sharing the rows of a frame, including the
+	 * background thread of the pipeline */
+	unsigned int thread_count;
+
+	/* Number of frames processed concurrently, 1 if 0. Frames are given
+	 * round-robin to pipelines having their own background thread, pool
+	 * of `thread_count` threads and buffers. Outputs are delivered in the
+	 * order of the frame timestamps */
+	unsigned int pipeline_count;
+
+	/* Function releasing the frames given to the processing object,
+	 * `vipcc_release_safe` is used if NULL */
+	processing_release_frame_t release_frame;
+	void *release_userdata;
+
+	/* Region of interest of the depth frames, as ratios of the frame
+	 * dimensions, clipped to the frame. The whole frame is used if width
+	 * or height is 0 */
 	struct {
 		float x;
 		float y;
-		float z;
-	} position_global;
+		float width;
+		float height;
+	} roi;
+
+	/* One pixel every `sample_stride` columns and rows of the region of
+	 * interest is used, every pixel if 0 or 1 */
+	unsigned int sample_stride;
+
+	/* Compute the mean of the dominant depth range of the region of
+	 * interest at full resolution, after a first sampled pass found the
+	 * dominant range */
+	bool refine_dominant_bin;
+
+	/* Depth estimate given as `depth_mean` of the outputs */
+	enum processing_estimator estimator;
+
+	/* Point cloud of each frame, published in a shared memory ring.
+	 * Disabled if `shm_name` is NULL */
+	struct {
+		const char *shm_name;
+		unsigned int shm_slot_count;
+		struct point_cloud_config params;
+	} cloud;
+
+	/* Telemetry section of the drone state, read by the processing thread
+	 * at the time of each frame. The state is left to zero if NULL */
+	const char *tlm_section;
+};
+
+struct processing_input {
+	const struct vipc_frame *frame;
 };
 
 struct processing_output {
 	struct timespec ts;
 	float x, y, z;
+	/* Depth of the configured estimator, 0 if no valid pixel [m] */
 	float depth_mean;
 	float confidence;
+
+	/* Quantiles of the depth of the region of interest, 0 if no valid
+	 * pixel or if the estimator is not the median [m] */
+	float depth_median;
+	float depth_p10;
+	float depth_p90;
+
+	/* Speed at which the obstacle gets closer, from the drone velocity or
+	 * the depth history, whichever is higher [m/s] */
+	float closing_speed;
+	/* Time-to-collision, INFINITY if not getting closer [s] */
+	float ttc;
+
+	/* Number of points of the published cloud */
+	unsigned int cloud_size;
+	/* Number of points dropped because the cloud was full */
+	unsigned int cloud_dropped;
+
+	/* Statistics of each region of the grid laid over the region of
+	 * interest, row major */
+	struct {
+		/* Minimum valid depth, INFINITY if none [m] */
+		float min[PROCESSING_GRID_SIZE];
+		/* Mean depth of the most frequent depth range [m] */
+		float mean[PROCESSING_GRID_SIZE];
+		/* Ratio of pixels with a valid depth */
+		float valid_ratio[PROCESSING_GRID_SIZE];
+	} grid;
+};
+
+/* Backpressure counters, since the creation of the processing object */
+struct processing_stats {
+	/* Inputs replaced by a newer one before being processed by their
+	 * pipeline */
+	unsigned int dropped_inputs;
+	/* Outputs discarded because the output queue was full */
+	unsigned int dropped_outputs;
+	/* Highest number of outputs waiting in the output queue */
+	unsigned int output_queue_high_water;
 };
 
 /**
  * Create a processing object.
+ * @param config processing configuration.
  * @param evt pomp event to be used to notify main loop when a processing
  *            step is completed
  * @param ret_obj pointer to return ed object.
  * @return 0 in case of success, negative errno in case of error.
  */
-int processing_new(struct pomp_evt *evt, struct processing **ret_obj);
+int processing_new(const struct processing_config *config,
+		   struct pomp_evt *evt,
+		   struct processing **ret_obj);
 
 /**
  * Delete a processing object.
@@ -39,21 +159,22 @@ int processing_new(struct pomp_evt *evt, struct processing **ret_obj);
 void processing_destroy(struct processing *self);
 
 /**
- * Start background thread for processing.
+ * Start background threads for processing.
  * @param self processing object.
  */
 int processing_start(struct processing *self);
 
 /**
- * Stop background thread for processing.
+ * Stop background threads for processing.
  * @param self processing object.
  */
 void processing_stop(struct processing *self);
 
 /**
- * Execute a step of processing. It will delegate the task to a background
- * thread. When done the pomp event given at creation will be signaled, meaning
- * `processing_get_output` can be called to retrieve the result.
+ * Execute a step of processing. It will delegate the task to the background
+ * thread of the next pipeline. When done the pomp event given at creation will
+ * be signaled, meaning `processing_get_output` can be called to retrieve the
+ * result. Frames shall be given in timestamp order.
  * @param self processing object.
  * @param input: input data including video frame.
  * @return 0 in case of success, negative errno in case of error.
@@ -65,10 +186,22 @@ int processing_step(struct processing *self,
 		    const struct processing_input *input);
 
 /**
- * Get output of processing step. Shall be called by the main loop when the
- * pomp event given at creation i s signaled.
+ * Get the oldest pending output of processing steps. Shall be called by the
+ * main loop when the pomp event given at creation is signaled, until it
+ * returns -ENOENT: several outputs may be pending for a single event.
  * @param self processing object.
- * @return 0 in case of success, negative errno in case of error.
+ * @param output pointer to return the output.
+ * @return 0 in case of success, -ENOENT if no output is pending, negative
+ *         errno in case of error.
  */
 int processing_get_output(struct processing *self,
 			  struct processing_output *output);
+
+/**
+ * Get backpressure counters of a processing object.
+ * @param self processing object.
+ * @param stats pointer to return the counters.
+ * @return 0 in case of success, negative errno in case of error.
+ */
+int processing_get_stats(struct processing *self,
+			 struct processing_stats *stats);
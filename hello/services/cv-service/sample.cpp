@@ -15,6 +15,7 @@
 #include <ulog.h>
 ULOG_DECLARE_TAG(ULOG_TAG);
 
+#include <cfgreader/cfgreader.hpp>
 #include <libpomp.hpp>
 #include <libtelemetry.h>
 #include <video-ipc/vipc_client.h>
@@ -25,33 +26,42 @@ ULOG_DECLARE_TAG(ULOG_TAG);
 
 #include "processing.h"
 
+#define CV_SERVICE_CONFIG_PATH "/etc/services/cv_service.cfg"
 #define VIPC_DEPTH_MAP_STREAM "fstcam_stereo_depth_filtered"
 #define TLM_SECTION_USER "drone_controller"
 #define TLM_SECTION_OUT "airsdk@cv@hello"
 #define TLM_SECTION_OUT_RATE 1000
 #define TLM_SECTION_OUT_COUNT 10
 #define MSGHUB_ADDR "unix:/tmp/hello-cv-service"
+#define CLOUD_SHM_NAME "/hello-cv-service-cloud"
+#define CLOUD_SHM_SLOT_COUNT 4
 #define CLOSE_DEPTH 0.8f /* [m] */
 #define FAR_DEPTH 1.2f   /* [m] */
-
-struct tlm_data_in {
-	struct {
-		float x;
-		float y;
-		float z;
-	} velocity;
-
-	struct {
-		float x;
-		float y;
-		float z;
-	} position_global;
-
-	struct {
-		float yaw;
-		float pitch;
-		float roll;
-	} attitude;
+#define CLOSE_TTC 1.5f   /* [s] */
+#define FAR_TTC 2.5f     /* [s] */
+#define FRAME_CB_LOG_PERIOD 300
+
+/* Configuration values */
+struct cv_service_cfg {
+	int threadCount;
+	int pipelineCount;
+	bool gridEventEnabled;
+	float roiX;
+	float roiY;
+	float roiWidth;
+	float roiHeight;
+	int sampleStride;
+	bool refineDominantBin;
+	std::string depthEstimator;
+	bool cloudEnabled;
+	float cameraFx;
+	float cameraFy;
+	float cameraCx;
+	float cameraCy;
+	float cloudVoxelSize;
+	float cloudMaxDepth;
+	int cloudStride;
+	int cloudMaxPoints;
 };
 
 struct tlm_data_out {
@@ -59,7 +69,25 @@ struct tlm_data_out {
 		float x, y, z;
 		float depth_mean;
 		float confidence;
+		float closing_speed;
+		float ttc;
+		float depth_median;
+		float depth_p10;
+		float depth_p90;
+		uint32_t cloud_size;
 	} algo;
+
+	struct {
+		uint32_t dropped_inputs;
+		uint32_t dropped_outputs;
+		uint32_t high_water;
+	} queue;
+
+	struct {
+		float min[PROCESSING_GRID_SIZE];
+		float mean[PROCESSING_GRID_SIZE];
+		float valid_ratio[PROCESSING_GRID_SIZE];
+	} grid;
 };
 
 class HelloServiceCommandHandler : public ::samples::hello::cv_service::
@@ -84,11 +112,8 @@ struct context {
 	/* Main loop of the program */
 	pomp::Loop loop;
 
-	/* Consumer to get drone telemetry */
-	struct tlm_consumer *consumer;
-
-	/* Structure where to save telemetry data */
-	struct tlm_data_in tlm_data_in;
+	/* Service configuration */
+	struct cv_service_cfg cfg;
 
 	/* Producer to log some telemetry */
 	struct tlm_producer *producer;
@@ -102,6 +127,9 @@ struct context {
 	/* Video ipc frame dimensions */
 	struct vipc_dim frame_dim;
 
+	/* Depth estimator of the processing, from the configuration */
+	enum processing_estimator estimator;
+
 	/* Processing result notification event */
 	struct pomp_evt *processing_evt;
 
@@ -120,42 +148,38 @@ struct context {
 	/* Message hub event sender */
 	HelloServiceEventSender msg_evt_sender;
 
-	/* Previous depth mean value */
-	float previous_depth_mean;
-
 	/* next timestamp at which depth mean value should be sent */
 	struct timespec next_depth_mean_timestamp;
 
 	/* Close state */
 	bool is_close;
 
+	/* Main loop time spent in frame_cb */
+	struct {
+		uint64_t total_ns;
+		uint64_t max_ns;
+		unsigned int count;
+	} frame_cb_time;
+
+	/* Latest processing backpressure counters */
+	struct processing_stats stats;
+
+	/* Backpressure counters at the time of the last warning */
+	struct processing_stats logged_stats;
+
 	inline context() : msg_cmd_handler(this), is_close(false) {}
 };
 
-// clang-format off
-static const struct tlm_reg_field s_tlm_data_in_fields[] = {
-	TLM_REG_FIELD_SCALAR_EX(struct tlm_data_in, velocity.x,
-			"linear_velocity_global.x", TLM_TYPE_FLOAT32),
-	TLM_REG_FIELD_SCALAR_EX(struct tlm_data_in, velocity.y,
-			"linear_velocity_global.y", TLM_TYPE_FLOAT32),
-	TLM_REG_FIELD_SCALAR_EX(struct tlm_data_in, velocity.z,
-			"linear_velocity_global.z", TLM_TYPE_FLOAT32),
-
-	TLM_REG_FIELD_SCALAR_EX(struct tlm_data_in, position_global.x,
-			"position_global.x", TLM_TYPE_FLOAT32),
-	TLM_REG_FIELD_SCALAR_EX(struct tlm_data_in, position_global.y,
-			"position_global.y", TLM_TYPE_FLOAT32),
-	TLM_REG_FIELD_SCALAR_EX(struct tlm_data_in, position_global.z,
-			"position_global.z", TLM_TYPE_FLOAT32),
-
-	TLM_REG_FIELD_SCALAR_EX(struct tlm_data_in, attitude.yaw,
-			"attitude_euler_angles.yaw", TLM_TYPE_FLOAT32),
-	TLM_REG_FIELD_SCALAR_EX(struct tlm_data_in, attitude.pitch,
-			"attitude_euler_angles.pitch", TLM_TYPE_FLOAT32),
-	TLM_REG_FIELD_SCALAR_EX(struct tlm_data_in, attitude.roll,
-			"attitude_euler_angles.roll", TLM_TYPE_FLOAT32),
-};
+/* Telemetry fields of a grid cell, named after their array element */
+#define TLM_GRID_CELL(i)                                                       \
+	TLM_REG_FIELD_SCALAR(struct tlm_data_out, grid.min[i],                 \
+			     TLM_TYPE_FLOAT32),                                \
+	TLM_REG_FIELD_SCALAR(struct tlm_data_out, grid.mean[i],                \
+			     TLM_TYPE_FLOAT32),                                \
+	TLM_REG_FIELD_SCALAR(struct tlm_data_out, grid.valid_ratio[i],         \
+			     TLM_TYPE_FLOAT32)
 
+// clang-format off
 static const struct tlm_reg_field s_tlm_data_out_fields[] = {
 	TLM_REG_FIELD_SCALAR(struct tlm_data_out, algo.x,
 			TLM_TYPE_FLOAT32),
@@ -167,11 +191,85 @@ static const struct tlm_reg_field s_tlm_data_out_fields[] = {
 			TLM_TYPE_FLOAT32),
 	TLM_REG_FIELD_SCALAR(struct tlm_data_out, algo.confidence,
 			TLM_TYPE_FLOAT32),
+	TLM_REG_FIELD_SCALAR(struct tlm_data_out, algo.closing_speed,
+			TLM_TYPE_FLOAT32),
+	TLM_REG_FIELD_SCALAR(struct tlm_data_out, algo.ttc,
+			TLM_TYPE_FLOAT32),
+	TLM_REG_FIELD_SCALAR(struct tlm_data_out, algo.depth_median,
+			TLM_TYPE_FLOAT32),
+	TLM_REG_FIELD_SCALAR(struct tlm_data_out, algo.depth_p10,
+			TLM_TYPE_FLOAT32),
+	TLM_REG_FIELD_SCALAR(struct tlm_data_out, algo.depth_p90,
+			TLM_TYPE_FLOAT32),
+	TLM_REG_FIELD_SCALAR(struct tlm_data_out, algo.cloud_size,
+			TLM_TYPE_UINT32),
+
+	TLM_REG_FIELD_SCALAR(struct tlm_data_out, queue.dropped_inputs,
+			TLM_TYPE_UINT32),
+	TLM_REG_FIELD_SCALAR(struct tlm_data_out, queue.dropped_outputs,
+			TLM_TYPE_UINT32),
+	TLM_REG_FIELD_SCALAR(struct tlm_data_out, queue.high_water,
+			TLM_TYPE_UINT32),
+
+	/* PROCESSING_GRID_SIZE cells */
+	TLM_GRID_CELL(0), TLM_GRID_CELL(1), TLM_GRID_CELL(2),
+	TLM_GRID_CELL(3), TLM_GRID_CELL(4), TLM_GRID_CELL(5),
+	TLM_GRID_CELL(6), TLM_GRID_CELL(7), TLM_GRID_CELL(8),
+	TLM_GRID_CELL(9), TLM_GRID_CELL(10), TLM_GRID_CELL(11),
+	TLM_GRID_CELL(12), TLM_GRID_CELL(13), TLM_GRID_CELL(14),
+	TLM_GRID_CELL(15), TLM_GRID_CELL(16), TLM_GRID_CELL(17),
+	TLM_GRID_CELL(18), TLM_GRID_CELL(19), TLM_GRID_CELL(20),
+	TLM_GRID_CELL(21), TLM_GRID_CELL(22), TLM_GRID_CELL(23),
+	TLM_GRID_CELL(24), TLM_GRID_CELL(25), TLM_GRID_CELL(26),
+	TLM_GRID_CELL(27), TLM_GRID_CELL(28), TLM_GRID_CELL(29),
+	TLM_GRID_CELL(30), TLM_GRID_CELL(31), TLM_GRID_CELL(32),
+	TLM_GRID_CELL(33), TLM_GRID_CELL(34), TLM_GRID_CELL(35),
+	TLM_GRID_CELL(36), TLM_GRID_CELL(37), TLM_GRID_CELL(38),
+	TLM_GRID_CELL(39), TLM_GRID_CELL(40), TLM_GRID_CELL(41),
+	TLM_GRID_CELL(42), TLM_GRID_CELL(43), TLM_GRID_CELL(44),
+	TLM_GRID_CELL(45), TLM_GRID_CELL(46), TLM_GRID_CELL(47),
 };
 // clang-format on
 
-static const struct tlm_reg_struct s_tlm_data_in_struct =
-	TLM_REG_STRUCT("tlm_data_in", s_tlm_data_in_fields);
+static_assert(PROCESSING_GRID_SIZE == 48,
+	      "grid telemetry fields do not match the grid size");
+
+#define CFG_CHECK(E) ULOG_ERRNO_RETURN_ERR_IF(E < 0, EINVAL)
+
+namespace cfgreader {
+template <>
+int SettingReader<struct cv_service_cfg>::read(const libconfig::Setting &set,
+					       T &v)
+{
+	CFG_CHECK(ConfigReader::getField(set, "threadCount", v.threadCount));
+	CFG_CHECK(ConfigReader::getField(
+		set, "pipelineCount", v.pipelineCount));
+	CFG_CHECK(ConfigReader::getField(
+		set, "gridEventEnabled", v.gridEventEnabled));
+	CFG_CHECK(ConfigReader::getField(set, "roiX", v.roiX));
+	CFG_CHECK(ConfigReader::getField(set, "roiY", v.roiY));
+	CFG_CHECK(ConfigReader::getField(set, "roiWidth", v.roiWidth));
+	CFG_CHECK(ConfigReader::getField(set, "roiHeight", v.roiHeight));
+	CFG_CHECK(ConfigReader::getField(set, "sampleStride", v.sampleStride));
+	CFG_CHECK(ConfigReader::getField(
+		set, "refineDominantBin", v.refineDominantBin));
+	CFG_CHECK(ConfigReader::getField(
+		set, "depthEstimator", v.depthEstimator));
+	CFG_CHECK(ConfigReader::getField(set, "cloudEnabled", v.cloudEnabled));
+	CFG_CHECK(ConfigReader::getField(set, "cameraFx", v.cameraFx));
+	CFG_CHECK(ConfigReader::getField(set, "cameraFy", v.cameraFy));
+	CFG_CHECK(ConfigReader::getField(set, "cameraCx", v.cameraCx));
+	CFG_CHECK(ConfigReader::getField(set, "cameraCy", v.cameraCy));
+	CFG_CHECK(ConfigReader::getField(
+		set, "cloudVoxelSize", v.cloudVoxelSize));
+	CFG_CHECK(ConfigReader::getField(
+		set, "cloudMaxDepth", v.cloudMaxDepth));
+	CFG_CHECK(ConfigReader::getField(set, "cloudStride", v.cloudStride));
+	CFG_CHECK(ConfigReader::getField(
+		set, "cloudMaxPoints", v.cloudMaxPoints));
+	return 0;
+}
+} // namespace cfgreader
 
 static const struct tlm_reg_struct s_tlm_data_out_struct =
 	TLM_REG_STRUCT("tlm_data_out", s_tlm_data_out_fields);
@@ -209,13 +307,6 @@ static void context_clean(struct context *ctx)
 			ULOG_ERRNO("tlm_producer_destroy", -res);
 		ctx->producer = NULL;
 	}
-
-	if (ctx->consumer != NULL) {
-		res = tlm_consumer_destroy(ctx->consumer);
-		if (res < 0)
-			ULOG_ERRNO("tlm_consumer_destroy", -res);
-		ctx->consumer = NULL;
-	}
 }
 
 static int context_start(struct context *ctx)
@@ -260,18 +351,25 @@ static bool timestamp_after(const struct timespec &t1,
 	       || (t1.tv_sec > t2.tv_sec);
 }
 
-static void processing_evt_cb(struct pomp_evt *evt, void *userdata)
+static void send_depth_grid(struct context *ctx,
+			    const struct processing_output *output)
 {
-	int res = 0;
-	struct context *ud = (struct context *)userdata;
-	struct processing_output output;
-
-	/* Get result from processing object */
-	res = processing_get_output(ud->processing, &output);
-	if (res < 0) {
-		ULOG_ERRNO("processing_get_output", -res);
-		return;
+	::samples::hello::cv_service::messages::DepthGrid message;
+
+	message.set_cols(PROCESSING_GRID_COLS);
+	message.set_rows(PROCESSING_GRID_ROWS);
+	for (unsigned int i = 0; i < PROCESSING_GRID_SIZE; i++) {
+		message.add_min(output->grid.min[i]);
+		message.add_mean(output->grid.mean[i]);
+		message.add_valid_ratio(output->grid.valid_ratio[i]);
 	}
+	ctx->msg_evt_sender.depthGrid(message);
+}
+
+static void processing_output_handle(struct context *ud,
+				     const struct processing_output &output)
+{
+	int res = 0;
 
 	/* Update telemetry output */
 	ud->tlm_data_out.algo.x = output.x;
@@ -279,6 +377,16 @@ static void processing_evt_cb(struct pomp_evt *evt, void *userdata)
 	ud->tlm_data_out.algo.z = output.z;
 	ud->tlm_data_out.algo.depth_mean = output.depth_mean;
 	ud->tlm_data_out.algo.confidence = output.confidence;
+	ud->tlm_data_out.algo.closing_speed = output.closing_speed;
+	ud->tlm_data_out.algo.ttc = output.ttc;
+	ud->tlm_data_out.algo.depth_median = output.depth_median;
+	ud->tlm_data_out.algo.depth_p10 = output.depth_p10;
+	ud->tlm_data_out.algo.depth_p90 = output.depth_p90;
+	ud->tlm_data_out.algo.cloud_size = output.cloud_size;
+	memcpy(&ud->tlm_data_out.grid, &output.grid, sizeof(output.grid));
+	ud->tlm_data_out.queue.dropped_inputs = ud->stats.dropped_inputs;
+	ud->tlm_data_out.queue.dropped_outputs = ud->stats.dropped_outputs;
+	ud->tlm_data_out.queue.high_water = ud->stats.output_queue_high_water;
 
 	/* Write in telemetry */
 	res = tlm_producer_put_sample(ud->producer, &output.ts);
@@ -292,22 +400,60 @@ static void processing_evt_cb(struct pomp_evt *evt, void *userdata)
 		ud->next_depth_mean_timestamp.tv_sec += 1;
 		ULOGD("sending depth_mean=%f", output.depth_mean);
 		ud->msg_evt_sender.depthMean(output.depth_mean);
+		if (ud->cfg.gridEventEnabled)
+			send_depth_grid(ud, &output);
+
+		if (ud->stats.dropped_inputs != ud->logged_stats.dropped_inputs
+		    || ud->stats.dropped_outputs
+			       != ud->logged_stats.dropped_outputs) {
+			ULOGW("backpressure: dropped inputs %u outputs %u, "
+			      "output queue high water %u",
+			      ud->stats.dropped_inputs,
+			      ud->stats.dropped_outputs,
+			      ud->stats.output_queue_high_water);
+			ud->logged_stats = ud->stats;
+		}
 	}
 
-	/* Send event message if required */
-	if (output.depth_mean <= CLOSE_DEPTH
-	    && ud->previous_depth_mean > CLOSE_DEPTH && !ud->is_close) {
+	/* Send event message if required: close when the obstacle would be
+	 * reached soon at the current closing speed, or when it is already
+	 * within the close distance (drone not moving). A frame without valid
+	 * depth has a null mean and says nothing about the distance */
+	if (!ud->is_close
+	    && (output.ttc <= CLOSE_TTC
+		|| (output.depth_mean > 0.f
+		    && output.depth_mean <= CLOSE_DEPTH))) {
 		const ::google::protobuf::Empty message;
+		ULOGD("close: depth_mean=%f ttc=%f",
+		      output.depth_mean,
+		      output.ttc);
 		ud->msg_evt_sender.close(message);
 		ud->is_close = true;
 	}
-	if (output.depth_mean >= FAR_DEPTH
-	    && ud->previous_depth_mean < FAR_DEPTH && ud->is_close) {
+	if (ud->is_close && output.ttc >= FAR_TTC
+	    && output.depth_mean >= FAR_DEPTH) {
 		const ::google::protobuf::Empty message;
 		ud->msg_evt_sender.far(message);
 		ud->is_close = false;
 	}
-	ud->previous_depth_mean = output.depth_mean;
+}
+
+static void processing_evt_cb(struct pomp_evt *evt, void *userdata)
+{
+	int res = 0;
+	struct context *ud = (struct context *)userdata;
+	struct processing_output output;
+
+	res = processing_get_stats(ud->processing, &ud->stats);
+	if (res < 0)
+		ULOG_ERRNO("processing_get_stats", -res);
+
+	/* Several results may be pending for a single event, each one is
+	 * handled with its own frame timestamp */
+	while ((res = processing_get_output(ud->processing, &output)) == 0)
+		processing_output_handle(ud, output);
+	if (res != -ENOENT)
+		ULOG_ERRNO("processing_get_output", -res);
 }
 
 static void status_cb(struct vipcc_ctx *ctx,
@@ -334,6 +480,29 @@ static void status_cb(struct vipcc_ctx *ctx,
 		ULOG_ERRNO("vipcc_start", -res);
 }
 
+static uint64_t time_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Log the main loop time spent per frame every FRAME_CB_LOG_PERIOD frames */
+static void frame_cb_time_add(struct context *ctx, uint64_t duration_ns)
+{
+	ctx->frame_cb_time.total_ns += duration_ns;
+	if (duration_ns > ctx->frame_cb_time.max_ns)
+		ctx->frame_cb_time.max_ns = duration_ns;
+	if (++ctx->frame_cb_time.count < FRAME_CB_LOG_PERIOD)
+		return;
+
+	ULOGI("frame_cb: mean %.1f us, max %.1f us over %u frames",
+	      ctx->frame_cb_time.total_ns / 1000. / ctx->frame_cb_time.count,
+	      ctx->frame_cb_time.max_ns / 1000.,
+	      ctx->frame_cb_time.count);
+	memset(&ctx->frame_cb_time, 0, sizeof(ctx->frame_cb_time));
+}
+
 static void frame_cb(struct vipcc_ctx *ctx,
 		     const struct vipc_frame *frame,
 		     void *be_frame,
@@ -342,7 +511,7 @@ static void frame_cb(struct vipcc_ctx *ctx,
 	int res = 0;
 	struct context *ud = (struct context *)userdata;
 	struct processing_input input;
-	struct timespec timestamp;
+	uint64_t start_ns = time_now_ns();
 
 	ULOGD("received frame %08x", frame->index);
 
@@ -368,21 +537,10 @@ static void frame_cb(struct vipcc_ctx *ctx,
 		goto out;
 	}
 
-	/* Get latest telemetry data */
-	timestamp.tv_sec = frame->ts_sof_ns / 1000000000UL;
-	timestamp.tv_nsec = frame->ts_sof_ns % 1000000000UL;
-	res = tlm_consumer_get_sample(ud->consumer, &timestamp, TLM_CLOSEST);
-	if (res < 0 && res != -ENOENT) {
-		ULOG_ERRNO("tlm_consumer_get_sample_with_timestamp", -res);
-		goto out;
-	}
-
-	/* Setup input structure for processing */
+	/* Setup input structure for processing, the drone state at the time
+	 * of the frame is read from telemetry by the processing thread */
 	memset(&input, 0, sizeof(input));
 	input.frame = frame;
-	input.position_global.x = ud->tlm_data_in.position_global.x;
-	input.position_global.y = ud->tlm_data_in.position_global.y;
-	input.position_global.z = ud->tlm_data_in.position_global.z;
 
 	res = processing_step(ud->processing, &input);
 	if (res < 0) {
@@ -397,6 +555,8 @@ static void frame_cb(struct vipcc_ctx *ctx,
 out:
 	if (frame != NULL)
 		vipcc_release(ctx, frame);
+
+	frame_cb_time_add(ud, time_now_ns() - start_ns);
 }
 
 static void conn_status_cb(struct vipcc_ctx *ctx,
@@ -420,31 +580,70 @@ static const struct vipcc_cb s_vipc_client_cbs = {.status_cb = status_cb,
 							  conn_status_cb,
 						  .eos_cb = eos_cb};
 
-static int context_init(struct context *ctx)
+static int context_load_config(struct context *ctx)
 {
 	int res = 0;
+	const std::string path = cfgreader::ConfigReader::insertMissionRootDir(
+		CV_SERVICE_CONFIG_PATH);
+	cfgreader::FileConfigReader reader(path);
 
-	/* Create telemetry consumer */
-	ctx->consumer = tlm_consumer_new();
-	if (ctx->consumer == NULL) {
-		res = -ENOMEM;
-		ULOG_ERRNO("tlm_consumer_new", -res);
-		goto error;
-	}
-	res = tlm_consumer_reg_struct_ptr(ctx->consumer,
-					  &ctx->tlm_data_in,
-					  TLM_SECTION_USER,
-					  &s_tlm_data_in_struct);
+	res = reader.load();
 	if (res < 0) {
-		ULOG_ERRNO("tlm_consumer_reg_struct_ptr", -res);
-		goto error;
+		ULOG_ERRNO("cannot load %s", -res, path.c_str());
+		return res;
 	}
-	res = tlm_consumer_reg_complete(ctx->consumer);
+
+	res = reader.get("cv_service", ctx->cfg);
 	if (res < 0) {
-		ULOG_ERRNO("tlm_consumer_reg_complete", -res);
-		goto error;
+		ULOG_ERRNO("cannot read cv_service config", -res);
+		return res;
+	}
+
+	if (ctx->cfg.threadCount < 1) {
+		ULOGE("invalid thread count (%d)", ctx->cfg.threadCount);
+		return -EINVAL;
+	}
+
+	if (ctx->cfg.pipelineCount < 1) {
+		ULOGE("invalid pipeline count (%d)", ctx->cfg.pipelineCount);
+		return -EINVAL;
+	}
+
+	if (ctx->cfg.sampleStride < 1) {
+		ULOGE("invalid sample stride (%d)", ctx->cfg.sampleStride);
+		return -EINVAL;
+	}
+
+	if (ctx->cfg.depthEstimator == "dominant") {
+		ctx->estimator = PROCESSING_ESTIMATOR_DOMINANT_BIN;
+	} else if (ctx->cfg.depthEstimator == "median") {
+		ctx->estimator = PROCESSING_ESTIMATOR_MEDIAN;
+	} else {
+		ULOGE("invalid depth estimator '%s'",
+		      ctx->cfg.depthEstimator.c_str());
+		return -EINVAL;
+	}
+
+	if (ctx->cfg.cloudStride < 1 || ctx->cfg.cloudMaxPoints < 1) {
+		ULOGE("invalid cloud stride (%d) or max points (%d)",
+		      ctx->cfg.cloudStride,
+		      ctx->cfg.cloudMaxPoints);
+		return -EINVAL;
 	}
 
+	return 0;
+}
+
+static int context_init(struct context *ctx)
+{
+	int res = 0;
+	struct processing_config processing_cfg;
+
+	/* Load service configuration */
+	res = context_load_config(ctx);
+	if (res < 0)
+		goto error;
+
 	/* Create telemetry producer */
 	ctx->producer = tlm_producer_new(
 		TLM_SECTION_OUT, TLM_SECTION_OUT_COUNT, TLM_SECTION_OUT_RATE);
@@ -490,7 +689,33 @@ static int context_init(struct context *ctx)
 	}
 
 	/* Create processing object */
-	res = processing_new(ctx->processing_evt, &ctx->processing);
+	memset(&processing_cfg, 0, sizeof(processing_cfg));
+	processing_cfg.thread_count = ctx->cfg.threadCount;
+	processing_cfg.pipeline_count = ctx->cfg.pipelineCount;
+	processing_cfg.roi.x = ctx->cfg.roiX;
+	processing_cfg.roi.y = ctx->cfg.roiY;
+	processing_cfg.roi.width = ctx->cfg.roiWidth;
+	processing_cfg.roi.height = ctx->cfg.roiHeight;
+	processing_cfg.sample_stride = ctx->cfg.sampleStride;
+	processing_cfg.refine_dominant_bin = ctx->cfg.refineDominantBin;
+	processing_cfg.estimator = ctx->estimator;
+	if (ctx->cfg.cloudEnabled) {
+		processing_cfg.cloud.shm_name = CLOUD_SHM_NAME;
+		processing_cfg.cloud.shm_slot_count = CLOUD_SHM_SLOT_COUNT;
+		processing_cfg.cloud.params.fx = ctx->cfg.cameraFx;
+		processing_cfg.cloud.params.fy = ctx->cfg.cameraFy;
+		processing_cfg.cloud.params.cx = ctx->cfg.cameraCx;
+		processing_cfg.cloud.params.cy = ctx->cfg.cameraCy;
+		processing_cfg.cloud.params.voxel_size =
+			ctx->cfg.cloudVoxelSize;
+		processing_cfg.cloud.params.max_depth = ctx->cfg.cloudMaxDepth;
+		processing_cfg.cloud.params.step = ctx->cfg.cloudStride;
+		processing_cfg.cloud.params.max_points =
+			ctx->cfg.cloudMaxPoints;
+	}
+	processing_cfg.tlm_section = TLM_SECTION_USER;
+	res = processing_new(
+		&processing_cfg, ctx->processing_evt, &ctx->processing);
 	if (res < 0) {
 		ULOG_ERRNO("processing_new", -res);
 		goto error;
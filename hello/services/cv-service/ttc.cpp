@@ -0,0 +1,117 @@
+/**
+ * Copyright (C) 2021 Parrot Drones SAS
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "ttc.h"
+
+/* Origin of the sums is moved forward once samples are this far from it, to
+ * keep the precision of the incremental sums [ns] */
+#define TTC_REBASE_NS 10000000000ULL
+
+static inline double relative_time(const struct ttc_estimator *self,
+				   uint64_t ts_ns)
+{
+	return (double)(ts_ns - self->origin_ns) / 1e9;
+}
+
+static void add_to_sums(struct ttc_estimator *self,
+			const struct ttc_sample *sample)
+{
+	double t = relative_time(self, sample->ts_ns);
+
+	self->sum_t += t;
+	self->sum_d += sample->depth;
+	self->sum_tt += t * t;
+	self->sum_td += t * sample->depth;
+}
+
+static void remove_from_sums(struct ttc_estimator *self,
+			     const struct ttc_sample *sample)
+{
+	double t = relative_time(self, sample->ts_ns);
+
+	self->sum_t -= t;
+	self->sum_d -= sample->depth;
+	self->sum_tt -= t * t;
+	self->sum_td -= t * sample->depth;
+}
+
+static void rebase(struct ttc_estimator *self)
+{
+	self->origin_ns = self->samples[self->head].ts_ns;
+	self->sum_t = 0.;
+	self->sum_d = 0.;
+	self->sum_tt = 0.;
+	self->sum_td = 0.;
+	for (unsigned int i = 0; i < self->count; i++) {
+		unsigned int index = (self->head + i) % TTC_HISTORY_SIZE;
+		add_to_sums(self, &self->samples[index]);
+	}
+}
+
+void ttc_estimator_reset(struct ttc_estimator *self)
+{
+	memset(self, 0, sizeof(*self));
+}
+
+void ttc_estimator_add(struct ttc_estimator *self, uint64_t ts_ns, float depth)
+{
+	struct ttc_sample *sample;
+
+	if (self->count > 0) {
+		const struct ttc_sample *last =
+			&self->samples[(self->head + self->count - 1)
+				       % TTC_HISTORY_SIZE];
+		if (ts_ns <= last->ts_ns
+		    || ts_ns - last->ts_ns > TTC_MAX_GAP_NS)
+			ttc_estimator_reset(self);
+	}
+
+	if (self->count == 0)
+		self->origin_ns = ts_ns;
+
+	if (self->count == TTC_HISTORY_SIZE) {
+		/* Replace the oldest sample */
+		remove_from_sums(self, &self->samples[self->head]);
+		sample = &self->samples[self->head];
+		self->head = (self->head + 1) % TTC_HISTORY_SIZE;
+	} else {
+		sample = &self->samples[(self->head + self->count)
+					% TTC_HISTORY_SIZE];
+		self->count++;
+	}
+
+	sample->ts_ns = ts_ns;
+	sample->depth = depth;
+	add_to_sums(self, sample);
+
+	if (ts_ns - self->origin_ns > TTC_REBASE_NS)
+		rebase(self);
+}
+
+float ttc_estimator_depth_rate(const struct ttc_estimator *self)
+{
+	double n = self->count;
+	double den;
+
+	if (self->count < 3)
+		return 0.f;
+
+	/* Least squares slope of depth over time */
+	den = n * self->sum_tt - self->sum_t * self->sum_t;
+	if (den <= 0.)
+		return 0.f;
+
+	return -(n * self->sum_td - self->sum_t * self->sum_d) / den;
+}
+
+float ttc_compute(float depth, float closing_speed)
+{
+	if (closing_speed < TTC_MIN_CLOSING_SPEED)
+		return INFINITY;
+
+	return depth / closing_speed;
+}
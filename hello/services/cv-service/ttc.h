@@ -0,0 +1,77 @@
+/**
+ * Copyright (C) 2021 Parrot Drones SAS
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* Number of depth results kept to estimate the depth rate */
+#define TTC_HISTORY_SIZE 8
+
+/* Frames further apart restart the history [ns] */
+#define TTC_MAX_GAP_NS 500000000ULL
+
+/* Closing speed under which no collision is expected [m/s] */
+#define TTC_MIN_CLOSING_SPEED 0.1f
+
+struct ttc_sample {
+	uint64_t ts_ns;
+	float depth;
+};
+
+/**
+ * Time-to-collision estimator.
+ *
+ * Keeps a ring of the latest (timestamp, depth) results and the running sums
+ * of a least squares line fit on them, so that adding a sample and getting
+ * the depth rate do not walk the history.
+ */
+struct ttc_estimator {
+	struct ttc_sample samples[TTC_HISTORY_SIZE];
+	/* Index of the oldest sample */
+	unsigned int head;
+	unsigned int count;
+
+	/* Sums over the samples of the history, times are relative to
+	 * `origin_ns` [s] and depths [m] */
+	uint64_t origin_ns;
+	double sum_t;
+	double sum_d;
+	double sum_tt;
+	double sum_td;
+};
+
+/**
+ * Reset a time-to-collision estimator, forgetting its history.
+ * @param self estimator.
+ */
+void ttc_estimator_reset(struct ttc_estimator *self);
+
+/**
+ * Add a depth result to the history, replacing the oldest one when the
+ * history is full. The history is restarted if the timestamp does not follow
+ * the previous one closely enough.
+ * @param self estimator.
+ * @param ts_ns timestamp of the depth result [ns].
+ * @param depth distance to the obstacle [m].
+ */
+void ttc_estimator_add(struct ttc_estimator *self, uint64_t ts_ns, float depth);
+
+/**
+ * Get the closing speed seen in the depth history, as the opposite of the
+ * slope of the depth over time.
+ * @param self estimator.
+ * @return closing speed [m/s], positive when the obstacle gets closer, 0 if
+ *         the history holds less than 3 samples.
+ */
+float ttc_estimator_depth_rate(const struct ttc_estimator *self);
+
+/**
+ * Get the time-to-collision given a distance and a closing speed.
+ * @param depth distance to the obstacle [m].
+ * @param closing_speed closing speed [m/s].
+ * @return time-to-collision [s], INFINITY if the closing speed is below
+ *         TTC_MIN_CLOSING_SPEED.
+ */
+float ttc_compute(float depth, float closing_speed);
@@ -0,0 +1,109 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "occupancy_volume.hpp"
+
+/* Synthetic scene shared by the benchmarks: free voxels, with a ground at the
+ * bottom (z goes down), walls and pillars of log-odds 5, and frames in which
+ * boxes move across the scene and a few voxels flip. */
+
+static inline uint64_t timeNowUs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Static part of the scene, the drone at its center, with the voxels of the
+ * last 4 columns and rows unknown if `unknownEdges`. */
+static inline void fillStatic(OccupancyVolume &volume, int size, int height,
+                              float resolution, bool unknownEdges) {
+  volume.size[0] = size;
+  volume.size[1] = size;
+  volume.size[2] = height;
+  volume.resolution = resolution;
+  for (int i = 0; i < 3; i++) {
+    volume.origin[i] = 0.f;
+    volume.center[i] = volume.size[i] * resolution / 2.f;
+  }
+  volume.logodds.assign(volume.count(), -2);
+
+  for (int z = 0; z < height; z++) {
+    for (int y = 0; y < size; y++) {
+      for (int x = 0; x < size; x++) {
+        /* z goes down, the ground is at the bottom of the volume */
+        bool ground = z >= height - 2;
+        bool wall = (x % 48) < 2 && (y % 32) > 8;
+        bool pillar = (x % 20) < 2 && (y % 20) < 2;
+        bool unknown = unknownEdges && (x >= size - 4 || y >= size - 4);
+        if (ground || wall || pillar)
+          volume.logodds[volume.index(x, y, z)] = 5;
+        else if (unknown)
+          volume.logodds[volume.index(x, y, z)] = OCCUPANCY_UNKNOWN;
+      }
+    }
+  }
+}
+
+/* Frame of the scene: boxes of 3x3x8 voxels of log-odds 4 moving along x by
+ * a voxel per frame above the ground, and voxels just above the ground
+ * flipping between free (-1) and obstacle (3), the same for a given frame. */
+static inline void fillFrame(const OccupancyVolume &scene,
+                             OccupancyVolume &volume, int frame,
+                             int moverCount, int flipCount) {
+  volume = scene;
+  const int *size = volume.size;
+
+  for (int m = 0; m < moverCount; m++) {
+    int x0 = (size[0] / 4 + m * 17 + frame) % (size[0] - 3);
+    int y0 = (size[1] / 3 + m * 29) % (size[1] - 3);
+    int z0 = size[2] - 10;
+    for (int z = z0; z < z0 + 8; z++) {
+      for (int y = y0; y < y0 + 3; y++) {
+        for (int x = x0; x < x0 + 3; x++)
+          volume.logodds[volume.index(x, y, z)] = 4;
+      }
+    }
+  }
+
+  srand(frame + 1);
+  for (int i = 0; i < flipCount; i++) {
+    size_t index =
+        volume.index(rand() % size[0], rand() % size[1], size[2] - 3);
+    volume.logodds[index] = volume.logodds[index] >= 3 ? -1 : 3;
+  }
+}
@@ -0,0 +1,225 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "clearance.hpp"
+
+#define DEFAULT_CAST_COUNT 200
+#define SIZE 160
+#define HEIGHT 48
+#define RESOLUTION 0.2f
+#define MAX_RANGE 10.f
+#define OBSTACLE_LOGODD 3
+
+/* Walls of the room around the drone, in voxels from its position. The
+ * inner face of a wall, the clearance of the horizontal rays along the
+ * axes, is one voxel closer */
+#define WALL_NORTH 20 /* 4 m */
+#define WALL_EAST 30  /* 6 m */
+#define WALL_SOUTH 35 /* 7 m */
+#define WALL_WEST 15  /* 3 m */
+
+static const unsigned int s_azimuthCounts[] = {8, 16, 32};
+
+/* Drone at a voxel corner in the middle of a room with pillars, the ground
+ * 2 m below. Beyond the walls, voxels are unknown. */
+static void fillVolume(OccupancyVolume &volume) {
+  const int c[3] = {SIZE / 2, SIZE / 2, HEIGHT / 2};
+
+  volume.size[0] = SIZE;
+  volume.size[1] = SIZE;
+  volume.size[2] = HEIGHT;
+  volume.resolution = RESOLUTION;
+  for (int i = 0; i < 3; i++) {
+    volume.origin[i] = 0.f;
+    volume.center[i] = c[i] * RESOLUTION;
+  }
+  volume.logodds.assign(volume.count(), OCCUPANCY_UNKNOWN);
+
+  srand(1);
+  for (int z = 0; z < HEIGHT; z++) {
+    for (int y = c[1] - WALL_WEST; y <= c[1] + WALL_EAST - 1; y++) {
+      for (int x = c[0] - WALL_SOUTH; x <= c[0] + WALL_NORTH - 1; x++) {
+        bool wall = x == c[0] - WALL_SOUTH || x == c[0] + WALL_NORTH - 1 ||
+                    y == c[1] - WALL_WEST || y == c[1] + WALL_EAST - 1;
+        /* z goes down */
+        bool ground = z >= c[2] + 10;
+        bool pillar = (x % 12) < 2 && (y % 12) < 2 && (x - c[0]) % 12 != 0 &&
+                      abs(x - c[0]) > 3 && abs(y - c[1]) > 3;
+        int8_t logodd;
+        if (wall || ground || pillar)
+          logodd = 4 + rand() % 3;
+        else
+          logodd = -(rand() % 4);
+        volume.logodds[volume.index(x, y, z)] = logodd;
+      }
+    }
+  }
+}
+
+/* Horizontal rays along the axes stop on the walls, pillars are kept out
+ * of their way */
+static int checkWalls(const ClearanceRing &ring, const float *clearances,
+                      unsigned int azimuthCount, unsigned int level) {
+  const float expected[4] = {WALL_NORTH - 1, WALL_EAST - 1, WALL_SOUTH - 1,
+                             WALL_WEST - 1};
+  int errors = 0;
+
+  for (int i = 0; i < 4; i++) {
+    unsigned int ray = level * azimuthCount + i * azimuthCount / 4;
+    const float *d = ring.getDirection(ray);
+    float e = expected[i] * RESOLUTION;
+    if (fabsf(clearances[ray] - e) > 1e-3f) {
+      fprintf(stderr, "ray %u (%.2f, %.2f, %.2f): %.3f m, expected %.3f m\n",
+              ray, d[0], d[1], d[2], clearances[ray], e);
+      errors++;
+    }
+  }
+  return errors;
+}
+
+static void usage(const char *progname) {
+  fprintf(stderr, "usage: %s [-n casts] [-t threads] [-b budget_us]\n",
+          progname);
+}
+
+int main(int argc, char *argv[]) {
+  int opt;
+  int castCount = DEFAULT_CAST_COUNT;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned int maxThreads =
+      std::min<long>(cpus > 0 ? cpus : 1, CLEARANCE_MAX_THREADS);
+  unsigned int budgetUs = 0;
+  OccupancyVolume volume;
+  int errors = 0;
+
+  while ((opt = getopt(argc, argv, "n:t:b:")) != -1) {
+    switch (opt) {
+    case 'n':
+      castCount = atoi(optarg);
+      break;
+    case 't':
+      maxThreads = atoi(optarg);
+      break;
+    case 'b':
+      budgetUs = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (castCount <= 0 || maxThreads == 0 ||
+      maxThreads > CLEARANCE_MAX_THREADS) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  fillVolume(volume);
+
+  for (unsigned int azimuthCount : s_azimuthCounts) {
+    std::vector<float> reference;
+    for (unsigned int threads = 1; threads <= maxThreads; threads++) {
+      ClearanceRing::Config config = {
+          .azimuthCount = azimuthCount,
+          .elevations = {-20.f, 0.f, 20.f, 40.f},
+          .maxRange = MAX_RANGE,
+          .obstacleLogodd = OBSTACLE_LOGODD,
+          .unknownIsObstacle = true,
+          .threadCount = threads,
+          .batchSize = 0,
+          .budgetUs = budgetUs,
+      };
+      ClearanceRing ring(config);
+      int res = ring.start();
+      if (res < 0) {
+        fprintf(stderr, "ClearanceRing::start: %s\n", strerror(-res));
+        return EXIT_FAILURE;
+      }
+      unsigned int rayCount = ring.getRayCount();
+      std::vector<float> clearances(rayCount);
+      std::vector<float> castUs(castCount);
+      ClearanceRing::Stats stats;
+      float batchMaxUs = 0.f, batchUsSum = 0.f;
+      unsigned int batches = 0, skipped = 0;
+
+      for (int n = 0; n < castCount; n++) {
+        res = ring.cast(volume, clearances.data(), &stats);
+        if (res < 0) {
+          fprintf(stderr, "ClearanceRing::cast: %s\n", strerror(-res));
+          return EXIT_FAILURE;
+        }
+        castUs[n] = stats.castUs;
+        batchMaxUs = std::max(batchMaxUs, stats.batchMaxUs);
+        batchUsSum += stats.batchMeanUs * stats.batches;
+        batches += stats.batches;
+        skipped += stats.skippedBatches;
+      }
+      ring.stop();
+
+      /* Threads shall not change the result, only a time budget may */
+      if (budgetUs == 0) {
+        errors += checkWalls(ring, clearances.data(), azimuthCount, 1);
+        if (reference.empty()) {
+          reference = clearances;
+        } else if (memcmp(reference.data(), clearances.data(),
+                          rayCount * sizeof(float)) != 0) {
+          fprintf(stderr, "%u rays: %u threads differ from 1 thread\n",
+                  rayCount, threads);
+          errors++;
+        }
+      }
+
+      std::sort(castUs.begin(), castUs.end());
+      float castSum = 0.f;
+      for (float us : castUs)
+        castSum += us;
+      printf("%3u rays, %u threads: cast mean %.1f us p99 %.1f us max "
+             "%.1f us, batch mean %.1f us max %.1f us, skipped %u/%u "
+             "batches\n",
+             rayCount, threads, castSum / castCount,
+             castUs[castCount * 99 / 100], castUs[castCount - 1],
+             batches > 0 ? batchUsSum / batches : 0.f, batchMaxUs, skipped,
+             batches + skipped);
+    }
+  }
+
+  return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,275 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#define ULOG_TAG spatial_perception
+#include <ulog.h>
+ULOG_DECLARE_TAG(ULOG_TAG);
+
+#include "bench_scene.hpp"
+#include "grid_delta.hpp"
+#include "grid_delta_shm.hpp"
+#include "occupancy_volume.hpp"
+
+#define DEFAULT_FRAME_COUNT 100
+#define DEFAULT_SIZE 128
+#define DEFAULT_HEIGHT 40
+#define DEFAULT_RESOLUTION 0.2f
+#define DEFAULT_MOVER_COUNT 4
+#define DEFAULT_FLIP_COUNT 50
+#define OBSTACLE_LOGODD 3
+#define SHM_NAME "/spatial_perception_grid_delta_bench"
+#define SHM_SLOT_COUNT 4
+
+/* Changed blocks of a volume, by comparing its voxels with the previous
+ * volume, and their counts. */
+static void referenceDelta(const OccupancyVolume &previous,
+                           const OccupancyVolume &volume,
+                           std::vector<GridBlock> &changed) {
+  int blocks[3];
+  for (int i = 0; i < 3; i++)
+    blocks[i] = (volume.size[i] + GRID_DELTA_BLOCK_SIZE - 1) /
+                GRID_DELTA_BLOCK_SIZE;
+
+  changed.clear();
+  for (int bz = 0; bz < blocks[2]; bz++) {
+    for (int by = 0; by < blocks[1]; by++) {
+      for (int bx = 0; bx < blocks[0]; bx++) {
+        GridBlock block = {(uint16_t)bx, (uint16_t)by, (uint16_t)bz, 0, 0, 0};
+        bool differs = false;
+        for (int z = bz * GRID_DELTA_BLOCK_SIZE;
+             z < std::min(volume.size[2], (bz + 1) * GRID_DELTA_BLOCK_SIZE);
+             z++) {
+          for (int y = by * GRID_DELTA_BLOCK_SIZE;
+               y <
+               std::min(volume.size[1], (by + 1) * GRID_DELTA_BLOCK_SIZE);
+               y++) {
+            for (int x = bx * GRID_DELTA_BLOCK_SIZE;
+                 x <
+                 std::min(volume.size[0], (bx + 1) * GRID_DELTA_BLOCK_SIZE);
+                 x++) {
+              size_t i = volume.index(x, y, z);
+              differs = differs || volume.logodds[i] != previous.logodds[i];
+              block.occupied += volume.logodds[i] >= OBSTACLE_LOGODD;
+              block.previousOccupied += previous.logodds[i] >= OBSTACLE_LOGODD;
+              block.unknown += volume.logodds[i] == OCCUPANCY_UNKNOWN;
+            }
+          }
+        }
+        if (differs)
+          changed.push_back(block);
+      }
+    }
+  }
+}
+
+static bool sameBlocks(const GridBlock *a, const GridBlock *b, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (a[i].x != b[i].x || a[i].y != b[i].y || a[i].z != b[i].z ||
+        a[i].occupied != b[i].occupied ||
+        a[i].previousOccupied != b[i].previousOccupied ||
+        a[i].unknown != b[i].unknown)
+      return false;
+  }
+  return true;
+}
+
+static void usage(const char *progname) {
+  fprintf(stderr,
+          "usage: %s [-n frames] [-s size] [-z height] [-o movers] "
+          "[-f flips]\n",
+          progname);
+}
+
+int main(int argc, char *argv[]) {
+  int opt, res;
+  int frameCount = DEFAULT_FRAME_COUNT;
+  int size = DEFAULT_SIZE;
+  int height = DEFAULT_HEIGHT;
+  int moverCount = DEFAULT_MOVER_COUNT;
+  int flipCount = DEFAULT_FLIP_COUNT;
+  OccupancyVolume scene, volume, previous;
+  GridDelta delta;
+  GridDeltaShmSlot slot;
+  std::vector<GridBlock> reference, blocks;
+  GridDeltaShm *writer = nullptr, *reader = nullptr;
+
+  while ((opt = getopt(argc, argv, "n:s:z:o:f:")) != -1) {
+    switch (opt) {
+    case 'n':
+      frameCount = atoi(optarg);
+      break;
+    case 's':
+      size = atoi(optarg);
+      break;
+    case 'z':
+      height = atoi(optarg);
+      break;
+    case 'o':
+      moverCount = atoi(optarg);
+      break;
+    case 'f':
+      flipCount = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (frameCount <= SHM_SLOT_COUNT || size < 16 || height < 16 ||
+      moverCount < 0 || flipCount < 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  GridDiff diff(OBSTACLE_LOGODD);
+  fillStatic(scene, size, height, DEFAULT_RESOLUTION, true);
+  size_t blockCount = 1;
+  for (int i = 0; i < 3; i++)
+    blockCount *= (scene.size[i] + GRID_DELTA_BLOCK_SIZE - 1) /
+                  GRID_DELTA_BLOCK_SIZE;
+
+  res = GridDeltaShm::create(SHM_NAME, SHM_SLOT_COUNT, blockCount, &writer);
+  if (res == 0)
+    res = GridDeltaShm::open(SHM_NAME, &reader);
+  if (res < 0) {
+    fprintf(stderr, "shared memory: %s\n", strerror(-res));
+    GridDeltaShm::destroy(writer);
+    return EXIT_FAILURE;
+  }
+  blocks.resize(reader->getMaxBlocks());
+
+  uint64_t diffUs = 0, hashUs = 0, compareUs = 0, publishUs = 0, readUs = 0;
+  uint64_t start, hash = 0;
+  size_t changedBlocks = 0, obstacleBlocks = 0;
+  int mismatches = 0;
+
+  for (int frame = 0; frame <= frameCount; frame++) {
+    fillFrame(scene, volume, frame, moverCount, flipCount);
+
+    /* The first frame gives a full delta */
+    start = timeNowUs();
+    res = diff.update(volume, &delta);
+    uint64_t us = timeNowUs() - start;
+    if (res < 0)
+      break;
+    delta.generation = frame;
+    delta.timestampNs = frame;
+    start = timeNowUs();
+    res = writer->publish(delta);
+    if (frame > 0)
+      publishUs += timeNowUs() - start;
+    if (res < 0)
+      break;
+    start = timeNowUs();
+    res = reader->read(frame, &slot, blocks.data());
+    if (frame > 0)
+      readUs += timeNowUs() - start;
+    if (res < 0)
+      break;
+    if (slot.generation != (uint64_t)frame ||
+        slot.count != delta.changed.size() ||
+        !sameBlocks(blocks.data(), delta.changed.data(), slot.count)) {
+      fprintf(stderr, "frame %d: delta read back differs\n", frame);
+      mismatches++;
+    }
+    if (frame == 0) {
+      if (!delta.full || delta.changed.size() != delta.blockCount()) {
+        fprintf(stderr, "first delta is not full\n");
+        mismatches++;
+      }
+      previous = volume;
+      continue;
+    }
+    diffUs += us;
+
+    /* Whole volume hash, as the service checks for unchanged grids */
+    start = timeNowUs();
+    hash ^= hashVolume(volume);
+    hashUs += timeNowUs() - start;
+
+    start = timeNowUs();
+    referenceDelta(previous, volume, reference);
+    compareUs += timeNowUs() - start;
+    if (delta.full || delta.changed.size() != reference.size() ||
+        !sameBlocks(delta.changed.data(), reference.data(),
+                    reference.size())) {
+      fprintf(stderr, "frame %d: %zu blocks changed, %zu expected\n", frame,
+              delta.changed.size(), reference.size());
+      mismatches++;
+    }
+    changedBlocks += delta.changed.size();
+    for (const GridBlock &block : delta.changed)
+      obstacleBlocks += block.occupied > block.previousOccupied;
+    previous = std::move(volume);
+  }
+
+  /* A reader falling behind by more than the ring loses deltas */
+  if (res == 0 &&
+      reader->read(frameCount - SHM_SLOT_COUNT, &slot, blocks.data()) !=
+          -ENODATA) {
+    fprintf(stderr, "overwritten delta still readable\n");
+    mismatches++;
+  }
+  GridDeltaShm::destroy(reader);
+  GridDeltaShm::destroy(writer);
+  if (res < 0) {
+    fprintf(stderr, "grid delta: %s\n", strerror(-res));
+    return EXIT_FAILURE;
+  }
+
+  printf("%dx%dx%d voxels, %zu blocks, %d movers, %d flips/frame "
+         "(hash %016llx)\n",
+         size, size, height, delta.blockCount(), moverCount, flipCount,
+         (unsigned long long)hash);
+  printf("diff: %.1f us/frame, %.1f blocks changed, %.1f with new "
+         "obstacles\n",
+         (double)diffUs / frameCount, (double)changedBlocks / frameCount,
+         (double)obstacleBlocks / frameCount);
+  printf("whole volume hash: %.1f us/frame, voxel compare: %.1f us/frame\n",
+         (double)hashUs / frameCount, (double)compareUs / frameCount);
+  printf("shm publish: %.1f us/frame, read: %.1f us/frame\n",
+         (double)publishUs / frameCount, (double)readUs / frameCount);
+
+  if (mismatches > 0) {
+    fprintf(stderr, "%d mismatches\n", mismatches);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,237 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "bench_scene.hpp"
+#include "occupancy_volume.hpp"
+
+#define DEFAULT_ITERATIONS 200
+#define DEFAULT_SIZE 160
+#define DEFAULT_HEIGHT 48
+#define DEFAULT_RESOLUTION 0.2f
+#define DEFAULT_LOGODDS "1,3"
+#define DEFAULT_DISTANCES "1.2,3,6"
+
+/* Drone in the middle of a volume with a ground plane, a few walls and
+ * pillars, free space in between. Voxels farther than 3/4 of the half size
+ * of the volume, and a few random ones, have never been observed. */
+static void fillVolume(OccupancyVolume &volume, int size, int height,
+                       float resolution) {
+  volume.size[0] = size;
+  volume.size[1] = size;
+  volume.size[2] = height;
+  volume.resolution = resolution;
+  for (int i = 0; i < 3; i++) {
+    volume.origin[i] = 0.f;
+    volume.center[i] = volume.size[i] * resolution / 2.f;
+  }
+  volume.logodds.assign(volume.count(), OCCUPANCY_UNKNOWN);
+
+  srand(1);
+  float observed = size * 3 / 8.f;
+  for (int z = 0; z < height; z++) {
+    for (int y = 0; y < size; y++) {
+      for (int x = 0; x < size; x++) {
+        float dx = x - size / 2.f, dy = y - size / 2.f;
+        if (dx * dx + dy * dy > observed * observed || rand() % 20 == 0)
+          continue;
+        /* z goes down, the ground is at the bottom of the volume */
+        bool ground = z >= height - 3;
+        bool wall = (x % 40) < 2 || (y % 56) < 2;
+        bool pillar = (x % 16) < 3 && (y % 16) < 3;
+        int8_t logodd;
+        if (ground || wall || pillar)
+          logodd = 1 + rand() % 7;
+        else
+          logodd = -(rand() % 5);
+        volume.logodds[volume.index(x, y, z)] = logodd;
+      }
+    }
+  }
+}
+
+/* Straightforward density of a single query, every voxel of the volume is
+ * checked. Distances are computed as in computeDensities so that voxels on
+ * the boundary of a shell are counted the same way. */
+static float referenceDensity(const OccupancyVolume &volume,
+                              const DensityQuery &query) {
+  float d = query.distance / volume.resolution;
+  float maxDist2 = d > 0.f ? d * d : 0.f;
+  float center[3];
+  uint32_t observed = 0, occupied = 0;
+
+  for (int i = 0; i < 3; i++)
+    center[i] = (volume.center[i] - volume.origin[i]) / volume.resolution - .5f;
+
+  for (int z = 0; z < volume.size[2]; z++) {
+    for (int y = 0; y < volume.size[1]; y++) {
+      for (int x = 0; x < volume.size[0]; x++) {
+        float dx = x - center[0], dy = y - center[1], dz = z - center[2];
+        int8_t logodd = volume.logodds[volume.index(x, y, z)];
+        if (logodd == OCCUPANCY_UNKNOWN ||
+            dy * dy + dz * dz + dx * dx > maxDist2)
+          continue;
+        observed++;
+        if (logodd >= query.logodd)
+          occupied++;
+      }
+    }
+  }
+  return observed > 0 ? (float)occupied / observed : 0.f;
+}
+
+static int parseList(const char *str, std::vector<float> &values) {
+  char *end;
+
+  values.clear();
+  do {
+    values.push_back(strtof(str, &end));
+    if (end == str || (*end != ',' && *end != '\0'))
+      return -EINVAL;
+    str = end + 1;
+  } while (*end != '\0');
+  return 0;
+}
+
+static void usage(const char *progname) {
+  fprintf(stderr,
+          "usage: %s [-n iterations] [-s size] [-z height] [-r resolution] "
+          "[-l logodds] [-d distances]\n",
+          progname);
+}
+
+int main(int argc, char *argv[]) {
+  int opt;
+  int iterations = DEFAULT_ITERATIONS;
+  int size = DEFAULT_SIZE;
+  int height = DEFAULT_HEIGHT;
+  float resolution = DEFAULT_RESOLUTION;
+  const char *logoddList = DEFAULT_LOGODDS;
+  const char *distanceList = DEFAULT_DISTANCES;
+  std::vector<float> logodds, distances;
+  std::vector<DensityQuery> queries;
+  OccupancyVolume volume;
+
+  while ((opt = getopt(argc, argv, "n:s:z:r:l:d:")) != -1) {
+    switch (opt) {
+    case 'n':
+      iterations = atoi(optarg);
+      break;
+    case 's':
+      size = atoi(optarg);
+      break;
+    case 'z':
+      height = atoi(optarg);
+      break;
+    case 'r':
+      resolution = atof(optarg);
+      break;
+    case 'l':
+      logoddList = optarg;
+      break;
+    case 'd':
+      distanceList = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (iterations <= 0 || size <= 0 || height <= 0 || resolution <= 0.f ||
+      parseList(logoddList, logodds) < 0 ||
+      parseList(distanceList, distances) < 0 ||
+      logodds.size() * distances.size() > OCCUPANCY_MAX_DENSITY_QUERIES) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  for (float distance : distances) {
+    for (float logodd : logodds)
+      queries.push_back({(int8_t)logodd, distance});
+  }
+  size_t count = queries.size();
+  std::vector<float> batch(count), single(count), reference(count);
+
+  fillVolume(volume, size, height, resolution);
+  for (size_t i = 0; i < count; i++)
+    reference[i] = referenceDensity(volume, queries[i]);
+
+  /* Alternate both ways of computing the densities so that they see the
+   * same cache and frequency conditions */
+  uint64_t batchUs = 0, singleUs = 0, start;
+  for (int n = 0; n < iterations; n++) {
+    start = timeNowUs();
+    int res = computeDensities(volume, queries.data(), count, batch.data());
+    batchUs += timeNowUs() - start;
+    if (res < 0) {
+      fprintf(stderr, "computeDensities: %s\n", strerror(-res));
+      return EXIT_FAILURE;
+    }
+
+    start = timeNowUs();
+    for (size_t i = 0; i < count && res == 0; i++)
+      res = computeDensities(volume, &queries[i], 1, &single[i]);
+    singleUs += timeNowUs() - start;
+    if (res < 0) {
+      fprintf(stderr, "computeDensities: %s\n", strerror(-res));
+      return EXIT_FAILURE;
+    }
+  }
+
+  int mismatches = 0;
+  for (size_t i = 0; i < count; i++) {
+    printf("logodd %3d distance %5.2f m: density %.4f\n", queries[i].logodd,
+           queries[i].distance, batch[i]);
+    if (fabsf(batch[i] - reference[i]) > 1e-6f ||
+        fabsf(single[i] - reference[i]) > 1e-6f) {
+      fprintf(stderr, "  mismatch: batch %.6f single %.6f reference %.6f\n",
+              batch[i], single[i], reference[i]);
+      mismatches++;
+    }
+  }
+
+  double batchAvg = (double)batchUs / iterations;
+  double singleAvg = (double)singleUs / iterations;
+  printf("%dx%dx%d voxels of %.2f m, %zu queries: batch %.1f us, "
+         "%zu separate queries %.1f us, speedup %.2f\n",
+         size, size, height, resolution, count, batchAvg, count, singleAvg,
+         singleAvg / batchAvg);
+
+  return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,254 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#define ULOG_TAG spatial_perception
+#include <ulog.h>
+ULOG_DECLARE_TAG(ULOG_TAG);
+
+#include "bench_scene.hpp"
+#include "distance_field.hpp"
+#include "distance_field_shm.hpp"
+
+#define DEFAULT_FRAME_COUNT 50
+#define DEFAULT_SIZE 128
+#define DEFAULT_HEIGHT 40
+#define DEFAULT_RESOLUTION 0.2f
+#define DEFAULT_MAX_DISTANCE 5.f
+#define DEFAULT_MOVER_COUNT 4
+#define DEFAULT_FLIP_COUNT 50
+#define OBSTACLE_LOGODD 3
+#define CHECKED_VOXELS 1000
+#define SHM_NAME "/spatial_perception_distance_field_bench"
+
+/* Exact distance of a voxel to the nearest obstacle within the maximum
+ * distance, INFINITY if none. */
+static float exactDistance(const OccupancyVolume &volume, int x, int y, int z,
+                           float maxDistance) {
+  int r = (int)(maxDistance / volume.resolution);
+  int32_t best = INT32_MAX;
+
+  for (int k = std::max(0, z - r); k <= std::min(volume.size[2] - 1, z + r);
+       k++) {
+    for (int j = std::max(0, y - r); j <= std::min(volume.size[1] - 1, y + r);
+         j++) {
+      for (int i = std::max(0, x - r);
+           i <= std::min(volume.size[0] - 1, x + r); i++) {
+        if (volume.logodds[volume.index(i, j, k)] < OBSTACLE_LOGODD)
+          continue;
+        int32_t d2 = (i - x) * (i - x) + (j - y) * (j - y) + (k - z) * (k - z);
+        if (d2 < best)
+          best = d2;
+      }
+    }
+  }
+  if (best > r * r)
+    return INFINITY;
+  return sqrtf((float)best) * volume.resolution;
+}
+
+static float distanceError(float a, float b) {
+  if (isinf(a) || isinf(b))
+    return isinf(a) && isinf(b) ? 0.f : INFINITY;
+  return fabsf(a - b);
+}
+
+static void usage(const char *progname) {
+  fprintf(stderr,
+          "usage: %s [-n frames] [-s size] [-z height] [-r resolution] "
+          "[-m max_distance] [-o movers] [-f flips]\n",
+          progname);
+}
+
+int main(int argc, char *argv[]) {
+  int opt, res;
+  int frameCount = DEFAULT_FRAME_COUNT;
+  int size = DEFAULT_SIZE;
+  int height = DEFAULT_HEIGHT;
+  float resolution = DEFAULT_RESOLUTION;
+  float maxDistance = DEFAULT_MAX_DISTANCE;
+  int moverCount = DEFAULT_MOVER_COUNT;
+  int flipCount = DEFAULT_FLIP_COUNT;
+  OccupancyVolume scene, volume;
+  DistanceField::Stats stats;
+  DistanceFieldShm *writer = nullptr, *reader = nullptr;
+
+  while ((opt = getopt(argc, argv, "n:s:z:r:m:o:f:")) != -1) {
+    switch (opt) {
+    case 'n':
+      frameCount = atoi(optarg);
+      break;
+    case 's':
+      size = atoi(optarg);
+      break;
+    case 'z':
+      height = atoi(optarg);
+      break;
+    case 'r':
+      resolution = atof(optarg);
+      break;
+    case 'm':
+      maxDistance = atof(optarg);
+      break;
+    case 'o':
+      moverCount = atoi(optarg);
+      break;
+    case 'f':
+      flipCount = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (frameCount <= 0 || size < 16 || height < 16 || resolution <= 0.f ||
+      maxDistance <= 0.f || moverCount < 0 || flipCount < 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  DistanceField incremental(OBSTACLE_LOGODD, maxDistance);
+  DistanceField full(OBSTACLE_LOGODD, maxDistance);
+  fillStatic(scene, size, height, resolution, false);
+
+  res = DistanceFieldShm::create(SHM_NAME, scene.count(), &writer);
+  if (res == 0)
+    res = DistanceFieldShm::open(SHM_NAME, &reader);
+  if (res < 0) {
+    fprintf(stderr, "shared memory: %s\n", strerror(-res));
+    DistanceFieldShm::destroy(writer);
+    return EXIT_FAILURE;
+  }
+
+  uint64_t fullUs = 0, incrementalUs = 0, publishUs = 0, start;
+  size_t changedObstacles = 0, changedVoxels = 0, visitedVoxels = 0;
+  size_t fullVisitedVoxels = 0;
+  float fieldError = 0.f, exactError = 0.f, shmError = 0.f;
+
+  for (int frame = 0; frame <= frameCount; frame++) {
+    fillFrame(scene, volume, frame, moverCount, flipCount);
+
+    /* The first frame initializes the incremental field */
+    start = timeNowUs();
+    res = incremental.update(volume, &stats);
+    uint64_t updateUs = timeNowUs() - start;
+    if (res < 0)
+      break;
+    if (frame > 0) {
+      incrementalUs += updateUs;
+      changedObstacles += stats.changedObstacles;
+      changedVoxels += stats.changedVoxels;
+      visitedVoxels += stats.visitedVoxels;
+    }
+
+    start = timeNowUs();
+    res = writer->publish(incremental, stats.full);
+    if (frame > 0)
+      publishUs += timeNowUs() - start;
+    if (res < 0)
+      break;
+
+    if (frame == 0)
+      continue;
+    start = timeNowUs();
+    res = full.recompute(volume, &stats);
+    fullUs += timeNowUs() - start;
+    if (res < 0)
+      break;
+    fullVisitedVoxels += stats.visitedVoxels;
+
+    /* Incremental and full fields, and what readers of the shared memory
+     * see, against the exact distance of a few voxels */
+    for (size_t i = 0; i < volume.count(); i++) {
+      fieldError =
+          std::max(fieldError, distanceError(incremental.getDistance(i),
+                                             full.getDistance(i)));
+    }
+    srand(1000 + frame);
+    for (int i = 0; i < CHECKED_VOXELS / frameCount + 1; i++) {
+      int x = rand() % size, y = rand() % size, z = rand() % height;
+      float position[3] = {(x + .5f) * resolution, (y + .5f) * resolution,
+                           (z + .5f) * resolution};
+      float exact = exactDistance(volume, x, y, z, maxDistance);
+      float shared;
+      exactError = std::max(
+          exactError, distanceError(full.getDistance(volume.index(x, y, z)),
+                                    exact));
+      res = reader->getDistance(position, &shared);
+      if (res < 0)
+        break;
+      shmError = std::max(
+          shmError,
+          distanceError(incremental.getDistance(position), shared));
+    }
+    if (res < 0)
+      break;
+  }
+  DistanceFieldShm::destroy(reader);
+  DistanceFieldShm::destroy(writer);
+  if (res < 0) {
+    fprintf(stderr, "distance field: %s\n", strerror(-res));
+    return EXIT_FAILURE;
+  }
+
+  printf("%dx%dx%d voxels of %.2f m, max distance %.1f m, %d movers, "
+         "%d flips/frame\n",
+         size, size, height, resolution, maxDistance, moverCount, flipCount);
+  printf("full: %.1f us/frame, %.0f voxels visited\n",
+         (double)fullUs / frameCount, (double)fullVisitedVoxels / frameCount);
+  printf("incremental: %.1f us/frame, %.0f obstacles changed, %.0f distances "
+         "changed, %.0f voxels visited, speedup %.1f\n",
+         (double)incrementalUs / frameCount,
+         (double)changedObstacles / frameCount,
+         (double)changedVoxels / frameCount,
+         (double)visitedVoxels / frameCount, (double)fullUs / incrementalUs);
+  printf("shm publish: %.1f us/frame\n", (double)publishUs / frameCount);
+  printf("max error: incremental vs full %.3f m, full vs exact %.3f m, "
+         "shm vs incremental %.4f m\n",
+         fieldError, exactError, shmError);
+
+  /* Distances through the 26 neighbours may be slightly off, both fields
+   * shall agree within a voxel, the shared memory within a millimeter */
+  if (fieldError > resolution || exactError > resolution ||
+      shmError > 0.001f) {
+    fprintf(stderr, "distance field error too large\n");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,256 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#define ULOG_TAG spatial_perception
+#include <ulog.h>
+ULOG_DECLARE_TAG(ULOG_TAG);
+
+#include "frontier_map.hpp"
+#include "grid_delta.hpp"
+#include "occupancy_volume.hpp"
+
+#define DEFAULT_FRAME_COUNT 200
+#define DEFAULT_SIZE 128
+#define DEFAULT_HEIGHT 40
+#define DEFAULT_RESOLUTION 0.2f
+#define DEFAULT_RANGE 4.f
+#define DEFAULT_BUDGET 2000
+#define OBSTACLE_LOGODD 3
+#define FREE_LOGODD -1
+#define MIN_CLUSTER_VOXELS 8
+#define MAX_GOALS 8
+#define DISTANCE_COST 0.2f
+#define MAX_FRONTIER_VOXELS (64 * 1024)
+#define UNLIMITED_BUDGET 1000000000
+
+/* Ground plane, walls and pillars seen by the drone. */
+static bool isObstacle(int x, int y, int z, int height) {
+  bool ground = z >= height - 2;
+  bool wall = (x % 48) < 2 && (y % 32) > 8;
+  bool pillar = (x % 20) < 2 && (y % 20) < 2;
+  return ground || wall || pillar;
+}
+
+static void fillUnknown(OccupancyVolume &volume, int size, int height,
+                        float resolution) {
+  volume.size[0] = size;
+  volume.size[1] = size;
+  volume.size[2] = height;
+  volume.resolution = resolution;
+  for (int i = 0; i < 3; i++)
+    volume.origin[i] = 0.f;
+  volume.logodds.assign(volume.count(), OCCUPANCY_UNKNOWN);
+}
+
+/* The drone sweeps the volume back and forth 2 m above the ground and
+ * observes every voxel within its range, without occlusions. */
+static void observe(OccupancyVolume &volume, int frame, int frameCount,
+                    float range) {
+  const int *size = volume.size;
+  float resolution = volume.resolution;
+  float extent = size[0] * resolution;
+  float t = (float)frame / frameCount;
+  int lane = (int)(t * 4);
+  float u = t * 4 - lane;
+
+  volume.center[0] = (0.1f + 0.8f * (lane % 2 ? 1.f - u : u)) * extent;
+  volume.center[1] = (0.15f + 0.7f * (t * 4 / 3 > 1.f ? 1.f : t * 4 / 3)) *
+                     size[1] * resolution;
+  volume.center[2] = (size[2] - 12) * resolution;
+
+  int lo[3], hi[3];
+  for (int i = 0; i < 3; i++) {
+    lo[i] = std::max((int)((volume.center[i] - range) / resolution), 0);
+    hi[i] = std::min((int)((volume.center[i] + range) / resolution) + 1,
+                     size[i]);
+  }
+  for (int z = lo[2]; z < hi[2]; z++) {
+    for (int y = lo[1]; y < hi[1]; y++) {
+      for (int x = lo[0]; x < hi[0]; x++) {
+        float d[3] = {(x + 0.5f) * resolution - volume.center[0],
+                      (y + 0.5f) * resolution - volume.center[1],
+                      (z + 0.5f) * resolution - volume.center[2]};
+        if (d[0] * d[0] + d[1] * d[1] + d[2] * d[2] > range * range)
+          continue;
+        volume.logodds[volume.index(x, y, z)] =
+            isObstacle(x, y, z, size[2]) ? 5 : -2;
+      }
+    }
+  }
+}
+
+static bool sameGoals(const FrontierMap::Result &a,
+                      const FrontierMap::Result &b) {
+  if (a.frontierVoxels != b.frontierVoxels || a.clusters != b.clusters ||
+      a.goals.size() != b.goals.size())
+    return false;
+  for (size_t i = 0; i < a.goals.size(); i++) {
+    if (a.goals[i].voxels != b.goals[i].voxels ||
+        memcmp(a.goals[i].position, b.goals[i].position,
+               sizeof(a.goals[i].position)) != 0)
+      return false;
+  }
+  return true;
+}
+
+static int run(int size, int height, int frameCount, float range,
+               unsigned int budgetUs) {
+  FrontierMap::Config config = {
+      .freeLogodd = FREE_LOGODD,
+      .minClusterVoxels = MIN_CLUSTER_VOXELS,
+      .maxGoals = MAX_GOALS,
+      .distanceCost = DISTANCE_COST,
+      .maxFrontierVoxels = MAX_FRONTIER_VOXELS,
+      .budgetUs = budgetUs,
+  };
+  FrontierMap incremental(config);
+  config.budgetUs = UNLIMITED_BUDGET;
+  FrontierMap full(config);
+  GridDiff diff(OBSTACLE_LOGODD);
+  OccupancyVolume volume;
+  GridDelta delta;
+  FrontierMap::Result result, reference;
+  uint64_t incrementalSum = 0, incrementalMax = 0;
+  uint64_t fullSum = 0, fullMax = 0;
+  size_t pendingMax = 0, frontierMax = 0, clusterMax = 0;
+  unsigned int behind = 0, mismatches = 0;
+
+  fillUnknown(volume, size, height, DEFAULT_RESOLUTION);
+  for (int i = 0; i < frameCount; i++) {
+    observe(volume, i, frameCount, range);
+    int res = diff.update(volume, &delta);
+    if (res < 0)
+      return res;
+    res = incremental.update(volume, delta, &result);
+    if (res < 0)
+      return res;
+
+    /* The same grid searched from scratch */
+    delta.full = true;
+    res = full.update(volume, delta, &reference);
+    if (res < 0)
+      return res;
+
+    incrementalSum += result.extractUs;
+    incrementalMax = std::max(incrementalMax, result.extractUs);
+    fullSum += reference.extractUs;
+    fullMax = std::max(fullMax, reference.extractUs);
+    pendingMax = std::max(pendingMax, result.pendingBlocks);
+    frontierMax = std::max(frontierMax, reference.frontierVoxels);
+    clusterMax = std::max(clusterMax, reference.clusters);
+    if (result.pendingBlocks > 0 || !result.clustered) {
+      behind++;
+    } else if (!sameGoals(result, reference)) {
+      fprintf(stderr, "frame %d: goals differ from a full extraction\n", i);
+      mismatches++;
+    }
+  }
+
+  char name[32];
+  if (budgetUs == UNLIMITED_BUDGET)
+    snprintf(name, sizeof(name), "unlimited");
+  else
+    snprintf(name, sizeof(name), "%u us", budgetUs);
+  printf("budget %-9s: incremental mean %.0f us max %llu us, full mean %.0f "
+         "us max %llu us, %u grids behind (%zu blocks max), up to %zu "
+         "frontier voxels in %zu clusters\n",
+         name, (double)incrementalSum / frameCount,
+         (unsigned long long)incrementalMax, (double)fullSum / frameCount,
+         (unsigned long long)fullMax, behind, pendingMax, frontierMax,
+         clusterMax);
+  return mismatches > 0 ? -EIO : 0;
+}
+
+static void usage(const char *progname) {
+  fprintf(stderr,
+          "usage: %s [-n frames] [-s size] [-z height] [-r range] "
+          "[-b budget_us]\n",
+          progname);
+}
+
+int main(int argc, char *argv[]) {
+  int opt;
+  int frameCount = DEFAULT_FRAME_COUNT;
+  int size = DEFAULT_SIZE;
+  int height = DEFAULT_HEIGHT;
+  float range = DEFAULT_RANGE;
+  unsigned int budgetUs = DEFAULT_BUDGET;
+  int res = 0;
+
+  while ((opt = getopt(argc, argv, "n:s:z:r:b:")) != -1) {
+    switch (opt) {
+    case 'n':
+      frameCount = atoi(optarg);
+      break;
+    case 's':
+      size = atoi(optarg);
+      break;
+    case 'z':
+      height = atoi(optarg);
+      break;
+    case 'r':
+      range = atof(optarg);
+      break;
+    case 'b':
+      budgetUs = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (frameCount <= 0 || size < 16 || height < 16 || range <= 0.f ||
+      budgetUs == 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  printf("%dx%dx%d voxels, range %.1f m, %d grids\n", size, size, height,
+         range, frameCount);
+  for (unsigned int budget : {(unsigned int)UNLIMITED_BUDGET, budgetUs}) {
+    int err = run(size, height, frameCount, range, budget);
+    if (err < 0) {
+      fprintf(stderr, "frontiers: %s\n", strerror(-err));
+      res = err;
+    }
+  }
+  return res < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
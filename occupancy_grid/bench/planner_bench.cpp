@@ -0,0 +1,349 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define ULOG_TAG spatial_perception
+#include <ulog.h>
+ULOG_DECLARE_TAG(ULOG_TAG);
+
+#include "grid_snapshot.hpp"
+#include "occupancy_pyramid.hpp"
+#include "path_planner.hpp"
+
+#define DEFAULT_QUERY_COUNT 20
+#define DEFAULT_RADIUS 0.4f
+#define DEFAULT_BUDGET_US 20000
+#define UNLIMITED_BUDGET_US 60000000
+#define MIN_GOAL_DISTANCE 3.f
+#define GOAL_ATTEMPTS 100
+
+/* Pyramid of the service, see its main.cpp */
+#define OBSTACLE_LOGODD 3
+#define LEVEL_COUNT 4
+
+struct Stats {
+  unsigned int count;
+  unsigned int status[PATH_NO_GRID + 1];
+  uint64_t timeSum;
+  uint64_t timeMax;
+  uint64_t expandedSum;
+  uint64_t checkedSum;
+  unsigned int openMax;
+  /* Length of the found paths over the straight line, and distance left
+   * to the goal by the other ones */
+  double ratioSum;
+  double remainingSum;
+  unsigned int collisions;
+
+  void add(const PathPlanner::Result &result, float straight) {
+    count++;
+    status[result.status]++;
+    timeSum += result.planningUs;
+    timeMax = std::max(timeMax, result.planningUs);
+    expandedSum += result.expandedNodes;
+    checkedSum += result.checkedCells;
+    openMax = std::max(openMax, result.openHighWater);
+    if (result.status == PATH_FOUND)
+      ratioSum += result.length / straight;
+    else
+      remainingSum += result.remaining;
+  }
+
+  void print(const char *name) const {
+    unsigned int others = count - status[PATH_FOUND];
+    printf("  %-9s found %u, partial %u, unreachable %u, "
+           "%.0f/%llu us mean/max, %.0f expanded, %.0f checked, open max %u, "
+           "length x%.3f, remaining %.2f m, collisions %u\n",
+           name, status[PATH_FOUND], status[PATH_PARTIAL],
+           status[PATH_UNREACHABLE], (double)timeSum / count,
+           (unsigned long long)timeMax, (double)expandedSum / count,
+           (double)checkedSum / count, openMax,
+           status[PATH_FOUND] > 0 ? ratioSum / status[PATH_FOUND] : 0.,
+           others > 0 ? remainingSum / others : 0., collisions);
+  }
+};
+
+static float randRange(float a, float b) {
+  return a + (b - a) * (rand() / (float)RAND_MAX);
+}
+
+static float distance(const float a[3], const float b[3]) {
+  float dx = b[0] - a[0], dy = b[1] - a[1], dz = b[2] - a[2];
+  return sqrtf(dx * dx + dy * dy + dz * dz);
+}
+
+static int listSnapshots(const char *dir, std::vector<std::string> &names) {
+  static const size_t extLen = strlen(GRID_SNAPSHOT_EXTENSION);
+  struct dirent *entry;
+
+  DIR *d = opendir(dir);
+  if (d == nullptr)
+    return -errno;
+  while ((entry = readdir(d)) != nullptr) {
+    size_t len = strlen(entry->d_name);
+    if (len > extLen &&
+        strcmp(entry->d_name + len - extLen, GRID_SNAPSHOT_EXTENSION) == 0)
+      names.push_back(entry->d_name);
+  }
+  closedir(d);
+  std::sort(names.begin(), names.end());
+  return 0;
+}
+
+/* Random goal at least MIN_GOAL_DISTANCE from the start, with no obstacle
+ * within the radius. */
+static bool pickGoal(const OccupancyPyramid &pyramid,
+                     const OccupancyVolume &volume, const float start[3],
+                     float radius, float goal[3]) {
+  for (int attempt = 0; attempt < GOAL_ATTEMPTS; attempt++) {
+    float min[3], max[3];
+    bool collides = true;
+    for (int i = 0; i < 3; i++) {
+      float extent = volume.size[i] * volume.resolution;
+      goal[i] = volume.origin[i] + randRange(radius, extent - radius);
+      min[i] = goal[i] - radius;
+      max[i] = goal[i] + radius;
+    }
+    if (distance(start, goal) < MIN_GOAL_DISTANCE)
+      continue;
+    if (pyramid.checkBox(min, max, &collides, nullptr) == 0 && !collides)
+      return true;
+  }
+  return false;
+}
+
+/* Segments of a path crossing an obstacle. When an obstacle is within a
+ * cell and the radius of the start, the drone may get away from it through
+ * cells which are not traversable, segments starting there are skipped. */
+static unsigned int countCollisions(const OccupancyPyramid &pyramid,
+                                    const PathPlanner::Result &result,
+                                    float radius, float cellSize) {
+  const PathPlanner::Waypoint &start = result.waypoints[0];
+  float grow = radius + cellSize;
+  float min[3] = {start.x - grow, start.y - grow, start.z - grow};
+  float max[3] = {start.x + grow, start.y + grow, start.z + grow};
+  unsigned int collisions = 0;
+  bool collides;
+
+  pyramid.checkBox(min, max, &collides, nullptr);
+  bool escaping = collides;
+  for (size_t i = 1; i < result.waypoints.size(); i++) {
+    const float *from = &result.waypoints[i - 1].x;
+    const float *to = &result.waypoints[i].x;
+    if (escaping && distance(&start.x, from) <= grow)
+      continue;
+    if (pyramid.checkSegment(from, to, radius, &collides, nullptr) == 0 &&
+        collides)
+      collisions++;
+  }
+  return collisions;
+}
+
+/* Cells of a level of the pyramid of a volume. */
+static size_t levelCells(const OccupancyVolume &volume, int level) {
+  size_t count = 1;
+  for (int i = 0; i < 3; i++)
+    count *= ((volume.size[i] - 1) >> level) + 1;
+  return count;
+}
+
+static int run(const char *dir, unsigned int queryCount, int onlyLevel,
+               float radius, unsigned int budgetUs) {
+  std::vector<std::string> names;
+  OccupancyVolume volume;
+  GridSnapshotHeader header;
+  OccupancyPyramid::Config pyramidConfig = {
+      .levelCount = LEVEL_COUNT,
+      .obstacleLogodd = OBSTACLE_LOGODD,
+      .unknownIsObstacle = false,
+      .threadCount = 1,
+  };
+  OccupancyPyramid pyramid(pyramidConfig);
+  std::vector<PathPlanner *> planners;
+  std::vector<Stats> budgeted, unlimited;
+  PathPlanner::Result result;
+  float cellSize;
+  size_t maxCells[LEVEL_COUNT - 1] = {};
+  unsigned int skipped = 0, collisions = 0;
+
+  int res = listSnapshots(dir, names);
+  if (res < 0 || names.empty()) {
+    fprintf(stderr, "no snapshot in '%s'\n", dir);
+    return res < 0 ? res : -ENOENT;
+  }
+  /* The planners are sized for the largest snapshot */
+  for (const std::string &name : names) {
+    res = readGridSnapshot(std::string(dir) + "/" + name, &volume, &header);
+    if (res < 0) {
+      fprintf(stderr, "'%s': %s\n", name.c_str(), strerror(-res));
+      return res;
+    }
+    for (int level = 0; level < LEVEL_COUNT - 1; level++)
+      maxCells[level] = std::max(maxCells[level], levelCells(volume, level));
+  }
+  res = pyramid.start();
+  if (res < 0) {
+    fprintf(stderr, "OccupancyPyramid::start: %s\n", strerror(-res));
+    return res;
+  }
+  for (int level = 0; level < LEVEL_COUNT - 1; level++) {
+    if (onlyLevel >= 0 && level != onlyLevel)
+      continue;
+    PathPlanner::Config config = {
+        .level = (unsigned int)level,
+        .radius = radius,
+        .maxCells = maxCells[level],
+        .maxOpenNodes = 1024 * 1024,
+        .defaultBudgetUs = budgetUs,
+        .maxBudgetUs = UNLIMITED_BUDGET_US,
+    };
+    planners.push_back(new PathPlanner(config));
+  }
+  budgeted.resize(planners.size());
+  unlimited.resize(planners.size());
+
+  srand(1);
+  for (const std::string &name : names) {
+    res = readGridSnapshot(std::string(dir) + "/" + name, &volume, &header);
+    if (res == 0)
+      res = pyramid.build(volume);
+    if (res < 0) {
+      fprintf(stderr, "'%s': %s\n", name.c_str(), strerror(-res));
+      goto out;
+    }
+
+    for (unsigned int q = 0; q < queryCount; q++) {
+      PathPlanner::Request request{};
+      request.id = q;
+      memcpy(request.start, volume.center, sizeof(request.start));
+      if (!pickGoal(pyramid, volume, request.start, radius, request.goal)) {
+        skipped++;
+        continue;
+      }
+      float straight = distance(request.start, request.goal);
+
+      for (size_t p = 0; p < planners.size(); p++) {
+        cellSize = volume.resolution * (1 << planners[p]->getConfig().level);
+
+        /* With the budget, then until the search ends */
+        request.budgetUs = 0;
+        res = planners[p]->plan(pyramid, request, &result);
+        if (res < 0)
+          goto out;
+        budgeted[p].add(result, straight);
+        budgeted[p].collisions +=
+            countCollisions(pyramid, result, radius, cellSize);
+
+        request.budgetUs = UNLIMITED_BUDGET_US;
+        res = planners[p]->plan(pyramid, request, &result);
+        if (res < 0)
+          goto out;
+        unlimited[p].add(result, straight);
+        unlimited[p].collisions +=
+            countCollisions(pyramid, result, radius, cellSize);
+      }
+    }
+  }
+
+  printf("%zu snapshots of '%s', %u queries each from the drone, radius "
+         "%.2f m, budget %u us, %u goals not found\n",
+         names.size(), dir, queryCount, radius, budgetUs, skipped);
+  for (size_t p = 0; p < planners.size(); p++) {
+    const PathPlanner::Config &config = planners[p]->getConfig();
+    printf("level %u (cells of %.1f m):\n", config.level,
+           volume.resolution * (1 << config.level));
+    budgeted[p].print("budget");
+    unlimited[p].print("unlimited");
+    collisions += budgeted[p].collisions + unlimited[p].collisions;
+  }
+  res = collisions > 0 ? -EIO : 0;
+
+out:
+  for (PathPlanner *planner : planners)
+    delete planner;
+  pyramid.stop();
+  return res;
+}
+
+static void usage(const char *progname) {
+  fprintf(stderr,
+          "usage: %s [-n queries] [-l level] [-r radius] [-b budget_us] "
+          "dir\n",
+          progname);
+}
+
+int main(int argc, char *argv[]) {
+  unsigned int queryCount = DEFAULT_QUERY_COUNT;
+  int level = -1;
+  float radius = DEFAULT_RADIUS;
+  unsigned int budgetUs = DEFAULT_BUDGET_US;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:l:r:b:")) != -1) {
+    switch (opt) {
+    case 'n':
+      queryCount = atoi(optarg);
+      break;
+    case 'l':
+      level = atoi(optarg);
+      break;
+    case 'r':
+      radius = atof(optarg);
+      break;
+    case 'b':
+      budgetUs = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind != argc - 1 || queryCount == 0 || level >= LEVEL_COUNT - 1 ||
+      radius < 0.f || budgetUs == 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (run(argv[optind], queryCount, level, radius, budgetUs) < 0)
+    return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
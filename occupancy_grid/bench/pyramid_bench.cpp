@@ -0,0 +1,371 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "bench_scene.hpp"
+#include "occupancy_pyramid.hpp"
+
+#define DEFAULT_QUERY_COUNT 2000
+#define DEFAULT_BUILD_COUNT 20
+#define SIZE 160
+#define HEIGHT 48
+#define RESOLUTION 0.2f
+#define OBSTACLE_LOGODD 3
+
+static float randRange(float a, float b) {
+  return a + (b - a) * (rand() / (float)RAND_MAX);
+}
+
+/* Ground plane, a few walls and pillars with free space in between, fully
+ * observed. */
+static void fillVolume(OccupancyVolume &volume) {
+  volume.size[0] = SIZE;
+  volume.size[1] = SIZE;
+  volume.size[2] = HEIGHT;
+  volume.resolution = RESOLUTION;
+  for (int i = 0; i < 3; i++) {
+    volume.origin[i] = 0.f;
+    volume.center[i] = volume.size[i] * RESOLUTION / 2.f;
+  }
+  volume.logodds.resize(volume.count());
+
+  srand(1);
+  for (int z = 0; z < HEIGHT; z++) {
+    for (int y = 0; y < SIZE; y++) {
+      for (int x = 0; x < SIZE; x++) {
+        /* z goes down, the ground is at the bottom of the volume */
+        bool ground = z >= HEIGHT - 3;
+        bool wall = (x % 80) < 2 || (y % 80) < 2;
+        bool pillar = (x % 32) < 3 && (y % 32) < 3;
+        volume.logodds[volume.index(x, y, z)] =
+            ground || wall || pillar ? 1 + rand() % 7 : -(rand() % 5);
+      }
+    }
+  }
+}
+
+/* Queries above the ground: boxes of 0.4 to 3 m and corridors of 1 to 12 m
+ * with a radius of 0.2 to 0.8 m. */
+struct Query {
+  float min[3], max[3];
+  float from[3], to[3];
+  float radius;
+};
+
+static void makeQueries(std::vector<Query> &queries, int count) {
+  const float extent[3] = {SIZE * RESOLUTION, SIZE * RESOLUTION,
+                           (HEIGHT - 4) * RESOLUTION};
+
+  srand(2);
+  queries.resize(count);
+  for (Query &q : queries) {
+    for (int i = 0; i < 3; i++) {
+      float c = randRange(0.f, extent[i]);
+      float half = randRange(0.2f, 1.5f);
+      q.min[i] = c - half;
+      q.max[i] = c + half;
+      q.from[i] = randRange(0.f, extent[i]);
+    }
+    float length = randRange(1.f, 12.f);
+    float az = randRange(0.f, 2.f * (float)M_PI);
+    float el = randRange(-0.3f, 0.3f);
+    q.to[0] = q.from[0] + length * cosf(el) * cosf(az);
+    q.to[1] = q.from[1] + length * cosf(el) * sinf(az);
+    q.to[2] = q.from[2] + length * sinf(el);
+    q.radius = randRange(0.2f, 0.8f);
+  }
+}
+
+static bool occupied(const OccupancyVolume &volume, int x, int y, int z) {
+  return volume.logodds[volume.index(x, y, z)] >= OBSTACLE_LOGODD;
+}
+
+/* Flat scans of the voxels, with the predicates of the pyramid. */
+static bool flatBox(const OccupancyVolume &volume, const Query &q) {
+  int lo[3], hi[3];
+
+  for (int i = 0; i < 3; i++) {
+    lo[i] = std::max(0, (int)floorf(q.min[i] / volume.resolution));
+    hi[i] = std::min(volume.size[i] - 1,
+                     (int)floorf(q.max[i] / volume.resolution));
+  }
+  for (int z = lo[2]; z <= hi[2]; z++) {
+    for (int y = lo[1]; y <= hi[1]; y++) {
+      for (int x = lo[0]; x <= hi[0]; x++) {
+        if (occupied(volume, x, y, z))
+          return true;
+      }
+    }
+  }
+  return false;
+}
+
+static bool flatSegment(const OccupancyVolume &volume, const Query &q) {
+  float from[3], delta[3], r = q.radius / volume.resolution;
+  int lo[3], hi[3];
+
+  for (int i = 0; i < 3; i++) {
+    from[i] = q.from[i] / volume.resolution;
+    delta[i] = q.to[i] / volume.resolution - from[i];
+    float a = std::min(from[i], from[i] + delta[i]);
+    float b = std::max(from[i], from[i] + delta[i]);
+    lo[i] = std::max(0, (int)floorf(a - r));
+    hi[i] = std::min(volume.size[i] - 1, (int)floorf(b + r));
+  }
+  for (int z = lo[2]; z <= hi[2]; z++) {
+    for (int y = lo[1]; y <= hi[1]; y++) {
+      for (int x = lo[0]; x <= hi[0]; x++) {
+        if (!occupied(volume, x, y, z))
+          continue;
+        const int cell[3] = {x, y, z};
+        float t0 = 0.f, t1 = 1.f;
+        bool hit = true;
+        for (int i = 0; i < 3 && hit; i++) {
+          float cl = (float)cell[i] - r, ch = (float)(cell[i] + 1) + r;
+          if (delta[i] == 0.f) {
+            hit = from[i] >= cl && from[i] <= ch;
+            continue;
+          }
+          float a = (cl - from[i]) / delta[i], b = (ch - from[i]) / delta[i];
+          if (a > b)
+            std::swap(a, b);
+          t0 = std::max(t0, a);
+          t1 = std::min(t1, b);
+          hit = t0 <= t1;
+        }
+        if (hit)
+          return true;
+      }
+    }
+  }
+  return false;
+}
+
+/* Every cell of every level against the voxels it covers. */
+static int checkPooling(const OccupancyPyramid &pyramid,
+                        const OccupancyVolume &volume) {
+  int errors = 0;
+
+  for (unsigned int l = 0; l < pyramid.getConfig().levelCount; l++) {
+    const int *size = pyramid.getLevelSize(l);
+    for (int z = 0; z < size[2]; z++) {
+      for (int y = 0; y < size[1]; y++) {
+        for (int x = 0; x < size[0]; x++) {
+          bool any = false;
+          for (int k = z << l; k < std::min((z + 1) << l, HEIGHT); k++) {
+            for (int j = y << l; j < std::min((y + 1) << l, SIZE); j++) {
+              for (int i = x << l; i < std::min((x + 1) << l, SIZE); i++)
+                any = any || occupied(volume, i, j, k);
+            }
+          }
+          if (any != pyramid.isOccupied(l, x, y, z))
+            errors++;
+        }
+      }
+    }
+  }
+  return errors;
+}
+
+static void usage(const char *progname) {
+  fprintf(stderr, "usage: %s [-n queries] [-b builds] [-t threads]\n",
+          progname);
+}
+
+/* Duration of the queries and cells visited, for the free and the
+ * colliding queries. */
+struct Timing {
+  uint64_t us[2];
+  uint64_t cells[2];
+};
+
+static void printTiming(const char *name, const Timing &timing,
+                        const Timing *flat, const int count[2]) {
+  printf(" %s", name);
+  for (int hit = 0; hit < 2; hit++) {
+    int n = std::max(count[hit], 1);
+    printf(" %s %.2f us", hit ? "colliding" : "free",
+           (double)timing.us[hit] / n);
+    if (flat != nullptr) {
+      printf(" (x%.1f, %.0f cells)",
+             (double)flat->us[hit] / std::max<uint64_t>(timing.us[hit], 1),
+             (double)timing.cells[hit] / n);
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int opt;
+  int queryCount = DEFAULT_QUERY_COUNT;
+  int buildCount = DEFAULT_BUILD_COUNT;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned int maxThreads =
+      std::min<long>(cpus > 0 ? cpus : 1, PYRAMID_MAX_THREADS);
+  OccupancyVolume volume;
+  std::vector<Query> queries;
+  /* Free and colliding queries, from the flat scan */
+  std::vector<const Query *> boxes[2], segments[2];
+  int boxCount[2], segmentCount[2];
+  Timing flat = {}, flatSegments = {};
+  uint64_t start;
+  int errors = 0;
+
+  while ((opt = getopt(argc, argv, "n:b:t:")) != -1) {
+    switch (opt) {
+    case 'n':
+      queryCount = atoi(optarg);
+      break;
+    case 'b':
+      buildCount = atoi(optarg);
+      break;
+    case 't':
+      maxThreads = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (queryCount <= 0 || buildCount <= 0 || maxThreads == 0 ||
+      maxThreads > PYRAMID_MAX_THREADS) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  fillVolume(volume);
+  makeQueries(queries, queryCount);
+  for (const Query &q : queries) {
+    boxes[flatBox(volume, q)].push_back(&q);
+    segments[flatSegment(volume, q)].push_back(&q);
+  }
+  for (int hit = 0; hit < 2; hit++) {
+    boxCount[hit] = boxes[hit].size();
+    segmentCount[hit] = segments[hit].size();
+    /* Scanned again for the timing, the hits keep the scans from being
+     * optimised out */
+    int hits = 0;
+    start = timeNowUs();
+    for (const Query *q : boxes[hit])
+      hits += flatBox(volume, *q);
+    flat.us[hit] = timeNowUs() - start;
+    start = timeNowUs();
+    for (const Query *q : segments[hit])
+      hits += flatSegment(volume, *q);
+    flatSegments.us[hit] = timeNowUs() - start;
+    if (hits != hit * (boxCount[hit] + segmentCount[hit]))
+      return EXIT_FAILURE;
+  }
+  printf("%dx%dx%d voxels, %d queries: %d free boxes, %d free corridors\n",
+         SIZE, SIZE, HEIGHT, queryCount, boxCount[0], segmentCount[0]);
+  printf("flat scan:");
+  printTiming("box", flat, nullptr, boxCount);
+  printTiming("corridor", flatSegments, nullptr, segmentCount);
+  printf("\n");
+
+  for (unsigned int levels = PYRAMID_MIN_LEVELS; levels <= PYRAMID_MAX_LEVELS;
+       levels++) {
+    double buildUs[PYRAMID_MAX_THREADS + 1] = {};
+    OccupancyPyramid::QueryStats stats;
+    Timing boxTiming = {}, segmentTiming = {};
+    int mismatches = 0;
+    bool collides;
+
+    for (unsigned int threads = 1; threads <= maxThreads; threads++) {
+      OccupancyPyramid::Config config = {
+          .levelCount = levels,
+          .obstacleLogodd = OBSTACLE_LOGODD,
+          .unknownIsObstacle = false,
+          .threadCount = threads,
+      };
+      OccupancyPyramid pyramid(config);
+      int res = pyramid.start();
+      if (res < 0) {
+        fprintf(stderr, "OccupancyPyramid::start: %s\n", strerror(-res));
+        return EXIT_FAILURE;
+      }
+      start = timeNowUs();
+      for (int i = 0; i < buildCount; i++)
+        pyramid.build(volume);
+      buildUs[threads] = (double)(timeNowUs() - start) / buildCount;
+      if (threads > 1)
+        continue;
+
+      int poolingErrors = checkPooling(pyramid, volume);
+      if (poolingErrors > 0) {
+        printf("%u levels: %d cells differ from their voxels\n", levels,
+               poolingErrors);
+        errors++;
+      }
+
+      for (int hit = 0; hit < 2; hit++) {
+        start = timeNowUs();
+        for (const Query *q : boxes[hit]) {
+          pyramid.checkBox(q->min, q->max, &collides, &stats);
+          boxTiming.cells[hit] += stats.visitedCells;
+          mismatches += collides != (bool)hit;
+        }
+        boxTiming.us[hit] = timeNowUs() - start;
+        start = timeNowUs();
+        for (const Query *q : segments[hit]) {
+          pyramid.checkSegment(q->from, q->to, q->radius, &collides, &stats);
+          segmentTiming.cells[hit] += stats.visitedCells;
+          mismatches += collides != (bool)hit;
+        }
+        segmentTiming.us[hit] = timeNowUs() - start;
+      }
+    }
+
+    printf("%u levels:", levels);
+    printTiming("box", boxTiming, &flat, boxCount);
+    printTiming("corridor", segmentTiming, &flatSegments, segmentCount);
+    printf("\n  build");
+    for (unsigned int threads = 1; threads <= maxThreads; threads++)
+      printf(" %.0f us (%u thread%s)", buildUs[threads], threads,
+             threads > 1 ? "s" : "");
+    printf("\n");
+    if (mismatches > 0) {
+      printf("%u levels: %d queries differ from the flat scan\n", levels,
+             mismatches);
+      errors++;
+    }
+  }
+
+  return errors > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
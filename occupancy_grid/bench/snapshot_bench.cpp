@@ -0,0 +1,361 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define ULOG_TAG spatial_perception
+#include <ulog.h>
+ULOG_DECLARE_TAG(ULOG_TAG);
+
+#include "bench_scene.hpp"
+#include "clearance.hpp"
+#include "distance_field.hpp"
+#include "grid_snapshot.hpp"
+#include "occupancy_volume.hpp"
+
+#define DEFAULT_PERIOD_MS 100
+#define SIZE 128
+#define HEIGHT 40
+#define RESOLUTION 0.2f
+#define MOVER_COUNT 4
+#define FLIP_COUNT 50
+#define TOLERANCE 1e-3f
+
+/* Analyses of the service, with the configuration of its main.cpp. The
+ * clearance ring has no time budget, skipped rays would make the results
+ * depend on the load of the host. */
+#define OBSTACLE_LOGODD 3
+#define MAX_DISTANCE 5.f
+#define AZIMUTH_COUNT 32
+#define MAX_RANGE 10.f
+
+static const int8_t s_logodds[] = {1, 3};
+static const float s_distances[] = {1.2f, 3.f, 6.f};
+
+struct Timing {
+  uint64_t sum;
+  uint64_t max;
+
+  void add(uint64_t us) {
+    sum += us;
+    max = std::max(max, us);
+  }
+};
+
+/* Record a synthetic flight through the recorder of the service, one frame
+ * of the bench scene every `periodMs`, with the drone moving along x. */
+static int generate(const char *dir, unsigned int count,
+                    unsigned int periodMs, uint64_t bytesPerSecond) {
+  SnapshotRecorder::Config config = {
+      .dir = dir,
+      .bytesPerSecond = bytesPerSecond,
+      .maxSnapshots = 0,
+  };
+  SnapshotRecorder recorder(config);
+  OccupancyVolume scene, volume;
+  uint64_t submitMax = 0;
+
+  int res = recorder.start();
+  if (res < 0) {
+    fprintf(stderr, "SnapshotRecorder::start: %s\n", strerror(-res));
+    return res;
+  }
+  fillStatic(scene, SIZE, HEIGHT, RESOLUTION, false);
+  for (unsigned int i = 0; i < count; i++) {
+    fillFrame(scene, volume, i, MOVER_COUNT, FLIP_COUNT);
+    volume.center[0] = (SIZE / 4 + i % (SIZE / 2)) * RESOLUTION;
+    uint64_t start = timeNowUs();
+    res = recorder.submit(volume, start * 1000);
+    submitMax = std::max(submitMax, timeNowUs() - start);
+    if (res < 0 && res != -EAGAIN) {
+      fprintf(stderr, "SnapshotRecorder::submit: %s\n", strerror(-res));
+      return res;
+    }
+    usleep(periodMs * 1000);
+  }
+  recorder.stop();
+
+  SnapshotRecorder::Stats stats = recorder.getStats();
+  printf("recorded %u of %u frames of %zu bytes in '%s': %u throttled, "
+         "%u busy, %u failed, submit max %llu us\n",
+         stats.recorded, count, volume.count(), dir, stats.throttled,
+         stats.busy, stats.failed, (unsigned long long)submitMax);
+  return stats.failed > 0 ? -EIO : 0;
+}
+
+static int listSnapshots(const char *dir, std::vector<std::string> &names) {
+  static const size_t extLen = strlen(GRID_SNAPSHOT_EXTENSION);
+  struct dirent *entry;
+
+  DIR *d = opendir(dir);
+  if (d == nullptr)
+    return -errno;
+  while ((entry = readdir(d)) != nullptr) {
+    size_t len = strlen(entry->d_name);
+    if (len > extLen &&
+        strcmp(entry->d_name + len - extLen, GRID_SNAPSHOT_EXTENSION) == 0)
+      names.push_back(entry->d_name);
+  }
+  closedir(d);
+  std::sort(names.begin(), names.end());
+  return 0;
+}
+
+/* Compare a result line against the line of the reference, field by field:
+ * the name exactly, the values within TOLERANCE. */
+static bool sameResult(const char *line, const char *reference) {
+  char name[256], refName[256];
+  int n, refN;
+
+  if (sscanf(line, "%255s%n", name, &n) != 1 ||
+      sscanf(reference, "%255s%n", refName, &refN) != 1 ||
+      strcmp(name, refName) != 0)
+    return false;
+  line += n;
+  reference += refN;
+  while (true) {
+    char *end, *refEnd;
+    float value = strtof(line, &end);
+    float refValue = strtof(reference, &refEnd);
+    if (end == line || refEnd == reference)
+      return end == line && refEnd == reference;
+    if (isnan(value) != isnan(refValue) ||
+        (!isnan(value) && !(value == refValue) &&
+         !(fabsf(value - refValue) <= TOLERANCE)))
+      return false;
+    line = end;
+    reference = refEnd;
+  }
+}
+
+static int run(const char *dir, const char *outputPath,
+               const char *referencePath) {
+  std::vector<std::string> names;
+  std::vector<DensityQuery> queries;
+  std::vector<float> densities;
+  std::vector<float> clearances;
+  OccupancyVolume volume;
+  GridSnapshotHeader header;
+  DistanceField field(OBSTACLE_LOGODD, MAX_DISTANCE);
+  ClearanceRing::Config ringConfig = {
+      .azimuthCount = AZIMUTH_COUNT,
+      .elevations = {-20.f, 0.f, 20.f},
+      .maxRange = MAX_RANGE,
+      .obstacleLogodd = OBSTACLE_LOGODD,
+      .unknownIsObstacle = false,
+      .threadCount = 1,
+      .batchSize = 0,
+      .budgetUs = 0,
+  };
+  ClearanceRing ring(ringConfig);
+  Timing readTime = {}, densityTime = {}, fieldTime = {}, clearanceTime = {};
+  FILE *output = nullptr, *reference = nullptr;
+  char line[1024], refLine[1024];
+  unsigned int mismatches = 0;
+  uint64_t start;
+
+  int res = listSnapshots(dir, names);
+  if (res < 0 || names.empty()) {
+    fprintf(stderr, "no snapshot in '%s'\n", dir);
+    return res < 0 ? res : -ENOENT;
+  }
+  if (outputPath != nullptr) {
+    output = fopen(outputPath, "w");
+    if (output == nullptr) {
+      res = -errno;
+      fprintf(stderr, "fopen('%s'): %s\n", outputPath, strerror(errno));
+      goto out;
+    }
+  }
+  if (referencePath != nullptr) {
+    reference = fopen(referencePath, "r");
+    if (reference == nullptr) {
+      res = -errno;
+      fprintf(stderr, "fopen('%s'): %s\n", referencePath, strerror(errno));
+      goto out;
+    }
+  }
+  res = ring.start();
+  if (res < 0) {
+    fprintf(stderr, "ClearanceRing::start: %s\n", strerror(-res));
+    goto out;
+  }
+  clearances.resize(ring.getRayCount());
+  for (int8_t logodd : s_logodds) {
+    for (float distance : s_distances)
+      queries.push_back({logodd, distance});
+  }
+  densities.resize(queries.size());
+
+  for (const std::string &name : names) {
+    DistanceField::Stats fieldStats;
+    ClearanceRing::Stats ringStats;
+    int len;
+
+    start = timeNowUs();
+    res = readGridSnapshot(std::string(dir) + "/" + name, &volume, &header);
+    readTime.add(timeNowUs() - start);
+    if (res < 0) {
+      fprintf(stderr, "readGridSnapshot('%s'): %s\n", name.c_str(),
+              strerror(-res));
+      goto out;
+    }
+
+    start = timeNowUs();
+    res = computeDensities(volume, queries.data(), queries.size(),
+                           densities.data());
+    densityTime.add(timeNowUs() - start);
+    if (res == 0) {
+      start = timeNowUs();
+      res = field.update(volume, &fieldStats);
+      fieldTime.add(timeNowUs() - start);
+    }
+    if (res == 0) {
+      start = timeNowUs();
+      res = ring.cast(volume, clearances.data(), &ringStats);
+      clearanceTime.add(timeNowUs() - start);
+    }
+    if (res < 0) {
+      fprintf(stderr, "analysis of '%s': %s\n", name.c_str(),
+              strerror(-res));
+      goto out;
+    }
+
+    /* Name, densities, nearest obstacle and clearances */
+    len = snprintf(line, sizeof(line), "%s", name.c_str());
+    for (float density : densities)
+      len += snprintf(line + len, sizeof(line) - len, " %.4f", density);
+    len += snprintf(line + len, sizeof(line) - len, " %.3f",
+                    field.getDistance(volume.center));
+    for (float clearance : clearances)
+      len += snprintf(line + len, sizeof(line) - len, " %.2f", clearance);
+
+    if (output != nullptr)
+      fprintf(output, "%s\n", line);
+    if (reference != nullptr) {
+      if (fgets(refLine, sizeof(refLine), reference) == nullptr)
+        refLine[0] = '\0';
+      if (!sameResult(line, refLine)) {
+        printf("%s differs from the reference:\n  %s\n  %s", name.c_str(),
+               line, refLine[0] != '\0' ? refLine : "(missing)\n");
+        mismatches++;
+      }
+    }
+  }
+
+  printf("%zu snapshots of '%s', mean/max per snapshot: read %.0f/%llu us, "
+         "densities %.0f/%llu us, distance field %.0f/%llu us, "
+         "clearance %.0f/%llu us\n",
+         names.size(), dir, (double)readTime.sum / names.size(),
+         (unsigned long long)readTime.max,
+         (double)densityTime.sum / names.size(),
+         (unsigned long long)densityTime.max,
+         (double)fieldTime.sum / names.size(),
+         (unsigned long long)fieldTime.max,
+         (double)clearanceTime.sum / names.size(),
+         (unsigned long long)clearanceTime.max);
+  if (reference != nullptr) {
+    if (fgets(refLine, sizeof(refLine), reference) != nullptr) {
+      printf("the reference has more snapshots\n");
+      mismatches++;
+    }
+    printf("%u snapshots differ from the reference\n", mismatches);
+  }
+  res = mismatches > 0 ? -EIO : 0;
+
+out:
+  ring.stop();
+  if (output != nullptr)
+    fclose(output);
+  if (reference != nullptr)
+    fclose(reference);
+  return res;
+}
+
+static void usage(const char *progname) {
+  fprintf(stderr,
+          "usage: %s [-g frames [-p period_ms] [-b bytes_per_s]] "
+          "[-o results] [-c reference] dir\n",
+          progname);
+}
+
+int main(int argc, char *argv[]) {
+  unsigned int generateCount = 0;
+  unsigned int periodMs = DEFAULT_PERIOD_MS;
+  uint64_t bytesPerSecond = UINT64_MAX;
+  const char *outputPath = nullptr;
+  const char *referencePath = nullptr;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "g:p:b:o:c:")) != -1) {
+    switch (opt) {
+    case 'g':
+      generateCount = atoi(optarg);
+      break;
+    case 'p':
+      periodMs = atoi(optarg);
+      break;
+    case 'b':
+      bytesPerSecond = strtoull(optarg, nullptr, 0);
+      break;
+    case 'o':
+      outputPath = optarg;
+      break;
+    case 'c':
+      referencePath = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind != argc - 1 || bytesPerSecond == 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (generateCount > 0 &&
+      generate(argv[optind], generateCount, periodMs, bytesPerSecond) < 0)
+    return EXIT_FAILURE;
+  if (run(argv[optind], outputPath, referencePath) < 0)
+    return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,286 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#define ULOG_TAG spatial_perception
+#include <ulog.h>
+ULOG_DECLARE_TAG(ULOG_TAG);
+
+#include "bench_scene.hpp"
+#include "grid_delta.hpp"
+#include "grid_stream.hpp"
+#include "occupancy_volume.hpp"
+
+#define DEFAULT_FRAME_COUNT 300
+#define DEFAULT_SIZE 128
+#define DEFAULT_HEIGHT 40
+#define DEFAULT_RESOLUTION 0.2f
+#define DEFAULT_MOVER_COUNT 4
+#define DEFAULT_FLIP_COUNT 50
+#define DEFAULT_PERIOD_MS 100
+#define DEFAULT_KEYFRAME_PERIOD_MS 2000
+#define OBSTACLE_LOGODD 3
+#define UNLIMITED_BUDGET UINT64_MAX
+
+static const uint64_t s_budgets[] = {8 * 1024, 32 * 1024, 128 * 1024,
+                                     UNLIMITED_BUDGET};
+
+/* Receiver of the stream, as a ground tool would decode it. */
+struct Receiver {
+  int size[3];
+  int blocks[3];
+  /* Obstacles of the last keyframe and of the last frame, one byte per
+   * voxel. */
+  std::vector<uint8_t> keyframe;
+  std::vector<uint8_t> current;
+  uint32_t keyframeId;
+
+  Receiver() : size{0, 0, 0}, blocks{0, 0, 0}, keyframeId(0) {}
+
+  static int getVarint(const uint8_t *&data, const uint8_t *end,
+                       uint32_t *value) {
+    *value = 0;
+    for (int shift = 0; data < end && shift < 32; shift += 7) {
+      uint8_t byte = *data++;
+      *value |= (uint32_t)(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return 0;
+    }
+    return -EPROTO;
+  }
+
+  void setVoxel(size_t block, int i, uint8_t obstacle) {
+    int x = (block % blocks[0]) * GRID_DELTA_BLOCK_SIZE + i % 8;
+    int y = (block / blocks[0] % blocks[1]) * GRID_DELTA_BLOCK_SIZE + i / 8 % 8;
+    int z = (block / blocks[0] / blocks[1]) * GRID_DELTA_BLOCK_SIZE + i / 64;
+    if (x < size[0] && y < size[1] && z < size[2])
+      current[((size_t)z * size[1] + y) * size[0] + x] = obstacle;
+    else if (obstacle)
+      current.clear();
+  }
+
+  int decode(const GridStreamer::Frame &frame) {
+    if (frame.keyframe) {
+      memcpy(size, frame.size, sizeof(size));
+      for (int i = 0; i < 3; i++)
+        blocks[i] = (size[i] + GRID_DELTA_BLOCK_SIZE - 1) /
+                    GRID_DELTA_BLOCK_SIZE;
+      current.assign((size_t)size[0] * size[1] * size[2], 0);
+      keyframeId = frame.keyframeId;
+    } else if (frame.keyframeId != keyframeId) {
+      return -ENOENT;
+    } else {
+      current = keyframe;
+    }
+
+    const uint8_t *data = frame.payload.data();
+    const uint8_t *end = data + frame.payload.size();
+    size_t block = 0;
+    for (uint32_t b = 0; b < frame.blockCount; b++) {
+      uint32_t gap, run;
+      if (getVarint(data, end, &gap) < 0 || data >= end)
+        return -EPROTO;
+      block += b == 0 ? gap : gap + 1;
+      if (block >= (size_t)blocks[0] * blocks[1] * blocks[2])
+        return -EPROTO;
+      uint8_t tag = *data++;
+      int i = 0;
+      if (tag == GRID_STREAM_BITMAP) {
+        if (end - data < GRID_STREAM_BITMAP_SIZE)
+          return -EPROTO;
+        for (; i < GRID_STREAM_BITMAP_SIZE * 8; i++)
+          setVoxel(block, i, (data[i / 8] >> (i % 8)) & 1);
+        data += GRID_STREAM_BITMAP_SIZE;
+      } else if (tag == GRID_STREAM_RUNS) {
+        for (uint8_t obstacle = 0; i < GRID_STREAM_BITMAP_SIZE * 8;
+             obstacle ^= 1) {
+          if (getVarint(data, end, &run) < 0 ||
+              run > (uint32_t)(GRID_STREAM_BITMAP_SIZE * 8 - i))
+            return -EPROTO;
+          for (uint32_t j = 0; j < run; j++, i++)
+            setVoxel(block, i, obstacle);
+        }
+      } else if (tag == GRID_STREAM_EMPTY && !frame.keyframe) {
+        for (; i < GRID_STREAM_BITMAP_SIZE * 8; i++)
+          setVoxel(block, i, 0);
+      } else {
+        return -EPROTO;
+      }
+      if (current.empty())
+        return -EPROTO;
+    }
+    if (data != end)
+      return -EPROTO;
+    if (frame.keyframe)
+      keyframe = current;
+    return 0;
+  }
+};
+
+static int run(const OccupancyVolume &scene, uint64_t budget, int frameCount,
+               int periodMs, int moverCount, int flipCount) {
+  GridDiff diff(OBSTACLE_LOGODD);
+  GridStreamer streamer({.obstacleLogodd = OBSTACLE_LOGODD,
+                         .bytesPerSecond = budget,
+                         .keyframePeriodMs = DEFAULT_KEYFRAME_PERIOD_MS});
+  Receiver receiver;
+  OccupancyVolume volume;
+  GridDelta delta;
+  GridStreamer::Frame frame;
+  int mismatches = 0;
+  size_t keyframeBytes = 0, deltaBytes = 0, frameMax = 0;
+
+  for (int i = 0; i < frameCount; i++) {
+    fillFrame(scene, volume, i, moverCount, flipCount);
+    int res = diff.update(volume, &delta);
+    if (res < 0)
+      return res;
+    delta.generation = i + 1;
+    delta.timestampNs = (uint64_t)(i + 1) * periodMs * 1000000;
+    res = streamer.update(volume, delta, &frame);
+    if (res == -EAGAIN)
+      continue;
+    if (res < 0)
+      return res;
+    (frame.keyframe ? keyframeBytes : deltaBytes) += frame.payload.size();
+    frameMax = std::max(frameMax, frame.payload.size());
+
+    /* What the receiver decodes shall be the obstacles of the grid */
+    res = receiver.decode(frame);
+    bool same = res == 0;
+    for (size_t j = 0; same && j < volume.count(); j++)
+      same = receiver.current[j] == (volume.logodds[j] >= OBSTACLE_LOGODD);
+    if (!same) {
+      fprintf(stderr, "frame %d: decoded obstacles differ (%s)\n", i,
+              res < 0 ? strerror(-res) : "wrong voxels");
+      mismatches++;
+    }
+  }
+
+  const GridStreamer::Stats &stats = streamer.getStats();
+  unsigned int sent = stats.keyframes + stats.deltas;
+  double seconds = frameCount * periodMs / 1000.;
+  char name[32];
+  if (budget == UNLIMITED_BUDGET)
+    snprintf(name, sizeof(name), "unlimited");
+  else
+    snprintf(name, sizeof(name), "%llu B/s", (unsigned long long)budget);
+  printf("%-10s: %u keyframes of %.0f bytes, %u deltas of %.0f bytes, "
+         "%u skipped, ratio %.0f, %.0f bytes/s, encode mean %.0f us max "
+         "%llu us\n",
+         name, stats.keyframes,
+         stats.keyframes > 0 ? (double)keyframeBytes / stats.keyframes : 0.,
+         stats.deltas,
+         stats.deltas > 0 ? (double)deltaBytes / stats.deltas : 0.,
+         stats.skipped,
+         stats.encodedBytes > 0 ? (double)stats.rawBytes / stats.encodedBytes
+                                : 0.,
+         stats.encodedBytes / seconds,
+         sent > 0 ? (double)stats.encodeUsSum / sent : 0.,
+         (unsigned long long)stats.encodeUsMax);
+  /* The last frame sent may not be paid for yet */
+  if (stats.encodedBytes > budget * seconds + frameMax) {
+    fprintf(stderr, "%s: budget exceeded\n", name);
+    mismatches++;
+  }
+  return mismatches > 0 ? -EIO : 0;
+}
+
+static void usage(const char *progname) {
+  fprintf(stderr,
+          "usage: %s [-n frames] [-s size] [-z height] [-p period_ms] "
+          "[-o movers] [-f flips]\n",
+          progname);
+}
+
+int main(int argc, char *argv[]) {
+  int opt;
+  int frameCount = DEFAULT_FRAME_COUNT;
+  int size = DEFAULT_SIZE;
+  int height = DEFAULT_HEIGHT;
+  int periodMs = DEFAULT_PERIOD_MS;
+  int moverCount = DEFAULT_MOVER_COUNT;
+  int flipCount = DEFAULT_FLIP_COUNT;
+  OccupancyVolume scene;
+  int res = 0;
+
+  while ((opt = getopt(argc, argv, "n:s:z:p:o:f:")) != -1) {
+    switch (opt) {
+    case 'n':
+      frameCount = atoi(optarg);
+      break;
+    case 's':
+      size = atoi(optarg);
+      break;
+    case 'z':
+      height = atoi(optarg);
+      break;
+    case 'p':
+      periodMs = atoi(optarg);
+      break;
+    case 'o':
+      moverCount = atoi(optarg);
+      break;
+    case 'f':
+      flipCount = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (frameCount <= 0 || size < 16 || height < 16 || periodMs <= 0 ||
+      moverCount < 0 || flipCount < 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  fillStatic(scene, size, height, DEFAULT_RESOLUTION, false);
+  printf("%dx%dx%d voxels (%zu bytes), a grid every %d ms, %d movers, "
+         "%d flips/grid\n",
+         size, size, height, scene.count(), periodMs, moverCount, flipCount);
+  for (uint64_t budget : s_budgets) {
+    int err = run(scene, budget, frameCount, periodMs, moverCount, flipCount);
+    if (err < 0) {
+      fprintf(stderr, "stream: %s\n", strerror(-err));
+      res = err;
+    }
+  }
+  return res < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,243 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "clearance.hpp"
+#include <errno.h>
+#include <math.h>
+
+#define DEFAULT_BATCH_SIZE 8
+
+ClearanceRing::ClearanceRing(const Config &config)
+    : mConfig(config), mBatchSize(0), mBatchCount(0), mVolume(nullptr),
+      mStart{0.f, 0.f, 0.f}, mClearances(nullptr), mNextBatch(0),
+      mGeneration(0), mBusyWorkers(0), mStopRequested(false) {}
+
+ClearanceRing::~ClearanceRing() { this->stop(); }
+
+int ClearanceRing::start() {
+  size_t rayCount = mConfig.azimuthCount * mConfig.elevations.size();
+  unsigned int threadCount = mConfig.threadCount > 0 ? mConfig.threadCount : 1;
+
+  if (mConfig.azimuthCount == 0 || rayCount == 0 ||
+      rayCount > CLEARANCE_MAX_RAYS || mConfig.maxRange <= 0.f ||
+      mConfig.obstacleLogodd == OCCUPANCY_UNKNOWN ||
+      threadCount > CLEARANCE_MAX_THREADS)
+    return -EINVAL;
+  if (!mWorkers.empty())
+    return -EBUSY;
+
+  mDirections.clear();
+  for (float elevation : mConfig.elevations) {
+    float el = elevation * (float)M_PI / 180.f;
+    for (unsigned int i = 0; i < mConfig.azimuthCount; i++) {
+      float az = 2.f * (float)M_PI * i / mConfig.azimuthCount;
+      /* NED: z goes down */
+      mDirections.push_back(
+          {{cosf(el) * cosf(az), cosf(el) * sinf(az), -sinf(el)}});
+    }
+  }
+  mBatchSize = mConfig.batchSize > 0 ? mConfig.batchSize : DEFAULT_BATCH_SIZE;
+  mBatchCount = (rayCount + mBatchSize - 1) / mBatchSize;
+  mBatchUs.assign(mBatchCount, 0.f);
+
+  mStopRequested = false;
+  /* Workers wait for the casts after the current generation, even if they
+   * start running after the first one */
+  for (unsigned int i = 1; i < threadCount; i++)
+    mWorkers.emplace_back(&ClearanceRing::workerThread, this, mGeneration);
+  return 0;
+}
+
+void ClearanceRing::stop() {
+  mMutex.lock();
+  mStopRequested = true;
+  mCond.notify_all();
+  mMutex.unlock();
+  for (auto &worker : mWorkers)
+    worker.join();
+  mWorkers.clear();
+}
+
+/* Distance along a ray to the first voxel stopping it. `start` is in voxels
+ * from the lower corner of the volume. */
+float ClearanceRing::castRay(const OccupancyVolume &volume,
+                             const float start[3],
+                             const Direction &direction) const {
+  const ptrdiff_t stride[3] = {1, volume.size[0],
+                               (ptrdiff_t)volume.size[0] * volume.size[1]};
+  const float tLimit = mConfig.maxRange / volume.resolution;
+  int voxel[3], step[3];
+  float tMax[3], tDelta[3];
+
+  /* Distance along the ray, in voxels, to the next boundary of a voxel on
+   * each axis, and between two boundaries */
+  for (int i = 0; i < 3; i++) {
+    float d = direction.v[i];
+    voxel[i] = (int)floorf(start[i]);
+    if (d > 0.f) {
+      step[i] = 1;
+      tDelta[i] = 1.f / d;
+      tMax[i] = (voxel[i] + 1 - start[i]) * tDelta[i];
+    } else if (d < 0.f) {
+      step[i] = -1;
+      tDelta[i] = -1.f / d;
+      tMax[i] = (start[i] - voxel[i]) * tDelta[i];
+    } else {
+      step[i] = 0;
+      tDelta[i] = INFINITY;
+      tMax[i] = INFINITY;
+    }
+  }
+
+  const int8_t *logodds = volume.logodds.data();
+  ptrdiff_t index = volume.index(voxel[0], voxel[1], voxel[2]);
+  while (true) {
+    int axis = tMax[0] < tMax[1] ? (tMax[0] < tMax[2] ? 0 : 2)
+                                 : (tMax[1] < tMax[2] ? 1 : 2);
+    float t = tMax[axis];
+    if (t >= tLimit)
+      return mConfig.maxRange;
+
+    voxel[axis] += step[axis];
+    if (voxel[axis] < 0 || voxel[axis] >= volume.size[axis])
+      return mConfig.unknownIsObstacle ? t * volume.resolution
+                                       : mConfig.maxRange;
+    index += step[axis] * stride[axis];
+    tMax[axis] += tDelta[axis];
+
+    int8_t logodd = logodds[index];
+    if (logodd >= mConfig.obstacleLogodd ||
+        (mConfig.unknownIsObstacle && logodd == OCCUPANCY_UNKNOWN))
+      return t * volume.resolution;
+  }
+}
+
+void ClearanceRing::castBatches() {
+  const unsigned int rayCount = mDirections.size();
+
+  while (true) {
+    unsigned int batch = mNextBatch.fetch_add(1, std::memory_order_relaxed);
+    if (batch >= mBatchCount)
+      break;
+    unsigned int first = batch * mBatchSize;
+    unsigned int last = std::min(first + mBatchSize, rayCount);
+
+    auto start = std::chrono::steady_clock::now();
+    if (mConfig.budgetUs > 0 && start > mDeadline) {
+      for (unsigned int ray = first; ray < last; ray++)
+        mClearances[ray] = NAN;
+      mBatchUs[batch] = -1.f;
+      continue;
+    }
+    for (unsigned int ray = first; ray < last; ray++)
+      mClearances[ray] = castRay(*mVolume, mStart, mDirections[ray]);
+    mBatchUs[batch] = std::chrono::duration<float, std::micro>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+  }
+}
+
+void ClearanceRing::workerThread(uint64_t generation) {
+  std::unique_lock<std::mutex> lk(mMutex);
+
+  while (true) {
+    mCond.wait(lk, [&] {
+      return mStopRequested || mGeneration != generation;
+    });
+    if (mStopRequested)
+      break;
+    generation = mGeneration;
+
+    lk.unlock();
+    castBatches();
+    lk.lock();
+
+    if (--mBusyWorkers == 0)
+      mDoneCond.notify_one();
+  }
+}
+
+int ClearanceRing::cast(const OccupancyVolume &volume, float *clearances,
+                        Stats *stats) {
+  if (clearances == nullptr || mDirections.empty() ||
+      volume.resolution <= 0.f || volume.logodds.size() != volume.count())
+    return -EINVAL;
+
+  float start[3];
+  for (int i = 0; i < 3; i++) {
+    start[i] = (volume.center[i] - volume.origin[i]) / volume.resolution;
+    if (!(start[i] >= 0.f && start[i] < volume.size[i]))
+      return -ERANGE;
+  }
+
+  auto castStart = std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lk(mMutex);
+  mVolume = &volume;
+  for (int i = 0; i < 3; i++)
+    mStart[i] = start[i];
+  mClearances = clearances;
+  mDeadline = castStart + std::chrono::microseconds(mConfig.budgetUs);
+  mNextBatch.store(0, std::memory_order_relaxed);
+  mBusyWorkers = mWorkers.size();
+  mGeneration++;
+  mCond.notify_all();
+  lk.unlock();
+
+  /* The calling thread takes its share of the batches */
+  castBatches();
+
+  lk.lock();
+  mDoneCond.wait(lk, [this] { return mBusyWorkers == 0; });
+  mVolume = nullptr;
+  mClearances = nullptr;
+  lk.unlock();
+
+  if (stats != nullptr) {
+    float sum = 0.f;
+    stats->castUs = std::chrono::duration<float, std::micro>(
+                        std::chrono::steady_clock::now() - castStart)
+                        .count();
+    stats->batchMaxUs = 0.f;
+    stats->batches = 0;
+    stats->skippedBatches = 0;
+    for (float us : mBatchUs) {
+      if (us < 0.f) {
+        stats->skippedBatches++;
+        continue;
+      }
+      stats->batches++;
+      stats->batchMaxUs = std::max(stats->batchMaxUs, us);
+      sum += us;
+    }
+    stats->batchMeanUs = stats->batches > 0 ? sum / stats->batches : 0.f;
+  }
+  return 0;
+}
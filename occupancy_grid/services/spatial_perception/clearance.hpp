@@ -0,0 +1,154 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include "occupancy_volume.hpp"
+
+/* Maximum number of rays of a clearance ring. */
+#define CLEARANCE_MAX_RAYS 128
+
+/* Maximum number of threads casting the rays of a clearance ring. */
+#define CLEARANCE_MAX_THREADS 4
+
+/* Free distance along a ring of directions around the drone, by casting
+ * rays through the voxels of an occupancy volume (3D DDA: a ray visits every
+ * voxel it crosses, in order, stepping along one axis at a time).
+ *
+ * Rays are cut in batches, taken in turn by the calling thread and the
+ * workers of the ring. Each batch is timed, and batches not started before
+ * the time budget of a cast is spent are skipped. */
+class ClearanceRing {
+public:
+  struct Config {
+    /* Rays per elevation, evenly spread in azimuth from +x (north)
+     * towards +y (east). */
+    unsigned int azimuthCount;
+    /* Elevation of each layer of rays, positive up [deg]. The ring has
+     * azimuthCount rays per elevation, at most CLEARANCE_MAX_RAYS. */
+    std::vector<float> elevations;
+    /* Clearance given to rays without obstacle [m]. */
+    float maxRange;
+    /* Voxels with at least this log-odds stop the rays. */
+    int8_t obstacleLogodd;
+    /* Whether unknown voxels, and the border of the volume, stop the
+     * rays as well. */
+    bool unknownIsObstacle;
+    /* Number of threads casting the rays, including the calling one, 1 if
+     * 0, at most CLEARANCE_MAX_THREADS. */
+    unsigned int threadCount;
+    /* Rays per batch, 8 if 0. */
+    unsigned int batchSize;
+    /* Time budget of a cast, no limit if 0 [us]. */
+    unsigned int budgetUs;
+  };
+
+  /* Timing of a cast. */
+  struct Stats {
+    /* Duration of the cast [us]. */
+    float castUs;
+    /* Longest and mean duration of a batch of rays [us]. */
+    float batchMaxUs;
+    float batchMeanUs;
+    /* Batches done and batches skipped because of the time budget. */
+    unsigned int batches;
+    unsigned int skippedBatches;
+  };
+
+  ClearanceRing(const Config &config);
+  ~ClearanceRing();
+
+  /* Check the configuration and start the worker threads. */
+  int start();
+  /* Stop the worker threads. */
+  void stop();
+
+  const Config &getConfig() const { return mConfig; }
+  unsigned int getRayCount() const { return mDirections.size(); }
+  /* Unit vector of a ray, NED. */
+  const float *getDirection(unsigned int ray) const {
+    return mDirections[ray].v;
+  }
+
+  /**
+   * Cast the rays of the ring from the center of a volume.
+   * @param volume voxels to cast the rays through.
+   * @param clearances array of getRayCount() distances to fill: distance to
+   *                   the first obstacle, `maxRange` if none, NAN for rays
+   *                   of skipped batches [m].
+   * @param stats pointer to return timing of the cast, may be null.
+   * @return 0 in case of success, -ERANGE if the center is outside of the
+   *         volume, negative errno in case of error.
+   */
+  int cast(const OccupancyVolume &volume, float *clearances, Stats *stats);
+
+private:
+  struct Direction {
+    float v[3];
+  };
+
+  float castRay(const OccupancyVolume &volume, const float start[3],
+                const Direction &direction) const;
+  void castBatches();
+  void workerThread(uint64_t generation);
+
+  const Config mConfig;
+  std::vector<Direction> mDirections;
+  unsigned int mBatchSize;
+  unsigned int mBatchCount;
+
+  /* The cast in progress, set by `cast` before waking the workers up. */
+  const OccupancyVolume *mVolume;
+  float mStart[3];
+  float *mClearances;
+  std::chrono::steady_clock::time_point mDeadline;
+  std::vector<float> mBatchUs;
+  std::atomic<unsigned int> mNextBatch;
+
+  /* Workers wait for a new `mGeneration`, `cast` waits for `mBusyWorkers`
+   * to drop to zero. */
+  std::mutex mMutex;
+  std::condition_variable mCond;
+  std::condition_variable mDoneCond;
+  uint64_t mGeneration;
+  unsigned int mBusyWorkers;
+  bool mStopRequested;
+  std::vector<std::thread> mWorkers;
+};
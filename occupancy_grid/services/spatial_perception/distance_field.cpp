@@ -0,0 +1,264 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "distance_field.hpp"
+#include <errno.h>
+#include <string.h>
+
+constexpr int32_t DistanceField::FAR;
+constexpr int32_t DistanceField::NO_OBSTACLE;
+
+DistanceField::DistanceField(int8_t obstacleLogodd, float maxDistance)
+    : mObstacleLogodd(obstacleLogodd), mMaxDistance(maxDistance),
+      mMaxDist2(0), mSize{0, 0, 0}, mResolution(0.f), mOrigin{0.f, 0.f, 0.f},
+      mVisitedVoxels(0), mQueueMin(0), mQueueSize(0) {}
+
+bool DistanceField::hasGeometry(const OccupancyVolume &volume) const {
+  return !mDist2.empty() &&
+         memcmp(mSize, volume.size, sizeof(mSize)) == 0 &&
+         mResolution == volume.resolution &&
+         memcmp(mOrigin, volume.origin, sizeof(mOrigin)) == 0;
+}
+
+int DistanceField::reset(const OccupancyVolume &volume) {
+  size_t count = volume.count();
+
+  if (volume.resolution <= 0.f || volume.size[0] <= 0 ||
+      volume.size[1] <= 0 || volume.size[2] <= 0 ||
+      count > (size_t)INT32_MAX || volume.logodds.size() != count ||
+      mObstacleLogodd == OCCUPANCY_UNKNOWN || mMaxDistance <= 0.f)
+    return -EINVAL;
+
+  memcpy(mSize, volume.size, sizeof(mSize));
+  mResolution = volume.resolution;
+  memcpy(mOrigin, volume.origin, sizeof(mOrigin));
+  float maxDist = mMaxDistance / mResolution;
+  mMaxDist2 = (int32_t)(maxDist * maxDist);
+
+  mOccupied.assign(count, 0);
+  mObstacle.assign(count, NO_OBSTACLE);
+  mDist2.assign(count, FAR);
+  mRaise.assign(count, 0);
+  mChanged.assign(count, 0);
+  mChangedVoxels.clear();
+  mQueue.resize(mMaxDist2 + 1);
+  for (auto &bucket : mQueue)
+    bucket.clear();
+  mQueueMin = 0;
+  mQueueSize = 0;
+  return 0;
+}
+
+void DistanceField::push(int32_t dist2, uint32_t index) {
+  mQueue[dist2].push_back(index);
+  if (dist2 < mQueueMin)
+    mQueueMin = dist2;
+  mQueueSize++;
+}
+
+void DistanceField::setDistance(uint32_t index, int32_t dist2,
+                                int32_t obstacle) {
+  if (mDist2[index] != dist2 && !mChanged[index]) {
+    mChanged[index] = 1;
+    mChangedVoxels.push_back(index);
+  }
+  mDist2[index] = dist2;
+  mObstacle[index] = obstacle;
+}
+
+void DistanceField::setObstacle(uint32_t index) {
+  mOccupied[index] = 1;
+  setDistance(index, 0, index);
+  push(0, index);
+}
+
+void DistanceField::removeObstacle(uint32_t index) {
+  mOccupied[index] = 0;
+  setDistance(index, FAR, NO_OBSTACLE);
+  mRaise[index] = 1;
+  push(0, index);
+}
+
+/* Clear the neighbours whose nearest obstacle is gone, and queue the other
+ * ones so that they propagate their obstacle again. */
+void DistanceField::raise(uint32_t index) {
+  const int sx = mSize[0], sy = mSize[1], sz = mSize[2];
+  int x = index % sx, y = index / sx % sy, z = index / sx / sy;
+
+  for (int dz = -1; dz <= 1; dz++) {
+    if (z + dz < 0 || z + dz >= sz)
+      continue;
+    for (int dy = -1; dy <= 1; dy++) {
+      if (y + dy < 0 || y + dy >= sy)
+        continue;
+      for (int dx = -1; dx <= 1; dx++) {
+        if (x + dx < 0 || x + dx >= sx)
+          continue;
+        uint32_t n = index + (dz * sy + dy) * sx + dx;
+        if (mObstacle[n] == NO_OBSTACLE || mRaise[n])
+          continue;
+        push(mDist2[n], n);
+        if (!mOccupied[mObstacle[n]]) {
+          setDistance(n, FAR, NO_OBSTACLE);
+          mRaise[n] = 1;
+        }
+      }
+    }
+  }
+  mRaise[index] = 0;
+}
+
+/* Give the obstacle of a voxel to the neighbours it is closer to. */
+void DistanceField::lower(uint32_t index) {
+  const int sx = mSize[0], sy = mSize[1], sz = mSize[2];
+  int x = index % sx, y = index / sx % sy, z = index / sx / sy;
+  int32_t obstacle = mObstacle[index];
+  int ox = obstacle % sx, oy = obstacle / sx % sy, oz = obstacle / sx / sy;
+
+  for (int dz = -1; dz <= 1; dz++) {
+    if (z + dz < 0 || z + dz >= sz)
+      continue;
+    int32_t ddz = z + dz - oz;
+    for (int dy = -1; dy <= 1; dy++) {
+      if (y + dy < 0 || y + dy >= sy)
+        continue;
+      int32_t ddy = y + dy - oy;
+      for (int dx = -1; dx <= 1; dx++) {
+        if (x + dx < 0 || x + dx >= sx)
+          continue;
+        int32_t ddx = x + dx - ox;
+        int32_t d2 = ddx * ddx + ddy * ddy + ddz * ddz;
+        uint32_t n = index + (dz * sy + dy) * sx + dx;
+        if (mRaise[n] || d2 >= mDist2[n] || d2 > mMaxDist2)
+          continue;
+        setDistance(n, d2, obstacle);
+        push(d2, n);
+      }
+    }
+  }
+}
+
+void DistanceField::propagate() {
+  while (mQueueSize > 0) {
+    while (mQueue[mQueueMin].empty())
+      mQueueMin++;
+    int32_t dist2 = mQueueMin;
+    uint32_t index = mQueue[dist2].back();
+    mQueue[dist2].pop_back();
+    mQueueSize--;
+    mVisitedVoxels++;
+
+    if (mRaise[index]) {
+      raise(index);
+    } else if (dist2 <= mDist2[index] &&
+               mObstacle[index] != NO_OBSTACLE &&
+               mOccupied[mObstacle[index]]) {
+      /* Entries of a voxel lowered again since are skipped, the newer
+       * entry propagates its closer obstacle */
+      lower(index);
+    }
+  }
+}
+
+int DistanceField::update(const OccupancyVolume &volume, Stats *stats) {
+  size_t changedObstacles = 0;
+
+  if (!hasGeometry(volume))
+    return recompute(volume, stats);
+  if (volume.logodds.size() != mOccupied.size())
+    return -EINVAL;
+
+  for (uint32_t index : mChangedVoxels)
+    mChanged[index] = 0;
+  mChangedVoxels.clear();
+  mVisitedVoxels = 0;
+
+  const int8_t *logodds = volume.logodds.data();
+  for (size_t i = 0; i < mOccupied.size(); i++) {
+    uint8_t occupied = logodds[i] >= mObstacleLogodd;
+    if (occupied == mOccupied[i])
+      continue;
+    if (occupied)
+      setObstacle(i);
+    else
+      removeObstacle(i);
+    changedObstacles++;
+  }
+  propagate();
+
+  if (stats != nullptr) {
+    stats->full = false;
+    stats->changedObstacles = changedObstacles;
+    stats->changedVoxels = mChangedVoxels.size();
+    stats->visitedVoxels = mVisitedVoxels;
+  }
+  return 0;
+}
+
+int DistanceField::recompute(const OccupancyVolume &volume, Stats *stats) {
+  size_t obstacles = 0;
+
+  int res = reset(volume);
+  if (res < 0)
+    return res;
+  mVisitedVoxels = 0;
+
+  const int8_t *logodds = volume.logodds.data();
+  for (size_t i = 0; i < mOccupied.size(); i++) {
+    if (logodds[i] < mObstacleLogodd)
+      continue;
+    setObstacle(i);
+    obstacles++;
+  }
+  propagate();
+
+  if (stats != nullptr) {
+    stats->full = true;
+    stats->changedObstacles = obstacles;
+    stats->changedVoxels = mChangedVoxels.size();
+    stats->visitedVoxels = mVisitedVoxels;
+  }
+  return 0;
+}
+
+float DistanceField::getDistance(const float position[3]) const {
+  int voxel[3];
+
+  if (mDist2.empty())
+    return NAN;
+  for (int i = 0; i < 3; i++) {
+    voxel[i] = (int)floorf((position[i] - mOrigin[i]) / mResolution);
+    if (voxel[i] < 0 || voxel[i] >= mSize[i])
+      return NAN;
+  }
+  return getDistance(((size_t)voxel[2] * mSize[1] + voxel[1]) * mSize[0] +
+                     voxel[0]);
+}
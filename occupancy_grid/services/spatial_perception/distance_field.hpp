@@ -0,0 +1,151 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+
+#include "occupancy_volume.hpp"
+
+/* Distance of each voxel of an occupancy volume to the nearest obstacle
+ * voxel, up to a maximum distance.
+ *
+ * It is updated incrementally from the voxels whose occupancy changed since
+ * the previous volume (dynamic brushfire): voxels which were closest to a
+ * removed obstacle are raised back to "far" by a first wave, then the
+ * remaining and new obstacles are propagated again by a lowering wave. Only
+ * the voxels around the changes are visited. Each voxel keeps its nearest
+ * obstacle, so distances are Euclidean up to the small error of propagating
+ * through the 26 neighbours. */
+class DistanceField {
+public:
+  /* Update of the field. */
+  struct Stats {
+    /* Whether the whole field was recomputed. */
+    bool full;
+    /* Voxels which became or stopped being an obstacle. */
+    size_t changedObstacles;
+    /* Voxels whose distance changed. */
+    size_t changedVoxels;
+    /* Voxels taken from the queue of the waves. */
+    size_t visitedVoxels;
+  };
+
+  /* Voxels with a log-odds of at least `obstacleLogodd` are obstacles,
+   * distances are computed up to `maxDistance` [m]. */
+  DistanceField(int8_t obstacleLogodd, float maxDistance);
+
+  /**
+   * Update the field from a new volume. The update is incremental if the
+   * volume has the same size, resolution and origin as the previous one,
+   * the field is recomputed otherwise.
+   * @param volume voxels of the new grid.
+   * @param stats pointer to return statistics of the update, may be null.
+   * @return 0 in case of success, negative errno in case of error.
+   */
+  int update(const OccupancyVolume &volume, Stats *stats);
+
+  /**
+   * Recompute the whole field from a volume.
+   * @param volume voxels of the grid.
+   * @param stats pointer to return statistics of the update, may be null.
+   * @return 0 in case of success, negative errno in case of error.
+   */
+  int recompute(const OccupancyVolume &volume, Stats *stats);
+
+  /* Distance of a voxel to the nearest obstacle, INFINITY if farther than
+   * the maximum distance [m]. */
+  float getDistance(size_t index) const {
+    int32_t d2 = mDist2[index];
+    return d2 == FAR ? INFINITY : sqrtf((float)d2) * mResolution;
+  }
+
+  /* Distance of a point to the nearest obstacle, INFINITY if farther than
+   * the maximum distance, NAN outside of the volume [m]. */
+  float getDistance(const float position[3]) const;
+
+  /* Voxels whose distance changed during the last update. */
+  const std::vector<uint32_t> &getChangedVoxels() const {
+    return mChangedVoxels;
+  }
+
+  bool isEmpty() const { return mDist2.empty(); }
+  const int *getSize() const { return mSize; }
+  float getResolution() const { return mResolution; }
+  const float *getOrigin() const { return mOrigin; }
+  float getMaxDistance() const { return mMaxDistance; }
+
+private:
+  static constexpr int32_t FAR = INT32_MAX;
+  static constexpr int32_t NO_OBSTACLE = -1;
+
+  bool hasGeometry(const OccupancyVolume &volume) const;
+  int reset(const OccupancyVolume &volume);
+  void setObstacle(uint32_t index);
+  void removeObstacle(uint32_t index);
+  void setDistance(uint32_t index, int32_t dist2, int32_t obstacle);
+  void push(int32_t dist2, uint32_t index);
+  void propagate();
+  void raise(uint32_t index);
+  void lower(uint32_t index);
+
+  const int8_t mObstacleLogodd;
+  const float mMaxDistance;
+  /* Maximum distance in voxels, squared. */
+  int32_t mMaxDist2;
+
+  /* Geometry of the volume the field was computed from. */
+  int mSize[3];
+  float mResolution;
+  float mOrigin[3];
+
+  /* Obstacles of the previous volume. */
+  std::vector<uint8_t> mOccupied;
+  /* Index of the nearest obstacle of each voxel, NO_OBSTACLE if none. */
+  std::vector<int32_t> mObstacle;
+  /* Squared distance to the nearest obstacle, in voxels, FAR if none. */
+  std::vector<int32_t> mDist2;
+  /* Voxels waiting for the raising wave. */
+  std::vector<uint8_t> mRaise;
+  /* Voxels whose distance changed, and their flag. */
+  std::vector<uint32_t> mChangedVoxels;
+  std::vector<uint8_t> mChanged;
+  size_t mVisitedVoxels;
+
+  /* Voxels of the waves, in one bucket per squared distance: distances are
+   * bounded, so the closest voxel is found without sorting. `mQueueMin` is
+   * the first bucket which may not be empty. */
+  std::vector<std::vector<uint32_t>> mQueue;
+  int32_t mQueueMin;
+  size_t mQueueSize;
+};
@@ -0,0 +1,257 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "distance_field_shm.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ULOG_TAG spatial_perception
+#include <ulog.h>
+
+/* Attempts of a reader racing with the writer. */
+#define DISTANCE_FIELD_SHM_READ_RETRIES 4
+
+DistanceFieldShm::DistanceFieldShm(const std::string &name, bool writer)
+    : mName(name), mWriter(writer), mMap(nullptr), mMapSize(0),
+      mHeader(nullptr) {}
+
+DistanceFieldShm::~DistanceFieldShm() {
+  if (mMap != nullptr)
+    munmap(mMap, mMapSize);
+  if (mWriter)
+    shm_unlink(mName.c_str());
+}
+
+int DistanceFieldShm::map(int fd, size_t size) {
+  int prot = mWriter ? PROT_READ | PROT_WRITE : PROT_READ;
+
+  mMap = mmap(nullptr, size, prot, MAP_SHARED, fd, 0);
+  if (mMap == MAP_FAILED) {
+    mMap = nullptr;
+    return -errno;
+  }
+  mMapSize = size;
+  mHeader = (DistanceFieldShmHeader *)mMap;
+  return 0;
+}
+
+int DistanceFieldShm::create(const std::string &name, size_t maxVoxels,
+                             DistanceFieldShm **ret) {
+  ULOG_ERRNO_RETURN_ERR_IF(maxVoxels == 0 || maxVoxels > UINT32_MAX, EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(ret == nullptr, EINVAL);
+
+  size_t size = sizeof(DistanceFieldShmHeader) + maxVoxels * sizeof(uint16_t);
+  DistanceFieldShm *self = new DistanceFieldShm(name, true);
+  int res;
+
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    res = -errno;
+    ULOG_ERRNO("shm_open('%s')", -res, name.c_str());
+    goto error;
+  }
+  if (ftruncate(fd, size) < 0) {
+    res = -errno;
+    ULOG_ERRNO("ftruncate", -res);
+    goto error;
+  }
+  res = self->map(fd, size);
+  if (res < 0) {
+    ULOG_ERRNO("mmap", -res);
+    goto error;
+  }
+  close(fd);
+
+  /* Readers check the magic last */
+  self->mHeader->version = DISTANCE_FIELD_SHM_VERSION;
+  self->mHeader->maxVoxels = maxVoxels;
+  self->mHeader->seq = 0;
+  self->mHeader->generation = 0;
+  __atomic_store_n(&self->mHeader->magic, DISTANCE_FIELD_SHM_MAGIC,
+                   __ATOMIC_RELEASE);
+
+  *ret = self;
+  return 0;
+
+error:
+  if (fd >= 0)
+    close(fd);
+  delete self;
+  return res;
+}
+
+int DistanceFieldShm::open(const std::string &name, DistanceFieldShm **ret) {
+  ULOG_ERRNO_RETURN_ERR_IF(ret == nullptr, EINVAL);
+
+  DistanceFieldShm *self = new DistanceFieldShm(name, false);
+  struct stat st;
+  int res;
+
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    res = -errno;
+    goto error;
+  }
+  if (fstat(fd, &st) < 0) {
+    res = -errno;
+    ULOG_ERRNO("fstat", -res);
+    goto error;
+  }
+  if ((size_t)st.st_size < sizeof(DistanceFieldShmHeader)) {
+    res = -EAGAIN;
+    goto error;
+  }
+  res = self->map(fd, st.st_size);
+  if (res < 0) {
+    ULOG_ERRNO("mmap", -res);
+    goto error;
+  }
+  close(fd);
+  fd = -1;
+
+  if (__atomic_load_n(&self->mHeader->magic, __ATOMIC_ACQUIRE) !=
+      DISTANCE_FIELD_SHM_MAGIC) {
+    res = -EAGAIN;
+    goto error;
+  }
+  if (self->mHeader->version != DISTANCE_FIELD_SHM_VERSION ||
+      sizeof(DistanceFieldShmHeader) +
+              (size_t)self->mHeader->maxVoxels * sizeof(uint16_t) >
+          self->mMapSize) {
+    res = -EPROTO;
+    ULOGE("unsupported distance field shared memory '%s'", name.c_str());
+    goto error;
+  }
+
+  *ret = self;
+  return 0;
+
+error:
+  if (fd >= 0)
+    close(fd);
+  delete self;
+  return res;
+}
+
+void DistanceFieldShm::destroy(DistanceFieldShm *self) { delete self; }
+
+static inline uint16_t toMillimeters(float distance) {
+  if (isinf(distance) || distance * 1000.f >= DISTANCE_FIELD_SHM_FAR)
+    return DISTANCE_FIELD_SHM_FAR;
+  return (uint16_t)lrintf(distance * 1000.f);
+}
+
+int DistanceFieldShm::publish(const DistanceField &field, bool full) {
+  ULOG_ERRNO_RETURN_ERR_IF(!mWriter, EPERM);
+  ULOG_ERRNO_RETURN_ERR_IF(field.isEmpty(), EINVAL);
+
+  const int *size = field.getSize();
+  size_t count = (size_t)size[0] * size[1] * size[2];
+  if (count > mHeader->maxVoxels)
+    return -E2BIG;
+
+  full = full || mHeader->generation == 0 ||
+         memcmp(mHeader->size, size, sizeof(mHeader->size)) != 0 ||
+         mHeader->resolution != field.getResolution() ||
+         memcmp(mHeader->origin, field.getOrigin(), sizeof(mHeader->origin)) !=
+             0;
+
+  /* Mark the field as being written before touching it */
+  uint64_t seq = mHeader->seq;
+  __atomic_store_n(&mHeader->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  uint16_t *values = distances();
+  if (full) {
+    memcpy(mHeader->size, size, sizeof(mHeader->size));
+    mHeader->resolution = field.getResolution();
+    memcpy(mHeader->origin, field.getOrigin(), sizeof(mHeader->origin));
+    mHeader->maxDistance = field.getMaxDistance();
+    for (size_t i = 0; i < count; i++)
+      values[i] = toMillimeters(field.getDistance(i));
+  } else {
+    for (uint32_t index : field.getChangedVoxels())
+      values[index] = toMillimeters(field.getDistance(index));
+  }
+
+  __atomic_store_n(&mHeader->generation, mHeader->generation + 1,
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&mHeader->seq, seq + 2, __ATOMIC_RELEASE);
+  return 0;
+}
+
+int DistanceFieldShm::getDistance(const float position[3],
+                                  float *distance) const {
+  ULOG_ERRNO_RETURN_ERR_IF(position == nullptr, EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(distance == nullptr, EINVAL);
+
+  const uint16_t *values = distances();
+
+  for (int i = 0; i < DISTANCE_FIELD_SHM_READ_RETRIES; i++) {
+    uint64_t seqBegin = __atomic_load_n(&mHeader->seq, __ATOMIC_ACQUIRE);
+    if (seqBegin & 1)
+      continue;
+    if (__atomic_load_n(&mHeader->generation, __ATOMIC_RELAXED) == 0)
+      return -ENOENT;
+
+    int voxel[3];
+    bool inside = true;
+    float resolution = mHeader->resolution;
+    for (int j = 0; j < 3; j++) {
+      voxel[j] = (int)floorf((position[j] - mHeader->origin[j]) / resolution);
+      inside = inside && voxel[j] >= 0 && voxel[j] < mHeader->size[j];
+    }
+    size_t index = 0;
+    if (inside) {
+      index = ((size_t)voxel[2] * mHeader->size[1] + voxel[1]) *
+                  mHeader->size[0] +
+              voxel[0];
+      inside = index < mHeader->maxVoxels;
+    }
+    uint16_t value = inside ? values[index] : DISTANCE_FIELD_SHM_FAR;
+
+    /* Values are valid if the field was not written meanwhile */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&mHeader->seq, __ATOMIC_RELAXED) != seqBegin)
+      continue;
+    if (!inside)
+      return -ERANGE;
+    *distance = value == DISTANCE_FIELD_SHM_FAR ? INFINITY : value / 1000.f;
+    return 0;
+  }
+
+  return -EAGAIN;
+}
@@ -0,0 +1,132 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "distance_field.hpp"
+
+/* Distance field shared with other mission services.
+ *
+ * The shared memory object starts with a `DistanceFieldShmHeader` followed
+ * by `maxVoxels` distances, one uint16_t per voxel in millimeters, x varying
+ * first. DISTANCE_FIELD_SHM_FAR is farther than `maxDistance`.
+ *
+ * A single copy of the field is kept, so that an update only writes the
+ * voxels whose distance changed. `seq` is odd while the writer updates the
+ * geometry or the distances. A reader loads `seq`, reads the geometry and
+ * the distances it needs, and loads `seq` again: what it read is valid if
+ * both values are equal and even. `generation` is the number of updates. */
+
+#define DISTANCE_FIELD_SHM_MAGIC 0x44495354 /* "DIST" */
+#define DISTANCE_FIELD_SHM_VERSION 1
+#define DISTANCE_FIELD_SHM_FAR UINT16_MAX
+
+struct DistanceFieldShmHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t maxVoxels;
+  uint32_t reserved;
+  /* Odd while the field is being written. */
+  uint64_t seq;
+  /* Number of updates of the field, 0 before the first one. */
+  uint64_t generation;
+  /* Geometry of the field, see OccupancyVolume. */
+  int32_t size[3];
+  float resolution;
+  float origin[3];
+  /* Maximum distance of the field [m]. */
+  float maxDistance;
+};
+
+class DistanceFieldShm {
+public:
+  /**
+   * Create the shared memory object of a distance field, for writing.
+   * @param name name of the POSIX shared memory object.
+   * @param maxVoxels maximum number of voxels of the field.
+   * @param ret pointer to return the created object.
+   * @return 0 in case of success, negative errno in case of error.
+   */
+  static int create(const std::string &name, size_t maxVoxels,
+                    DistanceFieldShm **ret);
+
+  /**
+   * Open an existing shared memory distance field, for reading.
+   * @param name name of the POSIX shared memory object.
+   * @param ret pointer to return the created object.
+   * @return 0 in case of success, -ENOENT or -EAGAIN if the writer has not
+   *         created it yet, negative errno in case of error.
+   */
+  static int open(const std::string &name, DistanceFieldShm **ret);
+
+  /* Unmap the shared memory, it is also removed for the writer. */
+  static void destroy(DistanceFieldShm *self);
+
+  /**
+   * Publish an update of a distance field. Only the voxels whose distance
+   * changed are written, unless the field was recomputed or its geometry
+   * changed.
+   * @param field updated distance field.
+   * @param full whether the field was recomputed.
+   * @return 0 in case of success, -E2BIG if the field has too many voxels,
+   *         negative errno in case of error.
+   */
+  int publish(const DistanceField &field, bool full);
+
+  /**
+   * Get the distance of a point to the nearest obstacle, in constant time.
+   * @param position point [m].
+   * @param distance pointer to return the distance, INFINITY if farther
+   *                 than the maximum distance [m].
+   * @return 0 in case of success, -ENOENT if no field has been published,
+   *         -ERANGE outside of the field, -EAGAIN if the writer kept
+   *         updating the field, negative errno in case of error.
+   */
+  int getDistance(const float position[3], float *distance) const;
+
+  const DistanceFieldShmHeader *getHeader() const { return mHeader; }
+
+private:
+  DistanceFieldShm(const std::string &name, bool writer);
+  ~DistanceFieldShm();
+  int map(int fd, size_t size);
+  uint16_t *distances() const { return (uint16_t *)(mHeader + 1); }
+
+  const std::string mName;
+  const bool mWriter;
+  void *mMap;
+  size_t mMapSize;
+  DistanceFieldShmHeader *mHeader;
+};
@@ -0,0 +1,381 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "frontier_map.hpp"
+#include <algorithm>
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+#define ULOG_TAG spatial_perception
+#include <ulog.h>
+
+/* Label of a frontier voxel left out of the clusters. */
+#define NO_LABEL UINT32_MAX
+
+/* Blocks searched or labelled, and nodes joined, between two checks of the
+ * budget. */
+#define BUDGET_CHECK_BLOCKS 8
+#define BUDGET_CHECK_NODES 1024
+
+FrontierMap::FrontierMap(const Config &config)
+    : mConfig(config), mSize{0, 0, 0}, mBlocks{0, 0, 0}, mFrontierCount(0),
+      mPendingHead(0), mClustersStale(false),
+      mNodes(config.maxFrontierVoxels), mClusters(config.maxFrontierVoxels),
+      mClusterTruncated(0) {}
+
+void FrontierMap::reset(const GridDelta &delta) {
+  size_t voxelCount = (size_t)delta.size[0] * delta.size[1] * delta.size[2];
+  size_t blockCount = delta.blockCount();
+
+  for (int i = 0; i < 3; i++) {
+    mSize[i] = delta.size[i];
+    mBlocks[i] = delta.blocks[i];
+  }
+  mFrontiers.assign(voxelCount, 0);
+  mLabels.resize(voxelCount);
+  mBlockFrontiers.assign(blockCount, 0);
+  mFrontierCount = 0;
+
+  /* Every block is searched, over as many grids as the budget needs */
+  mDirty.assign(blockCount, 1);
+  mPending.resize(blockCount);
+  for (size_t i = 0; i < blockCount; i++)
+    mPending[i] = i;
+  mPendingHead = 0;
+  mGoals.clear();
+  mClusterTruncated = 0;
+  mClustersStale = true;
+}
+
+bool FrontierMap::isFrontier(const OccupancyVolume &volume, int x, int y,
+                             int z) const {
+  const int8_t *voxel = &volume.logodds[volume.index(x, y, z)];
+  size_t plane = (size_t)mSize[0] * mSize[1];
+
+  if (*voxel == OCCUPANCY_UNKNOWN || *voxel > mConfig.freeLogodd)
+    return false;
+  return (x > 0 && voxel[-1] == OCCUPANCY_UNKNOWN) ||
+         (x < mSize[0] - 1 && voxel[1] == OCCUPANCY_UNKNOWN) ||
+         (y > 0 && voxel[-mSize[0]] == OCCUPANCY_UNKNOWN) ||
+         (y < mSize[1] - 1 && voxel[mSize[0]] == OCCUPANCY_UNKNOWN) ||
+         (z > 0 && voxel[-(ptrdiff_t)plane] == OCCUPANCY_UNKNOWN) ||
+         (z < mSize[2] - 1 && voxel[plane] == OCCUPANCY_UNKNOWN);
+}
+
+void FrontierMap::searchBlock(const OccupancyVolume &volume, size_t block) {
+  int b[3] = {(int)(block % mBlocks[0]), (int)(block / mBlocks[0] % mBlocks[1]),
+              (int)(block / mBlocks[0] / mBlocks[1])};
+  int lo[3], hi[3];
+
+  /* A voxel of the block may change the frontiers of the voxels next to it
+   * in the neighbouring blocks */
+  for (int i = 0; i < 3; i++) {
+    lo[i] = std::max(b[i] * GRID_DELTA_BLOCK_SIZE - 1, 0);
+    hi[i] = std::min((b[i] + 1) * GRID_DELTA_BLOCK_SIZE + 1, mSize[i]);
+  }
+  for (int z = lo[2]; z < hi[2]; z++) {
+    for (int y = lo[1]; y < hi[1]; y++) {
+      for (int x = lo[0]; x < hi[0]; x++) {
+        size_t index = volume.index(x, y, z);
+        uint8_t frontier = isFrontier(volume, x, y, z);
+        if (frontier == mFrontiers[index])
+          continue;
+        size_t owner =
+            ((size_t)(z >> GRID_DELTA_BLOCK_SHIFT) * mBlocks[1] +
+             (y >> GRID_DELTA_BLOCK_SHIFT)) *
+                mBlocks[0] +
+            (x >> GRID_DELTA_BLOCK_SHIFT);
+        mFrontiers[index] = frontier;
+        if (frontier) {
+          mBlockFrontiers[owner]++;
+          mFrontierCount++;
+        } else {
+          mBlockFrontiers[owner]--;
+          mFrontierCount--;
+        }
+        mClustersStale = true;
+      }
+    }
+  }
+}
+
+uint32_t FrontierMap::find(uint32_t node) {
+  /* Path halving */
+  while (mNodes[node].parent != node) {
+    mNodes[node].parent = mNodes[mNodes[node].parent].parent;
+    node = mNodes[node].parent;
+  }
+  return node;
+}
+
+bool FrontierMap::cluster(std::chrono::steady_clock::time_point deadline,
+                          size_t *truncated) {
+  size_t plane = (size_t)mSize[0] * mSize[1];
+  size_t blockCount = mBlockFrontiers.size();
+  size_t visited = 0;
+  uint32_t count = 0;
+
+  *truncated = 0;
+
+  /* Label the frontier voxels, skipping the blocks without any */
+  for (size_t block = 0; block < blockCount; block++) {
+    if (mBlockFrontiers[block] == 0)
+      continue;
+    if (++visited % BUDGET_CHECK_BLOCKS == 0 &&
+        std::chrono::steady_clock::now() >= deadline)
+      return false;
+
+    int b[3] = {(int)(block % mBlocks[0]),
+                (int)(block / mBlocks[0] % mBlocks[1]),
+                (int)(block / mBlocks[0] / mBlocks[1])};
+    int lo[3], hi[3];
+    for (int i = 0; i < 3; i++) {
+      lo[i] = b[i] * GRID_DELTA_BLOCK_SIZE;
+      hi[i] = std::min(lo[i] + GRID_DELTA_BLOCK_SIZE, mSize[i]);
+    }
+    for (int z = lo[2]; z < hi[2]; z++) {
+      for (int y = lo[1]; y < hi[1]; y++) {
+        size_t index = ((size_t)z * mSize[1] + y) * mSize[0] + lo[0];
+        /* Most rows of 8 voxels hold no frontier */
+        if (hi[0] - lo[0] == GRID_DELTA_BLOCK_SIZE) {
+          uint64_t row;
+          memcpy(&row, &mFrontiers[index], sizeof(row));
+          if (row == 0)
+            continue;
+        }
+        for (int x = lo[0]; x < hi[0]; x++, index++) {
+          if (!mFrontiers[index])
+            continue;
+          if (count == mNodes.size()) {
+            mLabels[index] = NO_LABEL;
+            (*truncated)++;
+            continue;
+          }
+          mNodes[count].parent = count;
+          mNodes[count].x = x;
+          mNodes[count].y = y;
+          mNodes[count].z = z;
+          mLabels[index] = count++;
+        }
+      }
+    }
+  }
+
+  /* Join each frontier voxel to the 13 of its 26 neighbours before it in
+   * memory order, which covers every pair of neighbours once. The root of
+   * a cluster is its lowest node, the parent of a node is lower than it. */
+  int offsets[13][3];
+  ptrdiff_t steps[13];
+  int n = 0;
+  for (int dz = -1; dz <= 0; dz++) {
+    for (int dy = -1; dy <= (dz < 0 ? 1 : 0); dy++) {
+      for (int dx = -1; dx <= (dz < 0 || dy < 0 ? 1 : -1); dx++, n++) {
+        offsets[n][0] = dx;
+        offsets[n][1] = dy;
+        offsets[n][2] = dz;
+        steps[n] = dz * (ptrdiff_t)plane + dy * mSize[0] + dx;
+      }
+    }
+  }
+  for (uint32_t node = 0; node < count; node++) {
+    if (node % BUDGET_CHECK_NODES == BUDGET_CHECK_NODES - 1 &&
+        std::chrono::steady_clock::now() >= deadline)
+      return false;
+    const Node &current = mNodes[node];
+    size_t index = getIndex(current);
+    bool inside = current.x > 0 && current.x < mSize[0] - 1 &&
+                  current.y > 0 && current.y < mSize[1] - 1 && current.z > 0;
+    uint32_t root = find(node);
+    for (int i = 0; i < 13; i++) {
+      if (!inside) {
+        int x = current.x + offsets[i][0], y = current.y + offsets[i][1];
+        int z = current.z + offsets[i][2];
+        if (x < 0 || x >= mSize[0] || y < 0 || y >= mSize[1] || z < 0)
+          continue;
+      }
+      size_t neighbour = index + steps[i];
+      if (!mFrontiers[neighbour] || mLabels[neighbour] == NO_LABEL)
+        continue;
+      uint32_t other = find(mLabels[neighbour]);
+      if (root < other) {
+        mNodes[other].parent = root;
+      } else if (other < root) {
+        mNodes[root].parent = other;
+        root = other;
+      }
+    }
+  }
+
+  /* Point every node to its root, and accumulate the voxels of each
+   * cluster on its root, which comes first */
+  for (uint32_t node = 0; node < count; node++) {
+    Node &current = mNodes[node];
+    current.parent = mNodes[current.parent].parent;
+    Cluster &cluster = mClusters[current.parent];
+    if (current.parent == node) {
+      cluster.voxels = 0;
+      cluster.sum[0] = cluster.sum[1] = cluster.sum[2] = 0.f;
+      cluster.best = node;
+      cluster.bestDistance2 = INFINITY;
+    }
+    cluster.voxels++;
+    cluster.sum[0] += current.x;
+    cluster.sum[1] += current.y;
+    cluster.sum[2] += current.z;
+  }
+
+  /* The goal of a cluster is its voxel closest to its centroid, which may
+   * not be a frontier itself */
+  for (uint32_t node = 0; node < count; node++) {
+    const Node &current = mNodes[node];
+    Cluster &cluster = mClusters[current.parent];
+    if (cluster.voxels < mConfig.minClusterVoxels)
+      continue;
+    float d[3] = {
+        current.x - cluster.sum[0] / cluster.voxels,
+        current.y - cluster.sum[1] / cluster.voxels,
+        current.z - cluster.sum[2] / cluster.voxels,
+    };
+    float distance2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+    if (distance2 < cluster.bestDistance2) {
+      cluster.bestDistance2 = distance2;
+      cluster.best = node;
+    }
+  }
+
+  mGoals.clear();
+  for (uint32_t node = 0; node < count; node++) {
+    const Cluster &cluster = mClusters[node];
+    if (mNodes[node].parent != node ||
+        cluster.voxels < mConfig.minClusterVoxels)
+      continue;
+    const Node &best = mNodes[cluster.best];
+    ClusterGoal goal = {
+        .voxel = {best.x, best.y, best.z},
+        .voxels = cluster.voxels,
+    };
+    mGoals.push_back(goal);
+  }
+  return true;
+}
+
+void FrontierMap::rank(const OccupancyVolume &volume, Result *result) {
+  result->goals.clear();
+  for (const ClusterGoal &cluster : mGoals) {
+    Goal goal;
+    float distance2 = 0.f;
+    for (int i = 0; i < 3; i++) {
+      goal.position[i] =
+          volume.origin[i] + (cluster.voxel[i] + 0.5f) * volume.resolution;
+      float d = goal.position[i] - volume.center[i];
+      distance2 += d * d;
+    }
+    goal.distance = sqrtf(distance2);
+    goal.voxels = cluster.voxels;
+    goal.score =
+        goal.voxels / (1.f + mConfig.distanceCost * goal.distance);
+    result->goals.push_back(goal);
+  }
+
+  size_t count = std::min(result->goals.size(), (size_t)mConfig.maxGoals);
+  std::partial_sort(
+      result->goals.begin(), result->goals.begin() + count,
+      result->goals.end(),
+      [](const Goal &a, const Goal &b) { return a.score > b.score; });
+  result->goals.resize(count);
+}
+
+int FrontierMap::update(const OccupancyVolume &volume, const GridDelta &delta,
+                        Result *result) {
+  ULOG_ERRNO_RETURN_ERR_IF(result == nullptr, EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(volume.logodds.size() != volume.count(), EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(volume.size[0] != delta.size[0] ||
+                               volume.size[1] != delta.size[1] ||
+                               volume.size[2] != delta.size[2],
+                           EINVAL);
+
+  auto start = std::chrono::steady_clock::now();
+  auto deadline = start + std::chrono::microseconds(mConfig.budgetUs);
+
+  /* The first delta is full, a delta of another geometry as well */
+  if (delta.full || mDirty.size() != delta.blockCount()) {
+    reset(delta);
+  } else {
+    for (const GridBlock &block : delta.changed) {
+      size_t index =
+          ((size_t)block.z * mBlocks[1] + block.y) * mBlocks[0] + block.x;
+      if (mDirty[index])
+        continue;
+      mDirty[index] = 1;
+      mPending.push_back(index);
+    }
+  }
+
+  /* The oldest changed blocks first, at least one per grid */
+  size_t updated = 0;
+  while (mPendingHead < mPending.size()) {
+    if (updated > 0 && updated % BUDGET_CHECK_BLOCKS == 0 &&
+        std::chrono::steady_clock::now() >= deadline)
+      break;
+    size_t block = mPending[mPendingHead++];
+    mDirty[block] = 0;
+    searchBlock(volume, block);
+    updated++;
+  }
+  if (mPendingHead == mPending.size()) {
+    mPending.clear();
+    mPendingHead = 0;
+  } else if (mPendingHead > mPending.size() / 2) {
+    mPending.erase(mPending.begin(), mPending.begin() + mPendingHead);
+    mPendingHead = 0;
+  }
+
+  if (mClustersStale && std::chrono::steady_clock::now() < deadline) {
+    size_t truncated;
+    if (cluster(deadline, &truncated)) {
+      mClustersStale = false;
+      mClusterTruncated = truncated;
+    }
+  }
+  rank(volume, result);
+
+  result->frontierVoxels = mFrontierCount;
+  result->clusters = mGoals.size();
+  result->truncatedVoxels = mClusterTruncated;
+  result->updatedBlocks = updated;
+  result->pendingBlocks = mPending.size() - mPendingHead;
+  result->clustered = !mClustersStale;
+  result->extractUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+  return 0;
+}
@@ -0,0 +1,183 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "grid_delta.hpp"
+#include "occupancy_volume.hpp"
+
+/* Frontiers of the explored space, for exploration missions.
+ *
+ * A frontier voxel is a free voxel with an unknown voxel among its 6
+ * neighbours in the grid, the voxels beyond the grid do not count. Frontier
+ * voxels touching by a face, an edge or a corner are clustered into goals,
+ * ranked by their size and their distance to the drone.
+ *
+ * The frontier voxels are kept from grid to grid: only the changed blocks of
+ * the grid delta, grown by a voxel, are searched again. Blocks left over by
+ * a grid which ran out of budget wait for the next grids. The clusters are
+ * then formed with a union-find over the frontier voxels, labelled block by
+ * block skipping the blocks without frontiers, in buffers allocated once:
+ * a label per voxel and a node per frontier voxel, up to
+ * `maxFrontierVoxels`. The clusters are only formed again when a frontier
+ * changed, the goals are ranked again on every grid as the drone moves. */
+class FrontierMap {
+public:
+  struct Config {
+    /* Voxels observed with at most this log-odds are free. */
+    int8_t freeLogodd;
+    /* Clusters of less voxels are not goals. */
+    unsigned int minClusterVoxels;
+    /* Maximum number of goals of a result. */
+    unsigned int maxGoals;
+    /* Goals are ranked by voxels / (1 + distanceCost * distance) [1/m]. */
+    float distanceCost;
+    /* Frontier voxels clustered at most, the following ones are left out
+     * of the clusters. */
+    size_t maxFrontierVoxels;
+    /* Budget of the extraction of a grid [us]. */
+    unsigned int budgetUs;
+  };
+
+  /* Cluster of frontier voxels. */
+  struct Goal {
+    /* Frontier voxel of the cluster closest to its centroid, in the frame
+     * of the grid [m]. */
+    float position[3];
+    /* Distance from the drone [m]. */
+    float distance;
+    /* Frontier voxels of the cluster. */
+    unsigned int voxels;
+    float score;
+  };
+
+  struct Result {
+    /* Number of the grid, set by the caller. */
+    uint64_t generation;
+    /* Goals by decreasing score. */
+    std::vector<Goal> goals;
+    /* Frontier voxels of the grid, clusters of at least
+     * `minClusterVoxels`, and frontier voxels left out of the clusters. */
+    size_t frontierVoxels;
+    size_t clusters;
+    size_t truncatedVoxels;
+    /* Blocks searched for frontiers, and changed blocks left for the next
+     * grids. */
+    size_t updatedBlocks;
+    size_t pendingBlocks;
+    /* Whether the clusters are the ones of the current frontiers, they are
+     * the previous ones if the budget ran out. */
+    bool clustered;
+    /* Duration of the extraction [us]. */
+    uint64_t extractUs;
+  };
+
+  FrontierMap(const Config &config);
+
+  /**
+   * Update the frontiers from the delta of a grid, and rank the goals.
+   * @param volume voxels of the grid.
+   * @param delta delta of the grid since the previous one.
+   * @param result pointer to return the goals, `generation` is left to the
+   *               caller.
+   * @return 0 in case of success, negative errno in case of error.
+   */
+  int update(const OccupancyVolume &volume, const GridDelta &delta,
+             Result *result);
+
+  const Config &getConfig() const { return mConfig; }
+
+private:
+  /* Union-find node of a frontier voxel. */
+  struct Node {
+    uint32_t parent;
+    int x;
+    int y;
+    int z;
+  };
+
+  /* Cluster accumulated on its root node. */
+  struct Cluster {
+    uint32_t voxels;
+    float sum[3];
+    uint32_t best;
+    float bestDistance2;
+  };
+
+  /* Goal of a cluster, in voxels. */
+  struct ClusterGoal {
+    int voxel[3];
+    unsigned int voxels;
+  };
+
+  void reset(const GridDelta &delta);
+  void searchBlock(const OccupancyVolume &volume, size_t block);
+  bool isFrontier(const OccupancyVolume &volume, int x, int y, int z) const;
+  uint32_t find(uint32_t node);
+  size_t getIndex(const Node &node) const {
+    return ((size_t)node.z * mSize[1] + node.y) * mSize[0] + node.x;
+  }
+  bool cluster(std::chrono::steady_clock::time_point deadline,
+               size_t *truncated);
+  void rank(const OccupancyVolume &volume, Result *result);
+
+  const Config mConfig;
+
+  /* Geometry of the grids, in voxels and in blocks. */
+  int mSize[3];
+  int mBlocks[3];
+  /* Whether each voxel is a frontier, and the frontier voxels of each
+   * block and of the grid. */
+  std::vector<uint8_t> mFrontiers;
+  std::vector<uint32_t> mBlockFrontiers;
+  size_t mFrontierCount;
+  /* Changed blocks not searched yet, oldest first from `mPendingHead`, and
+   * whether each block is among them. */
+  std::vector<uint32_t> mPending;
+  size_t mPendingHead;
+  std::vector<uint8_t> mDirty;
+  /* Whether a frontier changed since the clusters were formed. */
+  bool mClustersStale;
+
+  /* Label of each frontier voxel, index of its node, and the nodes and
+   * clusters, allocated once. */
+  std::vector<uint32_t> mLabels;
+  std::vector<Node> mNodes;
+  std::vector<Cluster> mClusters;
+  /* Clusters of the latest clustering, ranked on every grid. */
+  std::vector<ClusterGoal> mGoals;
+  size_t mClusterTruncated;
+};
@@ -0,0 +1,152 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "grid_delta.hpp"
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+
+#define ULOG_TAG spatial_perception
+#include <ulog.h>
+
+GridDiff::GridDiff(int8_t obstacleLogodd)
+    : mObstacleLogodd(obstacleLogodd), mSize{0, 0, 0}, mResolution(0.f),
+      mOrigin{0.f, 0.f, 0.f} {}
+
+void GridDiff::countBlock(const OccupancyVolume &volume, int bx, int by,
+                          int bz, BlockState *state) const {
+  int begin[3] = {bx << GRID_DELTA_BLOCK_SHIFT, by << GRID_DELTA_BLOCK_SHIFT,
+                  bz << GRID_DELTA_BLOCK_SHIFT};
+  int end[3];
+  unsigned int occupied = 0, unknown = 0;
+
+  for (int i = 0; i < 3; i++)
+    end[i] = std::min(begin[i] + GRID_DELTA_BLOCK_SIZE, volume.size[i]);
+  for (int z = begin[2]; z < end[2]; z++) {
+    for (int y = begin[1]; y < end[1]; y++) {
+      const int8_t *row = &volume.logodds[volume.index(0, y, z)];
+      for (int x = begin[0]; x < end[0]; x++) {
+        occupied += row[x] >= mObstacleLogodd;
+        unknown += row[x] == OCCUPANCY_UNKNOWN;
+      }
+    }
+  }
+  state->occupied = occupied;
+  state->unknown = unknown;
+}
+
+bool GridDiff::hasGeometry(const OccupancyVolume &volume) const {
+  return !mPrevious.empty() &&
+         memcmp(mSize, volume.size, sizeof(mSize)) == 0 &&
+         mResolution == volume.resolution &&
+         memcmp(mOrigin, volume.origin, sizeof(mOrigin)) == 0;
+}
+
+int GridDiff::update(const OccupancyVolume &volume, GridDelta *delta) {
+  ULOG_ERRNO_RETURN_ERR_IF(delta == nullptr, EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(volume.logodds.size() != volume.count(), EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(mObstacleLogodd == OCCUPANCY_UNKNOWN, EINVAL);
+
+  int blocks[3];
+  for (int i = 0; i < 3; i++) {
+    ULOG_ERRNO_RETURN_ERR_IF(volume.size[i] <= 0, EINVAL);
+    blocks[i] = (volume.size[i] + GRID_DELTA_BLOCK_SIZE - 1) >>
+                GRID_DELTA_BLOCK_SHIFT;
+    if (blocks[i] > UINT16_MAX)
+      return -ERANGE;
+  }
+  bool full = !hasGeometry(volume);
+
+  /* Rows of 8 voxels in memory order: a row is a 64 bits word of the
+   * checksum of its block, so the volume is read once, sequentially */
+  const int8_t *logodds = volume.logodds.data();
+  int lastWidth = volume.size[0] - ((blocks[0] - 1) << GRID_DELTA_BLOCK_SHIFT);
+  mCurrent.assign((size_t)blocks[0] * blocks[1] * blocks[2],
+                  BlockState{0, 0, 0});
+  for (int z = 0; z < volume.size[2]; z++) {
+    for (int y = 0; y < volume.size[1]; y++) {
+      const int8_t *row = logodds + volume.index(0, y, z);
+      BlockState *state =
+          &mCurrent[((size_t)(z >> GRID_DELTA_BLOCK_SHIFT) * blocks[1] +
+                     (y >> GRID_DELTA_BLOCK_SHIFT)) *
+                    blocks[0]];
+      for (int bx = 0; bx < blocks[0]; bx++) {
+        const int8_t *voxels = row + (bx << GRID_DELTA_BLOCK_SHIFT);
+        uint64_t word = 0;
+        if (bx + 1 < blocks[0])
+          memcpy(&word, voxels, sizeof(word));
+        else
+          memcpy(&word, voxels, lastWidth);
+        state[bx].checksum = hashMix(state[bx].checksum, word);
+      }
+    }
+  }
+
+  /* Voxels are only counted in the changed blocks, the others keep their
+   * counts */
+  memcpy(delta->size, volume.size, sizeof(delta->size));
+  delta->resolution = volume.resolution;
+  memcpy(delta->origin, volume.origin, sizeof(delta->origin));
+  memcpy(delta->blocks, blocks, sizeof(delta->blocks));
+  delta->full = full;
+  delta->changed.clear();
+  size_t index = 0;
+  for (int z = 0; z < blocks[2]; z++) {
+    for (int y = 0; y < blocks[1]; y++) {
+      for (int x = 0; x < blocks[0]; x++, index++) {
+        BlockState &current = mCurrent[index];
+        if (!full && current.checksum == mPrevious[index].checksum) {
+          current.occupied = mPrevious[index].occupied;
+          current.unknown = mPrevious[index].unknown;
+          continue;
+        }
+        countBlock(volume, x, y, z, &current);
+        GridBlock block = {
+            .x = (uint16_t)x,
+            .y = (uint16_t)y,
+            .z = (uint16_t)z,
+            .occupied = current.occupied,
+            .previousOccupied =
+                full ? (uint16_t)0 : mPrevious[index].occupied,
+            .unknown = current.unknown,
+        };
+        delta->changed.push_back(block);
+      }
+    }
+  }
+
+  /* The new blocks become the previous ones */
+  std::swap(mPrevious, mCurrent);
+  memcpy(mSize, volume.size, sizeof(mSize));
+  mResolution = volume.resolution;
+  memcpy(mOrigin, volume.origin, sizeof(mOrigin));
+  return 0;
+}
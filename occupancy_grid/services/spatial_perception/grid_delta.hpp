@@ -0,0 +1,143 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "occupancy_volume.hpp"
+
+/* Blocks of a grid delta are cubes of GRID_DELTA_BLOCK_SIZE voxels. */
+#define GRID_DELTA_BLOCK_SHIFT 3
+#define GRID_DELTA_BLOCK_SIZE (1 << GRID_DELTA_BLOCK_SHIFT)
+
+/* Block of voxels which changed between two grids. Blocks on the upper
+ * edges of a volume may be cut by the volume. */
+struct GridBlock {
+  /* Position of the block, in blocks: it covers the voxels x *
+   * GRID_DELTA_BLOCK_SIZE to (x + 1) * GRID_DELTA_BLOCK_SIZE - 1 along x,
+   * and so on. */
+  uint16_t x;
+  uint16_t y;
+  uint16_t z;
+  /* Obstacle voxels of the block in the new grid and in the previous one,
+   * an obstacle appeared in the block if `occupied` is larger. */
+  uint16_t occupied;
+  uint16_t previousOccupied;
+  /* Unknown voxels of the block in the new grid. */
+  uint16_t unknown;
+};
+
+/* Changes of a grid since the previous one. */
+struct GridDelta {
+  /* Number of the grid since the start, and its reception time,
+   * CLOCK_MONOTONIC [ns]. */
+  uint64_t generation;
+  uint64_t timestampNs;
+  /* Geometry of the grid, see OccupancyVolume. */
+  int size[3];
+  float resolution;
+  float origin[3];
+  /* Number of blocks along x, y and z. */
+  int blocks[3];
+  /* Whether every block is listed as changed: first grid, or geometry
+   * different from the previous grid, so that the previous blocks do not
+   * match. `previousOccupied` is then 0. */
+  bool full;
+  /* Changed blocks, z varying last, then y, then x. */
+  std::vector<GridBlock> changed;
+
+  size_t blockCount() const {
+    return (size_t)blocks[0] * blocks[1] * blocks[2];
+  }
+};
+
+/* Listener of the grid deltas, see `SpatialPerception::addDeltaListener`. */
+class GridDeltaListener {
+public:
+  virtual ~GridDeltaListener() {}
+  /* Called by the analysis thread with the delta of each grid which is not
+   * identical to the previous one, before its other analyses. It shall not
+   * block. */
+  virtual void onGridDelta(const OccupancyVolume &volume,
+                           const GridDelta &delta) = 0;
+};
+
+/* Block-level diff of successive occupancy volumes.
+ *
+ * Each volume is cut in blocks of GRID_DELTA_BLOCK_SIZE^3 voxels. A single
+ * traversal of the volume, in memory order, mixes each row of 8 voxels into
+ * the 64 bits checksum of its block (see `hashMix`). Blocks whose checksum
+ * differs from the one of the previous volume are changed, the others are
+ * taken as unchanged without keeping a copy of the previous voxels. Only
+ * the voxels of the changed blocks are then counted. */
+class GridDiff {
+public:
+  /* Voxels with at least this log-odds are obstacles. */
+  GridDiff(int8_t obstacleLogodd);
+
+  /**
+   * Diff a volume against the previous one.
+   * @param volume voxels of the new grid.
+   * @param delta delta to fill, `generation` and `timestampNs` are left
+   *              to the caller.
+   * @return 0 in case of success, -ERANGE if the volume has more than
+   *         UINT16_MAX blocks along an axis, negative errno in case of
+   *         error.
+   */
+  int update(const OccupancyVolume &volume, GridDelta *delta);
+
+  /* Forget the previous volume, the next delta is full. */
+  void reset() { mPrevious.clear(); }
+
+private:
+  struct BlockState {
+    uint64_t checksum;
+    uint16_t occupied;
+    uint16_t unknown;
+  };
+
+  bool hasGeometry(const OccupancyVolume &volume) const;
+  void countBlock(const OccupancyVolume &volume, int bx, int by, int bz,
+                  BlockState *state) const;
+
+  const int8_t mObstacleLogodd;
+  /* Geometry of the previous volume. */
+  int mSize[3];
+  float mResolution;
+  float mOrigin[3];
+  /* Blocks of the previous volume, empty before the first one, and of the
+   * new one. */
+  std::vector<BlockState> mPrevious;
+  std::vector<BlockState> mCurrent;
+};
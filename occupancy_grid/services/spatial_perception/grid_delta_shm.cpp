@@ -0,0 +1,240 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "grid_delta_shm.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ULOG_TAG spatial_perception
+#include <ulog.h>
+
+/* Attempts of a reader racing with the writer. */
+#define GRID_DELTA_SHM_READ_RETRIES 4
+
+GridDeltaShm::GridDeltaShm(const std::string &name, bool writer)
+    : mName(name), mWriter(writer), mMap(nullptr), mMapSize(0),
+      mHeader(nullptr) {}
+
+GridDeltaShm::~GridDeltaShm() {
+  if (mMap != nullptr)
+    munmap(mMap, mMapSize);
+  if (mWriter)
+    shm_unlink(mName.c_str());
+}
+
+int GridDeltaShm::map(int fd, size_t size) {
+  int prot = mWriter ? PROT_READ | PROT_WRITE : PROT_READ;
+
+  mMap = mmap(nullptr, size, prot, MAP_SHARED, fd, 0);
+  if (mMap == MAP_FAILED) {
+    mMap = nullptr;
+    return -errno;
+  }
+  mMapSize = size;
+  mHeader = (GridDeltaShmHeader *)mMap;
+  return 0;
+}
+
+int GridDeltaShm::create(const std::string &name, unsigned int slotCount,
+                         unsigned int maxBlocks, GridDeltaShm **ret) {
+  ULOG_ERRNO_RETURN_ERR_IF(slotCount == 0, EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(maxBlocks == 0, EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(ret == nullptr, EINVAL);
+
+  /* Slots are 8 bytes aligned for the 64 bits fields */
+  size_t slotSize = sizeof(GridDeltaShmSlot) + maxBlocks * sizeof(GridBlock);
+  slotSize = (slotSize + 7) & ~(size_t)7;
+  ULOG_ERRNO_RETURN_ERR_IF(slotSize > UINT32_MAX, EINVAL);
+  size_t size = sizeof(GridDeltaShmHeader) + slotCount * slotSize;
+  GridDeltaShm *self = new GridDeltaShm(name, true);
+  int res;
+
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    res = -errno;
+    ULOG_ERRNO("shm_open('%s')", -res, name.c_str());
+    goto error;
+  }
+  if (ftruncate(fd, size) < 0) {
+    res = -errno;
+    ULOG_ERRNO("ftruncate", -res);
+    goto error;
+  }
+  res = self->map(fd, size);
+  if (res < 0) {
+    ULOG_ERRNO("mmap", -res);
+    goto error;
+  }
+  close(fd);
+
+  /* Readers check the magic last */
+  self->mHeader->version = GRID_DELTA_SHM_VERSION;
+  self->mHeader->slotCount = slotCount;
+  self->mHeader->slotSize = slotSize;
+  self->mHeader->maxBlocks = maxBlocks;
+  self->mHeader->writeCount = 0;
+  __atomic_store_n(&self->mHeader->magic, GRID_DELTA_SHM_MAGIC,
+                   __ATOMIC_RELEASE);
+
+  *ret = self;
+  return 0;
+
+error:
+  if (fd >= 0)
+    close(fd);
+  delete self;
+  return res;
+}
+
+int GridDeltaShm::open(const std::string &name, GridDeltaShm **ret) {
+  ULOG_ERRNO_RETURN_ERR_IF(ret == nullptr, EINVAL);
+
+  GridDeltaShm *self = new GridDeltaShm(name, false);
+  struct stat st;
+  int res;
+
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    res = -errno;
+    goto error;
+  }
+  if (fstat(fd, &st) < 0) {
+    res = -errno;
+    ULOG_ERRNO("fstat", -res);
+    goto error;
+  }
+  if ((size_t)st.st_size < sizeof(GridDeltaShmHeader)) {
+    res = -EAGAIN;
+    goto error;
+  }
+  res = self->map(fd, st.st_size);
+  if (res < 0) {
+    ULOG_ERRNO("mmap", -res);
+    goto error;
+  }
+  close(fd);
+  fd = -1;
+
+  if (__atomic_load_n(&self->mHeader->magic, __ATOMIC_ACQUIRE) !=
+      GRID_DELTA_SHM_MAGIC) {
+    res = -EAGAIN;
+    goto error;
+  }
+  if (self->mHeader->version != GRID_DELTA_SHM_VERSION ||
+      self->mHeader->slotCount == 0 ||
+      self->mHeader->slotSize < sizeof(GridDeltaShmSlot) +
+                                    (size_t)self->mHeader->maxBlocks *
+                                        sizeof(GridBlock) ||
+      sizeof(GridDeltaShmHeader) +
+              (size_t)self->mHeader->slotCount * self->mHeader->slotSize >
+          self->mMapSize) {
+    res = -EPROTO;
+    ULOGE("unsupported grid delta shared memory '%s'", name.c_str());
+    goto error;
+  }
+
+  *ret = self;
+  return 0;
+
+error:
+  if (fd >= 0)
+    close(fd);
+  delete self;
+  return res;
+}
+
+void GridDeltaShm::destroy(GridDeltaShm *self) { delete self; }
+
+int GridDeltaShm::publish(const GridDelta &delta) {
+  ULOG_ERRNO_RETURN_ERR_IF(!mWriter, EPERM);
+
+  uint64_t index = mHeader->writeCount;
+  GridDeltaShmSlot *slot = getSlot(index);
+  bool truncated = delta.changed.size() > mHeader->maxBlocks;
+
+  /* Mark the slot as being written before touching its content */
+  uint64_t seq = slot->seq;
+  __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  slot->index = index;
+  slot->generation = delta.generation;
+  slot->timestampNs = delta.timestampNs;
+  memcpy(slot->size, delta.size, sizeof(slot->size));
+  slot->resolution = delta.resolution;
+  memcpy(slot->origin, delta.origin, sizeof(slot->origin));
+  memcpy(slot->blocks, delta.blocks, sizeof(slot->blocks));
+  slot->flags = (delta.full ? GRID_DELTA_SHM_FULL : 0) |
+                (truncated ? GRID_DELTA_SHM_TRUNCATED : 0);
+  slot->count = truncated ? 0 : delta.changed.size();
+  memcpy(slot + 1, delta.changed.data(), slot->count * sizeof(GridBlock));
+
+  __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+  __atomic_store_n(&mHeader->writeCount, index + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+int GridDeltaShm::read(uint64_t index, GridDeltaShmSlot *slot,
+                       GridBlock *blocks) const {
+  ULOG_ERRNO_RETURN_ERR_IF(slot == nullptr, EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(blocks == nullptr, EINVAL);
+
+  const GridDeltaShmSlot *shared = getSlot(index);
+
+  for (int i = 0; i < GRID_DELTA_SHM_READ_RETRIES; i++) {
+    uint64_t writeCount = getWriteCount();
+    if (index >= writeCount)
+      return -ENOENT;
+    if (writeCount - index > mHeader->slotCount)
+      return -ENODATA;
+
+    uint64_t seqBegin = __atomic_load_n(&shared->seq, __ATOMIC_ACQUIRE);
+    if (seqBegin & 1)
+      continue;
+    memcpy(slot, shared, sizeof(*slot));
+    if (slot->count > mHeader->maxBlocks)
+      continue;
+    memcpy(blocks, shared + 1, slot->count * sizeof(GridBlock));
+
+    /* Content is valid if the slot was not written meanwhile, it may hold
+     * a newer delta if the reader was preempted since `writeCount` */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&shared->seq, __ATOMIC_RELAXED) != seqBegin)
+      continue;
+    return slot->index == index ? 0 : -ENODATA;
+  }
+
+  return -EAGAIN;
+}
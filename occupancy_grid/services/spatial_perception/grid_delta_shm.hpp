@@ -0,0 +1,159 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "grid_delta.hpp"
+
+/* Ring of grid deltas shared with other mission services.
+ *
+ * The shared memory object starts with a `GridDeltaShmHeader` followed by
+ * `slotCount` slots of `slotSize` bytes. Each slot starts with a
+ * `GridDeltaShmSlot` followed by `maxBlocks` `GridBlock`.
+ *
+ * The writer publishes delta number n in slot n % slotCount, then sets
+ * `writeCount` to n + 1. The `seq` of a slot is odd while the slot is being
+ * written. A reader following every delta reads them by number: a delta is
+ * valid if the `seq` of its slot is equal and even before and after the
+ * copy, and the slot still holds that number. A reader falling more than
+ * `slotCount` deltas behind has lost some of them, and shall take every
+ * block as changed, as for a delta with GRID_DELTA_SHM_TRUNCATED. */
+
+#define GRID_DELTA_SHM_MAGIC 0x47444c54 /* "GDLT" */
+#define GRID_DELTA_SHM_VERSION 1
+
+/* Flags of a slot. */
+/* Every block of the grid changed, see GridDelta. */
+#define GRID_DELTA_SHM_FULL (1u << 0)
+/* More blocks changed than `maxBlocks`, none is listed. */
+#define GRID_DELTA_SHM_TRUNCATED (1u << 1)
+
+struct GridDeltaShmHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slotCount;
+  uint32_t slotSize;
+  uint32_t maxBlocks;
+  uint32_t reserved;
+  /* Number of deltas published. */
+  uint64_t writeCount;
+};
+
+struct GridDeltaShmSlot {
+  /* Odd while the slot is being written. */
+  uint64_t seq;
+  /* Number of the delta in the ring. */
+  uint64_t index;
+  /* See GridDelta. */
+  uint64_t generation;
+  uint64_t timestampNs;
+  int32_t size[3];
+  float resolution;
+  float origin[3];
+  int32_t blocks[3];
+  /* GRID_DELTA_SHM_* flags. */
+  uint32_t flags;
+  /* Number of blocks following. */
+  uint32_t count;
+};
+
+class GridDeltaShm {
+public:
+  /**
+   * Create the shared memory ring of grid deltas, for writing.
+   * @param name name of the POSIX shared memory object.
+   * @param slotCount number of deltas in the ring.
+   * @param maxBlocks maximum number of blocks of a delta.
+   * @param ret pointer to return the created object.
+   * @return 0 in case of success, negative errno in case of error.
+   */
+  static int create(const std::string &name, unsigned int slotCount,
+                    unsigned int maxBlocks, GridDeltaShm **ret);
+
+  /**
+   * Open an existing shared memory ring of grid deltas, for reading.
+   * @param name name of the POSIX shared memory object.
+   * @param ret pointer to return the created object.
+   * @return 0 in case of success, -ENOENT or -EAGAIN if the writer has not
+   *         created it yet, negative errno in case of error.
+   */
+  static int open(const std::string &name, GridDeltaShm **ret);
+
+  /* Unmap the shared memory, it is also removed for the writer. */
+  static void destroy(GridDeltaShm *self);
+
+  /**
+   * Publish a grid delta. A delta with more than `maxBlocks` blocks is
+   * published without its blocks, with GRID_DELTA_SHM_TRUNCATED.
+   * @param delta delta to publish.
+   * @return 0 in case of success, negative errno in case of error.
+   */
+  int publish(const GridDelta &delta);
+
+  /**
+   * Copy a delta of the ring.
+   * @param index number of the delta, from 0 to `getWriteCount() - 1`.
+   * @param slot pointer to return the delta.
+   * @param blocks buffer of at least `getMaxBlocks()` blocks.
+   * @return 0 in case of success, -ENOENT if the delta has not been
+   *         published yet, -ENODATA if it has been overwritten, -EAGAIN if
+   *         the writer kept overwriting the slot, negative errno in case of
+   *         error.
+   */
+  int read(uint64_t index, GridDeltaShmSlot *slot, GridBlock *blocks) const;
+
+  /* Number of deltas published. */
+  uint64_t getWriteCount() const {
+    return __atomic_load_n(&mHeader->writeCount, __ATOMIC_ACQUIRE);
+  }
+  unsigned int getMaxBlocks() const { return mHeader->maxBlocks; }
+
+private:
+  GridDeltaShm(const std::string &name, bool writer);
+  ~GridDeltaShm();
+  int map(int fd, size_t size);
+  GridDeltaShmSlot *getSlot(uint64_t index) const {
+    uint8_t *base = (uint8_t *)(mHeader + 1);
+    return (GridDeltaShmSlot *)(base +
+                                (index % mHeader->slotCount) *
+                                    mHeader->slotSize);
+  }
+
+  const std::string mName;
+  const bool mWriter;
+  void *mMap;
+  size_t mMapSize;
+  GridDeltaShmHeader *mHeader;
+};
@@ -0,0 +1,275 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "grid_snapshot.hpp"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ULOG_TAG spatial_perception
+#include <ulog.h>
+
+/* Offset of the voxels, a multiple of the cache line size. */
+#define GRID_SNAPSHOT_HEADER_SIZE                                              \
+  ((sizeof(GridSnapshotHeader) + 63) / 64 * 64)
+
+static uint64_t timeNowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int writeAll(int fd, const void *data, size_t size) {
+  const uint8_t *p = (const uint8_t *)data;
+
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -errno;
+    }
+    p += n;
+    size -= n;
+  }
+  return 0;
+}
+
+int writeGridSnapshot(const std::string &path, const OccupancyVolume &volume,
+                      uint64_t sequence, uint64_t timestampNs) {
+  uint8_t header[GRID_SNAPSHOT_HEADER_SIZE];
+  GridSnapshotHeader *h = (GridSnapshotHeader *)header;
+  std::string tmpPath = path + ".tmp";
+  int res;
+
+  if (volume.logodds.size() != volume.count())
+    return -EINVAL;
+
+  memset(header, 0, sizeof(header));
+  h->magic = GRID_SNAPSHOT_MAGIC;
+  h->version = GRID_SNAPSHOT_VERSION;
+  h->headerSize = sizeof(header);
+  h->sequence = sequence;
+  h->timestampNs = timestampNs;
+  for (int i = 0; i < 3; i++) {
+    h->size[i] = volume.size[i];
+    h->origin[i] = volume.origin[i];
+    h->center[i] = volume.center[i];
+  }
+  h->resolution = volume.resolution;
+  h->payloadSize = volume.count();
+
+  int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0644);
+  if (fd < 0)
+    return -errno;
+  res = writeAll(fd, header, sizeof(header));
+  if (res == 0)
+    res = writeAll(fd, volume.logodds.data(), volume.count());
+  if (close(fd) < 0 && res == 0)
+    res = -errno;
+  if (res == 0 && rename(tmpPath.c_str(), path.c_str()) < 0)
+    res = -errno;
+  if (res < 0)
+    unlink(tmpPath.c_str());
+  return res;
+}
+
+int readGridSnapshot(const std::string &path, OccupancyVolume *volume,
+                     GridSnapshotHeader *header) {
+  struct stat st;
+  void *map;
+  int res = 0;
+
+  if (volume == nullptr)
+    return -EINVAL;
+
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -errno;
+  if (fstat(fd, &st) < 0) {
+    res = -errno;
+    close(fd);
+    return res;
+  }
+  if ((size_t)st.st_size < sizeof(GridSnapshotHeader)) {
+    close(fd);
+    return -EPROTO;
+  }
+  map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return -errno;
+
+  const GridSnapshotHeader *h = (const GridSnapshotHeader *)map;
+  size_t count = (size_t)h->size[0] * h->size[1] * h->size[2];
+  if (h->magic != GRID_SNAPSHOT_MAGIC ||
+      h->version != GRID_SNAPSHOT_VERSION ||
+      h->headerSize < sizeof(GridSnapshotHeader) || h->size[0] <= 0 ||
+      h->size[1] <= 0 || h->size[2] <= 0 || h->resolution <= 0.f ||
+      h->payloadSize != count ||
+      (uint64_t)h->headerSize + h->payloadSize > (uint64_t)st.st_size) {
+    res = -EPROTO;
+    goto out;
+  }
+
+  for (int i = 0; i < 3; i++) {
+    volume->size[i] = h->size[i];
+    volume->origin[i] = h->origin[i];
+    volume->center[i] = h->center[i];
+  }
+  volume->resolution = h->resolution;
+  volume->logodds.assign((const int8_t *)map + h->headerSize,
+                         (const int8_t *)map + h->headerSize + count);
+  if (header != nullptr)
+    *header = *h;
+
+out:
+  munmap(map, st.st_size);
+  return res;
+}
+
+SnapshotRecorder::SnapshotRecorder(const Config &config)
+    : mConfig(config), mPendingSequence(0), mPendingTimestampNs(0),
+      mHasPending(false), mStopRequested(false), mSequence(0), mTokens(0.),
+      mRefillNs(0) {
+  memset(&mStats, 0, sizeof(mStats));
+}
+
+SnapshotRecorder::~SnapshotRecorder() { this->stop(); }
+
+int SnapshotRecorder::start() {
+  ULOG_ERRNO_RETURN_ERR_IF(mConfig.dir.empty(), EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(mConfig.bytesPerSecond == 0, EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(mThread.joinable(), EBUSY);
+
+  /* The first volume is recorded right away */
+  mTokens = -1.;
+  mRefillNs = timeNowNs();
+  mStopRequested = false;
+  mThread = std::thread(&SnapshotRecorder::writerThread, this);
+  return 0;
+}
+
+void SnapshotRecorder::stop() {
+  if (!mThread.joinable())
+    return;
+  mMutex.lock();
+  mStopRequested = true;
+  mCond.notify_one();
+  mMutex.unlock();
+  mThread.join();
+}
+
+int SnapshotRecorder::submit(const OccupancyVolume &volume,
+                             uint64_t timestampNs) {
+  std::unique_lock<std::mutex> lk(mMutex);
+  uint64_t sequence = mSequence++;
+  double size = GRID_SNAPSHOT_HEADER_SIZE + volume.count();
+
+  if (!mThread.joinable())
+    return -EPIPE;
+  if (volume.logodds.size() != volume.count())
+    return -EINVAL;
+  if (mConfig.maxSnapshots > 0 &&
+      mStats.recorded + (mHasPending ? 1 : 0) >= mConfig.maxSnapshots)
+    return -EAGAIN;
+  if (mHasPending) {
+    mStats.busy++;
+    return -EAGAIN;
+  }
+
+  /* The bucket holds a second of bandwidth, or a snapshot if it is
+   * larger */
+  uint64_t now = timeNowNs();
+  double capacity = std::max((double)mConfig.bytesPerSecond, size);
+  if (mTokens < 0.)
+    mTokens = capacity;
+  else
+    mTokens += (now - mRefillNs) * 1e-9 * mConfig.bytesPerSecond;
+  mTokens = std::min(mTokens, capacity);
+  mRefillNs = now;
+  if (mTokens < size) {
+    mStats.throttled++;
+    return -EAGAIN;
+  }
+  mTokens -= size;
+
+  mPending = volume;
+  mPendingSequence = sequence;
+  mPendingTimestampNs = timestampNs;
+  mHasPending = true;
+  mCond.notify_one();
+  return 0;
+}
+
+SnapshotRecorder::Stats SnapshotRecorder::getStats() {
+  std::lock_guard<std::mutex> lk(mMutex);
+  return mStats;
+}
+
+void SnapshotRecorder::writerThread() {
+  std::unique_lock<std::mutex> lk(mMutex);
+  OccupancyVolume volume;
+  char name[64];
+
+  while (true) {
+    mCond.wait(lk, [this] { return mStopRequested || mHasPending; });
+    if (!mHasPending)
+      break;
+
+    /* Write outside of the lock, `submit` only waits for the copy */
+    std::swap(volume, mPending);
+    uint64_t sequence = mPendingSequence;
+    uint64_t timestampNs = mPendingTimestampNs;
+    lk.unlock();
+
+    snprintf(name, sizeof(name), "/grid_%08llu" GRID_SNAPSHOT_EXTENSION,
+             (unsigned long long)sequence);
+    int res = writeGridSnapshot(mConfig.dir + name, volume, sequence,
+                                timestampNs);
+    if (res < 0)
+      ULOG_ERRNO("writeGridSnapshot('%s%s')", -res, mConfig.dir.c_str(), name);
+
+    lk.lock();
+    mHasPending = false;
+    if (res < 0)
+      mStats.failed++;
+    else
+      mStats.recorded++;
+  }
+}
@@ -0,0 +1,161 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+
+#include "occupancy_volume.hpp"
+
+/* Snapshot file of an occupancy volume: a `GridSnapshotHeader` followed by
+ * the log-odds of the voxels, x varying first. The voxels start at
+ * `headerSize`, a multiple of 64 bytes, so that a mapped file can be read in
+ * place. Fields are in the byte order of the drone, little endian. */
+
+#define GRID_SNAPSHOT_MAGIC 0x4e53474f /* "OGSN" */
+#define GRID_SNAPSHOT_VERSION 1
+#define GRID_SNAPSHOT_EXTENSION ".ogs"
+
+struct GridSnapshotHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t headerSize;
+  uint32_t reserved;
+  /* Number of the volume since the start of the recording, volumes which
+   * were not recorded leave gaps. */
+  uint64_t sequence;
+  /* Reception time of the grid, CLOCK_MONOTONIC [ns]. */
+  uint64_t timestampNs;
+  /* Geometry of the volume, see OccupancyVolume. */
+  int32_t size[3];
+  float resolution;
+  float origin[3];
+  float center[3];
+  /* Size of the voxels following the header [bytes]. */
+  uint64_t payloadSize;
+};
+
+/**
+ * Write a snapshot file. The file is written under a temporary name then
+ * renamed, a reader never sees a partial snapshot.
+ * @param path path of the snapshot file.
+ * @param volume voxels to write.
+ * @param sequence number of the grid.
+ * @param timestampNs reception time of the grid [ns].
+ * @return 0 in case of success, negative errno in case of error.
+ */
+int writeGridSnapshot(const std::string &path, const OccupancyVolume &volume,
+                      uint64_t sequence, uint64_t timestampNs);
+
+/**
+ * Read a snapshot file.
+ * @param path path of the snapshot file.
+ * @param volume pointer to return the voxels.
+ * @param header pointer to return the header, may be null.
+ * @return 0 in case of success, -EPROTO if the file is not a valid snapshot,
+ *         negative errno in case of error.
+ */
+int readGridSnapshot(const std::string &path, OccupancyVolume *volume,
+                     GridSnapshotHeader *header);
+
+/* Records volumes in snapshot files `<dir>/grid_<sequence>.ogs` from a
+ * background thread. Disk bandwidth is bounded by a token bucket: volumes
+ * arriving when the budget is spent are not recorded, nor are volumes
+ * arriving while the previous one is still being written. */
+class SnapshotRecorder {
+public:
+  struct Config {
+    /* Existing directory of the snapshot files. */
+    std::string dir;
+    /* Maximum write rate, on average [bytes/s]. */
+    uint64_t bytesPerSecond;
+    /* Maximum number of snapshots, no limit if 0. */
+    unsigned int maxSnapshots;
+  };
+
+  struct Stats {
+    /* Snapshots written. */
+    unsigned int recorded;
+    /* Volumes not recorded because of the bandwidth, because the previous
+     * one was still being written, or because of a write error. */
+    unsigned int throttled;
+    unsigned int busy;
+    unsigned int failed;
+  };
+
+  SnapshotRecorder(const Config &config);
+  ~SnapshotRecorder();
+
+  /* Start the writing thread. */
+  int start();
+  /* Write the pending snapshot, if any, and stop the writing thread. */
+  void stop();
+
+  /**
+   * Record a volume, if the bandwidth allows it. The volume is copied, the
+   * call never waits for the disk.
+   * @param volume voxels to record.
+   * @param timestampNs reception time of the grid [ns].
+   * @return 0 if the volume will be recorded, -EAGAIN if it is not recorded,
+   *         negative errno in case of error.
+   */
+  int submit(const OccupancyVolume &volume, uint64_t timestampNs);
+
+  Stats getStats();
+
+private:
+  void writerThread();
+
+  const Config mConfig;
+
+  /* All the following fields are protected by `mMutex`. */
+  std::mutex mMutex;
+  std::condition_variable mCond;
+  /* Snapshot waiting to be written. */
+  OccupancyVolume mPending;
+  uint64_t mPendingSequence;
+  uint64_t mPendingTimestampNs;
+  bool mHasPending;
+  bool mStopRequested;
+  /* Number of volumes submitted. */
+  uint64_t mSequence;
+  /* Token bucket of the bandwidth [bytes], and time of its last refill
+   * [ns]. */
+  double mTokens;
+  uint64_t mRefillNs;
+  Stats mStats;
+
+  std::thread mThread;
+};
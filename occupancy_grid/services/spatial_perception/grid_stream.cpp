@@ -0,0 +1,261 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "grid_stream.hpp"
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <string.h>
+
+#define ULOG_TAG spatial_perception
+#include <ulog.h>
+
+/* Voxels of a block. */
+#define BLOCK_VOXELS (GRID_STREAM_BITMAP_SIZE * 8)
+
+static void putVarint(std::vector<uint8_t> &payload, uint32_t value) {
+  while (value >= 0x80) {
+    payload.push_back((uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+  payload.push_back((uint8_t)value);
+}
+
+/* Runs of a bitmap, alternately free and obstacle starting with free,
+ * appended to `payload` unless they would take more than `maxSize` bytes.
+ * Return whether they were appended. */
+static bool putRuns(std::vector<uint8_t> &payload, const uint64_t *bitmap,
+                    size_t maxSize) {
+  size_t begin = payload.size();
+  uint32_t run = 0;
+  bool obstacle = false;
+
+  for (int i = 0; i < BLOCK_VOXELS; i++) {
+    bool bit = (bitmap[i / 64] >> (i % 64)) & 1;
+    if (bit != obstacle) {
+      putVarint(payload, run);
+      if (payload.size() - begin > maxSize) {
+        payload.resize(begin);
+        return false;
+      }
+      obstacle = bit;
+      run = 0;
+    }
+    run++;
+  }
+  putVarint(payload, run);
+  if (payload.size() - begin > maxSize) {
+    payload.resize(begin);
+    return false;
+  }
+  return true;
+}
+
+static void putBlock(std::vector<uint8_t> &payload, size_t gap,
+                     const uint64_t *bitmap) {
+  bool empty = true;
+  for (int z = 0; z < GRID_DELTA_BLOCK_SIZE; z++)
+    empty = empty && bitmap[z] == 0;
+
+  putVarint(payload, gap);
+  if (empty) {
+    payload.push_back(GRID_STREAM_EMPTY);
+    return;
+  }
+  payload.push_back(GRID_STREAM_RUNS);
+  if (putRuns(payload, bitmap, GRID_STREAM_BITMAP_SIZE))
+    return;
+  /* Bytes of the words in little-endian order, whatever the host */
+  payload.back() = GRID_STREAM_BITMAP;
+  for (int i = 0; i < GRID_STREAM_BITMAP_SIZE; i++)
+    payload.push_back((uint8_t)(bitmap[i / 8] >> (8 * (i % 8))));
+}
+
+GridStreamer::GridStreamer(const Config &config)
+    : mConfig(config), mBlocks{0, 0, 0}, mDifferCount(0), mOccupiedCount(0),
+      mKeyframeDue(true), mKeyframeId(0), mKeyframeNs(0), mBudget(0),
+      mBudgetNs(0) {
+  memset(&mStats, 0, sizeof(mStats));
+}
+
+void GridStreamer::reset(const GridDelta &delta) {
+  size_t count = delta.blockCount();
+
+  memcpy(mBlocks, delta.blocks, sizeof(mBlocks));
+  mBitmaps.assign(count * BLOCK_WORDS, 0);
+  mKeyBitmaps.assign(count * BLOCK_WORDS, 0);
+  mDiffers.assign(count, 0);
+  mDifferCount = 0;
+  mOccupiedCount = 0;
+  mKeyframeDue = true;
+}
+
+void GridStreamer::updateBlock(const OccupancyVolume &volume,
+                               const GridBlock &block) {
+  size_t index =
+      ((size_t)block.z * mBlocks[1] + block.y) * mBlocks[0] + block.x;
+  uint64_t *bitmap = &mBitmaps[index * BLOCK_WORDS];
+  const uint64_t *keyBitmap = &mKeyBitmaps[index * BLOCK_WORDS];
+  int begin[3] = {block.x * GRID_DELTA_BLOCK_SIZE,
+                  block.y * GRID_DELTA_BLOCK_SIZE,
+                  block.z * GRID_DELTA_BLOCK_SIZE};
+  int end[3];
+  bool wasOccupied = false, occupied = false, differs = false;
+
+  for (int i = 0; i < 3; i++)
+    end[i] = std::min(begin[i] + GRID_DELTA_BLOCK_SIZE, volume.size[i]);
+  for (int z = 0; z < GRID_DELTA_BLOCK_SIZE; z++) {
+    uint64_t word = 0;
+    for (int y = begin[1]; z + begin[2] < end[2] && y < end[1]; y++) {
+      const int8_t *row = &volume.logodds[volume.index(0, y, z + begin[2])];
+      uint64_t bits = 0;
+      for (int x = begin[0]; x < end[0]; x++)
+        bits |= (uint64_t)(row[x] >= mConfig.obstacleLogodd) << (x - begin[0]);
+      word |= bits << (8 * (y - begin[1]));
+    }
+    wasOccupied = wasOccupied || bitmap[z] != 0;
+    occupied = occupied || word != 0;
+    differs = differs || word != keyBitmap[z];
+    bitmap[z] = word;
+  }
+
+  mOccupiedCount += (size_t)occupied - (size_t)wasOccupied;
+  mDifferCount += (size_t)differs - (size_t)mDiffers[index];
+  mDiffers[index] = differs;
+}
+
+bool GridStreamer::refill(uint64_t nowNs) {
+  /* Clamped so that the arithmetic below cannot overflow */
+  int64_t capacity =
+      (int64_t)std::min(mConfig.bytesPerSecond, (uint64_t)INT64_MAX / 4);
+
+  /* The budget starts empty: a burst is only made of budget left unused
+   * since the first frame */
+  if (mBudgetNs == 0) {
+    mBudget = 0;
+  } else if (nowNs > mBudgetNs) {
+    double refill = (nowNs - mBudgetNs) * 1e-9 * capacity;
+    mBudget = (int64_t)std::min((double)(capacity - mBudget), refill) +
+              mBudget;
+  }
+  mBudgetNs = nowNs;
+  return mBudget >= 0;
+}
+
+void GridStreamer::encode(bool keyframe, Frame *frame) {
+  std::vector<uint8_t> &payload = frame->payload;
+  size_t count = mDiffers.size();
+  size_t previous = 0;
+  bool first = true;
+
+  payload.clear();
+  frame->blockCount = 0;
+  for (size_t index = 0; index < count; index++) {
+    const uint64_t *bitmap = &mBitmaps[index * BLOCK_WORDS];
+    bool listed;
+    if (keyframe) {
+      listed = false;
+      for (int z = 0; z < GRID_DELTA_BLOCK_SIZE; z++)
+        listed = listed || bitmap[z] != 0;
+    } else {
+      listed = mDiffers[index];
+    }
+    if (!listed)
+      continue;
+    putBlock(payload, first ? index : index - previous - 1, bitmap);
+    previous = index;
+    first = false;
+    frame->blockCount++;
+  }
+}
+
+int GridStreamer::update(const OccupancyVolume &volume,
+                         const GridDelta &delta, Frame *frame) {
+  ULOG_ERRNO_RETURN_ERR_IF(frame == nullptr, EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(volume.logodds.size() != volume.count(), EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(
+      memcmp(volume.size, delta.size, sizeof(delta.size)) != 0, EINVAL);
+
+  /* The blocks follow every grid, sent or not */
+  auto start = std::chrono::steady_clock::now();
+  if (delta.full || memcmp(mBlocks, delta.blocks, sizeof(mBlocks)) != 0)
+    reset(delta);
+  for (const GridBlock &block : delta.changed)
+    updateBlock(volume, block);
+
+  if (!refill(delta.timestampNs)) {
+    mStats.skipped++;
+    return -EAGAIN;
+  }
+
+  /* A delta with as many blocks as a keyframe is not worth it */
+  bool keyframe =
+      mKeyframeDue || (mDifferCount > 0 && mDifferCount >= mOccupiedCount) ||
+      delta.timestampNs - mKeyframeNs >=
+          (uint64_t)mConfig.keyframePeriodMs * 1000000;
+  if (keyframe) {
+    mKeyframeId++;
+    mKeyframeNs = delta.timestampNs;
+    mKeyframeDue = false;
+  }
+  encode(keyframe, frame);
+  if (keyframe) {
+    mKeyBitmaps = mBitmaps;
+    std::fill(mDiffers.begin(), mDiffers.end(), 0);
+    mDifferCount = 0;
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  frame->generation = delta.generation;
+  frame->timestampNs = delta.timestampNs;
+  memcpy(frame->size, delta.size, sizeof(frame->size));
+  frame->resolution = delta.resolution;
+  memcpy(frame->origin, delta.origin, sizeof(frame->origin));
+  frame->keyframe = keyframe;
+  frame->keyframeId = mKeyframeId;
+  frame->encodeUs =
+      std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+          .count();
+
+  mBudget -= frame->payload.size();
+  if (keyframe)
+    mStats.keyframes++;
+  else
+    mStats.deltas++;
+  mStats.rawBytes += volume.count();
+  mStats.encodedBytes += frame->payload.size();
+  mStats.encodeUsSum += frame->encodeUs;
+  mStats.encodeUsMax = std::max(mStats.encodeUsMax, frame->encodeUs);
+  if (mStats.firstNs == 0)
+    mStats.firstNs = delta.timestampNs;
+  mStats.lastNs = delta.timestampNs;
+  return 0;
+}
@@ -0,0 +1,176 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "grid_delta.hpp"
+#include "occupancy_volume.hpp"
+
+/* Tags of the blocks of a grid stream frame. */
+#define GRID_STREAM_EMPTY 0
+#define GRID_STREAM_BITMAP 1
+#define GRID_STREAM_RUNS 2
+
+/* Bytes of the bitmap of a block, one bit per voxel. */
+#define GRID_STREAM_BITMAP_SIZE                                                \
+  (GRID_DELTA_BLOCK_SIZE * GRID_DELTA_BLOCK_SIZE * GRID_DELTA_BLOCK_SIZE / 8)
+
+/* Encoder of the obstacles of the grids, for a low bandwidth link.
+ *
+ * The grids are cut in the blocks of GridDelta, only the blocks holding
+ * obstacles are sent. A keyframe gives all of them, a delta gives the
+ * blocks which differ from the last keyframe, so that a receiver only needs
+ * the last keyframe and the last delta, whatever the frames it lost in
+ * between. A keyframe is sent periodically, when the geometry of the grid
+ * changes, and instead of a delta which would not be smaller. Frames are
+ * skipped when the bandwidth budget is spent.
+ *
+ * The payload of a frame is the list of its blocks, by increasing index
+ * (x varying first, then y, then z). Each block is:
+ * - the gap from the index of the previous block, minus one, or the index
+ *   for the first block, as a varint;
+ * - a tag byte, then for
+ *   - GRID_STREAM_EMPTY: nothing, the block holds no more obstacles (deltas
+ *     only);
+ *   - GRID_STREAM_BITMAP: GRID_STREAM_BITMAP_SIZE bytes, byte 8 * z + y of
+ *     the block has bit x set for an obstacle voxel;
+ *   - GRID_STREAM_RUNS: the lengths of the runs of voxels, in the order of
+ *     the bitmap, alternately free and obstacle starting with free, as
+ *     varints summing to the voxels of a block.
+ * The voxels of a block out of the grid are free. Varints are little-endian
+ * base 128: 7 bits per byte, the high bit set on every byte but the last.
+ * The smaller of the bitmap and the runs is sent. */
+class GridStreamer {
+public:
+  struct Config {
+    /* Voxels with at least this log-odds are obstacles. */
+    int8_t obstacleLogodd;
+    /* Bandwidth budget of the stream [bytes/s]. A frame is sent once the
+     * previous ones are paid for, and budget left unused is kept up to a
+     * second of budget: from the first frame on, the stream sends at most
+     * the budget plus its last frame, in bursts of up to a second of
+     * budget after quieter periods. */
+    uint64_t bytesPerSecond;
+    /* Period of the keyframes [ms]. */
+    unsigned int keyframePeriodMs;
+  };
+
+  /* Encoded frame. */
+  struct Frame {
+    /* See GridDelta. */
+    uint64_t generation;
+    uint64_t timestampNs;
+    int size[3];
+    float resolution;
+    float origin[3];
+    /* Whether the frame is a keyframe, and the number of the keyframe it
+     * is, or the delta refers to. */
+    bool keyframe;
+    uint32_t keyframeId;
+    /* Blocks of the payload. */
+    uint32_t blockCount;
+    std::vector<uint8_t> payload;
+    /* Duration of the encoding [us]. */
+    uint64_t encodeUs;
+  };
+
+  struct Stats {
+    unsigned int keyframes;
+    unsigned int deltas;
+    /* Grids not sent because the budget was spent. */
+    unsigned int skipped;
+    /* Log-odds bytes of the grids sent, and bytes of their frames. */
+    uint64_t rawBytes;
+    uint64_t encodedBytes;
+    /* Encoding durations of the frames sent [us]. */
+    uint64_t encodeUsSum;
+    uint64_t encodeUsMax;
+    /* Reception times of the first and last grids sent [ns]. */
+    uint64_t firstNs;
+    uint64_t lastNs;
+  };
+
+  GridStreamer(const Config &config);
+
+  /**
+   * Update the blocks from the delta of a grid, and encode a frame if the
+   * budget allows it.
+   * @param volume voxels of the grid.
+   * @param delta delta of the grid since the previous one.
+   * @param frame frame to fill.
+   * @return 0 if a frame was encoded, -EAGAIN if the budget is spent,
+   *         negative errno in case of error.
+   */
+  int update(const OccupancyVolume &volume, const GridDelta &delta,
+             Frame *frame);
+
+  const Config &getConfig() const { return mConfig; }
+  const Stats &getStats() const { return mStats; }
+
+private:
+  static constexpr int BLOCK_WORDS = GRID_DELTA_BLOCK_SIZE;
+
+  void reset(const GridDelta &delta);
+  void updateBlock(const OccupancyVolume &volume, const GridBlock &block);
+  bool refill(uint64_t nowNs);
+  void encode(bool keyframe, Frame *frame);
+
+  const Config mConfig;
+
+  /* Geometry of the grids, in blocks. */
+  int mBlocks[3];
+  /* Obstacles of each block of the latest grid and of the last keyframe,
+   * a 64 bits word per z of the block, bit 8 * y + x. */
+  std::vector<uint64_t> mBitmaps;
+  std::vector<uint64_t> mKeyBitmaps;
+  /* Whether a block differs from the last keyframe, and the number of such
+   * blocks and of the blocks holding obstacles. */
+  std::vector<uint8_t> mDiffers;
+  size_t mDifferCount;
+  size_t mOccupiedCount;
+
+  /* Whether a keyframe shall be sent, the number and the time of the last
+   * one [ns]. */
+  bool mKeyframeDue;
+  uint32_t mKeyframeId;
+  uint64_t mKeyframeNs;
+
+  /* Budget left [bytes], negative until the last frame is paid for, and
+   * time of its last refill [ns]. */
+  int64_t mBudget;
+  uint64_t mBudgetNs;
+
+  Stats mStats;
+};
@@ -2,6 +2,7 @@
  * Copyright (C) 2023 parrot
  */
 
+#include <cmath>
 #include <csignal>
 #include <string>
 
@@ -16,6 +17,14 @@ ULOG_DECLARE_TAG(ULOG_TAG);
 
 #include "spatial_perception.hpp"
 
+/* Messages exchanged with the other components of the mission */
+#include <samples/occupancy_grid/spatial_perception/messages.msghub.h>
+#include <samples/occupancy_grid/spatial_perception/messages.pb.h>
+
+#define MSGHUB_ADDR "unix:/tmp/occupancy-grid-spatial-perception"
+
+namespace messages = ::samples::occupancy_grid::spatial_perception::messages;
+
 /* The grid provider name. */
 static const std::string GRID_PROVIDER_NAME = "default.grid";
 /* The grid server address */
@@ -25,53 +34,383 @@ sig_atomic_t run = 1;
 
 /*
  * Context inherits from SpatialPerceptionClient so it can get informed
- * when the occupation grid is available.
+ * when the occupation grid is available, and answers the path requests of
+ * the message hub.
  */
-class Context : public SpatialPerception::Client, public pomp::Timer::Handler {
+class Context : public SpatialPerception::Client,
+                public messages::msghub::CommandHandler,
+                public messages::msghub::EventSender {
 private:
   /* Main loop of the program. */
   pomp::Loop mLoop;
-  /* Timer to periodically query grid density. */
-  pomp::Timer mTimer;
   /* The spatial perception client */
   SpatialPerception mSpatialPerception;
+  /* The message hub and its server channel. */
+  msghub::MessageHub mMessageHub;
+  msghub::Channel *mChannel;
 
-  static constexpr uint32_t TIMER_INITAL_DELAY = 1000; /* ms */
-  static constexpr uint32_t TIMER_PERIOD = 1000;       /* ms */
+  /* Grids are analysed as they are received, at most 5 times per second,
+   * and within 100 ms of their reception. */
+  static constexpr unsigned int ANALYSIS_MIN_INTERVAL = 200; /* ms */
+  static constexpr unsigned int ANALYSIS_MAX_LATENCY = 100;  /* ms */
 
+  /* Densities of the near, mid and far shells around the drone, for
+   * likely and almost certain obstacles, computed as a single batch. */
   static constexpr int8_t GRID_OCCUPATION_LOGODD = 1;
+  static constexpr int8_t GRID_OBSTACLE_LOGODD = 3;
   static constexpr float GRID_STEP_DISTANCE = 1.2; /* meters */
+  static constexpr float GRID_MID_DISTANCE = 3.0;  /* meters */
+  static constexpr float GRID_FAR_DISTANCE = 6.0;  /* meters */
+
+  std::vector<DensityQuery> mDensityQueries;
+
+  /* Distance field of the almost certain obstacles, shared with the other
+   * services of the mission. */
+  static constexpr const char *DISTANCE_FIELD_SHM_NAME =
+      "/spatial_perception_distance_field";
+  static constexpr size_t DISTANCE_FIELD_MAX_VOXELS = 2 * 1024 * 1024;
+  static constexpr float DISTANCE_FIELD_MAX_DISTANCE = 5.0; /* meters */
+
+  /* Blocks of 8x8x8 voxels which changed since the previous grid, shared
+   * with the other services of the mission in a ring of 8 deltas. A grid of
+   * DISTANCE_FIELD_MAX_VOXELS voxels has 4096 blocks. */
+  static constexpr const char *GRID_DELTA_SHM_NAME =
+      "/spatial_perception_grid_delta";
+  static constexpr unsigned int GRID_DELTA_SHM_SLOT_COUNT = 8;
+  static constexpr unsigned int GRID_DELTA_SHM_MAX_BLOCKS =
+      DISTANCE_FIELD_MAX_VOXELS / 512;
+
+  /* Obstacles of the grids streamed to the ground on request, with a
+   * keyframe every 2 seconds. */
+  static constexpr unsigned int GRID_STREAM_KEYFRAME_PERIOD = 2000; /* ms */
+
+  /* Frontiers of the observed free space, clustered into the 8 best goals
+   * for exploration within 2 ms of each grid. A goal 5 m away counts as
+   * half as many frontier voxels as one next to the drone. */
+  static constexpr int8_t FRONTIER_FREE_LOGODD = -1;
+  static constexpr unsigned int FRONTIER_MIN_CLUSTER_VOXELS = 8;
+  static constexpr unsigned int FRONTIER_MAX_GOALS = 8;
+  static constexpr float FRONTIER_DISTANCE_COST = 0.2; /* 1/m */
+  static constexpr size_t FRONTIER_MAX_VOXELS = 64 * 1024;
+  static constexpr unsigned int FRONTIER_BUDGET = 2000; /* us */
+
+  /* Clearance ring of 32 directions on 3 elevations, cast on every grid
+   * within 5 ms. The 96 rays take tens of microseconds, a single thread is
+   * enough. */
+  static constexpr const char *CLEARANCE_TLM_SECTION =
+      "airsdk@occupancy_grid@clearance";
+  static constexpr unsigned int CLEARANCE_AZIMUTH_COUNT = 32;
+  static constexpr float CLEARANCE_MAX_RANGE = 10.0; /* meters */
+  static constexpr unsigned int CLEARANCE_THREAD_COUNT = 1;
+  static constexpr unsigned int CLEARANCE_BUDGET = 5000; /* us */
+
+  /* Pyramid of 4 levels of the almost certain obstacles, used to check the
+   * corridor below the drone, 2 m long and 0.6 m wide. */
+  static constexpr unsigned int PYRAMID_LEVEL_COUNT = 4;
+  static constexpr unsigned int PYRAMID_THREAD_COUNT = 1;
+  static constexpr float LANDING_CORRIDOR_LENGTH = 2.0; /* meters */
+  static constexpr float LANDING_CORRIDOR_RADIUS = 0.3; /* meters */
+
+  /* Paths are planned on cells of 2x2x2 voxels for a drone of 0.5 m with
+   * its margin, in 20 ms by default and at most 100 ms, which delay the
+   * analyses of the grids as much. Level 1 of a grid of
+   * DISTANCE_FIELD_MAX_VOXELS voxels has 256 K cells, a little more when
+   * the grid has odd sizes: the planner allocates twice as much up front and
+   * refuses larger grids. */
+  static constexpr unsigned int PLANNER_LEVEL = 1;
+  static constexpr float PLANNER_RADIUS = 0.5; /* meters */
+  static constexpr size_t PLANNER_MAX_CELLS = DISTANCE_FIELD_MAX_VOXELS / 4;
+  static constexpr size_t PLANNER_MAX_OPEN_NODES = 64 * 1024;
+  static constexpr unsigned int PLANNER_DEFAULT_BUDGET = 20000; /* us */
+  static constexpr unsigned int PLANNER_MAX_BUDGET = 100000;    /* us */
+
+  /* Snapshots are recorded at up to 2 MiB/s, a few grids per second, and
+   * replayed at 5 grids per second. */
+  static constexpr uint64_t RECORD_BANDWIDTH = 2 * 1024 * 1024; /* bytes/s */
+  static constexpr unsigned int RECORD_MAX_SNAPSHOTS = 1000;
+  static constexpr unsigned int REPLAY_PERIOD = 200; /* ms */
 
 public:
   Context()
-      : mTimer(&this->mLoop, this),
-        mSpatialPerception(&this->mLoop, this, GRID_SERVER_ADDR,
-                           GRID_PROVIDER_NAME) {}
+      : mSpatialPerception(&this->mLoop, this, GRID_SERVER_ADDR,
+                           GRID_PROVIDER_NAME),
+        mMessageHub(&this->mLoop, nullptr), mChannel(nullptr) {
+    for (float distance :
+         {GRID_STEP_DISTANCE, GRID_MID_DISTANCE, GRID_FAR_DISTANCE}) {
+      mDensityQueries.push_back({GRID_OCCUPATION_LOGODD, distance});
+      mDensityQueries.push_back({GRID_OBSTACLE_LOGODD, distance});
+    }
+  }
 
   inline void wakeup() { this->mLoop.wakeup(); }
   inline void waitAndProcess(int timeout) {
     this->mLoop.waitAndProcess(timeout);
   }
 
-  inline int start() { return this->mSpatialPerception.start(); }
+  /* Grids are read from the snapshots of `replayDir` instead of the
+   * occupation grid server if not null, and recorded in `recordDir` if not
+   * null. Their obstacles are streamed on the message hub if
+   * `streamBytesPerSecond` is not 0. */
+  inline int start(const char *replayDir, const char *recordDir,
+                   uint64_t streamBytesPerSecond) {
+    SpatialPerception::DistanceFieldConfig config = {
+        .shmName = DISTANCE_FIELD_SHM_NAME,
+        .shmMaxVoxels = DISTANCE_FIELD_MAX_VOXELS,
+        .obstacleLogodd = GRID_OBSTACLE_LOGODD,
+        .maxDistance = DISTANCE_FIELD_MAX_DISTANCE,
+    };
+    int res = this->mSpatialPerception.enableDistanceField(config);
+    if (res < 0)
+      return res;
+    SpatialPerception::GridDeltaConfig deltaConfig = {
+        .shmName = GRID_DELTA_SHM_NAME,
+        .shmSlotCount = GRID_DELTA_SHM_SLOT_COUNT,
+        .shmMaxBlocks = GRID_DELTA_SHM_MAX_BLOCKS,
+        .obstacleLogodd = GRID_OBSTACLE_LOGODD,
+    };
+    res = this->mSpatialPerception.enableGridDelta(deltaConfig);
+    if (res < 0)
+      return res;
+    if (streamBytesPerSecond > 0) {
+      GridStreamer::Config streamConfig = {
+          .obstacleLogodd = GRID_OBSTACLE_LOGODD,
+          .bytesPerSecond = streamBytesPerSecond,
+          .keyframePeriodMs = GRID_STREAM_KEYFRAME_PERIOD,
+      };
+      res = this->mSpatialPerception.enableStreaming(streamConfig);
+      if (res < 0)
+        return res;
+    }
+    FrontierMap::Config frontierConfig = {
+        .freeLogodd = FRONTIER_FREE_LOGODD,
+        .minClusterVoxels = FRONTIER_MIN_CLUSTER_VOXELS,
+        .maxGoals = FRONTIER_MAX_GOALS,
+        .distanceCost = FRONTIER_DISTANCE_COST,
+        .maxFrontierVoxels = FRONTIER_MAX_VOXELS,
+        .budgetUs = FRONTIER_BUDGET,
+    };
+    res = this->mSpatialPerception.enableFrontiers(frontierConfig);
+    if (res < 0)
+      return res;
+    SpatialPerception::AutoAnalysisConfig analysisConfig = {
+        .queries = mDensityQueries,
+        .minIntervalMs = ANALYSIS_MIN_INTERVAL,
+        .maxLatencyMs = ANALYSIS_MAX_LATENCY,
+    };
+    res = this->mSpatialPerception.enableAutoAnalysis(analysisConfig);
+    if (res < 0)
+      return res;
+    ClearanceRing::Config clearanceConfig = {
+        .azimuthCount = CLEARANCE_AZIMUTH_COUNT,
+        .elevations = {-20.f, 0.f, 20.f},
+        .maxRange = CLEARANCE_MAX_RANGE,
+        .obstacleLogodd = GRID_OBSTACLE_LOGODD,
+        .unknownIsObstacle = false,
+        .threadCount = CLEARANCE_THREAD_COUNT,
+        .batchSize = 0,
+        .budgetUs = CLEARANCE_BUDGET,
+    };
+    res = this->mSpatialPerception.enableClearance(clearanceConfig,
+                                                   CLEARANCE_TLM_SECTION);
+    if (res < 0)
+      return res;
+    OccupancyPyramid::Config pyramidConfig = {
+        .levelCount = PYRAMID_LEVEL_COUNT,
+        .obstacleLogodd = GRID_OBSTACLE_LOGODD,
+        .unknownIsObstacle = false,
+        .threadCount = PYRAMID_THREAD_COUNT,
+    };
+    res = this->mSpatialPerception.enablePyramid(pyramidConfig);
+    if (res < 0)
+      return res;
+    PathPlanner::Config plannerConfig = {
+        .level = PLANNER_LEVEL,
+        .radius = PLANNER_RADIUS,
+        .maxCells = PLANNER_MAX_CELLS,
+        .maxOpenNodes = PLANNER_MAX_OPEN_NODES,
+        .defaultBudgetUs = PLANNER_DEFAULT_BUDGET,
+        .maxBudgetUs = PLANNER_MAX_BUDGET,
+    };
+    res = this->mSpatialPerception.enablePlanner(plannerConfig);
+    if (res < 0)
+      return res;
+    if (replayDir != nullptr) {
+      res = this->mSpatialPerception.enableReplay(replayDir, REPLAY_PERIOD,
+                                                  true);
+      if (res < 0)
+        return res;
+    }
+    if (recordDir != nullptr) {
+      SnapshotRecorder::Config recorderConfig = {
+          .dir = recordDir,
+          .bytesPerSecond = RECORD_BANDWIDTH,
+          .maxSnapshots = RECORD_MAX_SNAPSHOTS,
+      };
+      res = this->mSpatialPerception.enableRecording(recorderConfig);
+      if (res < 0)
+        return res;
+    }
+    res = this->mSpatialPerception.start();
+    if (res < 0)
+      return res;
+
+    mChannel =
+        mMessageHub.startServerChannel(pomp::Address(MSGHUB_ADDR), 0666);
+    if (mChannel == nullptr) {
+      ULOGE("Failed to start server channel on '%s'", MSGHUB_ADDR);
+      return -EPERM;
+    }
+    mMessageHub.attachMessageHandler(this);
+    mMessageHub.attachMessageSender(this, mChannel);
+    return 0;
+  }
+  inline void stop() {
+    mMessageHub.detachMessageSender(this);
+    mMessageHub.detachMessageHandler(this);
+    mMessageHub.stop();
+    mChannel = nullptr;
+    this->mSpatialPerception.stop();
+  }
 
   /*
    * SpatialPerceptionClient override
    */
   virtual void onSpatialPerceptionReady() override {
     ULOGI("onSpatialPerceptionReady");
-    /* once at least a grid is available schedule a periodic timer to
-     * query the occupation grid density */
-    this->mTimer.setPeriodic(TIMER_INITAL_DELAY, TIMER_PERIOD);
   }
 
-  virtual void processTimer() override {
-    if (this->mSpatialPerception.isReady() == false)
+  /* The densities are computed by the analysis thread of the spatial
+   * perception from each new grid, the loop only gets the results */
+  virtual void onAnalysisResult(
+      const SpatialPerception::AnalysisResult &result) override {
+    ULOGI("grid %llu analysed, %llu us after its reception",
+          (unsigned long long)result.generation,
+          (unsigned long long)result.latencyUs);
+    for (size_t i = 0; i < result.queries.size(); i++) {
+      ULOGI("occupation density %f (logodd %d, distance %.1f m)",
+            result.densities[i], result.queries[i].logodd,
+            result.queries[i].distance);
+    }
+    if (!std::isnan(result.obstacleDistance))
+      ULOGI("nearest obstacle %.2f m", result.obstacleDistance);
+    checkLandingCorridor(result);
+  }
+
+  /*
+   * CommandHandler override
+   */
+  virtual void planPath(const messages::PathRequest &args) override {
+    PathPlanner::Request request{};
+    request.id = args.id();
+    request.budgetUs = args.budget_us();
+    request.start[0] = args.start().x();
+    request.start[1] = args.start().y();
+    request.start[2] = args.start().z();
+    request.goal[0] = args.goal().x();
+    request.goal[1] = args.goal().y();
+    request.goal[2] = args.goal().z();
+
+    /* A request which cannot be planned is answered right away */
+    int res = this->mSpatialPerception.requestPath(request);
+    if (res == 0)
       return;
-    const moser::IGrid &grid = this->mSpatialPerception.getGrid();
-    const float density = grid.getObstacleDensityRatio(GRID_OCCUPATION_LOGODD,
-                                                       GRID_STEP_DISTANCE);
-    ULOGI("occupation density %f", density);
+    ULOG_ERRNO("SpatialPerception::requestPath", -res);
+    messages::Path message;
+    message.set_id(args.id());
+    message.set_status(res == -EBUSY ? messages::PATH_STATUS_BUSY
+                                     : messages::PATH_STATUS_NO_GRID);
+    message.set_remaining(NAN);
+    this->path(message);
+  }
+
+  virtual void onPathResult(const PathPlanner::Result &result) override {
+    messages::Path message;
+
+    ULOGI("path %u: status %d, %zu waypoints, %.1f m, %.1f m from the goal, "
+          "%llu us, %u nodes expanded",
+          result.id, result.status, result.waypoints.size(), result.length,
+          result.remaining, (unsigned long long)result.planningUs,
+          result.expandedNodes);
+    message.set_id(result.id);
+    /* The values of PathStatus and of the message are the same */
+    message.set_status((messages::PathStatus)result.status);
+    for (const PathPlanner::Waypoint &waypoint : result.waypoints) {
+      messages::Position *position = message.add_waypoints();
+      position->set_x(waypoint.x);
+      position->set_y(waypoint.y);
+      position->set_z(waypoint.z);
+    }
+    message.set_length(result.length);
+    message.set_remaining(result.remaining);
+    message.set_planning_us(result.planningUs);
+    message.set_expanded_nodes(result.expandedNodes);
+    message.set_grid_generation(result.generation);
+    this->path(message);
+  }
+
+  virtual void onGridFrame(const GridStreamer::Frame &frame) override {
+    messages::GridFrame message;
+
+    if (frame.keyframe) {
+      ULOGI("grid keyframe %u: %u blocks, %zu bytes, encoded in %llu us",
+            frame.keyframeId, frame.blockCount, frame.payload.size(),
+            (unsigned long long)frame.encodeUs);
+    }
+    message.set_grid_generation(frame.generation);
+    message.set_timestamp_ns(frame.timestampNs);
+    message.set_keyframe(frame.keyframe);
+    message.set_keyframe_id(frame.keyframeId);
+    message.set_size_x(frame.size[0]);
+    message.set_size_y(frame.size[1]);
+    message.set_size_z(frame.size[2]);
+    message.set_resolution(frame.resolution);
+    message.mutable_origin()->set_x(frame.origin[0]);
+    message.mutable_origin()->set_y(frame.origin[1]);
+    message.mutable_origin()->set_z(frame.origin[2]);
+    message.set_block_count(frame.blockCount);
+    message.set_blocks(frame.payload.data(), frame.payload.size());
+    this->gridFrame(message);
+  }
+
+  virtual void onFrontierGoals(const FrontierMap::Result &result) override {
+    messages::Frontiers message;
+
+    if (!result.goals.empty()) {
+      const FrontierMap::Goal &goal = result.goals[0];
+      ULOGD("frontier goal (%.1f, %.1f, %.1f), %u voxels %.1f m away",
+            goal.position[0], goal.position[1], goal.position[2],
+            goal.voxels, goal.distance);
+    }
+    message.set_grid_generation(result.generation);
+    for (const FrontierMap::Goal &goal : result.goals) {
+      messages::FrontierGoal *frontier = message.add_goals();
+      frontier->mutable_position()->set_x(goal.position[0]);
+      frontier->mutable_position()->set_y(goal.position[1]);
+      frontier->mutable_position()->set_z(goal.position[2]);
+      frontier->set_distance(goal.distance);
+      frontier->set_voxels(goal.voxels);
+      frontier->set_score(goal.score);
+    }
+    message.set_frontier_voxels(result.frontierVoxels);
+    message.set_clusters(result.clusters);
+    message.set_complete(result.pendingBlocks == 0 && result.clustered);
+    message.set_extraction_us(result.extractUs);
+    this->frontiers(message);
+  }
+
+  /* The grid is NED, the corridor goes down from the drone. */
+  void checkLandingCorridor(const SpatialPerception::AnalysisResult &result) {
+    const float *from = result.position;
+    float to[3] = {from[0], from[1], from[2] + LANDING_CORRIDOR_LENGTH};
+    bool collides;
+
+    if (std::isnan(from[0]))
+      return;
+    int res = this->mSpatialPerception.checkCorridor(
+        from, to, LANDING_CORRIDOR_RADIUS, &collides);
+    if (res < 0)
+      return;
+    ULOGI("landing corridor %s", collides ? "obstructed" : "clear");
   }
 };
 /*
@@ -87,8 +426,17 @@ extern "C" void sig_handler(int signum) {
   s_ctx.wakeup();
 }
 
+static void usage(const char *progname) {
+  ULOGE("usage: %s [-r replay_dir] [-w record_dir] [-s stream_bytes_per_s]",
+        progname);
+}
+
 int main(int argc, char *argv[]) {
   int res;
+  int opt;
+  const char *replayDir = nullptr;
+  const char *recordDir = nullptr;
+  uint64_t streamBytesPerSecond = 0;
   /* Initialisation code
    *
    * The service is automatically started by the drone when the mission is
@@ -97,8 +445,27 @@ int main(int argc, char *argv[]) {
   ULOGI("Hello from spatial_perception");
   signal(SIGTERM, sig_handler);
 
+  /* The mission starts the service without options, they are given by hand
+   * to record grids, to replay them or to stream them to the ground */
+  while ((opt = getopt(argc, argv, "r:w:s:")) != -1) {
+    switch (opt) {
+    case 'r':
+      replayDir = optarg;
+      break;
+    case 'w':
+      recordDir = optarg;
+      break;
+    case 's':
+      streamBytesPerSecond = strtoull(optarg, nullptr, 10);
+      break;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
   /* Initialize and start context */
-  res = s_ctx.start();
+  res = s_ctx.start(replayDir, recordDir, streamBytesPerSecond);
   if (res != 0) {
     ULOGE("Error while starting spatial perception client");
     return res;
@@ -125,5 +492,6 @@ int main(int argc, char *argv[]) {
    * written data is coherent).
    */
   ULOGI("Cleaning up from spatial_perception");
+  s_ctx.stop();
   return res == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
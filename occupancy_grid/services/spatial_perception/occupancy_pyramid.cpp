@@ -0,0 +1,476 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "occupancy_pyramid.hpp"
+#include <algorithm>
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+OccupancyPyramid::OccupancyPyramid(const Config &config)
+    : mConfig(config), mOrigin{0.f, 0.f, 0.f}, mResolution(0.f),
+      mVolume(nullptr), mBuildLevel(0), mNextSlab(0), mGeneration(0),
+      mBusyWorkers(0), mStopRequested(false) {}
+
+OccupancyPyramid::~OccupancyPyramid() { this->stop(); }
+
+int OccupancyPyramid::start() {
+  unsigned int threadCount = mConfig.threadCount > 0 ? mConfig.threadCount : 1;
+
+  if (mConfig.levelCount < PYRAMID_MIN_LEVELS ||
+      mConfig.levelCount > PYRAMID_MAX_LEVELS ||
+      mConfig.obstacleLogodd == OCCUPANCY_UNKNOWN ||
+      threadCount > PYRAMID_MAX_THREADS)
+    return -EINVAL;
+  if (!mWorkers.empty())
+    return -EBUSY;
+
+  mStopRequested = false;
+  /* Workers wait for the builds after the current generation, even if they
+   * start running after the first one */
+  for (unsigned int i = 1; i < threadCount; i++)
+    mWorkers.emplace_back(&OccupancyPyramid::workerThread, this, mGeneration);
+  return 0;
+}
+
+void OccupancyPyramid::stop() {
+  mMutex.lock();
+  mStopRequested = true;
+  mCond.notify_all();
+  mMutex.unlock();
+  for (auto &worker : mWorkers)
+    worker.join();
+  mWorkers.clear();
+}
+
+/* Bits of 4 voxels, 0 or 1 in each byte, packed into 4 consecutive bits. */
+static inline uint64_t packNibble(const uint8_t *occupied) {
+  uint32_t four;
+  memcpy(&four, occupied, sizeof(four));
+  return ((four * 0x01020408u) >> 24) & 0xf;
+}
+
+/* Bricks of level 0 with z in [4 * slab, 4 * slab + 3], from the voxels. */
+void OccupancyPyramid::buildBaseSlab(int slab) {
+  const OccupancyVolume &volume = *mVolume;
+  Level &level = mLevels[0];
+  const int8_t obstacle = mConfig.obstacleLogodd;
+  const int8_t unknown =
+      mConfig.unknownIsObstacle ? OCCUPANCY_UNKNOWN : obstacle;
+  const int width = level.size[0];
+  size_t sliceWords = (size_t)level.bricks[0] * level.bricks[1];
+  uint64_t *words = level.words.data() + slab * sliceWords;
+
+  std::fill(words, words + sliceWords, 0);
+  for (int z = slab * 4; z < std::min(slab * 4 + 4, level.size[2]); z++) {
+    for (int y = 0; y < level.size[1]; y++) {
+      const int8_t *row = volume.logodds.data() + volume.index(0, y, z);
+      uint64_t *brickRow = words + (size_t)(y >> 2) * level.bricks[0];
+      int shift = bitIndex(0, y, z);
+      uint8_t occupied[16];
+
+      /* Blocks of 16 voxels compared without branches, which the compiler
+       * vectorises, then packed 4 at a time into 4 consecutive bits of
+       * their brick */
+      int x = 0;
+      for (; x + 16 <= width; x += 16) {
+        for (int i = 0; i < 16; i++)
+          occupied[i] = (row[x + i] >= obstacle) | (row[x + i] == unknown);
+        for (int i = 0; i < 4; i++)
+          brickRow[(x >> 2) + i] |= packNibble(occupied + i * 4) << shift;
+      }
+      for (; x < width; x += 4) {
+        memset(occupied, 0, 4);
+        for (int i = 0; i < 4 && x + i < width; i++)
+          occupied[i] = (row[x + i] >= obstacle) | (row[x + i] == unknown);
+        brickRow[x >> 2] |= packNibble(occupied) << shift;
+      }
+    }
+  }
+}
+
+/* Max-pool the 4x4x4 cells of a brick into 2x2x2 cells, returned at the
+ * bits of the first 2x2x2 cells of a brick. */
+static inline uint64_t poolBrick(uint64_t w) {
+  /* OR along x, y and z: the bits of the cells with even coordinates then
+   * hold the pooled cells */
+  w |= w >> 1;
+  w |= w >> 4;
+  w |= w >> 16;
+  /* Halve their coordinates, along x, y then z */
+  w = (w & 0x0000010100000101ull) | ((w & 0x0000040400000404ull) >> 1);
+  w = (w & 0x0000000300000003ull) | ((w & 0x0000030000000300ull) >> 4);
+  return (w & 0x33ull) | ((w & 0x0000003300000000ull) >> 16);
+}
+
+/* Bricks of a level with z in [4 * slab, 4 * slab + 3], from the 2x2x2
+ * bricks of the level below covering each of them. */
+void OccupancyPyramid::buildPooledSlab(unsigned int levelIndex, int slab) {
+  Level &level = mLevels[levelIndex];
+  const Level &child = mLevels[levelIndex - 1];
+
+  for (int by = 0; by < level.bricks[1]; by++) {
+    for (int bx = 0; bx < level.bricks[0]; bx++) {
+      uint64_t word = 0;
+      for (int cz = 0; cz < 2; cz++) {
+        int z = slab * 2 + cz;
+        for (int cy = 0; cy < 2; cy++) {
+          int y = by * 2 + cy;
+          for (int cx = 0; cx < 2; cx++) {
+            int x = bx * 2 + cx;
+            if (x >= child.bricks[0] || y >= child.bricks[1] ||
+                z >= child.bricks[2])
+              continue;
+            uint64_t w =
+                child.words[((size_t)z * child.bricks[1] + y) *
+                                child.bricks[0] +
+                            x];
+            if (w == 0)
+              continue;
+            word |= poolBrick(w) << bitIndex(cx * 2, cy * 2, cz * 2);
+          }
+        }
+      }
+      level.words[((size_t)slab * level.bricks[1] + by) * level.bricks[0] +
+                  bx] = word;
+    }
+  }
+}
+
+void OccupancyPyramid::buildSlabs() {
+  const int slabCount = mLevels[mBuildLevel].bricks[2];
+
+  while (true) {
+    int slab = mNextSlab.fetch_add(1, std::memory_order_relaxed);
+    if (slab >= slabCount)
+      break;
+    if (mBuildLevel == 0)
+      buildBaseSlab(slab);
+    else
+      buildPooledSlab(mBuildLevel, slab);
+  }
+}
+
+void OccupancyPyramid::workerThread(uint64_t generation) {
+  std::unique_lock<std::mutex> lk(mMutex);
+
+  while (true) {
+    mCond.wait(lk, [&] {
+      return mStopRequested || mGeneration != generation;
+    });
+    if (mStopRequested)
+      break;
+    generation = mGeneration;
+
+    lk.unlock();
+    buildSlabs();
+    lk.lock();
+
+    if (--mBusyWorkers == 0)
+      mDoneCond.notify_one();
+  }
+}
+
+/* Build a level with the workers, the levels below shall be built. */
+int OccupancyPyramid::runLevel(unsigned int level) {
+  std::unique_lock<std::mutex> lk(mMutex);
+  if (mStopRequested)
+    return -EPIPE;
+  mBuildLevel = level;
+  mNextSlab.store(0, std::memory_order_relaxed);
+  mBusyWorkers = mWorkers.size();
+  mGeneration++;
+  mCond.notify_all();
+  lk.unlock();
+
+  /* The calling thread takes its share of the slabs */
+  buildSlabs();
+
+  lk.lock();
+  mDoneCond.wait(lk, [this] { return mBusyWorkers == 0; });
+  return 0;
+}
+
+int OccupancyPyramid::build(const OccupancyVolume &volume) {
+  if (volume.resolution <= 0.f || volume.size[0] <= 0 ||
+      volume.size[1] <= 0 || volume.size[2] <= 0 ||
+      volume.logodds.size() != volume.count())
+    return -EINVAL;
+
+  mResolution = 0.f;
+  for (unsigned int l = 0; l < mConfig.levelCount; l++) {
+    Level &level = mLevels[l];
+    size_t wordCount = 1;
+    for (int i = 0; i < 3; i++) {
+      level.size[i] = ((volume.size[i] - 1) >> l) + 1;
+      level.bricks[i] = (level.size[i] + 3) / 4;
+      wordCount *= level.bricks[i];
+    }
+    /* Every word is written by the build, only grow the storage */
+    level.words.resize(wordCount);
+  }
+
+  mVolume = &volume;
+  for (unsigned int l = 0; l < mConfig.levelCount; l++) {
+    int res = runLevel(l);
+    if (res < 0) {
+      mVolume = nullptr;
+      return res;
+    }
+  }
+  mVolume = nullptr;
+
+  for (int i = 0; i < 3; i++)
+    mOrigin[i] = volume.origin[i];
+  mResolution = volume.resolution;
+  return 0;
+}
+
+/* Bits of the cells of a brick with coordinates in [lo[i], hi[i]] along each
+ * axis, within [0, 3]: the x bits times the first bit of the selected rows
+ * times the first bit of the selected planes. */
+static inline uint64_t brickMask(const int lo[3], const int hi[3]) {
+  uint64_t x = (0xfull >> (3 - hi[0] + lo[0])) << lo[0];
+  uint64_t y = (0x1111ull >> (4 * (3 - hi[1] + lo[1]))) << (4 * lo[1]);
+  uint64_t z = (0x0001000100010001ull >> (16 * (3 - hi[2] + lo[2])))
+               << (16 * lo[2]);
+  return x * y * z;
+}
+
+uint64_t OccupancyPyramid::occupiedCells(unsigned int level, const int c0[3],
+                                         const int c1[3],
+                                         unsigned int *visited) const {
+  const Level &l = mLevels[level];
+  int lo[3], hi[3];
+
+  for (int i = 0; i < 3; i++) {
+    lo[i] = c0[i] & 3;
+    hi[i] = c1[i] & 3;
+  }
+  *visited += (hi[0] - lo[0] + 1) * (hi[1] - lo[1] + 1) * (hi[2] - lo[2] + 1);
+  size_t word = ((size_t)(c0[2] >> 2) * l.bricks[1] + (c0[1] >> 2)) *
+                    l.bricks[0] +
+                (c0[0] >> 2);
+  return l.words[word] & brickMask(lo, hi);
+}
+
+/* Coordinates of a cell of a brick from its bit, `base` being the first cell
+ * of the brick. */
+static inline void bitCell(int bit, const int base[3], int cell[3]) {
+  cell[0] = base[0] + (bit & 3);
+  cell[1] = base[1] + ((bit >> 2) & 3);
+  cell[2] = base[2] + (bit >> 4);
+}
+
+bool OccupancyPyramid::boxCell(unsigned int level, const int cell[3],
+                               const int lo[3], const int hi[3],
+                               unsigned int *visited) const {
+  /* Children of the cell within the box, 2x2x2 cells at most, all in the
+   * same brick of the level below */
+  int c0[3], c1[3], base[3];
+  for (int i = 0; i < 3; i++) {
+    c0[i] = std::max(cell[i] * 2, lo[i] >> (level - 1));
+    c1[i] = std::min(cell[i] * 2 + 1, hi[i] >> (level - 1));
+    base[i] = c0[i] & ~3;
+  }
+  uint64_t bits = occupiedCells(level - 1, c0, c1, visited);
+  if (level == 1)
+    return bits != 0;
+
+  for (; bits != 0; bits &= bits - 1) {
+    int child[3];
+    bitCell(__builtin_ctzll(bits), base, child);
+    if (boxCell(level - 1, child, lo, hi, visited))
+      return true;
+  }
+  return false;
+}
+
+/* Call `cellFn` with the cells of each brick of the top level within
+ * [lo >> top, hi >> top], until it returns true. */
+template <typename CellFn>
+static bool forTopCells(const int lo[3], const int hi[3], unsigned int top,
+                        CellFn cellFn) {
+  int t0[3], t1[3];
+  for (int i = 0; i < 3; i++) {
+    t0[i] = lo[i] >> top;
+    t1[i] = hi[i] >> top;
+  }
+
+  for (int bz = t0[2] >> 2; bz <= t1[2] >> 2; bz++) {
+    for (int by = t0[1] >> 2; by <= t1[1] >> 2; by++) {
+      for (int bx = t0[0] >> 2; bx <= t1[0] >> 2; bx++) {
+        const int brick[3] = {bx, by, bz};
+        int c0[3], c1[3];
+        for (int i = 0; i < 3; i++) {
+          c0[i] = std::max(brick[i] * 4, t0[i]);
+          c1[i] = std::min(brick[i] * 4 + 3, t1[i]);
+        }
+        if (cellFn(c0, c1))
+          return true;
+      }
+    }
+  }
+  return false;
+}
+
+int OccupancyPyramid::checkBox(const float min[3], const float max[3],
+                               bool *collides, QueryStats *stats) const {
+  const unsigned int top = mConfig.levelCount - 1;
+  unsigned int visited = 0;
+  int lo[3], hi[3];
+
+  if (min == nullptr || max == nullptr || collides == nullptr)
+    return -EINVAL;
+  if (!isBuilt())
+    return -EAGAIN;
+
+  /* Voxels crossed by the box, clipped to the volume */
+  *collides = false;
+  for (int i = 0; i < 3; i++) {
+    lo[i] = std::max(0, (int)floorf((min[i] - mOrigin[i]) / mResolution));
+    hi[i] = std::min(mLevels[0].size[i] - 1,
+                     (int)floorf((max[i] - mOrigin[i]) / mResolution));
+    if (lo[i] > hi[i])
+      goto out;
+  }
+
+  *collides = forTopCells(lo, hi, top, [&](const int c0[3], const int c1[3]) {
+    int base[3] = {c0[0] & ~3, c0[1] & ~3, c0[2] & ~3};
+    for (uint64_t bits = occupiedCells(top, c0, c1, &visited); bits != 0;
+         bits &= bits - 1) {
+      int cell[3];
+      bitCell(__builtin_ctzll(bits), base, cell);
+      if (boxCell(top, cell, lo, hi, &visited))
+        return true;
+    }
+    return false;
+  });
+
+out:
+  if (stats != nullptr)
+    stats->visitedCells = visited;
+  return 0;
+}
+
+bool OccupancyPyramid::segmentCell(unsigned int level, const int cell[3],
+                                   const Segment &segment,
+                                   unsigned int *visited) const {
+  float t0 = 0.f, t1 = 1.f;
+
+  /* Slab test of the segment against the cell grown by the radius */
+  for (int i = 0; i < 3; i++) {
+    float lo = (float)(cell[i] << level) - segment.radius;
+    float hi = (float)((cell[i] + 1) << level) + segment.radius;
+    float from = segment.from[i];
+    float delta = segment.delta[i];
+    if (delta == 0.f) {
+      if (from < lo || from > hi)
+        return false;
+      continue;
+    }
+    float a = (lo - from) / delta;
+    float b = (hi - from) / delta;
+    if (a > b)
+      std::swap(a, b);
+    t0 = std::max(t0, a);
+    t1 = std::min(t1, b);
+    if (t0 > t1)
+      return false;
+  }
+  if (level == 0)
+    return true;
+
+  /* Occupied children of the cell, all in the same brick of the level
+   * below */
+  const int *size = mLevels[level - 1].size;
+  int c0[3], c1[3], base[3];
+  for (int i = 0; i < 3; i++) {
+    c0[i] = cell[i] * 2;
+    c1[i] = std::min(cell[i] * 2 + 1, size[i] - 1);
+    base[i] = c0[i] & ~3;
+  }
+  for (uint64_t bits = occupiedCells(level - 1, c0, c1, visited); bits != 0;
+       bits &= bits - 1) {
+    int child[3];
+    bitCell(__builtin_ctzll(bits), base, child);
+    if (segmentCell(level - 1, child, segment, visited))
+      return true;
+  }
+  return false;
+}
+
+int OccupancyPyramid::checkSegment(const float from[3], const float to[3],
+                                   float radius, bool *collides,
+                                   QueryStats *stats) const {
+  const unsigned int top = mConfig.levelCount - 1;
+  unsigned int visited = 0;
+  Segment segment;
+  int lo[3], hi[3];
+
+  if (from == nullptr || to == nullptr || collides == nullptr ||
+      !(radius >= 0.f))
+    return -EINVAL;
+  if (!isBuilt())
+    return -EAGAIN;
+
+  /* Cells of the top level covering the bounding box of the corridor,
+   * clipped to the volume */
+  *collides = false;
+  segment.radius = radius / mResolution;
+  for (int i = 0; i < 3; i++) {
+    segment.from[i] = (from[i] - mOrigin[i]) / mResolution;
+    segment.delta[i] = (to[i] - mOrigin[i]) / mResolution - segment.from[i];
+    float a = std::min(segment.from[i], segment.from[i] + segment.delta[i]);
+    float b = std::max(segment.from[i], segment.from[i] + segment.delta[i]);
+    lo[i] = std::max(0, (int)floorf(a - segment.radius));
+    hi[i] = std::min(mLevels[0].size[i] - 1, (int)floorf(b + segment.radius));
+    if (lo[i] > hi[i])
+      goto out;
+  }
+
+  *collides = forTopCells(lo, hi, top, [&](const int c0[3], const int c1[3]) {
+    int base[3] = {c0[0] & ~3, c0[1] & ~3, c0[2] & ~3};
+    for (uint64_t bits = occupiedCells(top, c0, c1, &visited); bits != 0;
+         bits &= bits - 1) {
+      int cell[3];
+      bitCell(__builtin_ctzll(bits), base, cell);
+      if (segmentCell(top, cell, segment, &visited))
+        return true;
+    }
+    return false;
+  });
+
+out:
+  if (stats != nullptr)
+    stats->visitedCells = visited;
+  return 0;
+}
@@ -0,0 +1,203 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include "occupancy_volume.hpp"
+
+/* Levels of an occupancy pyramid, including the full resolution one. */
+#define PYRAMID_MIN_LEVELS 2
+#define PYRAMID_MAX_LEVELS 4
+
+/* Maximum number of threads building an occupancy pyramid. */
+#define PYRAMID_MAX_THREADS 4
+
+/* Max-pooled pyramid of the obstacles of an occupancy volume: level 0 has a
+ * bit per voxel, a cell of level k covers 2x2x2 cells of level k - 1 and is
+ * occupied if any of them is. A free cell of any level proves the voxels it
+ * covers free, so collision queries descend the pyramid only below occupied
+ * cells and stop at the first occupied voxel.
+ *
+ * The cells of each level are stored in bricks of 4x4x4 cells, one 64 bits
+ * word per brick, so that the cells of a neighbourhood share a cache line
+ * and the cells of a brick within a query are tested at once by masking its
+ * word. Levels are built in slabs of bricks along z, taken in turn by the
+ * calling thread and the workers of the pyramid. */
+class OccupancyPyramid {
+public:
+  struct Config {
+    /* Number of levels, PYRAMID_MIN_LEVELS to PYRAMID_MAX_LEVELS. */
+    unsigned int levelCount;
+    /* Voxels with at least this log-odds are obstacles. */
+    int8_t obstacleLogodd;
+    /* Whether unknown voxels are obstacles as well. */
+    bool unknownIsObstacle;
+    /* Number of threads building the pyramid, including the calling one, 1
+     * if 0, at most PYRAMID_MAX_THREADS. */
+    unsigned int threadCount;
+  };
+
+  /* Work of a query. */
+  struct QueryStats {
+    /* Cells tested, all levels included. */
+    unsigned int visitedCells;
+  };
+
+  OccupancyPyramid(const Config &config);
+  ~OccupancyPyramid();
+
+  /* Check the configuration and start the worker threads. */
+  int start();
+  /* Stop the worker threads. */
+  void stop();
+
+  /**
+   * Build the pyramid of a volume, replacing the previous one.
+   * @param volume voxels of the pyramid.
+   * @return 0 in case of success, negative errno in case of error.
+   */
+  int build(const OccupancyVolume &volume);
+
+  /* Whether a pyramid has been built. */
+  bool isBuilt() const { return mResolution > 0.f; }
+  const Config &getConfig() const { return mConfig; }
+  /* Lower corner of the volume [m] and edge of a voxel [m]. */
+  const float *getOrigin() const { return mOrigin; }
+  float getResolution() const { return mResolution; }
+  /* Number of cells of a level along x, y and z. */
+  const int *getLevelSize(unsigned int level) const {
+    return mLevels[level].size;
+  }
+  /* Whether a cell of a level is occupied, the cell shall be within the
+   * level. */
+  bool isOccupied(unsigned int level, int x, int y, int z) const {
+    const Level &l = mLevels[level];
+    size_t word = ((size_t)(z >> 2) * l.bricks[1] + (y >> 2)) * l.bricks[0] +
+                  (x >> 2);
+    return (l.words[word] >> bitIndex(x, y, z)) & 1;
+  }
+
+  /**
+   * Check whether an axis aligned box contains an obstacle. Voxels crossed
+   * by the box count, parts of the box outside of the volume are free.
+   * @param min lower corner of the box [m].
+   * @param max upper corner of the box [m].
+   * @param collides pointer to return whether the box contains an obstacle.
+   * @param stats pointer to return the work of the query, may be null.
+   * @return 0 in case of success, -EAGAIN if no pyramid has been built,
+   *         negative errno in case of error.
+   */
+  int checkBox(const float min[3], const float max[3], bool *collides,
+               QueryStats *stats) const;
+
+  /**
+   * Check whether a segment swept by a sphere contains an obstacle. The
+   * check is conservative: a voxel collides if the segment crosses the voxel
+   * grown by `radius` on each side, which includes some voxels a little
+   * farther than `radius` near their corners. Parts of the corridor outside
+   * of the volume are free.
+   * @param from start of the segment [m].
+   * @param to end of the segment [m].
+   * @param radius radius of the sphere [m].
+   * @param collides pointer to return whether the corridor contains an
+   *                 obstacle.
+   * @param stats pointer to return the work of the query, may be null.
+   * @return 0 in case of success, -EAGAIN if no pyramid has been built,
+   *         negative errno in case of error.
+   */
+  int checkSegment(const float from[3], const float to[3], float radius,
+                   bool *collides, QueryStats *stats) const;
+
+private:
+  struct Level {
+    /* Cells and bricks along x, y and z. */
+    int size[3];
+    int bricks[3];
+    std::vector<uint64_t> words;
+  };
+
+  /* Segment of a query in voxels from the lower corner of the volume, and
+   * the radius in voxels. */
+  struct Segment {
+    float from[3];
+    float delta[3];
+    float radius;
+  };
+
+  static int bitIndex(int x, int y, int z) {
+    return ((z & 3) << 4) | ((y & 3) << 2) | (x & 3);
+  }
+
+  void buildBaseSlab(int slab);
+  void buildPooledSlab(unsigned int level, int slab);
+  void buildSlabs();
+  void workerThread(uint64_t generation);
+  int runLevel(unsigned int level);
+
+  /* Occupied cells of a level within [c0, c1], which shall be in the same
+   * brick, as the bits of the brick. */
+  uint64_t occupiedCells(unsigned int level, const int c0[3], const int c1[3],
+                         unsigned int *visited) const;
+  /* Whether an occupied cell has obstacles within the query below it. */
+  bool boxCell(unsigned int level, const int cell[3], const int lo[3],
+               const int hi[3], unsigned int *visited) const;
+  bool segmentCell(unsigned int level, const int cell[3],
+                   const Segment &segment, unsigned int *visited) const;
+
+  const Config mConfig;
+  Level mLevels[PYRAMID_MAX_LEVELS];
+  /* Geometry of the volume of the pyramid, resolution 0 if not built. */
+  float mOrigin[3];
+  float mResolution;
+
+  /* The level being built, set by `runLevel` before waking the workers
+   * up. */
+  const OccupancyVolume *mVolume;
+  unsigned int mBuildLevel;
+  std::atomic<int> mNextSlab;
+
+  /* Workers wait for a new `mGeneration`, `runLevel` waits for
+   * `mBusyWorkers` to drop to zero. */
+  std::mutex mMutex;
+  std::condition_variable mCond;
+  std::condition_variable mDoneCond;
+  uint64_t mGeneration;
+  unsigned int mBusyWorkers;
+  bool mStopRequested;
+  std::vector<std::thread> mWorkers;
+};
@@ -0,0 +1,167 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "occupancy_volume.hpp"
+#include <algorithm>
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+/* One histogram bin per log-odds value. */
+#define LOGODD_BIN_COUNT 256
+
+int computeDensities(const OccupancyVolume &volume,
+                     const DensityQuery *queries, size_t count,
+                     float *densities) {
+  float shells[OCCUPANCY_MAX_DENSITY_QUERIES];
+  int shellCount = 0;
+  float center[3];
+
+  if (queries == nullptr || densities == nullptr || count == 0 ||
+      count > OCCUPANCY_MAX_DENSITY_QUERIES || volume.resolution <= 0.f ||
+      volume.logodds.size() != volume.count())
+    return -EINVAL;
+
+  /* Distinct distances of the batch, ascending, as squared distances in
+   * voxels. A voxel belongs to shell i if it is farther than shell i - 1 and
+   * not farther than shell i */
+  for (size_t i = 0; i < count; i++) {
+    float d = queries[i].distance / volume.resolution;
+    shells[shellCount++] = d > 0.f ? d * d : 0.f;
+  }
+  std::sort(shells, shells + shellCount);
+  shellCount = std::unique(shells, shells + shellCount) - shells;
+  const float maxDist2 = shells[shellCount - 1];
+
+  /* Position of the drone in voxels, relative to the center of the first
+   * voxel */
+  for (int i = 0; i < 3; i++)
+    center[i] = (volume.center[i] - volume.origin[i]) / volume.resolution - .5f;
+
+  std::vector<uint32_t> hist(shellCount * LOGODD_BIN_COUNT, 0);
+  std::vector<float> rowDist2(volume.size[0]);
+  std::vector<uint8_t> rowShell(volume.size[0]);
+
+  for (int z = 0; z < volume.size[2]; z++) {
+    float dz = z - center[2];
+    if (dz * dz > maxDist2)
+      continue;
+    for (int y = 0; y < volume.size[1]; y++) {
+      float dy = y - center[1];
+      float dyz2 = dy * dy + dz * dz;
+      if (dyz2 > maxDist2)
+        continue;
+
+      /* Part of the row within the largest distance */
+      float half = sqrtf(maxDist2 - dyz2);
+      int x0 = std::max(0, (int)ceilf(center[0] - half));
+      int x1 = std::min(volume.size[0] - 1, (int)floorf(center[0] + half));
+      int n = x1 - x0 + 1;
+      if (n <= 0)
+        continue;
+
+      /* Shell of each voxel of the row: straight loops over the row, without
+       * branches, vectorized by the compiler */
+      for (int i = 0; i < n; i++) {
+        float dx = x0 + i - center[0];
+        rowDist2[i] = dyz2 + dx * dx;
+        rowShell[i] = 0;
+      }
+      for (int s = 0; s < shellCount - 1; s++) {
+        float d2 = shells[s];
+        for (int i = 0; i < n; i++)
+          rowShell[i] += rowDist2[i] > d2;
+      }
+
+      /* Bounds of the row are rounded, check the last shell as well */
+      const int8_t *row = &volume.logodds[volume.index(x0, y, z)];
+      for (int i = 0; i < n; i++) {
+        if (row[i] == OCCUPANCY_UNKNOWN || rowDist2[i] > maxDist2)
+          continue;
+        hist[rowShell[i] * LOGODD_BIN_COUNT + (row[i] - INT8_MIN)]++;
+      }
+    }
+  }
+
+  /* Cumulate the shells, then the log-odds from the highest one: bin v of
+   * shell s is the number of observed voxels within distance s whose
+   * log-odds is at least v */
+  for (int s = 1; s < shellCount; s++) {
+    for (int v = 0; v < LOGODD_BIN_COUNT; v++)
+      hist[s * LOGODD_BIN_COUNT + v] += hist[(s - 1) * LOGODD_BIN_COUNT + v];
+  }
+  for (int s = 0; s < shellCount; s++) {
+    uint32_t *bins = &hist[s * LOGODD_BIN_COUNT];
+    for (int v = LOGODD_BIN_COUNT - 2; v >= 0; v--)
+      bins[v] += bins[v + 1];
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    float d = queries[i].distance / volume.resolution;
+    float d2 = d > 0.f ? d * d : 0.f;
+    int s = std::lower_bound(shells, shells + shellCount, d2) - shells;
+    const uint32_t *bins = &hist[s * LOGODD_BIN_COUNT];
+    /* Unknown voxels are not counted, bin 0 is the first observed value */
+    uint32_t observed = bins[1];
+    uint32_t occupied = bins[std::max(1, queries[i].logodd - INT8_MIN)];
+    densities[i] = observed > 0 ? (float)occupied / observed : 0.f;
+  }
+
+  return 0;
+}
+
+uint64_t hashVolume(const OccupancyVolume &volume) {
+  const int8_t *logodds = volume.logodds.data();
+  size_t count = volume.logodds.size();
+  uint64_t hash = count;
+  uint64_t word;
+  uint32_t resolution;
+  size_t i;
+
+  /* Geometry and position, as bits */
+  for (int k = 0; k < 3; k++) {
+    uint32_t origin, center;
+    memcpy(&origin, &volume.origin[k], sizeof(origin));
+    memcpy(&center, &volume.center[k], sizeof(center));
+    hash = hashMix(hash, ((uint64_t)origin << 32) | (uint32_t)volume.size[k]);
+    hash = hashMix(hash, center);
+  }
+  memcpy(&resolution, &volume.resolution, sizeof(resolution));
+  hash = hashMix(hash, resolution);
+
+  for (i = 0; i + sizeof(word) <= count; i += sizeof(word)) {
+    memcpy(&word, logodds + i, sizeof(word));
+    hash = hashMix(hash, word);
+  }
+  word = 0;
+  memcpy(&word, logodds + i, count - i);
+  return hashMix(hash, word);
+}
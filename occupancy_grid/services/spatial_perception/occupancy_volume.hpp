@@ -0,0 +1,111 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/* Log-odds of a voxel which has never been observed. */
+#define OCCUPANCY_UNKNOWN INT8_MIN
+
+/* Maximum number of density queries of a batch. */
+#define OCCUPANCY_MAX_DENSITY_QUERIES 16
+
+/* Dense block of voxels of an occupancy grid, around the drone. */
+struct OccupancyVolume {
+  /* Number of voxels along x, y and z. x varies first in `logodds`. */
+  int size[3];
+  /* Edge of a voxel [m]. */
+  float resolution;
+  /* Position of the lower corner of the first voxel [m]. */
+  float origin[3];
+  /* Position of the drone, distances of the queries are counted from
+   * there [m]. */
+  float center[3];
+  /* Log-odds of each voxel, OCCUPANCY_UNKNOWN if never observed. */
+  std::vector<int8_t> logodds;
+
+  size_t index(int x, int y, int z) const {
+    return ((size_t)z * size[1] + y) * size[0] + x;
+  }
+  size_t count() const { return (size_t)size[0] * size[1] * size[2]; }
+};
+
+/* Grid giving access to its voxels. The moser grids only answer density
+ * queries, grids which also implement this interface get the voxel based
+ * analyses of the spatial perception. */
+class VolumeGrid {
+public:
+  virtual ~VolumeGrid() {}
+  virtual const OccupancyVolume &getVolume() const = 0;
+};
+
+/* Obstacle density query: ratio of the observed voxels closer than
+ * `distance` to the drone whose log-odds is at least `logodd`. */
+struct DensityQuery {
+  int8_t logodd;
+  float distance; /* [m] */
+};
+
+/**
+ * Compute the obstacle density ratio of a batch of queries in a single
+ * traversal of the volume. Each voxel within the largest distance of the
+ * batch is counted once in a histogram of log-odds per distance shell, the
+ * densities are then read from the cumulated histogram.
+ * @param volume voxels to query.
+ * @param queries queries of the batch.
+ * @param count number of queries, at most OCCUPANCY_MAX_DENSITY_QUERIES.
+ * @param densities array of `count` densities to fill, 0 for a query without
+ *                  any observed voxel.
+ * @return 0 in case of success, negative errno in case of error.
+ */
+int computeDensities(const OccupancyVolume &volume,
+                     const DensityQuery *queries, size_t count,
+                     float *densities);
+
+/* Multiply-rotate mixing of a 64 bits word into a hash, words are read
+ * 8 voxels at a time. */
+static inline uint64_t hashMix(uint64_t hash, uint64_t word) {
+  hash ^= word * 0x9e3779b97f4a7c15ull;
+  hash = (hash << 31) | (hash >> 33);
+  return hash * 0xff51afd7ed558ccdull;
+}
+
+/**
+ * Compute a 64 bits hash of a volume: its geometry, the position of the
+ * drone and the log-odds of every voxel. Equal hashes are taken as equal
+ * volumes, to skip the analysis of a grid identical to the previous one.
+ * @param volume voxels to hash.
+ * @return hash of the volume.
+ */
+uint64_t hashVolume(const OccupancyVolume &volume);
@@ -0,0 +1,352 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+
+#include "path_planner.hpp"
+
+/* Cost of a step to a neighbour along 1, 2 or 3 axes, in cells. */
+static const float s_stepCost[4] = {0.f, 1.f, 1.41421356f, 1.73205081f};
+
+/* Slightly favour the cells closer to the goal among the ones of equal
+ * cost, so that open space is crossed without expanding every equivalent
+ * path. */
+#define HEURISTIC_TIE_BREAK 1.001f
+
+/* Cell boxes are grown a little more than the radius, so that voxels just
+ * touching them count despite the rounding of their bounds [m]. */
+#define TRAVERSABLE_MARGIN 1e-3f
+
+/* The clock is read once every this many expanded cells. */
+#define CLOCK_INTERVAL 64
+
+PathPlanner::PathPlanner(const Config &config)
+    : mConfig(config), mSize{0, 0, 0}, mOrigin{0.f, 0.f, 0.f},
+      mCellSize(0.f), mGoal{0, 0, 0}, mGoalPosition{0.f, 0.f, 0.f},
+      mGoalInside(false), mCheckedCells(0) {
+  size_t words = (config.maxCells + 63) / 64;
+
+  mCost.resize(config.maxCells);
+  mParent.resize(config.maxCells);
+  mSeen.resize(words);
+  mClosed.resize(words);
+  mChecked.resize(words);
+  mTraversable.resize(words);
+  mOpen.reserve(config.maxOpenNodes);
+}
+
+int PathPlanner::reset(const OccupancyPyramid &pyramid) {
+  const int *size = pyramid.getLevelSize(mConfig.level);
+  size_t count = (size_t)size[0] * size[1] * size[2];
+  size_t words = (count + 63) / 64;
+
+  /* Searches never allocate */
+  if (count > mConfig.maxCells)
+    return -E2BIG;
+
+  for (int i = 0; i < 3; i++) {
+    mSize[i] = size[i];
+    mOrigin[i] = pyramid.getOrigin()[i];
+  }
+  mCellSize = pyramid.getResolution() * (1 << mConfig.level);
+
+  std::fill(mSeen.begin(), mSeen.begin() + words, 0);
+  std::fill(mClosed.begin(), mClosed.begin() + words, 0);
+  std::fill(mChecked.begin(), mChecked.begin() + words, 0);
+  std::fill(mTraversable.begin(), mTraversable.begin() + words, 0);
+  mOpen.clear();
+  mCheckedCells = 0;
+  return 0;
+}
+
+bool PathPlanner::isFree(const OccupancyPyramid &pyramid,
+                         const int position[3], float grow) const {
+  float min[3], max[3];
+  bool collides;
+
+  for (int i = 0; i < 3; i++) {
+    min[i] = mOrigin[i] + position[i] * mCellSize - grow;
+    max[i] = mOrigin[i] + (position[i] + 1) * mCellSize + grow;
+  }
+  int res = pyramid.checkBox(min, max, &collides, nullptr);
+  return res == 0 && !collides;
+}
+
+bool PathPlanner::isTraversable(const OccupancyPyramid &pyramid,
+                                uint32_t cell, const int position[3]) {
+  if (testBit(mChecked, cell))
+    return testBit(mTraversable, cell);
+
+  bool traversable =
+      isFree(pyramid, position, mConfig.radius + TRAVERSABLE_MARGIN);
+  setBit(mChecked, cell);
+  mCheckedCells++;
+  if (traversable)
+    setBit(mTraversable, cell);
+  return traversable;
+}
+
+/* Length of the shortest path to the goal without obstacles: a diagonal
+ * step along 3 axes, then along 2 axes, then straight steps. */
+float PathPlanner::heuristic(uint32_t cell) const {
+  int x = cell % mSize[0];
+  int y = (cell / mSize[0]) % mSize[1];
+  int z = cell / mSize[0] / mSize[1];
+  int d[3] = {abs(x - mGoal[0]), abs(y - mGoal[1]), abs(z - mGoal[2])};
+
+  std::sort(d, d + 3);
+  return s_stepCost[3] * d[0] + s_stepCost[2] * (d[1] - d[0]) +
+         (d[2] - d[1]);
+}
+
+void PathPlanner::cellCenter(uint32_t cell, float position[3]) const {
+  int p[3] = {(int)(cell % mSize[0]), (int)((cell / mSize[0]) % mSize[1]),
+              (int)(cell / mSize[0] / mSize[1])};
+
+  for (int i = 0; i < 3; i++)
+    position[i] = mOrigin[i] + (p[i] + 0.5f) * mCellSize;
+}
+
+bool PathPlanner::isGoalVisible(const OccupancyPyramid &pyramid,
+                                uint32_t cell) const {
+  float center[3];
+  bool collides;
+
+  cellCenter(cell, center);
+  int res = pyramid.checkSegment(center, mGoalPosition, mConfig.radius,
+                                 &collides, nullptr);
+  return res == 0 && !collides;
+}
+
+int PathPlanner::search(const OccupancyPyramid &pyramid, uint32_t start,
+                        std::chrono::steady_clock::time_point deadline,
+                        uint32_t *reached, Result *result) {
+  uint32_t goal = cellIndex(mGoal);
+  int position[3] = {(int)(start % mSize[0]),
+                     (int)((start / mSize[0]) % mSize[1]),
+                     (int)(start / mSize[0] / mSize[1])};
+  bool blocked = !isTraversable(pyramid, start, position);
+  uint32_t best = start;
+  float bestH = heuristic(start);
+  std::greater<OpenNode> compare;
+
+  mCost[start] = 0.f;
+  mParent[start] = start;
+  setBit(mSeen, start);
+  mOpen.push_back({bestH * HEURISTIC_TIE_BREAK, start});
+
+  while (!mOpen.empty()) {
+    std::pop_heap(mOpen.begin(), mOpen.end(), compare);
+    uint32_t cell = mOpen.back().cell;
+    mOpen.pop_back();
+    /* A cell is pushed again when a cheaper path reaches it */
+    if (testBit(mClosed, cell))
+      continue;
+    setBit(mClosed, cell);
+    result->expandedNodes++;
+
+    float h = heuristic(cell);
+    if (h < bestH) {
+      best = cell;
+      bestH = h;
+    }
+    /* The goal is reached from its cell, or from a neighbour in sight of it
+     * when its own cell is too close to an obstacle */
+    if (cell == goal || (mGoalInside && h <= s_stepCost[3] &&
+                         isGoalVisible(pyramid, cell))) {
+      *reached = cell;
+      return PATH_FOUND;
+    }
+    if (result->expandedNodes % CLOCK_INTERVAL == 0 &&
+        std::chrono::steady_clock::now() > deadline)
+      break;
+
+    /* A drone closer than its radius to an obstacle can only get away
+     * from it through free cells which are not traversable */
+    bool escaping = blocked && mCost[cell] * mCellSize <= mConfig.radius;
+    int x = cell % mSize[0];
+    int y = (cell / mSize[0]) % mSize[1];
+    int z = cell / mSize[0] / mSize[1];
+    for (int dz = -1; dz <= 1; dz++) {
+      for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+          int n[3] = {x + dx, y + dy, z + dz};
+          if ((dx | dy | dz) == 0 || n[0] < 0 || n[1] < 0 || n[2] < 0 ||
+              n[0] >= mSize[0] || n[1] >= mSize[1] || n[2] >= mSize[2])
+            continue;
+          uint32_t next = cellIndex(n);
+          if (testBit(mClosed, next))
+            continue;
+          float cost = mCost[cell] + s_stepCost[abs(dx) + abs(dy) + abs(dz)];
+          if (testBit(mSeen, next) && cost >= mCost[next])
+            continue;
+          if (!isTraversable(pyramid, next, n) &&
+              !(escaping && isFree(pyramid, n, 0.f)))
+            continue;
+          if (mOpen.size() == mOpen.capacity()) {
+            *reached = best;
+            return PATH_PARTIAL;
+          }
+          mCost[next] = cost;
+          mParent[next] = cell;
+          setBit(mSeen, next);
+          mOpen.push_back({cost + heuristic(next) * HEURISTIC_TIE_BREAK, next});
+          std::push_heap(mOpen.begin(), mOpen.end(), compare);
+          result->openHighWater =
+              std::max(result->openHighWater, (unsigned int)mOpen.size());
+        }
+      }
+    }
+  }
+
+  *reached = best;
+  return mOpen.empty() ? PATH_UNREACHABLE : PATH_PARTIAL;
+}
+
+static float distance(const PathPlanner::Waypoint &a,
+                      const PathPlanner::Waypoint &b) {
+  float dx = b.x - a.x, dy = b.y - a.y, dz = b.z - a.z;
+  return sqrtf(dx * dx + dy * dy + dz * dz);
+}
+
+void PathPlanner::buildPath(const OccupancyPyramid &pyramid,
+                            const Request &request, uint32_t reached,
+                            bool found, Result *result) {
+  const Waypoint goal = {request.goal[0], request.goal[1], request.goal[2]};
+  float center[3];
+  bool collides;
+
+  /* Cells from the start to the reached one, through their centers, from
+   * the exact start and to the exact goal */
+  mPathCells.clear();
+  for (uint32_t cell = reached; mParent[cell] != cell; cell = mParent[cell])
+    mPathCells.push_back(cell);
+  mCenters.clear();
+  mCenters.push_back({request.start[0], request.start[1], request.start[2]});
+  for (auto it = mPathCells.rbegin(); it != mPathCells.rend(); ++it) {
+    cellCenter(*it, center);
+    mCenters.push_back({center[0], center[1], center[2]});
+  }
+  if (found) {
+    if (mCenters.size() > 1 && reached == cellIndex(mGoal))
+      mCenters.back() = goal;
+    else
+      mCenters.push_back(goal);
+  }
+
+  /* Skip the centers while the segment from the last waypoint to the next
+   * one is free */
+  size_t count = mCenters.size();
+  size_t anchor = 0;
+  result->waypoints.push_back(mCenters[0]);
+  for (size_t i = 2; i < count; i++) {
+    const float *from = &mCenters[anchor].x;
+    const float *to = &mCenters[i].x;
+    int res = pyramid.checkSegment(from, to, mConfig.radius, &collides,
+                                   nullptr);
+    if (res == 0 && !collides)
+      continue;
+    anchor = i - 1;
+    result->waypoints.push_back(mCenters[anchor]);
+  }
+  if (count > 1)
+    result->waypoints.push_back(mCenters[count - 1]);
+
+  for (size_t i = 1; i < result->waypoints.size(); i++) {
+    result->length +=
+        distance(result->waypoints[i - 1], result->waypoints[i]);
+  }
+  result->remaining = distance(result->waypoints.back(), goal);
+}
+
+int PathPlanner::plan(const OccupancyPyramid &pyramid,
+                      const Request &request, Result *result) {
+  int start[3];
+  uint32_t reached;
+
+  if (result == nullptr || mConfig.radius < 0.f ||
+      mConfig.level >= pyramid.getConfig().levelCount ||
+      mConfig.maxOpenNodes == 0)
+    return -EINVAL;
+
+  auto startTime = std::chrono::steady_clock::now();
+  unsigned int budgetUs =
+      request.budgetUs == 0 ? mConfig.defaultBudgetUs
+                            : std::min(request.budgetUs, mConfig.maxBudgetUs);
+  auto deadline = startTime + std::chrono::microseconds(budgetUs);
+
+  result->id = request.id;
+  result->waypoints.clear();
+  result->length = 0.f;
+  result->remaining = NAN;
+  result->expandedNodes = 0;
+  result->checkedCells = 0;
+  result->openHighWater = 0;
+  result->planningUs = 0;
+  result->status = PATH_NO_GRID;
+  if (!pyramid.isBuilt())
+    return 0;
+
+  int res = reset(pyramid);
+  if (res < 0)
+    return res;
+  mGoalInside = true;
+  for (int i = 0; i < 3; i++) {
+    start[i] = (int)floorf((request.start[i] - mOrigin[i]) / mCellSize);
+    if (start[i] < 0 || start[i] >= mSize[i])
+      return 0;
+    /* A goal outside of the grid is unreachable, the search goes to the
+     * closest cell */
+    mGoalPosition[i] = request.goal[i];
+    mGoal[i] = (int)floorf((request.goal[i] - mOrigin[i]) / mCellSize);
+    if (mGoal[i] < 0 || mGoal[i] >= mSize[i]) {
+      mGoalInside = false;
+      mGoal[i] = std::min(std::max(mGoal[i], 0), mSize[i] - 1);
+    }
+  }
+
+  int status = search(pyramid, cellIndex(start), deadline, &reached, result);
+  if (status == PATH_FOUND && !mGoalInside)
+    status = PATH_UNREACHABLE;
+  result->status = (PathStatus)status;
+  result->checkedCells = mCheckedCells;
+  buildPath(pyramid, request, reached, status == PATH_FOUND, result);
+
+  result->planningUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::steady_clock::now() - startTime)
+                           .count();
+  return 0;
+}
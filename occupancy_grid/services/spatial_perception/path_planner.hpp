@@ -0,0 +1,206 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <stdint.h>
+#include <vector>
+
+#include "occupancy_pyramid.hpp"
+
+/* Status of a planned path. */
+enum PathStatus {
+  /* The path reaches the goal. */
+  PATH_FOUND = 0,
+  /* The budget or the open list ran out, the path reaches the cell closest
+   * to the goal found so far. */
+  PATH_PARTIAL,
+  /* Every cell reachable from the start has been expanded without reaching
+   * the goal, the path reaches the closest one. */
+  PATH_UNREACHABLE,
+  /* No pyramid has been built yet, or the start is outside of it. */
+  PATH_NO_GRID,
+};
+
+/* A* planner over a level of an occupancy pyramid, each cell connected to
+ * its 26 neighbours. A cell is traversable if its box, grown by the radius
+ * of the drone, is free: the segment between the centers of two
+ * neighbouring traversable cells is then free for the drone as well.
+ * Traversability is checked the first time a cell is reached and cached for
+ * the search. The goal is reached from its cell or, if that cell is not
+ * traversable, from a neighbour with a free segment to the goal. A drone
+ * already closer than its radius to an obstacle may also cross free cells
+ * until it has moved by its radius.
+ *
+ * The cost, parent and state bitmaps of the cells and the binary heap of the
+ * open list are allocated once by the constructor, a search only clears the
+ * bitmaps and fails on a level larger than the allocation. The
+ * search stops at the budget, with the path to the expanded cell closest to
+ * the goal. The path of cell centers is then shortened: a center is
+ * skipped while the straight segment from the previous waypoint to the next
+ * center is free. */
+class PathPlanner {
+public:
+  struct Config {
+    /* Level of the pyramid planned on, its cells are 2^level voxels
+     * wide. */
+    unsigned int level;
+    /* Radius of the drone, with a margin [m]. */
+    float radius;
+    /* Cells of the largest level planned on, allocated by the
+     * constructor. */
+    size_t maxCells;
+    /* Size of the open list, the search stops when it is full. */
+    size_t maxOpenNodes;
+    /* Budget of a search if the request gives none, and maximum budget of
+     * a request [us]. */
+    unsigned int defaultBudgetUs;
+    unsigned int maxBudgetUs;
+  };
+
+  struct Request {
+    /* Identifier given back in the result. */
+    uint32_t id;
+    /* Start and goal of the path, in the frame of the grid [m]. */
+    float start[3];
+    float goal[3];
+    /* Budget of the search, the default one if 0 [us]. */
+    unsigned int budgetUs;
+  };
+
+  struct Waypoint {
+    float x;
+    float y;
+    float z;
+  };
+
+  struct Result {
+    uint32_t id;
+    PathStatus status;
+    /* From the start to the goal, or to the cell closest to the goal. */
+    std::vector<Waypoint> waypoints;
+    /* Length of the path [m]. */
+    float length;
+    /* Distance from the end of the path to the goal [m]. */
+    float remaining;
+    /* Cells taken out of the open list and cells whose traversability has
+     * been checked. */
+    unsigned int expandedNodes;
+    unsigned int checkedCells;
+    /* Highest number of nodes in the open list. */
+    unsigned int openHighWater;
+    /* Duration of the search and of the shortening of the path [us]. */
+    uint64_t planningUs;
+    /* Number of the grid planned on, not set by `plan`: SpatialPerception
+     * sets it to the generation of its latest grid. */
+    uint64_t generation;
+  };
+
+  PathPlanner(const Config &config);
+
+  /**
+   * Plan a path on the latest pyramid.
+   * @param pyramid pyramid of the obstacles, built.
+   * @param request start, goal and budget of the path.
+   * @param result pointer to return the path and the work of the search.
+   * @return 0 in case of success, -E2BIG if the level has more than
+   *         `maxCells` cells, negative errno in case of error.
+   */
+  int plan(const OccupancyPyramid &pyramid, const Request &request,
+           Result *result);
+
+  const Config &getConfig() const { return mConfig; }
+
+private:
+  struct OpenNode {
+    /* Cost from the start plus estimated cost to the goal. */
+    float f;
+    uint32_t cell;
+    bool operator>(const OpenNode &other) const { return f > other.f; }
+  };
+
+  static bool testBit(const std::vector<uint64_t> &bits, uint32_t i) {
+    return (bits[i >> 6] >> (i & 63)) & 1;
+  }
+  static void setBit(std::vector<uint64_t> &bits, uint32_t i) {
+    bits[i >> 6] |= (uint64_t)1 << (i & 63);
+  }
+
+  uint32_t cellIndex(const int position[3]) const {
+    return ((uint32_t)position[2] * mSize[1] + position[1]) * mSize[0] +
+           position[0];
+  }
+
+  int reset(const OccupancyPyramid &pyramid);
+  bool isFree(const OccupancyPyramid &pyramid, const int position[3],
+              float grow) const;
+  bool isTraversable(const OccupancyPyramid &pyramid, uint32_t cell,
+                     const int position[3]);
+  float heuristic(uint32_t cell) const;
+  bool isGoalVisible(const OccupancyPyramid &pyramid, uint32_t cell) const;
+  void cellCenter(uint32_t cell, float position[3]) const;
+  int search(const OccupancyPyramid &pyramid, uint32_t start,
+             std::chrono::steady_clock::time_point deadline,
+             uint32_t *reached, Result *result);
+  void buildPath(const OccupancyPyramid &pyramid, const Request &request,
+                 uint32_t reached, bool found, Result *result);
+
+  const Config mConfig;
+
+  /* Geometry of the planned level: cells along x, y and z, lower corner
+   * and edge of a cell [m]. */
+  int mSize[3];
+  float mOrigin[3];
+  float mCellSize;
+  /* Goal of the current search, in cells and in meters, and whether it is
+   * within the level. */
+  int mGoal[3];
+  float mGoalPosition[3];
+  bool mGoalInside;
+
+  /* Cost from the start and parent of each cell, valid if the cell is
+   * `mSeen`. */
+  std::vector<float> mCost;
+  std::vector<uint32_t> mParent;
+  /* Bitmaps of the cells reached, expanded, checked and found
+   * traversable. */
+  std::vector<uint64_t> mSeen;
+  std::vector<uint64_t> mClosed;
+  std::vector<uint64_t> mChecked;
+  std::vector<uint64_t> mTraversable;
+  unsigned int mCheckedCells;
+  /* Binary heap of the open list, its capacity is never exceeded. */
+  std::vector<OpenNode> mOpen;
+  /* Cells of the path from the reached cell back to the start. */
+  std::vector<uint32_t> mPathCells;
+  std::vector<Waypoint> mCenters;
+};
@@ -0,0 +1,136 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "snapshot_player.hpp"
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+#define ULOG_TAG spatial_perception
+#include <ulog.h>
+
+SnapshotGrid::SnapshotGrid(OccupancyVolume &&volume,
+                           const GridSnapshotHeader &header)
+    : mVolume(std::move(volume)), mSequence(header.sequence),
+      mTimestampNs(header.timestampNs) {}
+
+float SnapshotGrid::getObstacleDensityRatio(int8_t logodd,
+                                            float distance) const {
+  DensityQuery query = {.logodd = logodd, .distance = distance};
+  float density;
+
+  int res = computeDensities(mVolume, &query, 1, &density);
+  return res < 0 ? NAN : density;
+}
+
+SnapshotPlayer::SnapshotPlayer(pomp::Loop *loop,
+                               moser::Client::Callbacks *callbacks,
+                               const std::string &dir, unsigned int periodMs,
+                               bool repeat)
+    : mTimer(loop, this), mCallbacks(callbacks), mDir(dir),
+      mPeriodMs(periodMs), mRepeat(repeat), mNext(0), mStarted(false) {}
+
+SnapshotPlayer::~SnapshotPlayer() { this->stop(); }
+
+int SnapshotPlayer::start() {
+  static const size_t extLen = strlen(GRID_SNAPSHOT_EXTENSION);
+  struct dirent *entry;
+
+  ULOG_ERRNO_RETURN_ERR_IF(mPeriodMs == 0, EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(mStarted, EBUSY);
+
+  DIR *dir = opendir(mDir.c_str());
+  if (dir == nullptr) {
+    int res = -errno;
+    ULOG_ERRNO("opendir('%s')", -res, mDir.c_str());
+    return res;
+  }
+  mPaths.clear();
+  while ((entry = readdir(dir)) != nullptr) {
+    size_t len = strlen(entry->d_name);
+    if (len > extLen &&
+        strcmp(entry->d_name + len - extLen, GRID_SNAPSHOT_EXTENSION) == 0)
+      mPaths.push_back(mDir + "/" + entry->d_name);
+  }
+  closedir(dir);
+  if (mPaths.empty()) {
+    ULOGE("no snapshot in '%s'", mDir.c_str());
+    return -ENOENT;
+  }
+
+  /* Recorded names are numbered, their order is the recording order */
+  std::sort(mPaths.begin(), mPaths.end());
+  ULOGI("replaying %zu snapshots of '%s' every %u ms", mPaths.size(),
+        mDir.c_str(), mPeriodMs);
+
+  mNext = 0;
+  mStarted = true;
+  mTimer.setPeriodic(mPeriodMs, mPeriodMs);
+  return 0;
+}
+
+void SnapshotPlayer::stop() {
+  if (!mStarted)
+    return;
+  mTimer.clear();
+  mStarted = false;
+}
+
+void SnapshotPlayer::releaseGrid(std::unique_ptr<moser::IGrid> grid) {
+  /* Snapshots are read again when replayed, nothing to recycle */
+  grid.reset();
+}
+
+void SnapshotPlayer::processTimer() {
+  GridSnapshotHeader header;
+  OccupancyVolume volume;
+
+  if (mNext >= mPaths.size()) {
+    if (!mRepeat) {
+      ULOGI("end of the snapshots");
+      this->stop();
+      return;
+    }
+    mNext = 0;
+  }
+
+  const std::string &path = mPaths[mNext++];
+  int res = readGridSnapshot(path, &volume, &header);
+  if (res < 0) {
+    ULOG_ERRNO("readGridSnapshot('%s')", -res, path.c_str());
+    return;
+  }
+  mCallbacks->gridReceived(
+      nullptr, std::unique_ptr<moser::IGrid>(
+                   new SnapshotGrid(std::move(volume), header)));
+}
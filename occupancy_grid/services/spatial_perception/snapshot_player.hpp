@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libmoser_ipc_client.hpp>
+#include <libpomp.hpp>
+
+#include "grid_snapshot.hpp"
+#include "occupancy_volume.hpp"
+
+/* Grid read from a snapshot file. */
+class SnapshotGrid : public moser::IGrid, public VolumeGrid {
+public:
+  SnapshotGrid(OccupancyVolume &&volume, const GridSnapshotHeader &header);
+
+  float getObstacleDensityRatio(int8_t logodd, float distance) const override;
+  const OccupancyVolume &getVolume() const override { return mVolume; }
+
+  uint64_t getSequence() const { return mSequence; }
+  uint64_t getTimestampNs() const { return mTimestampNs; }
+
+private:
+  const OccupancyVolume mVolume;
+  const uint64_t mSequence;
+  const uint64_t mTimestampNs;
+};
+
+/* Stand-in for the moser client: gives the snapshots of a directory, in the
+ * order of their names, to `Callbacks::gridReceived` on the loop at a fixed
+ * period, with a null consumer. The analyses downstream of `gridReceived`
+ * run as with a live server. */
+class SnapshotPlayer : public pomp::Timer::Handler {
+public:
+  SnapshotPlayer(pomp::Loop *loop, moser::Client::Callbacks *callbacks,
+                 const std::string &dir, unsigned int periodMs, bool repeat);
+  ~SnapshotPlayer();
+
+  /* List the snapshots of the directory and start playing them. */
+  int start();
+  /* Stop playing, the next start plays from the first snapshot. */
+  void stop();
+
+  /* Give back a grid received from the player. */
+  void releaseGrid(std::unique_ptr<moser::IGrid> grid);
+
+private:
+  void processTimer() override;
+
+  pomp::Timer mTimer;
+  moser::Client::Callbacks *const mCallbacks;
+  const std::string mDir;
+  const unsigned int mPeriodMs;
+  const bool mRepeat;
+  /* Paths of the snapshots and index of the next one. */
+  std::vector<std::string> mPaths;
+  size_t mNext;
+  bool mStarted;
+};
@@ -30,27 +30,351 @@
  */
 
 #include "spatial_perception.hpp"
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
 #include <string>
+#include <time.h>
 
 #include <libpomp.hpp>
 
 #define ULOG_TAG spatial_perception
 #include <ulog.h>
 
+/* Samples kept in the clearance telemetry section, and their approximate
+ * period [us]. */
+#define CLEARANCE_TLM_COUNT 10
+#define CLEARANCE_TLM_RATE 100000
+
+static uint64_t timeNowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Voxels of a grid, null if the grid does not give access to them. Grids of
+ * the moser client only give obstacle density ratios, snapshot grids give
+ * their voxels. */
+static const OccupancyVolume *getGridVolume(const moser::IGrid &grid) {
+  const VolumeGrid *volumeGrid = dynamic_cast<const VolumeGrid *>(&grid);
+  return volumeGrid != nullptr ? &volumeGrid->getVolume() : nullptr;
+}
+
 SpatialPerception::SpatialPerception(pomp::Loop *loop,
                                      SpatialPerception::Client *client,
                                      const std::string &serverAddress,
                                      const std::string &consumerName)
     : mLoop(loop), mClient(client), mServerAddress(serverAddress),
       mConsumerName(consumerName), mMoserClient(nullptr),
-      mMoserConsumer(nullptr), mLastGrid(nullptr), mIsReady(false) {}
+      mMoserConsumer(nullptr), mIsReady(false), mLastGrid(nullptr),
+      mLastGridGeneration(0), mLastGridTimestampNs(0), mAnalysedGrid(nullptr),
+      mAnalysisRequested(false), mGridChanged(false), mAutoPending(false),
+      mCoalescedGrids(0), mUnchangedGrids(0), mDroppedGridFrames(0),
+      mFrontierPending(false), mStopRequested(false), mAnalysisEvt(nullptr),
+      mDistanceFieldShm(nullptr), mGridDeltaShm(nullptr), mDeltaCount(0),
+      mDeltaChangedBlocks(0), mDeltaTotalBlocks(0), mDeltaObstacleBlocks(0),
+      mDeltaUsSum(0), mFrontierCount(0), mFrontierBehind(0), mFrontierUsSum(0),
+      mFrontierUsMax(0), mClearanceProducer(nullptr), mAutoAnalysis(false),
+      mAutoResultCount(0), mAutoLatencySumUs(0), mAutoLatencyMaxUs(0) {
+  memset(&mClearanceTlm, 0, sizeof(mClearanceTlm));
+  mGridDelta.generation = 0;
+}
+
+SpatialPerception::~SpatialPerception() { this->stop(); }
+
+int SpatialPerception::enableDistanceField(const DistanceFieldConfig &config) {
+  ULOG_ERRNO_RETURN_ERR_IF(mThread.joinable(), EBUSY);
+  ULOG_ERRNO_RETURN_ERR_IF(config.obstacleLogodd == OCCUPANCY_UNKNOWN, EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(config.maxDistance <= 0.f, EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(!config.shmName.empty() && config.shmMaxVoxels == 0,
+                           EINVAL);
+
+  mDistanceFieldConfig = config;
+  mDistanceField.reset(
+      new DistanceField(config.obstacleLogodd, config.maxDistance));
+  return 0;
+}
+
+int SpatialPerception::enableGridDelta(const GridDeltaConfig &config) {
+  ULOG_ERRNO_RETURN_ERR_IF(mThread.joinable(), EBUSY);
+  ULOG_ERRNO_RETURN_ERR_IF(config.obstacleLogodd == OCCUPANCY_UNKNOWN, EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(!config.shmName.empty() &&
+                               (config.shmSlotCount == 0 ||
+                                config.shmMaxBlocks == 0),
+                           EINVAL);
+
+  mGridDeltaConfig = config;
+  mGridDiff.reset(new GridDiff(config.obstacleLogodd));
+  return 0;
+}
+
+int SpatialPerception::addDeltaListener(GridDeltaListener *listener) {
+  ULOG_ERRNO_RETURN_ERR_IF(mThread.joinable(), EBUSY);
+  ULOG_ERRNO_RETURN_ERR_IF(listener == nullptr, EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(mGridDiff == nullptr, ENOSYS);
+
+  mDeltaListeners.push_back(listener);
+  return 0;
+}
+
+int SpatialPerception::enableStreaming(const GridStreamer::Config &config) {
+  ULOG_ERRNO_RETURN_ERR_IF(mThread.joinable(), EBUSY);
+  ULOG_ERRNO_RETURN_ERR_IF(mGridDiff == nullptr, ENOSYS);
+  ULOG_ERRNO_RETURN_ERR_IF(config.obstacleLogodd == OCCUPANCY_UNKNOWN, EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(config.bytesPerSecond == 0, EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(config.keyframePeriodMs == 0, EINVAL);
+
+  mStreamer.reset(new GridStreamer(config));
+  return 0;
+}
+
+int SpatialPerception::enableFrontiers(const FrontierMap::Config &config) {
+  ULOG_ERRNO_RETURN_ERR_IF(mThread.joinable(), EBUSY);
+  ULOG_ERRNO_RETURN_ERR_IF(mGridDiff == nullptr, ENOSYS);
+  ULOG_ERRNO_RETURN_ERR_IF(config.freeLogodd == OCCUPANCY_UNKNOWN, EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(config.maxGoals == 0, EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(config.distanceCost < 0.f, EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(config.maxFrontierVoxels == 0 ||
+                               config.maxFrontierVoxels > UINT32_MAX,
+                           EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(config.budgetUs == 0, EINVAL);
+
+  mFrontierMap.reset(new FrontierMap(config));
+  return 0;
+}
+
+int SpatialPerception::enableClearance(const ClearanceRing::Config &config,
+                                       const std::string &tlmSection) {
+  ULOG_ERRNO_RETURN_ERR_IF(mThread.joinable(), EBUSY);
+  ULOG_ERRNO_RETURN_ERR_IF(tlmSection.empty(), EINVAL);
+
+  mClearanceRing.reset(new ClearanceRing(config));
+  mClearanceSection = tlmSection;
+  return 0;
+}
+
+int SpatialPerception::enableAutoAnalysis(const AutoAnalysisConfig &config) {
+  ULOG_ERRNO_RETURN_ERR_IF(mThread.joinable(), EBUSY);
+  ULOG_ERRNO_RETURN_ERR_IF(config.queries.empty(), EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(
+      config.queries.size() > OCCUPANCY_MAX_DENSITY_QUERIES, EINVAL);
+
+  mAutoConfig = config;
+  mAutoAnalysis = true;
+  return 0;
+}
+
+int SpatialPerception::enablePyramid(const OccupancyPyramid::Config &config) {
+  ULOG_ERRNO_RETURN_ERR_IF(mThread.joinable(), EBUSY);
+
+  mPyramid.reset(new OccupancyPyramid(config));
+  mPyramidBack.reset(new OccupancyPyramid(config));
+  return 0;
+}
+
+int SpatialPerception::enablePlanner(const PathPlanner::Config &config) {
+  ULOG_ERRNO_RETURN_ERR_IF(mThread.joinable(), EBUSY);
+  ULOG_ERRNO_RETURN_ERR_IF(mPyramid == nullptr, ENOSYS);
+  ULOG_ERRNO_RETURN_ERR_IF(
+      config.level >= mPyramid->getConfig().levelCount, EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(config.radius < 0.f, EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(config.maxOpenNodes == 0, EINVAL);
+
+  mPlanner.reset(new PathPlanner(config));
+  return 0;
+}
+
+int SpatialPerception::enableRecording(
+    const SnapshotRecorder::Config &config) {
+  ULOG_ERRNO_RETURN_ERR_IF(mThread.joinable(), EBUSY);
+  ULOG_ERRNO_RETURN_ERR_IF(config.dir.empty(), EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(config.bytesPerSecond == 0, EINVAL);
+
+  mRecorder.reset(new SnapshotRecorder(config));
+  return 0;
+}
+
+int SpatialPerception::enableReplay(const std::string &dir,
+                                    unsigned int periodMs, bool repeat) {
+  ULOG_ERRNO_RETURN_ERR_IF(mThread.joinable(), EBUSY);
+  ULOG_ERRNO_RETURN_ERR_IF(dir.empty(), EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(periodMs == 0, EINVAL);
+
+  mPlayer.reset(new SnapshotPlayer(mLoop, this, dir, periodMs, repeat));
+  return 0;
+}
+
+int SpatialPerception::startClearanceTelemetry() {
+  char name[32];
+  int res;
+
+  mClearanceTlm.rayCount = mClearanceRing->getRayCount();
+  mClearanceTlm.azimuthCount = mClearanceRing->getConfig().azimuthCount;
+  const std::vector<float> &elevations = mClearanceRing->getConfig().elevations;
+  for (size_t i = 0; i < elevations.size(); i++)
+    mClearanceTlm.elevations[i] = elevations[i];
+  for (unsigned int i = 0; i < mClearanceTlm.rayCount; i++)
+    mClearanceTlm.clearances[i] = NAN;
 
-SpatialPerception::~SpatialPerception() {}
+  mClearanceProducer = telemetry::Producer::create(
+      mClearanceSection, CLEARANCE_TLM_COUNT, CLEARANCE_TLM_RATE, nullptr,
+      false);
+  if (mClearanceProducer == nullptr) {
+    ULOG_ERRNO("telemetry::Producer::create", ENOMEM);
+    return -ENOMEM;
+  }
+
+  /* Fields are named after their array element, only the elements in use
+   * are registered */
+  mClearanceFieldNames.clear();
+  for (size_t i = 0; i < elevations.size(); i++) {
+    snprintf(name, sizeof(name), "elevations[%zu]", i);
+    mClearanceFieldNames.push_back(name);
+  }
+  for (unsigned int i = 0; i < mClearanceTlm.rayCount; i++) {
+    snprintf(name, sizeof(name), "clearances[%u]", i);
+    mClearanceFieldNames.push_back(name);
+  }
+  res = mClearanceProducer->reg(mClearanceTlm.rayCount, "ray_count");
+  if (res == 0)
+    res = mClearanceProducer->reg(mClearanceTlm.azimuthCount,
+                                  "azimuth_count");
+  for (size_t i = 0; i < elevations.size() && res == 0; i++) {
+    res = mClearanceProducer->reg(mClearanceTlm.elevations[i],
+                                  mClearanceFieldNames[i]);
+  }
+  for (unsigned int i = 0; i < mClearanceTlm.rayCount && res == 0; i++) {
+    res = mClearanceProducer->reg(
+        mClearanceTlm.clearances[i],
+        mClearanceFieldNames[elevations.size() + i]);
+  }
+  if (res == 0)
+    res = mClearanceProducer->reg(mClearanceTlm.castUs, "cast_us");
+  if (res == 0)
+    res = mClearanceProducer->reg(mClearanceTlm.batchMaxUs, "batch_max_us");
+  if (res == 0)
+    res = mClearanceProducer->reg(mClearanceTlm.skippedBatches,
+                                  "skipped_batches");
+  if (res == 0)
+    res = mClearanceProducer->regComplete();
+  if (res < 0) {
+    ULOG_ERRNO("clearance telemetry registration", -res);
+    telemetry::Producer::release(mClearanceProducer);
+    mClearanceProducer = nullptr;
+    return res;
+  }
+  return 0;
+}
 
 int SpatialPerception::start() {
   moser::Client::Config moserConfig = {.addr = mServerAddress};
 
-  int ret = moser::Client::create(mLoop, moserConfig, this, &mMoserClient);
+  if (mClearanceRing != nullptr && mClearanceProducer == nullptr) {
+    int res = mClearanceRing->start();
+    if (res < 0) {
+      ULOG_ERRNO("ClearanceRing::start", -res);
+      return res;
+    }
+    res = startClearanceTelemetry();
+    if (res < 0)
+      return res;
+  }
+
+  if (mDistanceField != nullptr && !mDistanceFieldConfig.shmName.empty() &&
+      mDistanceFieldShm == nullptr) {
+    int res = DistanceFieldShm::create(mDistanceFieldConfig.shmName,
+                                       mDistanceFieldConfig.shmMaxVoxels,
+                                       &mDistanceFieldShm);
+    if (res < 0) {
+      ULOG_ERRNO("DistanceFieldShm::create", -res);
+      return res;
+    }
+  }
+
+  if (mGridDiff != nullptr && !mGridDeltaConfig.shmName.empty() &&
+      mGridDeltaShm == nullptr) {
+    int res = GridDeltaShm::create(mGridDeltaConfig.shmName,
+                                   mGridDeltaConfig.shmSlotCount,
+                                   mGridDeltaConfig.shmMaxBlocks,
+                                   &mGridDeltaShm);
+    if (res < 0) {
+      ULOG_ERRNO("GridDeltaShm::create", -res);
+      return res;
+    }
+  }
+
+  if (mPyramid != nullptr) {
+    int res = mPyramid->start();
+    if (res == 0)
+      res = mPyramidBack->start();
+    if (res < 0) {
+      ULOG_ERRNO("OccupancyPyramid::start", -res);
+      mPyramid->stop();
+      return res;
+    }
+  }
+
+  if (mRecorder != nullptr) {
+    int res = mRecorder->start();
+    if (res < 0) {
+      ULOG_ERRNO("SnapshotRecorder::start", -res);
+      return res;
+    }
+  }
+
+  /* Results of the analysis thread are given back on the loop */
+  mAnalysisEvt = pomp_evt_new();
+  if (mAnalysisEvt == nullptr) {
+    ULOG_ERRNO("pomp_evt_new", ENOMEM);
+    return -ENOMEM;
+  }
+  int ret = pomp_evt_attach_to_loop(mAnalysisEvt, mLoop->get(),
+                                    &SpatialPerception::analysisEvtCb, this);
+  if (ret < 0) {
+    ULOG_ERRNO("pomp_evt_attach_to_loop", -ret);
+    pomp_evt_destroy(mAnalysisEvt);
+    mAnalysisEvt = nullptr;
+    return ret;
+  }
+
+  mStopRequested = false;
+  mLastGridGeneration = 0;
+  mCoalescedGrids = 0;
+  mUnchangedGrids = 0;
+  mAutoResultCount = 0;
+  mAutoLatencySumUs = 0;
+  mAutoLatencyMaxUs = 0;
+  mDeltaCount = 0;
+  mDeltaChangedBlocks = 0;
+  mDeltaTotalBlocks = 0;
+  mDeltaObstacleBlocks = 0;
+  mDeltaUsSum = 0;
+  mDroppedGridFrames = 0;
+  mFrontierPending = false;
+  mFrontierCount = 0;
+  mFrontierBehind = 0;
+  mFrontierUsSum = 0;
+  mFrontierUsMax = 0;
+  mGridDelta.generation = 0;
+  if (mGridDiff != nullptr)
+    mGridDiff->reset();
+  if (mStreamer != nullptr)
+    mStreamer.reset(new GridStreamer(mStreamer->getConfig()));
+  if (mFrontierMap != nullptr)
+    mFrontierMap.reset(new FrontierMap(mFrontierMap->getConfig()));
+  mThread = std::thread(&SpatialPerception::analysisThread, this);
+
+  if (mPlayer != nullptr) {
+    ret = mPlayer->start();
+    if (ret < 0)
+      ULOG_ERRNO("SnapshotPlayer::start", -ret);
+    return ret;
+  }
+
+  ret = moser::Client::create(mLoop, moserConfig, this, &mMoserClient);
 
   if (ret < 0) {
     ULOG_ERRNO("start moser ipc client", -ret);
@@ -75,13 +399,115 @@ int SpatialPerception::start() {
 }
 
 void SpatialPerception::stop() {
+  std::vector<std::unique_ptr<moser::IGrid>> grids;
+
   this->mIsReady = false;
+
+  /* Wait for the analysis in progress, if any */
+  if (mThread.joinable()) {
+    mMutex.lock();
+    mStopRequested = true;
+    mCond.notify_one();
+    mMutex.unlock();
+    mThread.join();
+  }
+  if (mAnalysisEvt != nullptr) {
+    pomp_evt_detach_from_loop(mAnalysisEvt, mLoop->get());
+    pomp_evt_destroy(mAnalysisEvt);
+    mAnalysisEvt = nullptr;
+  }
+
+  if (mDistanceFieldShm != nullptr) {
+    DistanceFieldShm::destroy(mDistanceFieldShm);
+    mDistanceFieldShm = nullptr;
+  }
+  if (mGridDeltaShm != nullptr) {
+    GridDeltaShm::destroy(mGridDeltaShm);
+    mGridDeltaShm = nullptr;
+  }
+  if (mGridDiff != nullptr) {
+    ULOGI("grid deltas: %u, %.1f%% of the blocks changed, %llu blocks with "
+          "new obstacles, diff mean %.0f us",
+          mDeltaCount,
+          mDeltaTotalBlocks > 0
+              ? 100. * mDeltaChangedBlocks / mDeltaTotalBlocks
+              : 0.,
+          (unsigned long long)mDeltaObstacleBlocks,
+          mDeltaCount > 0 ? (double)mDeltaUsSum / mDeltaCount : 0.);
+  }
+  if (mStreamer != nullptr) {
+    const GridStreamer::Stats &stats = mStreamer->getStats();
+    uint64_t elapsedNs = stats.lastNs - stats.firstNs;
+    ULOGI("grid stream: %u keyframes, %u deltas, %u skipped, %u dropped, "
+          "compression ratio %.0f, %.0f bytes/s, encode mean %.0f us max "
+          "%llu us",
+          stats.keyframes, stats.deltas, stats.skipped, mDroppedGridFrames,
+          stats.encodedBytes > 0
+              ? (double)stats.rawBytes / stats.encodedBytes
+              : 0.,
+          elapsedNs > 0 ? stats.encodedBytes * 1e9 / elapsedNs : 0.,
+          stats.keyframes + stats.deltas > 0
+              ? (double)stats.encodeUsSum / (stats.keyframes + stats.deltas)
+              : 0.,
+          (unsigned long long)stats.encodeUsMax);
+  }
+  if (mFrontierMap != nullptr) {
+    ULOGI("frontiers: %u grids, %u behind the budget, extraction mean %.0f "
+          "us max %llu us",
+          mFrontierCount, mFrontierBehind,
+          mFrontierCount > 0 ? (double)mFrontierUsSum / mFrontierCount : 0.,
+          (unsigned long long)mFrontierUsMax);
+  }
+  if (mClearanceRing != nullptr)
+    mClearanceRing->stop();
+  if (mPyramid != nullptr) {
+    mPyramid->stop();
+    mPyramidBack->stop();
+  }
+  if (mClearanceProducer != nullptr) {
+    telemetry::Producer::release(mClearanceProducer);
+    mClearanceProducer = nullptr;
+  }
+  if (mRecorder != nullptr) {
+    mRecorder->stop();
+    SnapshotRecorder::Stats stats = mRecorder->getStats();
+    ULOGI("snapshots: %u recorded, %u throttled, %u busy, %u failed",
+          stats.recorded, stats.throttled, stats.busy, stats.failed);
+  }
+
+  /* Every grid is back to the loop thread */
+  grids = std::move(mReleasedGrids);
+  mReleasedGrids.clear();
+  if (mAnalysedGrid != nullptr)
+    grids.push_back(std::move(mAnalysedGrid));
+  if (mLastGrid != nullptr)
+    grids.push_back(std::move(mLastGrid));
+  mResults.clear();
+  mPathRequests.clear();
+  mPathResults.clear();
+  mGridFrames.clear();
+  mFrontierPending = false;
+  mAnalysisRequested = false;
+  mGridChanged = false;
+  mAutoPending = false;
+  if (mAutoAnalysis) {
+    ULOGI("auto analysis: %u results, latency mean %.0f us max %llu us, "
+          "%u grids coalesced, %u unchanged grids",
+          mAutoResultCount,
+          mAutoResultCount > 0 ? (double)mAutoLatencySumUs / mAutoResultCount
+                               : 0.,
+          (unsigned long long)mAutoLatencyMaxUs, mCoalescedGrids,
+          mUnchangedGrids);
+  }
+
+  if (mPlayer != nullptr) {
+    mPlayer->stop();
+    releaseGrids(grids);
+  }
   if (mMoserClient != nullptr) {
     mMoserClient->stop();
     if (mMoserConsumer != nullptr) {
-      if (mLastGrid != nullptr)
-        mMoserClient->releaseGrid(mMoserConsumer, std::move(mLastGrid));
-      mLastGrid = nullptr;
+      releaseGrids(grids);
       mMoserClient->removeConsumer(mMoserConsumer);
       mMoserConsumer = nullptr;
     }
@@ -90,17 +516,543 @@ void SpatialPerception::stop() {
   }
 }
 
+void SpatialPerception::releaseGrid(std::unique_ptr<moser::IGrid> grid) {
+  /* Grids go back to where they come from */
+  if (mPlayer != nullptr)
+    mPlayer->releaseGrid(std::move(grid));
+  else if (mMoserClient != nullptr && mMoserConsumer != nullptr)
+    mMoserClient->releaseGrid(mMoserConsumer, std::move(grid));
+}
+
+void SpatialPerception::releaseGrids(
+    std::vector<std::unique_ptr<moser::IGrid>> &grids) {
+  for (auto &grid : grids)
+    releaseGrid(std::move(grid));
+  grids.clear();
+}
+
 void SpatialPerception::gridReceived(moser::Client::Consumer *consumer,
                                      std::unique_ptr<moser::IGrid> grid) {
-  bool wasNull = (mLastGrid == nullptr);
-  if (!wasNull)
-    mMoserClient->releaseGrid(consumer, std::move(mLastGrid));
+  std::unique_ptr<moser::IGrid> previous;
+  bool wasReady = mIsReady;
+
+  /* Only swap pointers under the lock, the analysis thread keeps its grid
+   * until it is done with it */
+  mMutex.lock();
+  previous = std::move(mLastGrid);
   mLastGrid = std::move(grid);
-  if (wasNull) {
+  mLastGridGeneration++;
+  mLastGridTimestampNs = timeNowNs();
+  if (mAutoAnalysis) {
+    if (mAutoPending) {
+      mCoalescedGrids++;
+    } else {
+      mAutoPending = true;
+      mAutoPendingSince = std::chrono::steady_clock::now();
+    }
+  }
+  if (mGridDiff != nullptr || mDistanceField != nullptr ||
+      mClearanceRing != nullptr || mPyramid != nullptr ||
+      mRecorder != nullptr || mAutoAnalysis) {
+    mGridChanged = true;
+    mCond.notify_one();
+  }
+  mMutex.unlock();
+
+  if (previous != nullptr)
+    releaseGrid(std::move(previous));
+
+  if (!wasReady) {
     ULOGI("first grid");
     this->mIsReady = true;
     mClient->onSpatialPerceptionReady();
   }
 }
 
-const moser::IGrid &SpatialPerception::getGrid() const { return *mLastGrid; }
+int SpatialPerception::requestAnalysis(
+    const std::vector<DensityQuery> &queries) {
+  ULOG_ERRNO_RETURN_ERR_IF(queries.empty(), EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(queries.size() > OCCUPANCY_MAX_DENSITY_QUERIES,
+                           EINVAL);
+  ULOG_ERRNO_RETURN_ERR_IF(!mIsReady, EAGAIN);
+
+  mMutex.lock();
+  mAnalysisRequested = true;
+  mRequestQueries = queries;
+  mCond.notify_one();
+  mMutex.unlock();
+
+  return 0;
+}
+
+int SpatialPerception::requestPath(const PathPlanner::Request &request) {
+  ULOG_ERRNO_RETURN_ERR_IF(mPlanner == nullptr, ENOSYS);
+  ULOG_ERRNO_RETURN_ERR_IF(!mIsReady, EAGAIN);
+
+  std::lock_guard<std::mutex> lk(mMutex);
+  if (mPathRequests.size() >= SPATIAL_PERCEPTION_MAX_PATH_REQUESTS)
+    return -EBUSY;
+  mPathRequests.push_back(request);
+  mCond.notify_one();
+  return 0;
+}
+
+static void computeGridDensities(const moser::IGrid &grid,
+                                 const std::vector<DensityQuery> &queries,
+                                 std::vector<float> &densities) {
+  const OccupancyVolume *volume = getGridVolume(grid);
+
+  densities.resize(queries.size());
+  if (volume != nullptr) {
+    int res = computeDensities(*volume, queries.data(), queries.size(),
+                               densities.data());
+    if (res == 0)
+      return;
+    ULOG_ERRNO("computeDensities", -res);
+  }
+
+  /* Without access to the voxels, each query traverses the grid */
+  for (size_t i = 0; i < queries.size(); i++) {
+    densities[i] = grid.getObstacleDensityRatio(queries[i].logodd,
+                                                queries[i].distance);
+  }
+}
+
+void SpatialPerception::diffGrid(const moser::IGrid &grid,
+                                 uint64_t generation, uint64_t timestampNs) {
+  const OccupancyVolume *volume = getGridVolume(grid);
+
+  if (volume == nullptr)
+    return;
+
+  auto start = std::chrono::steady_clock::now();
+  int res = mGridDiff->update(*volume, &mGridDelta);
+  if (res < 0) {
+    ULOG_ERRNO("GridDiff::update", -res);
+    return;
+  }
+  auto end = std::chrono::steady_clock::now();
+  uint64_t diffUs =
+      std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+          .count();
+  mGridDelta.generation = generation;
+  mGridDelta.timestampNs = timestampNs;
+
+  /* Blocks gaining obstacles show the obstacles which moved in */
+  size_t obstacleBlocks = 0;
+  if (!mGridDelta.full) {
+    for (const GridBlock &block : mGridDelta.changed)
+      obstacleBlocks += block.occupied > block.previousOccupied;
+  }
+  ULOGD("grid delta%s: %zu/%zu blocks changed, %zu with new obstacles, "
+        "%llu us",
+        mGridDelta.full ? " (full)" : "", mGridDelta.changed.size(),
+        mGridDelta.blockCount(), obstacleBlocks, (unsigned long long)diffUs);
+  mDeltaCount++;
+  mDeltaChangedBlocks += mGridDelta.changed.size();
+  mDeltaTotalBlocks += mGridDelta.blockCount();
+  mDeltaObstacleBlocks += obstacleBlocks;
+  mDeltaUsSum += diffUs;
+
+  if (mGridDeltaShm != nullptr) {
+    res = mGridDeltaShm->publish(mGridDelta);
+    if (res < 0)
+      ULOG_ERRNO("GridDeltaShm::publish", -res);
+  }
+  for (GridDeltaListener *listener : mDeltaListeners)
+    listener->onGridDelta(*volume, mGridDelta);
+}
+
+void SpatialPerception::streamGrid(const moser::IGrid &grid,
+                                   uint64_t generation,
+                                   std::vector<GridStreamer::Frame> &frames) {
+  const OccupancyVolume *volume = getGridVolume(grid);
+  GridStreamer::Frame frame;
+
+  /* The delta shall be the one of this grid */
+  if (volume == nullptr || mGridDelta.generation != generation)
+    return;
+
+  int res = mStreamer->update(*volume, mGridDelta, &frame);
+  if (res == -EAGAIN)
+    return;
+  if (res < 0) {
+    ULOG_ERRNO("GridStreamer::update", -res);
+    return;
+  }
+  ULOGD("grid stream %s %u: %u blocks, %zu bytes, %llu us",
+        frame.keyframe ? "keyframe" : "delta of keyframe", frame.keyframeId,
+        frame.blockCount, frame.payload.size(),
+        (unsigned long long)frame.encodeUs);
+  frames.push_back(std::move(frame));
+}
+
+bool SpatialPerception::extractFrontiers(const moser::IGrid &grid,
+                                         uint64_t generation,
+                                         FrontierMap::Result &result) {
+  const OccupancyVolume *volume = getGridVolume(grid);
+
+  /* The delta shall be the one of this grid */
+  if (volume == nullptr || mGridDelta.generation != generation)
+    return false;
+
+  int res = mFrontierMap->update(*volume, mGridDelta, &result);
+  if (res < 0) {
+    ULOG_ERRNO("FrontierMap::update", -res);
+    return false;
+  }
+  result.generation = generation;
+  ULOGD("frontiers: %zu voxels, %zu clusters%s, %zu blocks searched, %zu "
+        "left, %llu us",
+        result.frontierVoxels, result.clusters,
+        result.clustered ? "" : " (previous)", result.updatedBlocks,
+        result.pendingBlocks, (unsigned long long)result.extractUs);
+  mFrontierCount++;
+  if (result.pendingBlocks > 0 || !result.clustered)
+    mFrontierBehind++;
+  mFrontierUsSum += result.extractUs;
+  mFrontierUsMax = std::max(mFrontierUsMax, result.extractUs);
+  return true;
+}
+
+void SpatialPerception::updateDistanceField(const moser::IGrid &grid) {
+  const OccupancyVolume *volume = getGridVolume(grid);
+  DistanceField::Stats stats;
+
+  if (volume == nullptr)
+    return;
+
+  auto start = std::chrono::steady_clock::now();
+  int res = mDistanceField->update(*volume, &stats);
+  if (res < 0) {
+    ULOG_ERRNO("DistanceField::update", -res);
+    return;
+  }
+  auto end = std::chrono::steady_clock::now();
+  ULOGD("distance field %s update: %zu obstacles changed, %zu distances "
+        "changed, %zu voxels visited, %lld us",
+        stats.full ? "full" : "incremental", stats.changedObstacles,
+        stats.changedVoxels, stats.visitedVoxels,
+        (long long)std::chrono::duration_cast<std::chrono::microseconds>(
+            end - start)
+            .count());
+
+  if (mDistanceFieldShm != nullptr) {
+    res = mDistanceFieldShm->publish(*mDistanceField, stats.full);
+    if (res < 0)
+      ULOG_ERRNO("DistanceFieldShm::publish", -res);
+  }
+}
+
+void SpatialPerception::castClearance(const moser::IGrid &grid) {
+  const OccupancyVolume *volume = getGridVolume(grid);
+  ClearanceRing::Stats stats;
+
+  if (volume == nullptr)
+    return;
+
+  int res = mClearanceRing->cast(*volume, mClearanceTlm.clearances, &stats);
+  if (res < 0) {
+    ULOG_ERRNO("ClearanceRing::cast", -res);
+    return;
+  }
+  if (stats.skippedBatches > 0) {
+    ULOGW("clearance: %u batches of rays skipped, cast %.0f us",
+          stats.skippedBatches, stats.castUs);
+  }
+  mClearanceTlm.castUs = stats.castUs;
+  mClearanceTlm.batchMaxUs = stats.batchMaxUs;
+  mClearanceTlm.skippedBatches = stats.skippedBatches;
+
+  res = mClearanceProducer->putSample(nullptr);
+  if (res < 0)
+    ULOG_ERRNO("telemetry::Producer::putSample", -res);
+}
+
+void SpatialPerception::buildPyramid(const moser::IGrid &grid) {
+  const OccupancyVolume *volume = getGridVolume(grid);
+
+  if (volume == nullptr)
+    return;
+
+  auto start = std::chrono::steady_clock::now();
+  int res = mPyramidBack->build(*volume);
+  if (res < 0) {
+    ULOG_ERRNO("OccupancyPyramid::build", -res);
+    return;
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  std::lock_guard<std::mutex> lk(mPyramidMutex);
+  std::swap(mPyramid, mPyramidBack);
+  ULOGD("pyramid built in %lld us",
+        (long long)std::chrono::duration_cast<std::chrono::microseconds>(
+            end - start)
+            .count());
+}
+
+int SpatialPerception::checkBox(const float min[3], const float max[3],
+                                bool *collides) {
+  std::lock_guard<std::mutex> lk(mPyramidMutex);
+  ULOG_ERRNO_RETURN_ERR_IF(mPyramid == nullptr, ENOSYS);
+
+  return mPyramid->checkBox(min, max, collides, nullptr);
+}
+
+int SpatialPerception::checkCorridor(const float from[3], const float to[3],
+                                     float radius, bool *collides) {
+  std::lock_guard<std::mutex> lk(mPyramidMutex);
+  ULOG_ERRNO_RETURN_ERR_IF(mPyramid == nullptr, ENOSYS);
+
+  return mPyramid->checkSegment(from, to, radius, collides, nullptr);
+}
+
+float SpatialPerception::getObstacleDistance(const moser::IGrid &grid) const {
+  const OccupancyVolume *volume = getGridVolume(grid);
+
+  if (mDistanceField == nullptr || volume == nullptr)
+    return NAN;
+  return mDistanceField->getDistance(volume->center);
+}
+
+void SpatialPerception::recordGrid(const moser::IGrid &grid,
+                                   uint64_t timestampNs) {
+  const OccupancyVolume *volume = getGridVolume(grid);
+
+  if (volume == nullptr)
+    return;
+
+  /* Grids over the bandwidth of the recorder are silently skipped, they
+   * are counted in its statistics */
+  int res = mRecorder->submit(*volume, timestampNs);
+  if (res < 0 && res != -EAGAIN)
+    ULOG_ERRNO("SnapshotRecorder::submit", -res);
+}
+
+void SpatialPerception::analyseGrid(const moser::IGrid &grid,
+                                    AnalysisResult &result) const {
+  const OccupancyVolume *volume = getGridVolume(grid);
+
+  computeGridDensities(grid, result.queries, result.densities);
+  result.obstacleDistance = getObstacleDistance(grid);
+  for (int i = 0; i < 3; i++)
+    result.position[i] = volume != nullptr ? volume->center[i] : NAN;
+}
+
+std::chrono::steady_clock::time_point SpatialPerception::getAutoAnalysisTime(
+    std::chrono::steady_clock::time_point lastStart) const {
+  std::chrono::milliseconds minInterval(mAutoConfig.minIntervalMs);
+  std::chrono::milliseconds maxLatency(mAutoConfig.maxLatencyMs);
+
+  /* As soon as the minimum interval has elapsed, but no later than the
+   * maximum latency of the oldest waiting grid */
+  return std::min(std::max(lastStart + minInterval, mAutoPendingSince),
+                  mAutoPendingSince + maxLatency);
+}
+
+void SpatialPerception::analysisThread() {
+  std::unique_lock<std::mutex> lk(mMutex);
+  std::chrono::steady_clock::time_point lastAutoStart;
+  AnalysisResult result, autoResult;
+  std::vector<PathPlanner::Request> pathRequests;
+  std::vector<PathPlanner::Result> pathResults;
+  std::vector<GridStreamer::Frame> gridFrames;
+  FrontierMap::Result frontierResult;
+  bool requested, changed, autoDue, unchanged, frontiers;
+  uint64_t generation, timestampNs;
+  /* Hashes of the latest grid, of the previous one and of the grid of the
+   * last automatic analysis, if they give access to their voxels */
+  bool hashed = false, previousHashed, autoHashed = false;
+  uint64_t hash = 0, previousHash, autoHash = 0;
+  /* Densities of the last automatic result given to the client */
+  std::vector<float> autoDensities;
+
+  autoResult.queries = mAutoConfig.queries;
+  autoResult.automatic = true;
+  result.automatic = false;
+
+  while (true) {
+    /* Wait for a request, a grid not yet given to the analyses run on every
+     * grid or the time of the automatic analysis, with a grid to analyse */
+    auto now = std::chrono::steady_clock::now();
+    autoDue = false;
+    if (!mStopRequested && mLastGrid != nullptr && mAutoPending) {
+      auto autoTime = getAutoAnalysisTime(lastAutoStart);
+      autoDue = now >= autoTime;
+      if (!autoDue && !mAnalysisRequested && !mGridChanged &&
+          mPathRequests.empty()) {
+        mCond.wait_until(lk, autoTime);
+        continue;
+      }
+    }
+    if (mStopRequested)
+      break;
+    if (mLastGrid == nullptr || (!mAnalysisRequested && !mGridChanged &&
+                                 !autoDue && mPathRequests.empty())) {
+      mCond.wait(lk);
+      continue;
+    }
+
+    /* Take the latest grid, the loop thread may receive a new one
+     * meanwhile */
+    mAnalysedGrid = std::move(mLastGrid);
+    requested = mAnalysisRequested;
+    changed = mGridChanged;
+    generation = mLastGridGeneration;
+    timestampNs = mLastGridTimestampNs;
+    mAnalysisRequested = false;
+    mGridChanged = false;
+    if (autoDue)
+      mAutoPending = false;
+    if (requested)
+      result.queries = mRequestQueries;
+    pathRequests.swap(mPathRequests);
+
+    /* Do the heavy computation outside lock */
+    lk.unlock();
+    unchanged = false;
+    if (changed) {
+      /* A grid identical to the previous one gets no analysis */
+      const OccupancyVolume *volume = getGridVolume(*mAnalysedGrid);
+      previousHashed = hashed;
+      previousHash = hash;
+      hashed = volume != nullptr;
+      hash = hashed ? hashVolume(*volume) : 0;
+      unchanged = hashed && previousHashed && hash == previousHash;
+      changed = !unchanged;
+    }
+    if (changed && mGridDiff != nullptr)
+      diffGrid(*mAnalysedGrid, generation, timestampNs);
+    if (changed && mStreamer != nullptr)
+      streamGrid(*mAnalysedGrid, generation, gridFrames);
+    frontiers = changed && mFrontierMap != nullptr &&
+                extractFrontiers(*mAnalysedGrid, generation, frontierResult);
+    if (changed && mRecorder != nullptr)
+      recordGrid(*mAnalysedGrid, timestampNs);
+    if (changed && mDistanceField != nullptr)
+      updateDistanceField(*mAnalysedGrid);
+    if (changed && mClearanceRing != nullptr)
+      castClearance(*mAnalysedGrid);
+    if (changed && mPyramid != nullptr)
+      buildPyramid(*mAnalysedGrid);
+    if (autoDue && hashed && autoHashed && hash == autoHash)
+      autoDue = false;
+    if (autoDue) {
+      lastAutoStart = now;
+      autoHashed = hashed;
+      autoHash = hash;
+      autoResult.generation = generation;
+      autoResult.timestampNs = timestampNs;
+      analyseGrid(*mAnalysedGrid, autoResult);
+      /* Grids without voxels can only be compared by their densities, a
+       * result equal to the previous one is not given again */
+      if (!hashed && autoResult.densities == autoDensities) {
+        autoDue = false;
+        unchanged = true;
+      } else {
+        autoDensities = autoResult.densities;
+      }
+    }
+    if (requested) {
+      result.generation = generation;
+      result.timestampNs = timestampNs;
+      analyseGrid(*mAnalysedGrid, result);
+    }
+    pathResults.resize(pathRequests.size());
+    for (size_t i = 0; i < pathRequests.size(); i++) {
+      int res = mPlanner->plan(*mPyramid, pathRequests[i], &pathResults[i]);
+      if (res < 0)
+        ULOG_ERRNO("PathPlanner::plan", -res);
+      pathResults[i].generation = generation;
+    }
+    pathRequests.clear();
+    lk.lock();
+
+    /* The grid stays the latest one unless a newer one has been received,
+     * otherwise it goes back to the server */
+    if (mLastGrid == nullptr)
+      mLastGrid = std::move(mAnalysedGrid);
+    else
+      mReleasedGrids.push_back(std::move(mAnalysedGrid));
+    if (unchanged)
+      mUnchangedGrids++;
+    if (autoDue)
+      mResults.push_back(autoResult);
+    if (requested)
+      mResults.push_back(result);
+    for (auto &pathResult : pathResults)
+      mPathResults.push_back(std::move(pathResult));
+    pathResults.clear();
+    for (auto &frame : gridFrames)
+      mGridFrames.push_back(std::move(frame));
+    gridFrames.clear();
+    if (mGridFrames.size() > SPATIAL_PERCEPTION_MAX_GRID_FRAMES) {
+      size_t dropped = mGridFrames.size() - SPATIAL_PERCEPTION_MAX_GRID_FRAMES;
+      mGridFrames.erase(mGridFrames.begin(), mGridFrames.begin() + dropped);
+      mDroppedGridFrames += dropped;
+    }
+    /* Only the goals of the latest grid are worth delivering, the buffers
+     * are swapped to be reused */
+    if (frontiers) {
+      std::swap(mFrontierResult, frontierResult);
+      mFrontierPending = true;
+    }
+    if (!autoDue && !requested && mPathResults.empty() &&
+        mGridFrames.empty() && !mFrontierPending && mReleasedGrids.empty())
+      continue;
+
+    int res = pomp_evt_signal(mAnalysisEvt);
+    if (res < 0)
+      ULOG_ERRNO("pomp_evt_signal", -res);
+  }
+}
+
+void SpatialPerception::analysisEvtCb(struct pomp_evt *evt, void *userdata) {
+  SpatialPerception *self = static_cast<SpatialPerception *>(userdata);
+  self->analysisDone();
+}
+
+void SpatialPerception::analysisDone() {
+  std::vector<std::unique_ptr<moser::IGrid>> grids;
+  std::vector<AnalysisResult> results;
+  std::vector<PathPlanner::Result> pathResults;
+  std::vector<GridStreamer::Frame> gridFrames;
+  FrontierMap::Result frontierResult;
+  bool frontiers;
+
+  mMutex.lock();
+  grids = std::move(mReleasedGrids);
+  mReleasedGrids.clear();
+  results = std::move(mResults);
+  mResults.clear();
+  pathResults = std::move(mPathResults);
+  mPathResults.clear();
+  gridFrames = std::move(mGridFrames);
+  mGridFrames.clear();
+  frontiers = mFrontierPending;
+  if (frontiers)
+    frontierResult = mFrontierResult;
+  mFrontierPending = false;
+  mMutex.unlock();
+
+  /* Give analysed grids back to the server right away */
+  releaseGrids(grids);
+
+  /* Latency up to the delivery to the client */
+  uint64_t now = timeNowNs();
+  for (auto &result : results) {
+    result.latencyUs = (now - result.timestampNs) / 1000;
+    if (result.automatic) {
+      mAutoResultCount++;
+      mAutoLatencySumUs += result.latencyUs;
+      mAutoLatencyMaxUs = std::max(mAutoLatencyMaxUs, result.latencyUs);
+    }
+    mClient->onAnalysisResult(result);
+  }
+  for (const auto &pathResult : pathResults)
+    mClient->onPathResult(pathResult);
+  for (const auto &frame : gridFrames)
+    mClient->onGridFrame(frame);
+  if (frontiers)
+    mClient->onFrontierGoals(frontierResult);
+}
@@ -32,24 +32,178 @@
 
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <libmoser_ipc_client.hpp>
 #include <libpomp.hpp>
+#include <libtelemetry.hpp>
+
+#include "clearance.hpp"
+#include "distance_field.hpp"
+#include "distance_field_shm.hpp"
+#include "frontier_map.hpp"
+#include "grid_delta.hpp"
+#include "grid_delta_shm.hpp"
+#include "grid_snapshot.hpp"
+#include "grid_stream.hpp"
+#include "occupancy_pyramid.hpp"
+#include "occupancy_volume.hpp"
+#include "path_planner.hpp"
+#include "snapshot_player.hpp"
+
+/* Maximum number of path requests waiting for the analysis thread. */
+#define SPATIAL_PERCEPTION_MAX_PATH_REQUESTS 4
+
+/* Maximum number of grid stream frames waiting for the loop thread, the
+ * oldest ones are dropped beyond. */
+#define SPATIAL_PERCEPTION_MAX_GRID_FRAMES 4
 
 class SpatialPerception : public ::moser::Client::Callbacks {
 public:
+  /* Result of the analysis of a grid. */
+  struct AnalysisResult {
+    /* Queries of the request and their obstacle density ratio, in the same
+     * order. */
+    std::vector<DensityQuery> queries;
+    std::vector<float> densities;
+    /* Distance from the drone to the nearest obstacle, from the distance
+     * field, NAN if unknown [m]. */
+    float obstacleDistance;
+    /* Position of the drone in the grid, NAN if unknown [m]. */
+    float position[3];
+    /* Number of the analysed grid since the start, and its reception time,
+     * CLOCK_MONOTONIC [ns]. */
+    uint64_t generation;
+    uint64_t timestampNs;
+    /* Time from the reception of the grid to the delivery of the result,
+     * including the wait for the analysis thread [us]. */
+    uint64_t latencyUs;
+    /* Whether the result comes from the analysis of received grids rather
+     * than from `requestAnalysis`. */
+    bool automatic;
+  };
+
+  /* Analysis of the grids as they are received. Grids received during the
+   * minimum interval are coalesced, only the latest one is analysed, unless
+   * the oldest of them would wait for more than the maximum latency. Grids
+   * identical to the previously analysed one are skipped, grids without
+   * voxels when their densities equal the previous result. */
+  struct AutoAnalysisConfig {
+    /* Queries computed on each analysed grid. */
+    std::vector<DensityQuery> queries;
+    /* Minimum interval between the start of two analyses [ms]. */
+    unsigned int minIntervalMs;
+    /* Maximum time from the reception of a grid to the start of its
+     * analysis, takes precedence over the minimum interval [ms]. */
+    unsigned int maxLatencyMs;
+  };
+
+  /* Distance field of the obstacles, updated from each grid giving access
+   * to its voxels. */
+  struct DistanceFieldConfig {
+    /* Name of the shared memory object the field is published in, not
+     * published if empty. */
+    std::string shmName;
+    /* Maximum number of voxels of the published field. */
+    size_t shmMaxVoxels;
+    /* Voxels with at least this log-odds are obstacles. */
+    int8_t obstacleLogodd;
+    /* Distances are computed up to this distance [m]. */
+    float maxDistance;
+  };
+
+  /* Block-level changes of each grid giving access to its voxels, given to
+   * the delta listeners. */
+  struct GridDeltaConfig {
+    /* Name of the shared memory ring the deltas are published in, not
+     * published if empty. */
+    std::string shmName;
+    /* Number of deltas of the ring, and maximum number of blocks of a
+     * delta. */
+    unsigned int shmSlotCount;
+    unsigned int shmMaxBlocks;
+    /* Voxels with at least this log-odds are obstacles. */
+    int8_t obstacleLogodd;
+  };
+
   class Client {
   public:
     virtual void onSpatialPerceptionReady() = 0;
+    /* Called on the loop thread when the analysis of a grid is done. */
+    virtual void onAnalysisResult(const AnalysisResult &result) = 0;
+    /* Called on the loop thread when a requested path has been planned. */
+    virtual void onPathResult(const PathPlanner::Result &result) = 0;
+    /* Called on the loop thread with each frame of the grid stream. */
+    virtual void onGridFrame(const GridStreamer::Frame &frame) = 0;
+    /* Called on the loop thread with the frontier goals of the latest
+     * grid, the results of older grids not yet delivered are dropped. */
+    virtual void onFrontierGoals(const FrontierMap::Result &result) = 0;
   };
 
   SpatialPerception(pomp::Loop *loop, SpatialPerception::Client *client,
                     const std::string &server, const std::string &consumer);
   ~SpatialPerception();
 
-  /* Subscribe to occupation grid server. */
+  /* Maintain a distance field of the obstacles, shall be called before
+   * `start`. */
+  int enableDistanceField(const DistanceFieldConfig &config);
+
+  /* Cast a ring of rays from the drone through each grid giving access to
+   * its voxels, and publish their clearance in the telemetry section
+   * `tlmSection`. Shall be called before `start`. */
+  int enableClearance(const ClearanceRing::Config &config,
+                      const std::string &tlmSection);
+
+  /* Diff each grid giving access to its voxels against the previous one,
+   * see GridDiff. Shall be called before `start`. */
+  int enableGridDelta(const GridDeltaConfig &config);
+
+  /* Give the delta of each grid to `listener`, from the analysis thread.
+   * Shall be called after `enableGridDelta` and before `start`. */
+  int addDeltaListener(GridDeltaListener *listener);
+
+  /* Encode the obstacles of the grids for a low bandwidth link, see
+   * GridStreamer, and give the frames to `Client::onGridFrame`. Shall be
+   * called after `enableGridDelta` and before `start`. */
+  int enableStreaming(const GridStreamer::Config &config);
+
+  /* Extract the frontiers of the explored space from the changed blocks of
+   * each grid, see FrontierMap, and give the ranked goals to
+   * `Client::onFrontierGoals`. Shall be called after `enableGridDelta` and
+   * before `start`. */
+  int enableFrontiers(const FrontierMap::Config &config);
+
+  /* Analyse the grids as they are received, shall be called before
+   * `start`. */
+  int enableAutoAnalysis(const AutoAnalysisConfig &config);
+
+  /* Build a max-pooled pyramid of the obstacles of each grid giving access
+   * to its voxels, for `checkBox` and `checkCorridor`. Shall be called
+   * before `start`. */
+  int enablePyramid(const OccupancyPyramid::Config &config);
+
+  /* Plan paths on the pyramid of the latest grid, see `requestPath`. Shall
+   * be called after `enablePyramid` and before `start`. */
+  int enablePlanner(const PathPlanner::Config &config);
+
+  /* Record the grids giving access to their voxels in snapshot files, shall
+   * be called before `start`. */
+  int enableRecording(const SnapshotRecorder::Config &config);
+
+  /* Replay the snapshots of a directory instead of subscribing to the
+   * occupation grid server, one every `periodMs`, looping over them if
+   * `repeat`. Shall be called before `start`. */
+  int enableReplay(const std::string &dir, unsigned int periodMs,
+                   bool repeat);
+
+  /* Subscribe to occupation grid server, or start the replay, and start the
+   * analysis thread. */
   int start();
   /* Unsubscribe from the occupation grid server. */
   void stop();
@@ -57,11 +211,52 @@ public:
   void gridReceived(moser::Client::Consumer *consumer,
                     std::unique_ptr<moser::IGrid> grid) override;
 
-  const moser::IGrid &getGrid() const;
+  /* Ask the analysis thread for the obstacle density ratios of a batch of
+   * at most OCCUPANCY_MAX_DENSITY_QUERIES queries on the latest grid. It
+   * never blocks on the analysis: the result is given to
+   * `Client::onAnalysisResult` later. A request made while an analysis is
+   * running is merged with the next one. Grids giving access to their
+   * voxels (`VolumeGrid`) are traversed once for the whole batch, other
+   * grids are queried once per query. */
+  int requestAnalysis(const std::vector<DensityQuery> &queries);
+
+  /* Ask the analysis thread for a path on the latest grid, planned after
+   * the pyramid of a new grid has been built. It never blocks on the
+   * planning: the result is given to `Client::onPathResult` later. Return
+   * -EBUSY if SPATIAL_PERCEPTION_MAX_PATH_REQUESTS requests are waiting. */
+  int requestPath(const PathPlanner::Request &request);
+
+  /* Check whether a box, or a segment swept by a sphere, contains an
+   * obstacle of the latest grid, see OccupancyPyramid. Return -EAGAIN if no
+   * pyramid has been built yet. */
+  int checkBox(const float min[3], const float max[3], bool *collides);
+  int checkCorridor(const float from[3], const float to[3], float radius,
+                    bool *collides);
 
   bool isReady() const { return this->mIsReady; }
 
 private:
+  void analysisThread();
+  void analysisDone();
+  static void analysisEvtCb(struct pomp_evt *evt, void *userdata);
+  void releaseGrid(std::unique_ptr<moser::IGrid> grid);
+  void releaseGrids(std::vector<std::unique_ptr<moser::IGrid>> &grids);
+  void recordGrid(const moser::IGrid &grid, uint64_t timestampNs);
+  void analyseGrid(const moser::IGrid &grid, AnalysisResult &result) const;
+  std::chrono::steady_clock::time_point
+  getAutoAnalysisTime(std::chrono::steady_clock::time_point lastStart) const;
+  void diffGrid(const moser::IGrid &grid, uint64_t generation,
+                uint64_t timestampNs);
+  void streamGrid(const moser::IGrid &grid, uint64_t generation,
+                  std::vector<GridStreamer::Frame> &frames);
+  bool extractFrontiers(const moser::IGrid &grid, uint64_t generation,
+                        FrontierMap::Result &result);
+  void updateDistanceField(const moser::IGrid &grid);
+  void castClearance(const moser::IGrid &grid);
+  void buildPyramid(const moser::IGrid &grid);
+  int startClearanceTelemetry();
+  float getObstacleDistance(const moser::IGrid &grid) const;
+
   /* The associated runloop. */
   pomp::Loop *const mLoop;
   /* The client to notify. */
@@ -74,9 +269,129 @@ private:
   moser::Client *mMoserClient;
   /* The occupation grid consumer that will get notified by the client. */
   moser::Client::Consumer *mMoserConsumer;
-  /* The last occupation grid received from the client. */
-  std::unique_ptr<moser::IGrid> mLastGrid;
-  /* A flag indicating whether the spatial perception is ready and thus
-   * `mLastGrid` can be accessed. */
+  /* A flag indicating whether a grid has been received. */
   bool mIsReady;
-};
\ No newline at end of file
+
+  /* Grids are double buffered between the loop thread and the analysis
+   * thread, all the following fields are protected by `mMutex`. The loop
+   * thread puts each new grid in `mLastGrid`, the analysis thread moves it
+   * to `mAnalysedGrid` while it is analysed. Grids to give back to the moser
+   * client, which is only used from the loop thread, wait in
+   * `mReleasedGrids`. */
+  std::mutex mMutex;
+  std::condition_variable mCond;
+  std::unique_ptr<moser::IGrid> mLastGrid;
+  /* Number of `mLastGrid` since the start and its reception time,
+   * CLOCK_MONOTONIC [ns]. */
+  uint64_t mLastGridGeneration;
+  uint64_t mLastGridTimestampNs;
+  std::unique_ptr<moser::IGrid> mAnalysedGrid;
+  std::vector<std::unique_ptr<moser::IGrid>> mReleasedGrids;
+  /* Pending request and its queries. */
+  bool mAnalysisRequested;
+  std::vector<DensityQuery> mRequestQueries;
+  /* Whether the latest grid has not been given to the analyses run on
+   * every grid, the grid diff, the distance field, the clearance ring and
+   * the recorder, yet. */
+  bool mGridChanged;
+  /* Whether a grid received since the last automatic analysis waits for
+   * one, and the reception time of the oldest such grid. */
+  bool mAutoPending;
+  std::chrono::steady_clock::time_point mAutoPendingSince;
+  /* Grids not analysed because a newer one was received before their
+   * automatic analysis, and grids identical to the previous one or whose
+   * densities were. */
+  unsigned int mCoalescedGrids;
+  unsigned int mUnchangedGrids;
+  /* Pending path requests. */
+  std::vector<PathPlanner::Request> mPathRequests;
+  /* Results not yet given to the client. */
+  std::vector<AnalysisResult> mResults;
+  std::vector<PathPlanner::Result> mPathResults;
+  std::vector<GridStreamer::Frame> mGridFrames;
+  unsigned int mDroppedGridFrames;
+  bool mFrontierPending;
+  FrontierMap::Result mFrontierResult;
+  bool mStopRequested;
+
+  /* The analysis thread and the event waking up the loop when it is done
+   * with a grid. */
+  std::thread mThread;
+  struct pomp_evt *mAnalysisEvt;
+
+  /* The distance field, only used by the analysis thread once started, and
+   * its shared memory. */
+  DistanceFieldConfig mDistanceFieldConfig;
+  std::unique_ptr<DistanceField> mDistanceField;
+  DistanceFieldShm *mDistanceFieldShm;
+
+  /* The grid diff, its last delta and its statistics, only used by the
+   * analysis thread once started, the shared memory ring of the deltas and
+   * the listeners. */
+  std::unique_ptr<GridDiff> mGridDiff;
+  GridDeltaConfig mGridDeltaConfig;
+  GridDelta mGridDelta;
+  GridDeltaShm *mGridDeltaShm;
+  std::vector<GridDeltaListener *> mDeltaListeners;
+  unsigned int mDeltaCount;
+  uint64_t mDeltaChangedBlocks;
+  uint64_t mDeltaTotalBlocks;
+  uint64_t mDeltaObstacleBlocks;
+  uint64_t mDeltaUsSum;
+
+  /* The encoder of the grid stream, only used by the analysis thread once
+   * started. */
+  std::unique_ptr<GridStreamer> mStreamer;
+
+  /* The frontier map and its statistics, only used by the analysis thread
+   * once started. */
+  std::unique_ptr<FrontierMap> mFrontierMap;
+  unsigned int mFrontierCount;
+  unsigned int mFrontierBehind;
+  uint64_t mFrontierUsSum;
+  uint64_t mFrontierUsMax;
+
+  /* Telemetry of the clearance ring: the rays of elevation i are rays
+   * i * azimuthCount to (i + 1) * azimuthCount - 1. */
+  struct ClearanceTlm {
+    uint32_t rayCount;
+    uint32_t azimuthCount;
+    float elevations[CLEARANCE_MAX_RAYS]; /* [deg] */
+    float clearances[CLEARANCE_MAX_RAYS]; /* [m], NAN if not cast */
+    float castUs;
+    float batchMaxUs;
+    uint32_t skippedBatches;
+  };
+
+  /* The clearance ring, only used by the analysis thread once started, and
+   * its telemetry producer. */
+  std::unique_ptr<ClearanceRing> mClearanceRing;
+  std::string mClearanceSection;
+  telemetry::Producer *mClearanceProducer;
+  ClearanceTlm mClearanceTlm;
+  std::vector<std::string> mClearanceFieldNames;
+
+  /* The pyramids of the obstacles. The analysis thread builds the pyramid
+   * of a new grid in `mPyramidBack` and swaps it with `mPyramid`, queried by
+   * any thread under `mPyramidMutex`, so queries never wait for a build. */
+  std::unique_ptr<OccupancyPyramid> mPyramid;
+  std::unique_ptr<OccupancyPyramid> mPyramidBack;
+  std::mutex mPyramidMutex;
+
+  /* The path planner, only used by the analysis thread once started, on
+   * `mPyramid` which only the analysis thread swaps. */
+  std::unique_ptr<PathPlanner> mPlanner;
+
+  /* The snapshot recorder, fed by the analysis thread, and the player
+   * replacing the moser client during a replay. */
+  std::unique_ptr<SnapshotRecorder> mRecorder;
+  std::unique_ptr<SnapshotPlayer> mPlayer;
+
+  /* Configuration of the automatic analysis, read-only once started, and
+   * latency of its results, only used by the loop thread. */
+  bool mAutoAnalysis;
+  AutoAnalysisConfig mAutoConfig;
+  unsigned int mAutoResultCount;
+  uint64_t mAutoLatencySumUs;
+  uint64_t mAutoLatencyMaxUs;
+};
@@ -0,0 +1,541 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include <libpomp.hpp>
+
+#define TELEMETRY_NOTIFY_MAGIC 0x4e4d4c54 /* "TLMN" */
+#define TELEMETRY_NOTIFY_VERSION 1
+
+/* Period of the wake ups of a watcher thread being stopped, in case it was
+ * about to block when the stop was requested [us] */
+#define TELEMETRY_WATCHER_STOP_PERIOD_US 1000
+
+/* Shared memory of a section, mapped by its producer and its watchers */
+struct TelemetryNotifyShm {
+	/* Written last by the producer, once the other fields are set */
+	uint32_t magic;
+	uint32_t version;
+	/* Number of notifications, futex word of the watchers */
+	uint32_t seq;
+	/* Number of watchers blocked on `seq`, the producer does not wake
+	 * them up if 0 */
+	uint32_t waiters;
+};
+
+static inline std::string telemetryNotifyShmName(const std::string &section)
+{
+	return "/" + section + ".notify";
+}
+
+static inline int telemetryNotifyFutexWait(uint32_t *word,
+					   uint32_t value,
+					   const timespec *timeout)
+{
+	/* Not FUTEX_PRIVATE_FLAG: the word is shared between processes */
+	if (syscall(SYS_futex, word, FUTEX_WAIT, value, timeout, NULL, 0) < 0)
+		return -errno;
+	return 0;
+}
+
+static inline void telemetryNotifyFutexWake(uint32_t *word)
+{
+	syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static inline int64_t telemetryNotifyTimeMs()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Notification of the samples put in a telemetry section.
+ *
+ * libtelemetry consumers can only poll a section. A producer using a
+ * TelemetryNotifier increments a counter in a small shared memory named after
+ * its section ("/<section>.notify") after each putSample, and wakes up the
+ * TelemetryWatcher objects blocked on it with a futex. Nothing is shared with
+ * libtelemetry itself: a watcher is only woken up for sections whose producer
+ * has a notifier.
+ *
+ * The shared memory is never removed, so that the watchers of a section keep
+ * working when its producer is restarted. It is only opened to the user and
+ * the group of its producer.
+ *
+ * Header only, so that the producer and the consumers of a mission, built
+ * separately, share a single copy. Nothing is logged here, errors are
+ * returned to the caller.
+ */
+
+class TelemetryNotifier {
+private:
+	/* Shared memory */
+	std::string mName;
+	struct TelemetryNotifyShm *mShm;
+
+	TelemetryNotifier() : mShm(nullptr) {}
+	~TelemetryNotifier();
+
+public:
+	/**
+	 * Create the notifier of a section, or reuse the one of a previous
+	 * producer of the section.
+	 *
+	 * @param section telemetry section of the producer.
+	 * @param ret pointer to return the notifier.
+	 *
+	 * @return 0 in case of success, negative errno in case of error.
+	 */
+	static int create(const std::string &section, TelemetryNotifier **ret);
+
+	/**
+	 * Destroy a notifier, the shared memory is left for the watchers.
+	 *
+	 * @param notifier notifier to destroy, may be nullptr.
+	 */
+	static void destroy(TelemetryNotifier *notifier);
+
+	/**
+	 * Notify the watchers of the section. To be called after putSample.
+	 * There is no system call if no watcher is blocked.
+	 */
+	void notify();
+};
+
+class TelemetryWatcher {
+private:
+	/* Shared memory */
+	struct TelemetryNotifyShm *mShm;
+	size_t mShmSize;
+
+	/* Wake up of a pomp loop: a thread blocked on the futex signals an
+	 * eventfd added to the loop */
+	pomp::Loop *mLoop;
+	int mEventFd;
+	pomp::Loop::HandlerFunc mEventHandlerFunc;
+	std::function<void()> mCallback;
+	std::thread mThread;
+	std::atomic<bool> mStopRequested;
+	std::atomic<bool> mThreadDone;
+
+	TelemetryWatcher();
+	~TelemetryWatcher();
+
+	void threadEntry();
+	void eventCb();
+
+public:
+	/**
+	 * Open the notifications of a section.
+	 *
+	 * @param section telemetry section to watch.
+	 * @param ret pointer to return the watcher.
+	 *
+	 * @return 0 in case of success, -ENOENT if the producer of the section
+	 *         has not created its notifier yet, negative errno in case of
+	 *         error.
+	 */
+	static int open(const std::string &section, TelemetryWatcher **ret);
+
+	/**
+	 * Destroy a watcher, detaching it from its loop if needed.
+	 *
+	 * @param watcher watcher to destroy, may be nullptr.
+	 */
+	static void destroy(TelemetryWatcher *watcher);
+
+	/**
+	 * Get the number of notifications of the section, changes each time a
+	 * sample is put. Does not block, for callers which cannot wait, like a
+	 * guidance mode skipping the read of a section without new sample.
+	 *
+	 * @return notification count, wraps around.
+	 */
+	uint32_t getSequence() const;
+
+	/**
+	 * Wait for a notification.
+	 *
+	 * @param seq last notification count seen by the caller, updated.
+	 * @param timeoutMs maximum time to wait, -1 to wait forever.
+	 *
+	 * @return 0 if a sample has been put since `seq`, -ETIMEDOUT, -EINTR
+	 *         if interrupted by a signal, negative errno in case of error.
+	 */
+	int wait(uint32_t *seq, int timeoutMs);
+
+	/**
+	 * Call a function from a pomp loop when samples are put. Several
+	 * samples put before the loop gets to the call give a single call.
+	 *
+	 * @param loop loop calling the function.
+	 * @param callback function to call.
+	 *
+	 * @return 0 in case of success, negative errno in case of error.
+	 */
+	int attach(pomp::Loop &loop, std::function<void()> callback);
+
+	/**
+	 * Stop calling the function given to attach.
+	 */
+	void detach();
+};
+
+inline TelemetryNotifier::~TelemetryNotifier()
+{
+	if (mShm != nullptr)
+		munmap(mShm, sizeof(*mShm));
+}
+
+inline int TelemetryNotifier::create(const std::string &section,
+				     TelemetryNotifier **ret)
+{
+	int res = 0;
+	int fd = -1;
+	void *map;
+	struct stat st;
+	TelemetryNotifier *self;
+
+	if (section.empty() || ret == nullptr)
+		return -EINVAL;
+
+	self = new TelemetryNotifier();
+	self->mName = telemetryNotifyShmName(section);
+
+	/* The shared memory of a previous producer of the section is reused,
+	 * its watchers are still mapping it */
+	fd = shm_open(self->mName.c_str(), O_RDWR | O_CREAT, 0660);
+	if (fd < 0) {
+		res = -errno;
+		goto error;
+	}
+	/* Consumers of the user or the group of the producer can wait for the
+	 * samples, whatever the umask */
+	fchmod(fd, 0660);
+	if (fstat(fd, &st) < 0) {
+		res = -errno;
+		goto error;
+	}
+	if ((size_t)st.st_size < sizeof(TelemetryNotifyShm)
+	    && ftruncate(fd, sizeof(TelemetryNotifyShm)) < 0) {
+		res = -errno;
+		goto error;
+	}
+	map = mmap(NULL,
+		   sizeof(TelemetryNotifyShm),
+		   PROT_READ | PROT_WRITE,
+		   MAP_SHARED,
+		   fd,
+		   0);
+	if (map == MAP_FAILED) {
+		res = -errno;
+		goto error;
+	}
+	close(fd);
+	fd = -1;
+	self->mShm = (TelemetryNotifyShm *)map;
+
+	if (__atomic_load_n(&self->mShm->magic, __ATOMIC_ACQUIRE)
+		    != TELEMETRY_NOTIFY_MAGIC
+	    || self->mShm->version != TELEMETRY_NOTIFY_VERSION) {
+		self->mShm->version = TELEMETRY_NOTIFY_VERSION;
+		self->mShm->seq = 0;
+		self->mShm->waiters = 0;
+		__atomic_store_n(&self->mShm->magic,
+				 TELEMETRY_NOTIFY_MAGIC,
+				 __ATOMIC_RELEASE);
+	}
+
+	*ret = self;
+	return 0;
+
+error:
+	if (fd >= 0)
+		close(fd);
+	delete self;
+	return res;
+}
+
+inline void TelemetryNotifier::destroy(TelemetryNotifier *notifier)
+{
+	delete notifier;
+}
+
+inline void TelemetryNotifier::notify()
+{
+	/* Sequentially consistent with the watchers: either a watcher sees
+	 * the new count before blocking, or it has been counted in `waiters`
+	 * before the count is read here */
+	__atomic_add_fetch(&mShm->seq, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&mShm->waiters, __ATOMIC_SEQ_CST) > 0)
+		telemetryNotifyFutexWake(&mShm->seq);
+}
+
+inline TelemetryWatcher::TelemetryWatcher() :
+		mShm(nullptr), mShmSize(0), mLoop(nullptr), mEventFd(-1),
+		mStopRequested(false), mThreadDone(true)
+{
+}
+
+inline TelemetryWatcher::~TelemetryWatcher()
+{
+	detach();
+	if (mShm != nullptr)
+		munmap(mShm, mShmSize);
+}
+
+inline int TelemetryWatcher::open(const std::string &section,
+				 TelemetryWatcher **ret)
+{
+	int res = 0;
+	int fd = -1;
+	void *map;
+	struct stat st;
+	std::string name;
+	TelemetryWatcher *self;
+
+	if (section.empty() || ret == nullptr)
+		return -EINVAL;
+
+	self = new TelemetryWatcher();
+	name = telemetryNotifyShmName(section);
+
+	/* Read-write for the futex and the count of waiters */
+	fd = shm_open(name.c_str(), O_RDWR, 0);
+	if (fd < 0) {
+		res = -errno;
+		goto error;
+	}
+	if (fstat(fd, &st) < 0) {
+		res = -errno;
+		goto error;
+	}
+	if ((size_t)st.st_size < sizeof(TelemetryNotifyShm)) {
+		res = -ENOENT;
+		goto error;
+	}
+	map = mmap(NULL,
+		   sizeof(TelemetryNotifyShm),
+		   PROT_READ | PROT_WRITE,
+		   MAP_SHARED,
+		   fd,
+		   0);
+	if (map == MAP_FAILED) {
+		res = -errno;
+		goto error;
+	}
+	close(fd);
+	fd = -1;
+	self->mShm = (TelemetryNotifyShm *)map;
+	self->mShmSize = sizeof(TelemetryNotifyShm);
+
+	if (__atomic_load_n(&self->mShm->magic, __ATOMIC_ACQUIRE)
+	    != TELEMETRY_NOTIFY_MAGIC) {
+		res = -ENOENT;
+		goto error;
+	}
+	if (self->mShm->version != TELEMETRY_NOTIFY_VERSION) {
+		res = -EPROTO;
+		goto error;
+	}
+
+	*ret = self;
+	return 0;
+
+error:
+	if (fd >= 0)
+		close(fd);
+	delete self;
+	return res;
+}
+
+inline void TelemetryWatcher::destroy(TelemetryWatcher *watcher)
+{
+	delete watcher;
+}
+
+inline uint32_t TelemetryWatcher::getSequence() const
+{
+	return __atomic_load_n(&mShm->seq, __ATOMIC_ACQUIRE);
+}
+
+inline int TelemetryWatcher::wait(uint32_t *seq, int timeoutMs)
+{
+	int res;
+	uint32_t current;
+	int64_t deadline = telemetryNotifyTimeMs() + timeoutMs;
+	int64_t remaining;
+	timespec timeout;
+
+	if (seq == nullptr)
+		return -EINVAL;
+
+	while (true) {
+		current = __atomic_load_n(&mShm->seq, __ATOMIC_SEQ_CST);
+		if (current != *seq) {
+			*seq = current;
+			return 0;
+		}
+		if (timeoutMs >= 0) {
+			remaining = deadline - telemetryNotifyTimeMs();
+			if (remaining <= 0)
+				return -ETIMEDOUT;
+			timeout.tv_sec = remaining / 1000;
+			timeout.tv_nsec = (remaining % 1000) * 1000000;
+		}
+
+		/* The kernel blocks only if the count is still `*seq` */
+		__atomic_add_fetch(&mShm->waiters, 1, __ATOMIC_SEQ_CST);
+		res = telemetryNotifyFutexWait(
+			&mShm->seq, *seq, timeoutMs >= 0 ? &timeout : nullptr);
+		__atomic_sub_fetch(&mShm->waiters, 1, __ATOMIC_SEQ_CST);
+		if (res == -EINTR)
+			return res;
+		if (res < 0 && res != -EAGAIN && res != -ETIMEDOUT)
+			return res;
+	}
+}
+
+inline void TelemetryWatcher::threadEntry()
+{
+	int res;
+	uint32_t seq = getSequence();
+	uint32_t current;
+	uint64_t one = 1;
+	sigset_t mask;
+
+	/* Signals are left to the thread of the loop, a futex wait is
+	 * restarted after a handler installed with SA_RESTART */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	while (!mStopRequested.load()) {
+		current = __atomic_load_n(&mShm->seq, __ATOMIC_SEQ_CST);
+		if (current != seq) {
+			seq = current;
+			/* The eventfd counter coalesces the notifications
+			 * until the loop reads it */
+			if (write(mEventFd, &one, sizeof(one)) < 0
+			    && errno != EAGAIN)
+				break;
+			continue;
+		}
+
+		__atomic_add_fetch(&mShm->waiters, 1, __ATOMIC_SEQ_CST);
+		res = telemetryNotifyFutexWait(&mShm->seq, seq, nullptr);
+		__atomic_sub_fetch(&mShm->waiters, 1, __ATOMIC_SEQ_CST);
+		if (res < 0 && res != -EAGAIN && res != -EINTR)
+			break;
+	}
+	mThreadDone = true;
+}
+
+inline void TelemetryWatcher::eventCb()
+{
+	uint64_t value;
+
+	if (read(mEventFd, &value, sizeof(value)) < 0)
+		return;
+	mCallback();
+}
+
+inline int TelemetryWatcher::attach(pomp::Loop &loop,
+				   std::function<void()> callback)
+{
+	int res;
+
+	if (!callback)
+		return -EINVAL;
+	if (mLoop != nullptr)
+		return -EBUSY;
+
+	mEventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (mEventFd < 0) {
+		return -errno;
+	}
+	mEventHandlerFunc.set([this](int fd, uint32_t revents) { eventCb(); });
+	res = loop.add(mEventFd, POMP_FD_EVENT_IN, &mEventHandlerFunc);
+	if (res < 0) {
+		close(mEventFd);
+		mEventFd = -1;
+		return res;
+	}
+	mLoop = &loop;
+	mCallback = callback;
+	mStopRequested = false;
+	mThreadDone = false;
+	mThread = std::thread(&TelemetryWatcher::threadEntry, this);
+
+	return 0;
+}
+
+inline void TelemetryWatcher::detach()
+{
+	if (mLoop == nullptr)
+		return;
+
+	/* The futex is woken up until the thread exits: it may have checked
+	 * the stop request right before blocking. Other watchers of the
+	 * section wake up for nothing and block again */
+	mStopRequested = true;
+	while (!mThreadDone.load()) {
+		telemetryNotifyFutexWake(&mShm->seq);
+		usleep(TELEMETRY_WATCHER_STOP_PERIOD_US);
+	}
+	mThread.join();
+
+	mLoop->remove(mEventFd);
+	close(mEventFd);
+	mEventFd = -1;
+	mLoop = nullptr;
+}
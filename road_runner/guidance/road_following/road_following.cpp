@@ -41,9 +41,19 @@ static const std::string ROAD_FOLLOWING_MODE_NAME =
 static const std::string ROAD_FOLLOWING_CONFIG_PATH =
 	"/etc/guidance/road_following/mode.cfg";
 
-RoadFollowing::RoadFollowing(guidance::Guidance *guidance) : Mode(guidance)
+static const std::string ROAD_FOLLOWING_SERVICE_CONFIG_PATH =
+	"/etc/services/road_following.cfg";
+
+/* Period of the attempts to open the notifications of the service section
+ * until the service has created them [us] */
+static const uint64_t TELEMETRY_WATCHER_RETRY_PERIOD = 1000000;
+
+RoadFollowing::RoadFollowing(guidance::Guidance *guidance) :
+		Mode(guidance), mTelemetryServiceWatcher(nullptr),
+		mTelemetryServiceSeq(0), mTelemetryServiceOpenTime(0)
 {
 	int res;
+	std::string section;
 
 	/* read configuration */
 	res = mConfiguration.read(
@@ -53,6 +63,15 @@ RoadFollowing::RoadFollowing(guidance::Guidance *guidance) : Mode(guidance)
 		goto out;
 	}
 
+	/* The service section is the one produced by cv_road */
+	res = mServiceConfiguration.read(
+		guidance->getConfigFile(ROAD_FOLLOWING_SERVICE_CONFIG_PATH));
+	if (res < 0) {
+		ULOG_ERRNO("RoadFollowingServiceConfiguration::read", -res);
+		goto out;
+	}
+	section = mServiceConfiguration.telemetryProducerSection;
+
 	// https://developer.parrot.com/docs/airsdk/telemetry/api_telemetry.html
 	mTelemetryServiceConsumer = telemetry::Consumer::create();
 	if (mTelemetryServiceConsumer == nullptr) {
@@ -72,13 +91,13 @@ RoadFollowing::RoadFollowing(guidance::Guidance *guidance) : Mode(guidance)
 
 	/* road estimation telemetry */
 	mTelemetryServiceConsumer->reg(mVelocityEst.x(),
-		"road_estimation.x_velocity", &mTsServiceCons);
+		section + ".x_velocity", &mTsServiceCons);
 	mTelemetryServiceConsumer->reg(mVelocityEst.y(),
-		"road_estimation.y_velocity");
+		section + ".y_velocity");
 	mTelemetryServiceConsumer->reg(mVelocityEst.z(),
-		"road_estimation.z_velocity");
+		section + ".z_velocity");
 	mTelemetryServiceConsumer->reg(mYawVelocityEst,
-		"road_estimation.yaw_velocity");
+		section + ".yaw_velocity");
 	// clang-format on
 
 	mTelemetryDroneConsumer->regComplete();
@@ -102,10 +121,46 @@ out:
 
 RoadFollowing::~RoadFollowing()
 {
+	TelemetryWatcher::destroy(mTelemetryServiceWatcher);
 	telemetry::Consumer::release(mTelemetryServiceConsumer);
 	telemetry::Consumer::release(mTelemetryDroneConsumer);
 }
 
+bool RoadFollowing::hasNewServiceSample(const timespec &now)
+{
+	int res;
+	uint32_t seq;
+	uint64_t nowUs;
+
+	/* The service may start after the mode, or run without notifying its
+	 * samples: the section is then read at each tick, and the notifications
+	 * are looked for again once per retry period */
+	if (mTelemetryServiceWatcher == nullptr) {
+		time_timespec_to_us(&now, &nowUs);
+		if (mTelemetryServiceOpenTime != 0
+		    && nowUs - mTelemetryServiceOpenTime
+			       < TELEMETRY_WATCHER_RETRY_PERIOD)
+			return true;
+		mTelemetryServiceOpenTime = nowUs;
+		res = TelemetryWatcher::open(
+			mServiceConfiguration.telemetryProducerSection,
+			&mTelemetryServiceWatcher);
+		if (res < 0) {
+			if (res != -ENOENT)
+				ULOG_ERRNO("TelemetryWatcher::open", -res);
+			return true;
+		}
+		mTelemetryServiceSeq = mTelemetryServiceWatcher->getSequence();
+		return true;
+	}
+
+	seq = mTelemetryServiceWatcher->getSequence();
+	if (seq == mTelemetryServiceSeq)
+		return false;
+	mTelemetryServiceSeq = seq;
+	return true;
+}
+
 const std::string &RoadFollowing::getName() const
 {
 	return ROAD_FOLLOWING_MODE_NAME;
@@ -166,8 +221,10 @@ void RoadFollowing::beginStep()
 
 	/* Update telemetry data */
 	time_get_monotonic(&now);
-	mTelemetryServiceConsumer->getSample(
-		&now, telemetry::Method::TLM_FIRST_BEFORE);
+	if (hasNewServiceSample(now)) {
+		mTelemetryServiceConsumer->getSample(
+			&now, telemetry::Method::TLM_FIRST_BEFORE);
+	}
 	mTelemetryDroneConsumer->getSample(nullptr,
 					   telemetry::Method::TLM_LATEST);
 
@@ -31,6 +31,7 @@
 
 #pragma once
 
+#include "../../common/telemetry_notify.hpp"
 #include "road_following_configuration.hpp"
 #include "road_following_plugin.hpp"
 
@@ -44,11 +45,19 @@ private:
 
 	/* Road Following guidance mode configuration Object */
 	RoadFollowingConfiguration mConfiguration;
+	RoadFollowingServiceConfiguration mServiceConfiguration;
 
 	/* Telemetry consumer */
 	telemetry::Consumer *mTelemetryDroneConsumer;
 	telemetry::Consumer *mTelemetryServiceConsumer;
 
+	/* Notifications of the service section, nullptr until the service has
+	 * created them. The section is read only when the count of samples
+	 * changes. Time of the last attempt to open them [us] */
+	TelemetryWatcher *mTelemetryServiceWatcher;
+	uint32_t mTelemetryServiceSeq;
+	uint64_t mTelemetryServiceOpenTime;
+
 	/* Drone estimated telemetry */
 	float mDroneYaw;
 
@@ -60,6 +69,15 @@ private:
 	/* Watchdog service */
 	timespec mTsServiceCons;
 
+	/**
+	 * Tell whether the service has put a sample since the last call.
+	 *
+	 * @param now current monotonic time.
+	 *
+	 * @return true if the service section has to be read.
+	 */
+	bool hasNewServiceSample(const timespec &now);
+
 public:
 	/**
 	 * Constructor
@@ -60,4 +60,21 @@ int SettingReader<RoadFollowingConfiguration>::read(
 			       v.missingTelemetryValuesLimit));
 	return 0;
 }
+
+template <>
+int SettingReader<RoadFollowingServiceConfiguration>::read(
+	const libconfig::Setting &set,
+	T &v)
+{
+	using CR = ConfigReader;
+
+	CFG_CHECK(CR::getField(
+		set, "telemetryProducerSection", v.telemetryProducerSection));
+	return 0;
+}
 } // namespace cfgreader
+
+int RoadFollowingServiceConfiguration::read(const std::string &path)
+{
+	return cfgreader::loadFromFile(*this, path, "road_following");
+}
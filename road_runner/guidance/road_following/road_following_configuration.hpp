@@ -50,4 +50,12 @@ struct RoadFollowingConfiguration : public guidance::ModeConfiguration {
 	{
 	}
 	int read(const std::string &path) override final;
+};
+
+/* Values of the cv_road service configuration used by the mode */
+struct RoadFollowingServiceConfiguration {
+	/* Telemetry section of the road estimation of the service */
+	std::string telemetryProducerSection;
+
+	int read(const std::string &path);
 };
\ No newline at end of file
@@ -259,6 +259,7 @@ Processing::Processing(pomp::Loop *loop) :
 	mStopRequested = 0;
 	mStarted = false;
 	mIsRoadDetected = false;
+	mTelemetryNotifier = nullptr;
 
 	/* timer */
 	mTimerHandler.set(std::bind(&Processing::produceTelemetry, this));
@@ -350,6 +351,15 @@ Processing::Processing(pomp::Loop *loop) :
 		std::bad_alloc ex;
 		throw ex;
 	}
+
+	res = TelemetryNotifier::create(
+		mRoadFollowingCfg.telemetryProducerSection,
+		&mTelemetryNotifier);
+	if (res < 0) {
+		ULOG_ERRNO("TelemetryNotifier::create", -res);
+		std::bad_alloc ex;
+		throw ex;
+	}
 }
 
 Processing::~Processing()
@@ -358,6 +368,7 @@ Processing::~Processing()
 
 	telemetry::Consumer::release(mTelemetryConsumer);
 	telemetry::Producer::release(mTelemetryProducer);
+	TelemetryNotifier::destroy(mTelemetryNotifier);
 
 	delete mThread;
 
@@ -398,6 +409,7 @@ int Processing::start(void)
 	mTlmZVelocity = 0.f;
 	mTlmYawVelocity = 0.f;
 	mTelemetryProducer->putSample(nullptr);
+	mTelemetryNotifier->notify();
 
 	/* Init road data values */
 	mRoadData.line_center_diff = 0;
@@ -499,6 +511,7 @@ void Processing::computeTrajectoryRoadLost()
 void Processing::produceTelemetry(void)
 {
 	mTelemetryProducer->putSample(nullptr);
+	mTelemetryNotifier->notify();
 }
 
 void Processing::onConnected(::msghub::Channel *channel, pomp::Connection *conn)
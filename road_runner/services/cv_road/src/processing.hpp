@@ -43,6 +43,7 @@
 #include <libtelemetry.hpp>
 #include <video-ipc/vipc_client.h>
 
+#include "../../../common/telemetry_notify.hpp"
 #include "listener.hpp"
 #include "video.hpp"
 
@@ -136,6 +137,8 @@ private:
 	/* Telemetry */
 	telemetry::Consumer *mTelemetryConsumer;
 	telemetry::Producer *mTelemetryProducer;
+	/* Wakes up the guidance mode when a sample is put */
+	TelemetryNotifier *mTelemetryNotifier;
 
 	float mTlmAltitudeAgl;
 
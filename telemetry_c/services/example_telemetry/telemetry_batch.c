@@ -0,0 +1,86 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "telemetry_batch.h"
+
+#define ULOG_TAG telemetry_batch
+#include <ulog.h>
+ULOG_DECLARE_TAG(ULOG_TAG);
+
+static bool is_before(const struct timespec *a, const struct timespec *b)
+{
+	return a->tv_sec < b->tv_sec
+	       || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+int telemetry_batch_put_samples(struct tlm_producer *producer,
+				void *storage,
+				const void *samples,
+				size_t sample_size,
+				const struct timespec *timestamps,
+				size_t count)
+{
+	int res = 0;
+	size_t i;
+
+	ULOG_ERRNO_RETURN_ERR_IF(producer == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(storage == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(samples == NULL && count > 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(sample_size == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(timestamps == NULL && count > 0, EINVAL);
+
+	/* Consumers search the samples by timestamp: reject the batch as a
+	 * whole rather than leaving half of it in the section */
+	for (i = 1; i < count; i++) {
+		if (!is_before(&timestamps[i - 1], &timestamps[i])) {
+			ULOGE("timestamp of sample %zu not increasing", i);
+			return -EINVAL;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		memcpy(storage,
+		       (const uint8_t *)samples + i * sample_size,
+		       sample_size);
+		res = tlm_producer_put_sample(producer, &timestamps[i]);
+		if (res < 0) {
+			ULOG_ERRNO("tlm_producer_put_sample", -res);
+			break;
+		}
+	}
+
+	return res;
+}
@@ -0,0 +1,67 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef TELEMETRY_BATCH_H
+#define TELEMETRY_BATCH_H
+
+#include <stddef.h>
+#include <time.h>
+
+#include <libtelemetry.h>
+
+/**
+ * @brief Put a batch of samples in a telemetry section.
+ *
+ * For producers getting several results at once, like the detections of a
+ * frame or replayed logs. The variables registered in the producer must be
+ * contiguous in `storage`, like a structure registered with
+ * tlm_producer_reg_struct_ptr: each sample of `samples` is copied to
+ * `storage` before being put with its own timestamp.
+ *
+ * The batch is checked before anything is put. If a put fails, the samples
+ * put before it stay in the section.
+ *
+ * @param producer producer of the section, with its registration completed.
+ * @param storage variables registered in the producer.
+ * @param samples samples to put, `count` times `sample_size` bytes.
+ * @param sample_size size of a sample, and of `storage`.
+ * @param timestamps timestamps of the samples, strictly increasing.
+ * @param count number of samples.
+ * @return 0 in case of success, negative errno value in case of error.
+ */
+int telemetry_batch_put_samples(struct tlm_producer *producer,
+				void *storage,
+				const void *samples,
+				size_t sample_size,
+				const struct timespec *timestamps,
+				size_t count);
+
+#endif // TELEMETRY_BATCH_H
@@ -0,0 +1,361 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libtelemetry.hpp>
+
+#define ULOG_TAG ex_tlm_batch_bench
+#include <ulog.h>
+ULOG_DECLARE_TAG(ULOG_TAG);
+
+#include "telemetry_batch.hpp"
+#include "telemetry_notify.hpp"
+
+#define DEFAULT_PUT_COUNT 100000
+#define DEFAULT_FIELD_COUNT 16
+#define MAX_FIELD_COUNT 128
+#define SECTION_SAMPLE_COUNT 1024
+
+/* Samples put by a single call, 0 for one putSample and one notification
+ * per sample */
+static const unsigned int s_batch_sizes[] = {0, 1, 4, 16, 64, 256};
+
+struct bench {
+	std::string section;
+	unsigned int put_count;
+	unsigned int field_count;
+
+	telemetry::Producer *producer;
+	TelemetryNotifier *notifier;
+	float fields[MAX_FIELD_COUNT];
+	/* Samples of a batch, ready to be copied to `fields` */
+	std::vector<float> samples;
+	std::vector<struct timespec> timestamps;
+	/* Index of the next sample, numbering kept across the runs */
+	unsigned int index;
+
+	/* Consumer thread */
+	telemetry::Consumer *consumer;
+	TelemetryWatcher *watcher;
+	float read_value;
+	pthread_t thread;
+	std::atomic<bool> producing;
+	unsigned int last_index;
+	unsigned int wakeup_count;
+	uint64_t consumer_cpu_ns;
+};
+
+static uint64_t time_now_ns(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Timestamps one microsecond apart, from the index of the sample */
+static struct timespec sample_timestamp(unsigned int index)
+{
+	struct timespec ts;
+	ts.tv_sec = 1 + index / 1000000;
+	ts.tv_nsec = (index % 1000000) * 1000;
+	return ts;
+}
+
+/* Reads the latest sample each time the section is notified */
+static void *consumer_thread(void *userdata)
+{
+	struct bench *bench = (struct bench *)userdata;
+	uint64_t cpu_start = time_now_ns(CLOCK_THREAD_CPUTIME_ID);
+	uint32_t seq = bench->watcher->getSequence();
+	int res;
+
+	while (true) {
+		/* Timeout to see the end of the producer */
+		res = bench->watcher->wait(&seq, 100);
+		if (res == -ETIMEDOUT) {
+			if (!bench->producing)
+				break;
+			continue;
+		}
+		if (res < 0) {
+			ULOG_ERRNO("TelemetryWatcher::wait", -res);
+			break;
+		}
+		bench->wakeup_count++;
+		if (bench->consumer->getSample(nullptr,
+					       telemetry::Method::TLM_LATEST))
+			bench->last_index = (unsigned int)bench->read_value;
+	}
+	bench->consumer_cpu_ns =
+		time_now_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+
+	return NULL;
+}
+
+static void fill_sample(struct bench *bench, float *sample)
+{
+	for (unsigned int j = 0; j < bench->field_count; j++)
+		sample[j] = (float)(bench->index + j);
+}
+
+static int put_single(struct bench *bench)
+{
+	int res;
+	struct timespec ts;
+
+	for (unsigned int i = 0; i < bench->put_count; i++) {
+		bench->index++;
+		fill_sample(bench, bench->fields);
+		ts = sample_timestamp(bench->index);
+		res = bench->producer->putSample(&ts);
+		if (res < 0) {
+			ULOG_ERRNO("telemetry::Producer::putSample", -res);
+			return res;
+		}
+		bench->notifier->notify();
+	}
+	return 0;
+}
+
+static int put_batches(struct bench *bench, unsigned int batch_size)
+{
+	int res;
+	unsigned int count;
+	size_t sample_size = bench->field_count * sizeof(float);
+
+	for (unsigned int i = 0; i < bench->put_count; i += count) {
+		count = bench->put_count - i;
+		if (count > batch_size)
+			count = batch_size;
+		for (unsigned int k = 0; k < count; k++) {
+			bench->index++;
+			fill_sample(bench,
+				    &bench->samples[k * bench->field_count]);
+			bench->timestamps[k] = sample_timestamp(bench->index);
+		}
+		res = telemetryPutSamples(
+			bench->producer,
+			bench->timestamps.data(),
+			count,
+			[bench, sample_size](size_t k) {
+				memcpy(bench->fields,
+				       &bench->samples[k * bench->field_count],
+				       sample_size);
+			},
+			bench->notifier);
+		if (res < 0)
+			return res;
+	}
+	return 0;
+}
+
+static int run(struct bench *bench, unsigned int batch_size)
+{
+	int res;
+	uint64_t start, cpu_start, elapsed_ns, producer_cpu_ns;
+	char label[32];
+
+	bench->last_index = bench->index;
+	bench->wakeup_count = 0;
+	bench->producing = true;
+	res = pthread_create(&bench->thread, NULL, &consumer_thread, bench);
+	if (res != 0) {
+		ULOG_ERRNO("pthread_create", res);
+		return -res;
+	}
+	/* Let the consumer block on the section */
+	usleep(10000);
+
+	cpu_start = time_now_ns(CLOCK_THREAD_CPUTIME_ID);
+	start = time_now_ns(CLOCK_MONOTONIC);
+	if (batch_size == 0)
+		res = put_single(bench);
+	else
+		res = put_batches(bench, batch_size);
+	elapsed_ns = time_now_ns(CLOCK_MONOTONIC) - start;
+	producer_cpu_ns = time_now_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+	bench->producing = false;
+	pthread_join(bench->thread, NULL);
+	if (res < 0)
+		return res;
+
+	if (batch_size == 0)
+		snprintf(label, sizeof(label), "single");
+	else
+		snprintf(label, sizeof(label), "batch of %u", batch_size);
+	printf("%-14s %.0f samples/s, producer cpu %.0f ns/sample, "
+	       "%u consumer wake ups, consumer cpu %.0f ns/sample\n",
+	       label,
+	       bench->put_count * 1e9 / elapsed_ns,
+	       (double)producer_cpu_ns / bench->put_count,
+	       bench->wakeup_count,
+	       (double)bench->consumer_cpu_ns / bench->put_count);
+
+	/* The notification of the last sample must not be lost */
+	if (bench->last_index != bench->index) {
+		fprintf(stderr,
+			"%s: last sample %u read, %u put\n",
+			label,
+			bench->last_index,
+			bench->index);
+		return -EDOM;
+	}
+	return 0;
+}
+
+static void usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s [-n puts] [-f fields]\n", progname);
+}
+
+int main(int argc, char *argv[])
+{
+	int res = 0;
+	int opt;
+	char name[32];
+	unsigned int max_batch_size;
+	struct bench bench;
+
+	bench.put_count = DEFAULT_PUT_COUNT;
+	bench.field_count = DEFAULT_FIELD_COUNT;
+	bench.producer = nullptr;
+	bench.notifier = nullptr;
+	bench.consumer = nullptr;
+	bench.watcher = nullptr;
+	bench.index = 0;
+	memset(bench.fields, 0, sizeof(bench.fields));
+
+	while ((opt = getopt(argc, argv, "n:f:")) != -1) {
+		switch (opt) {
+		case 'n':
+			bench.put_count = atoi(optarg);
+			break;
+		case 'f':
+			bench.field_count = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (bench.put_count == 0 || bench.field_count == 0
+	    || bench.field_count > MAX_FIELD_COUNT) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	max_batch_size = s_batch_sizes[sizeof(s_batch_sizes)
+				       / sizeof(s_batch_sizes[0]) - 1];
+	bench.samples.resize(max_batch_size * bench.field_count);
+	bench.timestamps.resize(max_batch_size);
+
+	snprintf(name, sizeof(name), "tlm_batch_bench_%u", (int)getpid());
+	bench.section = name;
+	bench.producer = telemetry::Producer::create(bench.section,
+						     SECTION_SAMPLE_COUNT,
+						     1,
+						     nullptr,
+						     false);
+	if (bench.producer == nullptr) {
+		ULOG_ERRNO("telemetry::Producer::create", ENOMEM);
+		return EXIT_FAILURE;
+	}
+	for (unsigned int j = 0; j < bench.field_count; j++) {
+		res = bench.producer->reg(bench.fields[j],
+					  ("f" + std::to_string(j)).c_str());
+		if (res < 0) {
+			ULOG_ERRNO("telemetry::Producer::reg", -res);
+			goto out;
+		}
+	}
+	res = bench.producer->regComplete();
+	if (res < 0) {
+		ULOG_ERRNO("telemetry::Producer::regComplete", -res);
+		goto out;
+	}
+	res = TelemetryNotifier::create(bench.section, &bench.notifier);
+	if (res < 0) {
+		ULOG_ERRNO("TelemetryNotifier::create", -res);
+		goto out;
+	}
+
+	bench.consumer = telemetry::Consumer::create();
+	if (bench.consumer == nullptr) {
+		res = -ENOMEM;
+		ULOG_ERRNO("telemetry::Consumer::create", -res);
+		goto out;
+	}
+	res = bench.consumer->reg(bench.read_value,
+				  (bench.section + ".f0").c_str());
+	if (res == 0)
+		res = bench.consumer->regComplete();
+	if (res < 0) {
+		ULOG_ERRNO("telemetry::Consumer::reg", -res);
+		goto out;
+	}
+	res = TelemetryWatcher::open(bench.section, &bench.watcher);
+	if (res < 0) {
+		ULOG_ERRNO("TelemetryWatcher::open", -res);
+		goto out;
+	}
+
+	printf("%u samples of %u fields:\n",
+	       bench.put_count,
+	       bench.field_count);
+	for (size_t i = 0; i < sizeof(s_batch_sizes) / sizeof(s_batch_sizes[0]);
+	     i++) {
+		res = run(&bench, s_batch_sizes[i]);
+		if (res < 0)
+			goto out;
+	}
+
+out:
+	TelemetryWatcher::destroy(bench.watcher);
+	telemetry::Consumer::release(bench.consumer);
+	/* The notifications of the section are left by the notifier */
+	TelemetryNotifier::destroy(bench.notifier);
+	shm_unlink(("/" + bench.section + ".notify").c_str());
+	telemetry::Producer::release(bench.producer);
+	return res < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
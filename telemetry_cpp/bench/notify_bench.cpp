@@ -0,0 +1,431 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libpomp.hpp>
+#include <libtelemetry.hpp>
+
+#define ULOG_TAG ex_tlm_notify_bench
+#include <ulog.h>
+ULOG_DECLARE_TAG(ULOG_TAG);
+
+#include "telemetry_notify.hpp"
+
+#define DEFAULT_RATE_US 10000
+#define DEFAULT_DURATION_S 5
+#define SECTION_SAMPLE_COUNT 10
+
+/* Polling periods compared to the notifications, in addition to the
+ * period of the producer [us] */
+static const unsigned int s_poll_periods_us[] = {1000, 5000};
+
+enum mode {
+	MODE_POLL = 0,
+	MODE_WAIT,
+	MODE_LOOP,
+};
+
+struct bench {
+	std::string section;
+	unsigned int rate_us;
+	unsigned int duration_s;
+
+	/* Producer thread */
+	telemetry::Producer *producer;
+	TelemetryNotifier *notifier;
+	pthread_t thread;
+	std::atomic<bool> producing;
+	float value;
+	unsigned int put_count;
+	uint64_t producer_cpu_ns;
+
+	/* Consumer of the running mode */
+	telemetry::Consumer *consumer;
+	float read_value;
+	struct timespec read_ts;
+	int last_index;
+	unsigned int read_count;
+	unsigned int seen_count;
+	unsigned int reordered_count;
+	/* Time from the put of a sample to its read [ns] */
+	std::vector<uint32_t> latency;
+};
+
+static uint64_t time_now_ns(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static struct timespec ns_to_timespec(uint64_t ns)
+{
+	struct timespec ts;
+	ts.tv_sec = ns / 1000000000;
+	ts.tv_nsec = ns % 1000000000;
+	return ts;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* Nearest rank percentile of sorted values given in per mille, in us */
+static double percentile_us(const std::vector<uint32_t> &values,
+			    unsigned int permille)
+{
+	if (values.empty())
+		return 0.;
+	return values[(values.size() - 1) * permille / 1000] / 1000.;
+}
+
+/* Puts a sample every period with the current time, and notifies it */
+static void *producer_thread(void *userdata)
+{
+	struct bench *bench = (struct bench *)userdata;
+	struct timespec next;
+	uint64_t next_ns, end_ns, cpu_start;
+	int res;
+
+	cpu_start = time_now_ns(CLOCK_THREAD_CPUTIME_ID);
+	next_ns = time_now_ns(CLOCK_MONOTONIC);
+	end_ns = next_ns + (uint64_t)bench->duration_s * 1000000000;
+	while ((next_ns += (uint64_t)bench->rate_us * 1000) < end_ns) {
+		next = ns_to_timespec(next_ns);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		bench->value = (float)++bench->put_count;
+		res = bench->producer->putSample(nullptr);
+		if (res < 0) {
+			ULOG_ERRNO("telemetry::Producer::putSample", -res);
+			break;
+		}
+		bench->notifier->notify();
+	}
+	bench->producer_cpu_ns =
+		time_now_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+	bench->producing = false;
+
+	return NULL;
+}
+
+/* Reads the latest sample and records the latency of a new one */
+static void read_sample(struct bench *bench)
+{
+	uint64_t now;
+	int index;
+
+	bench->read_count++;
+	if (!bench->consumer->getSample(nullptr,
+					telemetry::Method::TLM_LATEST))
+		return;
+	now = time_now_ns(CLOCK_MONOTONIC);
+
+	index = (int)bench->read_value;
+	if (index == bench->last_index)
+		return;
+	if (index < bench->last_index)
+		bench->reordered_count++;
+	bench->last_index = index;
+	bench->seen_count++;
+	bench->latency.push_back(now
+				 - ((uint64_t)bench->read_ts.tv_sec * 1000000000
+				    + bench->read_ts.tv_nsec));
+}
+
+static int run_poll(struct bench *bench, unsigned int period_us)
+{
+	struct timespec next;
+	uint64_t next_ns = time_now_ns(CLOCK_MONOTONIC);
+
+	while (bench->producing) {
+		next_ns += (uint64_t)period_us * 1000;
+		next = ns_to_timespec(next_ns);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		read_sample(bench);
+	}
+	return 0;
+}
+
+static int run_wait(struct bench *bench, TelemetryWatcher *watcher)
+{
+	int res;
+	uint32_t seq = watcher->getSequence();
+
+	while (bench->producing) {
+		/* Timeout to see the end of the producer */
+		res = watcher->wait(&seq, 100);
+		if (res == -ETIMEDOUT)
+			continue;
+		if (res < 0) {
+			ULOG_ERRNO("TelemetryWatcher::wait", -res);
+			return res;
+		}
+		read_sample(bench);
+	}
+	return 0;
+}
+
+static int run_loop(struct bench *bench, TelemetryWatcher *watcher)
+{
+	int res;
+	pomp::Loop loop;
+
+	res = watcher->attach(loop, [bench]() { read_sample(bench); });
+	if (res < 0)
+		return res;
+	while (bench->producing)
+		loop.waitAndProcess(100);
+	watcher->detach();
+	return 0;
+}
+
+static int run(struct bench *bench, enum mode mode, unsigned int period_us)
+{
+	int res = 0;
+	TelemetryWatcher *watcher = nullptr;
+	uint64_t start, cpu_start, elapsed_ns, consumer_cpu_ns;
+	unsigned int put_start, put_count;
+	const char *label;
+	char poll_label[32];
+
+	bench->consumer = telemetry::Consumer::create();
+	if (bench->consumer == nullptr) {
+		ULOG_ERRNO("telemetry::Consumer::create", ENOMEM);
+		return -ENOMEM;
+	}
+	res = bench->consumer->reg(bench->read_value,
+				   (bench->section + ".value").c_str(),
+				   &bench->read_ts);
+	if (res == 0)
+		res = bench->consumer->regComplete();
+	if (res < 0) {
+		ULOG_ERRNO("telemetry::Consumer::reg", -res);
+		goto out;
+	}
+	if (mode != MODE_POLL) {
+		res = TelemetryWatcher::open(bench->section, &watcher);
+		if (res < 0) {
+			ULOG_ERRNO("TelemetryWatcher::open", -res);
+			goto out;
+		}
+	}
+
+	/* Samples keep their numbering across the runs, the latest one of
+	 * the previous run is still in the section */
+	bench->last_index = bench->put_count;
+	put_start = bench->put_count;
+	bench->read_count = 0;
+	bench->seen_count = 0;
+	bench->reordered_count = 0;
+	bench->latency.clear();
+	bench->latency.reserve((uint64_t)bench->duration_s * 1000000
+			       / bench->rate_us);
+	bench->producing = true;
+
+	/* The CPU time of the process includes the thread of the watcher
+	 * attached to a loop */
+	cpu_start = time_now_ns(CLOCK_PROCESS_CPUTIME_ID);
+	start = time_now_ns(CLOCK_MONOTONIC);
+	res = pthread_create(&bench->thread, NULL, &producer_thread, bench);
+	if (res != 0) {
+		res = -res;
+		ULOG_ERRNO("pthread_create", -res);
+		goto out;
+	}
+	switch (mode) {
+	case MODE_POLL:
+		res = run_poll(bench, period_us);
+		break;
+	case MODE_WAIT:
+		res = run_wait(bench, watcher);
+		break;
+	case MODE_LOOP:
+		res = run_loop(bench, watcher);
+		break;
+	}
+	bench->producing = false;
+	pthread_join(bench->thread, NULL);
+	elapsed_ns = time_now_ns(CLOCK_MONOTONIC) - start;
+	consumer_cpu_ns = time_now_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start
+			  - bench->producer_cpu_ns;
+	put_count = bench->put_count - put_start;
+	if (res < 0)
+		goto out;
+
+	if (mode == MODE_POLL) {
+		snprintf(poll_label,
+			 sizeof(poll_label),
+			 "poll %u us",
+			 period_us);
+		label = poll_label;
+	} else {
+		label = mode == MODE_WAIT ? "wait" : "pomp loop";
+	}
+	qsort(bench->latency.data(),
+	      bench->latency.size(),
+	      sizeof(uint32_t),
+	      &compare_u32);
+	printf("%-14s %u samples, %u seen, %.0f reads/s, consumer cpu "
+	       "%.2f%%, latency p50 %.1f us, p99 %.1f us, max %.1f us\n",
+	       label,
+	       put_count,
+	       bench->seen_count,
+	       bench->read_count * 1e9 / elapsed_ns,
+	       100. * consumer_cpu_ns / elapsed_ns,
+	       percentile_us(bench->latency, 500),
+	       percentile_us(bench->latency, 990),
+	       percentile_us(bench->latency, 1000));
+
+	/* Samples put before the consumer runs give a single wake up, but a
+	 * notification must never be lost: the last sample must be seen */
+	if (bench->reordered_count > 0
+	    || (mode != MODE_POLL
+		&& (unsigned int)bench->last_index != bench->put_count)) {
+		fprintf(stderr,
+			"%s: last sample %d of %u seen, %u out of order\n",
+			label,
+			bench->last_index,
+			bench->put_count,
+			bench->reordered_count);
+		res = -EDOM;
+	}
+
+out:
+	TelemetryWatcher::destroy(watcher);
+	telemetry::Consumer::release(bench->consumer);
+	bench->consumer = nullptr;
+	return res;
+}
+
+static void usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s [-r rate_us] [-d duration_s]\n", progname);
+}
+
+int main(int argc, char *argv[])
+{
+	int res = 0;
+	int opt;
+	char name[32];
+	struct bench bench;
+
+	bench.rate_us = DEFAULT_RATE_US;
+	bench.duration_s = DEFAULT_DURATION_S;
+	bench.producer = nullptr;
+	bench.notifier = nullptr;
+	bench.consumer = nullptr;
+	bench.value = 0.f;
+	bench.put_count = 0;
+
+	while ((opt = getopt(argc, argv, "r:d:")) != -1) {
+		switch (opt) {
+		case 'r':
+			bench.rate_us = atoi(optarg);
+			break;
+		case 'd':
+			bench.duration_s = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (bench.rate_us == 0 || bench.duration_s == 0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	snprintf(name, sizeof(name), "tlm_notify_bench_%u", (int)getpid());
+	bench.section = name;
+	bench.producer = telemetry::Producer::create(bench.section,
+						     SECTION_SAMPLE_COUNT,
+						     bench.rate_us,
+						     nullptr,
+						     false);
+	if (bench.producer == nullptr) {
+		ULOG_ERRNO("telemetry::Producer::create", ENOMEM);
+		return EXIT_FAILURE;
+	}
+	res = bench.producer->reg(bench.value, "value");
+	if (res == 0)
+		res = bench.producer->regComplete();
+	if (res < 0) {
+		ULOG_ERRNO("telemetry::Producer::reg", -res);
+		goto out;
+	}
+	res = TelemetryNotifier::create(bench.section, &bench.notifier);
+	if (res < 0) {
+		ULOG_ERRNO("TelemetryNotifier::create", -res);
+		goto out;
+	}
+
+	printf("sample every %u us for %u s:\n",
+	       bench.rate_us,
+	       bench.duration_s);
+	for (size_t i = 0;
+	     i < sizeof(s_poll_periods_us) / sizeof(s_poll_periods_us[0]);
+	     i++) {
+		if (s_poll_periods_us[i] == bench.rate_us)
+			continue;
+		res = run(&bench, MODE_POLL, s_poll_periods_us[i]);
+		if (res < 0)
+			goto out;
+	}
+	res = run(&bench, MODE_POLL, bench.rate_us);
+	if (res == 0)
+		res = run(&bench, MODE_WAIT, 0);
+	if (res == 0)
+		res = run(&bench, MODE_LOOP, 0);
+
+out:
+	/* The notifications of the section are left by the notifier */
+	TelemetryNotifier::destroy(bench.notifier);
+	shm_unlink(("/" + bench.section + ".notify").c_str());
+	telemetry::Producer::release(bench.producer);
+	return res < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,752 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libtelemetry.hpp>
+
+#define ULOG_TAG ex_tlm_bench
+#include <ulog.h>
+ULOG_DECLARE_TAG(ULOG_TAG);
+
+#define DEFAULT_PUT_COUNT 100000
+#define DEFAULT_RATE_US 1000
+#define DEFAULT_SECTION_SIZE 100
+#define DEFAULT_DURATION_S 2
+#define DEFAULT_MAX_CONSUMERS 8
+
+/* Queries of each method timed by the get phase */
+#define GET_QUERY_COUNT 10000
+
+/* Samples returned by a single getSamples call */
+#define GET_SAMPLES_COUNT 16
+
+/* Field values are exact in a float up to 2^24 */
+#define MAX_PUT_COUNT (1 << 23)
+
+#define MAX_FIELD_COUNT 256
+
+/* Number of float fields of the sections */
+static const unsigned int s_field_counts[] = {1, 16, 128};
+
+/* Number of samples kept by the sections */
+static const unsigned int s_section_sizes[] = {10, 100, 1000};
+
+/* Section of `field_count` float fields. Field j of sample i is i + j, a
+ * consumer can tell which sample it read and whether all the fields come
+ * from the same sample */
+struct section {
+	std::string name;
+	unsigned int field_count;
+	unsigned int sample_count;
+	unsigned int rate_us;
+	telemetry::Producer *producer;
+	float values[MAX_FIELD_COUNT];
+};
+
+/* Consumer registered on every field of a section, the timestamp of the
+ * samples is the one of the first field */
+struct reader {
+	telemetry::Consumer *consumer;
+	float values[MAX_FIELD_COUNT];
+	struct timespec ts;
+};
+
+/* Consumer thread of the concurrent phase */
+struct poller {
+	const struct section *section;
+	const std::atomic<bool> *stop;
+	pthread_t thread;
+	bool started;
+	unsigned int period_us;
+	struct reader reader;
+	/* Get latency and age of the read sample, in ns */
+	std::vector<uint32_t> latency;
+	std::vector<uint32_t> age;
+	unsigned int read_count;
+	unsigned int stale_count;
+	unsigned int torn_count;
+	uint64_t cpu_ns;
+};
+
+static uint64_t time_now_ns(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static struct timespec ns_to_timespec(uint64_t ns)
+{
+	struct timespec ts;
+	ts.tv_sec = ns / 1000000000;
+	ts.tv_nsec = ns % 1000000000;
+	return ts;
+}
+
+static inline uint64_t timespec_to_ns(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* Nearest rank percentile of sorted values given in per mille, in us */
+static double percentile_us(const std::vector<uint32_t> &values,
+			    unsigned int permille)
+{
+	if (values.empty())
+		return 0.;
+	return values[(values.size() - 1) * permille / 1000] / 1000.;
+}
+
+static void print_latency(const char *label, std::vector<uint32_t> *values)
+{
+	qsort(values->data(), values->size(), sizeof(uint32_t), &compare_u32);
+	printf("  %-14s p50 %8.2f us, p99 %8.2f us, p99.9 %8.2f us, "
+	       "max %8.2f us\n",
+	       label,
+	       percentile_us(*values, 500),
+	       percentile_us(*values, 990),
+	       percentile_us(*values, 999),
+	       percentile_us(*values, 1000));
+}
+
+static void set_sample(struct section *section, unsigned int index)
+{
+	for (unsigned int j = 0; j < section->field_count; j++)
+		section->values[j] = (float)(index + j);
+}
+
+/* Index of the sample read, or -1 if its fields come from different
+ * samples */
+static int check_sample(const float *values, unsigned int field_count)
+{
+	for (unsigned int j = 1; j < field_count; j++) {
+		if (values[j] != values[0] + j)
+			return -1;
+	}
+	return (int)values[0];
+}
+
+static int section_init(struct section *section,
+			unsigned int field_count,
+			unsigned int sample_count,
+			unsigned int rate_us)
+{
+	int res = 0;
+	char name[32];
+
+	section->field_count = field_count;
+	section->sample_count = sample_count;
+	section->rate_us = rate_us;
+	snprintf(name,
+		 sizeof(name),
+		 "tlm_bench_%u_%u_%u",
+		 field_count,
+		 sample_count,
+		 (unsigned int)getpid());
+	section->name = name;
+
+	section->producer = telemetry::Producer::create(
+		section->name, sample_count, rate_us, nullptr, false);
+	if (section->producer == nullptr) {
+		ULOG_ERRNO("telemetry::Producer::create", ENOMEM);
+		return -ENOMEM;
+	}
+
+	set_sample(section, 0);
+	for (unsigned int j = 0; j < field_count && res == 0; j++) {
+		snprintf(name, sizeof(name), "f%u", j);
+		res = section->producer->reg(section->values[j], name);
+	}
+	if (res == 0)
+		res = section->producer->regComplete();
+	if (res < 0) {
+		ULOG_ERRNO("telemetry::Producer::reg", -res);
+		telemetry::Producer::release(section->producer);
+		section->producer = nullptr;
+	}
+	return res;
+}
+
+static void section_clear(struct section *section)
+{
+	telemetry::Producer::release(section->producer);
+	section->producer = nullptr;
+}
+
+static int reader_init(struct reader *reader, const struct section *section)
+{
+	int res = 0;
+	std::string name;
+
+	reader->consumer = telemetry::Consumer::create();
+	if (reader->consumer == nullptr) {
+		ULOG_ERRNO("telemetry::Consumer::create", ENOMEM);
+		return -ENOMEM;
+	}
+
+	memset(reader->values, 0, sizeof(reader->values));
+	for (unsigned int j = 0; j < section->field_count && res == 0; j++) {
+		name = section->name + ".f" + std::to_string(j);
+		res = reader->consumer->reg(reader->values[j],
+					    name.c_str(),
+					    j == 0 ? &reader->ts : nullptr);
+	}
+	if (res == 0)
+		res = reader->consumer->regComplete();
+	if (res < 0) {
+		ULOG_ERRNO("telemetry::Consumer::reg", -res);
+		telemetry::Consumer::release(reader->consumer);
+		reader->consumer = nullptr;
+	}
+	return res;
+}
+
+static void reader_clear(struct reader *reader)
+{
+	telemetry::Consumer::release(reader->consumer);
+	reader->consumer = nullptr;
+}
+
+/* Puts `count` samples as fast as possible, with synthetic timestamps one
+ * period apart starting at `base_ns` */
+static int run_put(struct section *section,
+		   unsigned int count,
+		   uint64_t base_ns)
+{
+	int res;
+	std::vector<uint32_t> latency(count);
+	struct timespec ts;
+	uint64_t start, end, total_start;
+	double total_ns;
+
+	total_start = time_now_ns(CLOCK_MONOTONIC);
+	for (unsigned int i = 0; i < count; i++) {
+		set_sample(section, i);
+		ts = ns_to_timespec(base_ns + (uint64_t)i * section->rate_us
+						      * 1000);
+		start = time_now_ns(CLOCK_MONOTONIC);
+		res = section->producer->putSample(&ts);
+		end = time_now_ns(CLOCK_MONOTONIC);
+		if (res < 0) {
+			ULOG_ERRNO("telemetry::Producer::putSample", -res);
+			return res;
+		}
+		latency[i] = end - start;
+	}
+	total_ns = time_now_ns(CLOCK_MONOTONIC) - total_start;
+
+	printf("  put: %u samples, max rate %.0f samples/s, %.1f MB/s\n",
+	       count,
+	       count * 1e9 / total_ns,
+	       count * section->field_count * sizeof(float) * 1e3 / total_ns);
+	print_latency("putSample", &latency);
+	return 0;
+}
+
+/* Times each query method over the samples left in the section by the put
+ * phase and checks the sample it returns */
+static int run_get(const struct section *section,
+		   unsigned int put_count,
+		   uint64_t base_ns)
+{
+	int res = 0;
+	struct reader reader;
+	telemetry::Consumer *array_consumer = nullptr;
+	float array[GET_SAMPLES_COUNT];
+	size_t nb, ref;
+	unsigned int before;
+	unsigned int query_count = GET_QUERY_COUNT;
+	unsigned int window, mismatch_count = 0;
+	std::vector<uint32_t> latest, closest, first_before, samples;
+	struct timespec ts;
+	uint64_t start, end;
+	unsigned int expected;
+	bool ok;
+
+	res = reader_init(&reader, section);
+	if (res < 0)
+		return res;
+
+	array_consumer = telemetry::Consumer::create();
+	if (array_consumer == nullptr) {
+		res = -ENOMEM;
+		ULOG_ERRNO("telemetry::Consumer::create", -res);
+		goto out;
+	}
+	array_consumer->regSamplesArray(array, (section->name + ".f0").c_str());
+	res = array_consumer->regComplete();
+	if (res < 0) {
+		ULOG_ERRNO("array_consumer regComplete", -res);
+		goto out;
+	}
+
+	/* Only the samples still in the section are queried, the oldest one
+	 * is left out */
+	window = section->sample_count < put_count ? section->sample_count - 1
+						   : put_count;
+	before = (section->sample_count < GET_SAMPLES_COUNT
+			  ? section->sample_count
+			  : GET_SAMPLES_COUNT)
+		 - 1;
+	if (before >= put_count)
+		before = put_count - 1;
+	latest.reserve(query_count);
+	closest.reserve(query_count);
+	first_before.reserve(query_count);
+	samples.reserve(query_count);
+	srand(put_count);
+
+	for (unsigned int i = 0; i < query_count; i++) {
+		start = time_now_ns(CLOCK_MONOTONIC);
+		ok = reader.consumer->getSample(nullptr,
+						telemetry::Method::TLM_LATEST);
+		end = time_now_ns(CLOCK_MONOTONIC);
+		latest.push_back(end - start);
+		if (!ok || check_sample(reader.values, section->field_count)
+				   != (int)put_count - 1)
+			mismatch_count++;
+
+		/* Quarter of a period after a sample, closest to it */
+		expected = put_count - 1 - rand() % window;
+		ts = ns_to_timespec(base_ns
+				    + (uint64_t)expected * section->rate_us
+					      * 1000
+				    + section->rate_us * 250);
+		start = time_now_ns(CLOCK_MONOTONIC);
+		ok = reader.consumer->getSample(&ts,
+						telemetry::Method::TLM_CLOSEST);
+		end = time_now_ns(CLOCK_MONOTONIC);
+		closest.push_back(end - start);
+		if (!ok || check_sample(reader.values, section->field_count)
+				   != (int)expected)
+			mismatch_count++;
+
+		/* Three quarters of a period after a sample, first before */
+		ts = ns_to_timespec(timespec_to_ns(&ts)
+				    + section->rate_us * 500);
+		start = time_now_ns(CLOCK_MONOTONIC);
+		ok = reader.consumer->getSample(
+			&ts, telemetry::Method::TLM_FIRST_BEFORE);
+		end = time_now_ns(CLOCK_MONOTONIC);
+		first_before.push_back(end - start);
+		if (!ok || check_sample(reader.values, section->field_count)
+				   != (int)expected)
+			mismatch_count++;
+
+		/* Latest samples of the first field, oldest first */
+		start = time_now_ns(CLOCK_MONOTONIC);
+		ok = array_consumer->getSamples(nullptr,
+						telemetry::Method::TLM_LATEST,
+						before,
+						0,
+						&nb,
+						&ref);
+		end = time_now_ns(CLOCK_MONOTONIC);
+		samples.push_back(end - start);
+		if (!ok || nb != before + 1 || ref >= nb) {
+			mismatch_count++;
+			continue;
+		}
+		for (size_t k = 0; k <= ref; k++) {
+			if (array[ref - k] != (float)(put_count - 1 - k)) {
+				mismatch_count++;
+				break;
+			}
+		}
+	}
+
+	printf("  get: %u queries per method over the last %u samples\n",
+	       query_count,
+	       window);
+	print_latency("LATEST", &latest);
+	print_latency("CLOSEST", &closest);
+	print_latency("FIRST_BEFORE", &first_before);
+	printf("  getSamples of %u samples:\n", before + 1);
+	print_latency("LATEST", &samples);
+
+	if (mismatch_count > 0) {
+		fprintf(stderr,
+			"%s: %u queries returned a wrong sample\n",
+			section->name.c_str(),
+			mismatch_count);
+		res = -EDOM;
+	}
+
+out:
+	telemetry::Consumer::release(array_consumer);
+	reader_clear(&reader);
+	return res;
+}
+
+/* Reads the latest sample every period like a service polling a section,
+ * until stopped */
+static void *poller_thread(void *userdata)
+{
+	struct poller *poller = (struct poller *)userdata;
+	const struct section *section = poller->section;
+	struct timespec next;
+	uint64_t next_ns, start, end, cpu_start;
+	int index, last_index = -1;
+	bool ok;
+
+	cpu_start = time_now_ns(CLOCK_THREAD_CPUTIME_ID);
+	next_ns = time_now_ns(CLOCK_MONOTONIC);
+	while (!poller->stop->load(std::memory_order_relaxed)) {
+		if (poller->period_us > 0) {
+			next_ns += (uint64_t)poller->period_us * 1000;
+			next = ns_to_timespec(next_ns);
+			clock_nanosleep(
+				CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		}
+
+		start = time_now_ns(CLOCK_MONOTONIC);
+		ok = poller->reader.consumer->getSample(
+			nullptr, telemetry::Method::TLM_LATEST);
+		end = time_now_ns(CLOCK_MONOTONIC);
+		if (!ok)
+			continue;
+
+		poller->read_count++;
+		index = check_sample(poller->reader.values,
+				     section->field_count);
+		if (index < 0)
+			poller->torn_count++;
+		else if (index == last_index)
+			poller->stale_count++;
+		last_index = index;
+		if (poller->latency.size() < poller->latency.capacity()) {
+			poller->latency.push_back(end - start);
+			poller->age.push_back(
+				end - timespec_to_ns(&poller->reader.ts));
+		}
+	}
+	poller->cpu_ns = time_now_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+
+	return NULL;
+}
+
+/* Puts samples in real time at the section rate, or as fast as possible if
+ * the rate is 0, with `consumer_count` threads polling the section */
+static int run_concurrent(struct section *section,
+			  unsigned int consumer_count,
+			  unsigned int period_us,
+			  unsigned int duration_s)
+{
+	int res = 0;
+	std::atomic<bool> stop(false);
+	std::vector<struct poller> pollers(consumer_count);
+	std::vector<uint32_t> latency, age;
+	struct timespec next;
+	uint64_t start, end, next_ns, cpu_start;
+	uint64_t cpu_ns = 0, consumer_cpu_ns = 0;
+	unsigned int put_count = 0, late_count = 0;
+	unsigned int read_count = 0, stale_count = 0, torn_count = 0;
+	size_t max_reads = (uint64_t)duration_s * 1000000
+			   / (period_us > 0 ? period_us : 10)
+			   + 1;
+	double elapsed_ns = 1.;
+
+	for (unsigned int i = 0; i < consumer_count; i++) {
+		struct poller *poller = &pollers[i];
+		poller->section = section;
+		poller->stop = &stop;
+		poller->started = false;
+		poller->period_us = period_us;
+		poller->reader.consumer = nullptr;
+		poller->latency.reserve(max_reads);
+		poller->age.reserve(max_reads);
+		poller->read_count = 0;
+		poller->stale_count = 0;
+		poller->torn_count = 0;
+		poller->cpu_ns = 0;
+	}
+	for (unsigned int i = 0; i < consumer_count; i++) {
+		res = reader_init(&pollers[i].reader, section);
+		if (res < 0)
+			goto out;
+	}
+
+	/* A first sample so that the consumers never read an empty section */
+	set_sample(section, 0);
+	res = section->producer->putSample(nullptr);
+	if (res < 0) {
+		ULOG_ERRNO("telemetry::Producer::putSample", -res);
+		goto out;
+	}
+
+	for (unsigned int i = 0; i < consumer_count; i++) {
+		res = pthread_create(
+			&pollers[i].thread, NULL, &poller_thread, &pollers[i]);
+		if (res != 0) {
+			res = -res;
+			ULOG_ERRNO("pthread_create", -res);
+			goto stop;
+		}
+		pollers[i].started = true;
+	}
+
+	cpu_start = time_now_ns(CLOCK_THREAD_CPUTIME_ID);
+	start = time_now_ns(CLOCK_MONOTONIC);
+	end = start + (uint64_t)duration_s * 1000000000;
+	next_ns = start;
+	while ((next_ns = section->rate_us > 0
+				  ? next_ns + (uint64_t)section->rate_us * 1000
+				  : time_now_ns(CLOCK_MONOTONIC))
+	       < end) {
+		if (section->rate_us > 0) {
+			next = ns_to_timespec(next_ns);
+			clock_nanosleep(
+				CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+			if (time_now_ns(CLOCK_MONOTONIC)
+			    > next_ns + (uint64_t)section->rate_us * 1000)
+				late_count++;
+		}
+		set_sample(section, ++put_count);
+		res = section->producer->putSample(nullptr);
+		if (res < 0) {
+			ULOG_ERRNO("telemetry::Producer::putSample", -res);
+			goto stop;
+		}
+		if (put_count >= MAX_PUT_COUNT)
+			break;
+	}
+	elapsed_ns = time_now_ns(CLOCK_MONOTONIC) - start;
+	cpu_ns = time_now_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+
+stop:
+	stop.store(true);
+	for (unsigned int i = 0; i < consumer_count; i++) {
+		struct poller *poller = &pollers[i];
+		if (!poller->started)
+			continue;
+		pthread_join(poller->thread, NULL);
+		consumer_cpu_ns += poller->cpu_ns;
+		read_count += poller->read_count;
+		stale_count += poller->stale_count;
+		torn_count += poller->torn_count;
+		latency.insert(latency.end(),
+			       poller->latency.begin(),
+			       poller->latency.end());
+		age.insert(age.end(), poller->age.begin(), poller->age.end());
+	}
+	if (res < 0)
+		goto out;
+
+	printf("  %u consumers: %.0f puts/s (%u late), producer cpu %.1f%%, "
+	       "consumers cpu %.1f%% (%.2f%% each), %.0f reads/s, "
+	       "%.1f%% stale\n",
+	       consumer_count,
+	       put_count * 1e9 / elapsed_ns,
+	       late_count,
+	       100. * cpu_ns / elapsed_ns,
+	       100. * consumer_cpu_ns / elapsed_ns,
+	       100. * consumer_cpu_ns / elapsed_ns / consumer_count,
+	       read_count * 1e9 / elapsed_ns,
+	       read_count > 0 ? 100. * stale_count / read_count : 0.);
+	print_latency("getSample", &latency);
+	print_latency("sample age", &age);
+
+	/* Fields of a sample must never be mixed with the ones of another */
+	if (torn_count > 0) {
+		fprintf(stderr,
+			"%s: %u reads mixed the fields of several samples\n",
+			section->name.c_str(),
+			torn_count);
+		res = -EDOM;
+	}
+
+out:
+	for (unsigned int i = 0; i < consumer_count; i++)
+		reader_clear(&pollers[i].reader);
+	return res;
+}
+
+static int run(unsigned int field_count,
+	       unsigned int sample_count,
+	       unsigned int rate_us,
+	       unsigned int put_count)
+{
+	int res;
+	struct section section;
+	uint64_t base_ns;
+
+	res = section_init(&section, field_count, sample_count, rate_us);
+	if (res < 0)
+		return res;
+
+	printf("%u fields, %u samples, rate %u us:\n",
+	       field_count,
+	       sample_count,
+	       rate_us);
+
+	/* Synthetic timestamps end about now, as if the samples had been put
+	 * in real time */
+	base_ns = time_now_ns(CLOCK_MONOTONIC)
+		  - (uint64_t)put_count * rate_us * 1000;
+	res = run_put(&section, put_count, base_ns);
+	if (res == 0)
+		res = run_get(&section, put_count, base_ns);
+
+	section_clear(&section);
+	return res;
+}
+
+static int run_consumers(unsigned int field_count,
+			 unsigned int sample_count,
+			 unsigned int rate_us,
+			 unsigned int period_us,
+			 unsigned int max_consumers,
+			 unsigned int duration_s)
+{
+	int res;
+	struct section section;
+
+	/* The producer rate is only a hint of the section, never 0 */
+	res = section_init(
+		&section, field_count, sample_count, rate_us > 0 ? rate_us : 1);
+	if (res < 0)
+		return res;
+	section.rate_us = rate_us;
+
+	printf("%u fields, %u samples, put every %u us, read every %u us:\n",
+	       field_count,
+	       sample_count,
+	       rate_us,
+	       period_us);
+	for (unsigned int n = 1; n <= max_consumers && res == 0; n *= 2)
+		res = run_concurrent(&section, n, period_us, duration_s);
+
+	section_clear(&section);
+	return res;
+}
+
+static void usage(const char *progname)
+{
+	fprintf(stderr,
+		"usage: %s [-n puts] [-r rate_us] [-p period_us] "
+		"[-s section_size] [-c max_consumers] [-d duration_s]\n",
+		progname);
+}
+
+int main(int argc, char *argv[])
+{
+	int res = 0;
+	int opt;
+	unsigned int put_count = DEFAULT_PUT_COUNT;
+	unsigned int rate_us = DEFAULT_RATE_US;
+	int period_us = -1;
+	unsigned int section_size = DEFAULT_SECTION_SIZE;
+	unsigned int max_consumers = DEFAULT_MAX_CONSUMERS;
+	unsigned int duration_s = DEFAULT_DURATION_S;
+
+	while ((opt = getopt(argc, argv, "n:r:p:s:c:d:")) != -1) {
+		switch (opt) {
+		case 'n':
+			put_count = atoi(optarg);
+			break;
+		case 'r':
+			rate_us = atoi(optarg);
+			break;
+		case 'p':
+			period_us = atoi(optarg);
+			break;
+		case 's':
+			section_size = atoi(optarg);
+			break;
+		case 'c':
+			max_consumers = atoi(optarg);
+			break;
+		case 'd':
+			duration_s = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (put_count == 0 || put_count > MAX_PUT_COUNT || section_size < 2
+	    || max_consumers == 0 || duration_s == 0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	/* Consumers poll at the producer rate by default */
+	if (period_us < 0)
+		period_us = rate_us;
+
+	for (size_t i = 0;
+	     i < sizeof(s_field_counts) / sizeof(s_field_counts[0]);
+	     i++) {
+		for (size_t j = 0;
+		     j < sizeof(s_section_sizes) / sizeof(s_section_sizes[0]);
+		     j++) {
+			res = run(s_field_counts[i],
+				  s_section_sizes[j],
+				  rate_us > 0 ? rate_us : DEFAULT_RATE_US,
+				  put_count);
+			if (res < 0)
+				return EXIT_FAILURE;
+		}
+	}
+
+	for (size_t i = 0;
+	     i < sizeof(s_field_counts) / sizeof(s_field_counts[0]);
+	     i++) {
+		res = run_consumers(s_field_counts[i],
+				    section_size,
+				    rate_us,
+				    period_us,
+				    max_consumers,
+				    duration_s);
+		if (res < 0)
+			return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
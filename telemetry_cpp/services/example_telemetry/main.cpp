@@ -30,18 +30,32 @@
  */
 
 #include <csignal>
+#include <time.h>
 #include <unistd.h>
 
+#include <libpomp.hpp>
 #include <libtelemetry.hpp>
 
+#include "telemetry_notify.hpp"
+
 #define ULOG_TAG ex_tlm_cpp
 #include <ulog.h>
 ULOG_DECLARE_TAG(ULOG_TAG);
 
 #define MAX_SAMPLE 10
 
+/* Period of the samples of the producers [ms] */
+#define PRODUCER_PERIOD_MS 5000
+
 sig_atomic_t run = 1;
 
+static int64_t get_time_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 extern "C" void sig_handler(int sig)
 {
 	run = 0;
@@ -112,6 +126,21 @@ int main(int argc, char *argv[])
 	telemetry::Consumer *my_struct_consumer;
 	MyStruct new_struct_destination;
 
+	/**
+	 * Wake up on new samples.
+	 *
+	 * In this example:
+	 *     - Notify the samples of the two producers.
+	 *     - Read the consumers from a pomp loop when a sample of
+	 *           new_struct_section is put.
+	 */
+	pomp::Loop loop;
+	TelemetryNotifier *my_notifier = nullptr;
+	TelemetryNotifier *my_struct_notifier = nullptr;
+	TelemetryWatcher *my_struct_watcher = nullptr;
+	int64_t next_ms;
+	int64_t remaining_ms;
+
 	single_sample_consumer = telemetry::Consumer::create();
 
 	array_sample_consumer = telemetry::Consumer::create();
@@ -224,56 +253,33 @@ int main(int argc, char *argv[])
 		goto out;
 	}
 
-	/* Loop code
+	/**
+	 * Notifications of the new samples.
 	 *
-	 * The service is assumed to run an infinite loop, and termination
-	 * requests are handled via a SIGTERM signal.
-	 * If your service exits before this SIGTERM is sent, it will be
-	 * considered as a crash, and the system will relaunch the service.
-	 * If this happens too many times, the system will no longer start the
-	 * service.
+	 * Each producer notifies the watchers of its section after putting a
+	 * sample. The consumers are read from the pomp loop when the sample of
+	 * new_struct_section, put last, lands, instead of polling them. The
+	 * sections of the drone have no notifier, they are read at the same
+	 * time.
 	 */
-	while (run) {
-
-		if (new_value_source > 5) {
-			new_value_source = 0;
-
-			new_struct_source.myIntergerValue = 0;
-			new_struct_source.myFloatValue= 0.0;
-		} else {
-			new_value_source++;
-
-			tmp_integer = new_struct_source.myIntergerValue;
-			tmp_float = new_struct_source.myFloatValue;
-
-			tmp_integer++;
-			tmp_float += 0.6;
-
-			new_struct_source.myIntergerValue = tmp_integer;
-			new_struct_source.myFloatValue = tmp_float;
-		}
-
-		/* Put only one sample */
-		res = my_producer->putSample(
-			/* timestamp of sample (can be nullptr to use current
-			   time). */
-			nullptr);
-		if (res < 0) {
-			ULOGW("Can't put my_producer sample %s",
-			      strerror(-res));
-		}
-
-		/* Put only one sample */
-		res = my_struct_producer->putSample(
-			/* timestamp of sample (can be nullptr to use current
-			   time). */
-			nullptr);
-		if (res < 0) {
-			ULOGW("Can't put my_struct_producer sample %s",
-			      strerror(-res));
-		}
-
-		sleep(5);
+	res = TelemetryNotifier::create("new_section", &my_notifier);
+	if (res < 0) {
+		ULOG_ERRNO("my_notifier create", -res);
+		goto out;
+	}
+	res = TelemetryNotifier::create("new_struct_section",
+					&my_struct_notifier);
+	if (res < 0) {
+		ULOG_ERRNO("my_struct_notifier create", -res);
+		goto out;
+	}
+	res = TelemetryWatcher::open("new_struct_section", &my_struct_watcher);
+	if (res < 0) {
+		ULOG_ERRNO("my_struct_watcher open", -res);
+		goto out;
+	}
+	res = my_struct_watcher->attach(loop, [&]() {
+		int res;
 
 		/* Get only one sample */
 		res = single_sample_consumer->getSample(
@@ -359,6 +365,68 @@ int main(int argc, char *argv[])
 		      new_struct_destination.myIntergerValue);
 		ULOGI("####     my_float_value   %f",
 		      new_struct_destination.myFloatValue);
+	});
+	if (res < 0) {
+		ULOG_ERRNO("my_struct_watcher attach", -res);
+		goto out;
+	}
+
+	/* Loop code
+	 *
+	 * The service is assumed to run an infinite loop, and termination
+	 * requests are handled via a SIGTERM signal.
+	 * If your service exits before this SIGTERM is sent, it will be
+	 * considered as a crash, and the system will relaunch the service.
+	 * If this happens too many times, the system will no longer start the
+	 * service.
+	 */
+	while (run) {
+
+		if (new_value_source > 5) {
+			new_value_source = 0;
+
+			new_struct_source.myIntergerValue = 0;
+			new_struct_source.myFloatValue= 0.0;
+		} else {
+			new_value_source++;
+
+			tmp_integer = new_struct_source.myIntergerValue;
+			tmp_float = new_struct_source.myFloatValue;
+
+			tmp_integer++;
+			tmp_float += 0.6;
+
+			new_struct_source.myIntergerValue = tmp_integer;
+			new_struct_source.myFloatValue = tmp_float;
+		}
+
+		/* Put only one sample */
+		res = my_producer->putSample(
+			/* timestamp of sample (can be nullptr to use current
+			   time). */
+			nullptr);
+		if (res < 0) {
+			ULOGW("Can't put my_producer sample %s",
+			      strerror(-res));
+		}
+		my_notifier->notify();
+
+		/* Put only one sample */
+		res = my_struct_producer->putSample(
+			/* timestamp of sample (can be nullptr to use current
+			   time). */
+			nullptr);
+		if (res < 0) {
+			ULOGW("Can't put my_struct_producer sample %s",
+			      strerror(-res));
+		}
+		my_struct_notifier->notify();
+
+		/* Process the notifications until the next samples, the
+		 * consumers are read as soon as the samples land */
+		next_ms = get_time_ms() + PRODUCER_PERIOD_MS;
+		while (run && (remaining_ms = next_ms - get_time_ms()) > 0)
+			loop.waitAndProcess(remaining_ms);
 	}
 
 	/* Cleanup code
@@ -370,6 +438,9 @@ int main(int argc, char *argv[])
 	ULOGI("Cleaning up from example_telemetry");
 
 out:
+	TelemetryWatcher::destroy(my_struct_watcher);
+	TelemetryNotifier::destroy(my_notifier);
+	TelemetryNotifier::destroy(my_struct_notifier);
 	telemetry::Consumer::release(single_sample_consumer);
 	telemetry::Consumer::release(array_sample_consumer);
 	telemetry::Producer::release(my_producer);
@@ -0,0 +1,81 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <errno.h>
+
+#define ULOG_TAG telemetry_batch
+#include <ulog.h>
+ULOG_DECLARE_TAG(ULOG_TAG);
+
+#include "telemetry_batch.hpp"
+
+static bool isBefore(const struct timespec &a, const struct timespec &b)
+{
+	return a.tv_sec < b.tv_sec
+	       || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
+int telemetryPutSamples(telemetry::Producer *producer,
+			const struct timespec *timestamps,
+			size_t count,
+			const std::function<void(size_t index)> &fill,
+			TelemetryNotifier *notifier)
+{
+	int res = 0;
+	size_t i;
+
+	ULOG_ERRNO_RETURN_ERR_IF(producer == nullptr, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(timestamps == nullptr && count > 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(!fill, EINVAL);
+
+	/* Consumers search the samples by timestamp: reject the batch as a
+	 * whole rather than leaving half of it in the section */
+	for (i = 1; i < count; i++) {
+		if (!isBefore(timestamps[i - 1], timestamps[i])) {
+			ULOGE("timestamp of sample %zu not increasing", i);
+			return -EINVAL;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		fill(i);
+		res = producer->putSample(&timestamps[i]);
+		if (res < 0) {
+			ULOG_ERRNO("telemetry::Producer::putSample", -res);
+			break;
+		}
+	}
+
+	if (i > 0 && notifier != nullptr)
+		notifier->notify();
+
+	return res;
+}
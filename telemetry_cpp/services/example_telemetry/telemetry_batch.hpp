@@ -0,0 +1,68 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ * * Neither the name of the Parrot Company nor the names
+ *   of its contributors may be used to endorse or promote products
+ *   derived from this software without specific prior written
+ *   permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * PARROT COMPANY BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <time.h>
+
+#include <functional>
+
+#include <libtelemetry.hpp>
+
+#include "telemetry_notify.hpp"
+
+/**
+ * Put a batch of samples in a telemetry section, for producers getting
+ * several results at once, like the detections of a frame or replayed logs.
+ *
+ * `fill` is called before each putSample to copy the sample to the variables
+ * registered in the producer. The watchers of the section are notified once,
+ * after the last sample, so that a consumer reads the whole batch with a
+ * single getSamples instead of being woken up for each sample.
+ *
+ * The batch is checked before anything is put. If a putSample fails, the
+ * samples put before it stay in the section and are notified.
+ *
+ * @param producer producer of the section, with its registration completed.
+ * @param timestamps timestamps of the samples, strictly increasing.
+ * @param count number of samples.
+ * @param fill function copying the sample of a given index to the registered
+ *             variables.
+ * @param notifier notifier of the section, may be nullptr.
+ *
+ * @return 0 in case of success, negative errno in case of error.
+ */
+int telemetryPutSamples(telemetry::Producer *producer,
+			const struct timespec *timestamps,
+			size_t count,
+			const std::function<void(size_t index)> &fill,
+			TelemetryNotifier *notifier);
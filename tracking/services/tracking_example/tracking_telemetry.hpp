@@ -131,6 +131,10 @@ public:
 
 	/**
 	 * Start a timer to obtain telemetry samples every second.
+	 *
+	 * The sections are put by the tracking service of the drone, which
+	 * does not signal a TelemetryNotifier: a TelemetryWatcher would never
+	 * be woken up, so the sections are polled.
 	 */
 	void startt();
 